@@ -0,0 +1,101 @@
+#ifndef W_ATLAS_H
+#define W_ATLAS_H
+
+#include <raylib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * One GPU texture holding every player's avatar.
+ *
+ * - The atlas is a grid of fixed cells, each big enough for the largest avatar we accept;
+ *   a player owns the cell matching their slot in g_players, so nothing ever gets packed
+ * - A changed avatar is pushed with a sub-rect upload into its cell only
+ * - Since every avatar comes from the same texture, drawing them all is a single batch
+ * - Each cell remembers who was last uploaded into it, so the renderer can tell whether
+ *   a cell holds the avatar it's about to draw without asking the players table
+ *
+ * Render thread only; needs a live GL context.
+ */
+
+#define ATLAS_COLS 64        // Cells per row; fixed, so a cell's column never changes
+#define ATLAS_INITIAL_ROWS 4 // Rows up front; doubles whenever a slot doesn't fit
+
+typedef struct
+{
+  Texture2D tex;
+  uint32_t  cell_w, cell_h;
+  uint32_t  rows;
+  uint32_t *owners; // Per cell: owner tag of the last upload, 0 if blank
+  bool      ready;
+} AvatarAtlas;
+
+/**
+ * @brief Create the atlas texture, fully transparent
+ * @param atlas The atlas to initialize
+ * @param cell_w Width of one cell; the widest avatar we accept
+ * @param cell_h Height of one cell; the tallest avatar we accept
+ * @returns true on success, false if the texture couldn't be created
+ */
+bool atlas_init(AvatarAtlas *atlas, uint32_t cell_w, uint32_t cell_h);
+
+/**
+ * @brief Free the atlas texture
+ * @param atlas The atlas to unload
+ */
+void atlas_unload(AvatarAtlas *atlas);
+
+/**
+ * @brief Make sure a cell exists for the given slot, growing the texture if it doesn't
+ * @note Growing starts over with a blank texture; every cell must be uploaded again after that
+ * @param atlas The atlas
+ * @param slot The slot that needs a cell
+ * @returns true if the atlas grew (and was cleared), false if the cell was already there or growing failed
+ */
+bool atlas_reserve(AvatarAtlas *atlas, uint32_t slot);
+
+/**
+ * @brief Does the atlas have a cell for this slot right now?
+ */
+static inline bool atlas_has_cell(const AvatarAtlas *atlas, uint32_t slot)
+{
+  return atlas->ready && slot / ATLAS_COLS < atlas->rows;
+}
+
+/**
+ * @brief Who was last uploaded into a slot's cell
+ * @returns The owner tag given to atlas_upload(), or 0 if the cell is blank (or doesn't exist)
+ */
+static inline uint32_t atlas_cell_owner(const AvatarAtlas *atlas, uint32_t slot)
+{
+  return atlas_has_cell(atlas, slot) ? atlas->owners[slot] : 0;
+}
+
+/**
+ * @brief Where a slot's avatar lives inside the atlas texture
+ * @param atlas The atlas
+ * @param slot The slot
+ * @param w Width of the avatar in that cell
+ * @param h Height of the avatar in that cell
+ * @returns The w x h source rectangle at the cell's origin
+ */
+Rectangle atlas_cell_rect(const AvatarAtlas *atlas, uint32_t slot, uint32_t w, uint32_t h);
+
+/**
+ * @brief Upload an RGBA avatar into its cell; only that cell's pixels are touched
+ * @param atlas The atlas
+ * @param slot The slot owning the cell; must have one (see atlas_reserve())
+ * @param owner Nonzero tag saying whose avatar this is; see atlas_cell_owner()
+ * @param pixels Tightly packed RGBA32 pixels
+ * @param w Width of the avatar; at most cell_w
+ * @param h Height of the avatar; at most cell_h
+ */
+void atlas_upload(AvatarAtlas   *atlas,
+                  uint32_t       slot,
+                  uint32_t       owner,
+                  const uint8_t *pixels,
+                  uint32_t       w,
+                  uint32_t       h);
+
+#endif
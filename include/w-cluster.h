@@ -0,0 +1,146 @@
+#ifndef W_CLUSTER_H
+#define W_CLUSTER_H
+
+#include "w-player.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cluster mode: several server nodes sharing one wall, each owning a share of the players.
+ *
+ * - Every node is started with the same node list and its own index in it; a player belongs
+ *   to whichever node their peer key (see listen_peer_key()) lands on in a consistent-hash
+ *   ring, CLUSTER_VNODES points per node. Adding a node only moves about 1/N of them
+ * - A REGISTER or RESUME that reaches the wrong node gets a REDIRECT to the owner instead
+ * - Owners stream changes to their players to every other node over peer links, and those
+ *   keep them as replicas (see w-player.h); so every node has, renders and broadcasts the
+ *   whole world, while registrations are spread over all of them
+ *
+ * Peer links are one-way: each node dials every other one and only ever writes to the link
+ * it dialed, so there is never a pair of links to pick between. A link starts with HELLO:
+ *
+ * MAGIC   u16 == CLUSTER_MAGIC
+ * VERSION u8  == CLUSTER_VERSION
+ * NODE    u8  Index of the node dialing
+ * DIGEST  u64 Of the whole node list; nodes that disagree on it hang up
+ *
+ * Then a full snapshot of the dialer's players, then changes, as records:
+ *
+ * LEN  u16 Bytes after this field
+ * KIND u8  CLUSTER_REC_PLAYER or CLUSTER_REC_GONE
+ * IP   u32 The player's peer key, as it is in memory (network order for IPv4)
+ *
+ * CLUSTER_REC_PLAYER goes on with the fields its FIELDS bits say are there, in this order:
+ *
+ * ID        u32
+ * FIELDS    u8  REPLICA_* bits
+ * X, Y      i32 REPLICA_POS
+ * CONNECTED u8  REPLICA_STATE
+ * TAG_LEN   u8, then the tag; REPLICA_TAG
+ * HASH      u64, then W u8, H u8 and W * H RGBA pixels; REPLICA_AVATAR
+ *
+ * Everything is big endian, the IP aside.
+ */
+
+#define CLUSTER_MAX_NODES 16
+#define CLUSTER_VNODES 64    // Ring points per node; more evens out the shares, costs a longer search
+#define CLUSTER_MAX_HOST 64  // Longest node address, NUL included
+#define CLUSTER_MAGIC 0x5743 // "WC"
+#define CLUSTER_VERSION 1
+#define CLUSTER_HELLO_BYTES 12
+#define CLUSTER_MAX_RECORD (2 + 1 + 4 + 4 + 1 + 8 + 1 + 1 + MAX_NAMETAG_LEN + 8 + 2 + MAX_AVATAR_BYTES)
+
+enum
+{
+  CLUSTER_REC_PLAYER = 1,
+  CLUSTER_REC_GONE   = 2 // Their owner forgot them; only IP follows
+};
+
+typedef struct
+{
+  char     host[CLUSTER_MAX_HOST]; // Where clients get redirected to, and peers dial
+  uint16_t port;                   // Game port, host order
+  uint16_t peer_port;              // Replication port, host order
+} ClusterNode;
+
+typedef struct
+{
+  uint64_t point;
+  uint32_t node;
+} ClusterPoint;
+
+typedef struct
+{
+  ClusterNode  nodes[CLUSTER_MAX_NODES];
+  size_t       count;
+  size_t       self;   // Which of them we are
+  uint64_t     digest; // See HELLO
+  ClusterPoint ring[CLUSTER_MAX_NODES * CLUSTER_VNODES]; // Sorted by point
+  size_t       ring_len;
+} Cluster;
+
+typedef struct
+{
+  uint8_t       kind;
+  PlayerReplica player; // CLUSTER_REC_GONE only fills in ip
+} ClusterRecord;
+
+/**
+ * @brief Set a cluster up from its node list
+ * @param cl The cluster to fill in
+ * @param spec Comma-separated host:port:peer_port; IPv6 hosts go in brackets, [::1]:7000:7100
+ * @param self Our index in that list
+ * @returns false if the list doesn't parse, has too many nodes, or self isn't in it
+ */
+bool cluster_init(Cluster *cl, const char *spec, size_t self);
+
+/**
+ * @brief Which node owns a player
+ * @param cl The cluster
+ * @param key The player's peer key
+ * @returns The owner's index
+ */
+size_t cluster_owner(const Cluster *cl, uint32_t key);
+
+/**
+ * @brief Do we own this player?
+ */
+static inline bool cluster_is_mine(const Cluster *cl, uint32_t key)
+{
+  return cluster_owner(cl, key) == cl->self;
+}
+
+/**
+ * @brief Write our HELLO
+ * @param out Room for CLUSTER_HELLO_BYTES
+ */
+void cluster_encode_hello(const Cluster *cl, uint8_t *out);
+
+/**
+ * @brief Check a peer's HELLO
+ * @param in CLUSTER_HELLO_BYTES of it
+ * @param node Receives the peer's index
+ * @returns false if it's from another cluster, another version, or claims to be us
+ */
+bool cluster_decode_hello(const Cluster *cl, const uint8_t *in, size_t *node);
+
+/**
+ * @brief Write one record
+ * @param rec The record; only the fields its FIELDS bits name are read
+ * @param out Room for CLUSTER_MAX_RECORD
+ * @returns Bytes written
+ */
+size_t cluster_encode_record(const ClusterRecord *rec, uint8_t *out);
+
+/**
+ * @brief Read one record
+ * @note The avatar pointer, if any, points into in
+ * @param in Bytes off the link
+ * @param len Amt. of bytes in in
+ * @param rec Receives the record
+ * @returns Bytes it took, 0 if it isn't all there yet, -1 if it's garbage
+ */
+long cluster_decode_record(const uint8_t *in, size_t len, ClusterRecord *rec);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef W_CODEC_H
+#define W_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Avatar decompression, for v2 REGISTER frames.
+ *
+ * RLE: runs of identical pixels, one after the other:
+ *
+ * COUNT u8 Run length minus 1, so a run covers 1-256 pixels
+ * PIXEL bytes[channels]
+ *
+ * QOI: the "Quite OK Image" format as specified at qoiformat.org; 14 byte header, chunks,
+ * 8 byte end marker. Any off-the-shelf encoder works.
+ *
+ * Both decoders are strict: a stream that's cut short, runs past the last pixel or has bytes
+ * left over is rejected as a whole, without ever reading or writing out of bounds.
+ */
+
+#define QOI_HEADER_BYTES 14
+#define QOI_END_BYTES 8
+
+// Worst case a well-formed stream takes for an image; an encoder never needs more than this
+#define RLE_MAX_BYTES(npixels, channels) ((size_t)(npixels) * ((channels) + 1))
+#define QOI_MAX_BYTES(npixels) (QOI_HEADER_BYTES + (size_t)(npixels) * 5 + QOI_END_BYTES)
+
+/**
+ * @brief Expand an RLE stream
+ * @param dst Receives npixels * channels bytes
+ * @param src The stream
+ * @param len Amt. of bytes in src
+ * @param npixels Amt. of pixels the stream has to come out to
+ * @param channels Bytes per pixel
+ * @returns false if the stream doesn't decode to exactly npixels pixels
+ */
+bool rle_decode(uint8_t *dst, const uint8_t *src, size_t len, size_t npixels, uint32_t channels);
+
+/**
+ * @brief Decode a QOI image into RGBA
+ * @note Always RGBA out, whatever channel count the header claims; QOI tracks alpha either way
+ * @param dst Receives width * height * 4 bytes
+ * @param src The whole file, header to end marker
+ * @param len Amt. of bytes in src
+ * @param width Width the image must have
+ * @param height Height the image must have
+ * @returns false if it's malformed or not width x height
+ */
+bool qoi_decode(uint8_t *dst, const uint8_t *src, size_t len, uint32_t width, uint32_t height);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef W_DEDUP_H
+#define W_DEDUP_H
+
+#include "w-index.h"
+#include "w-pool.h"
+#include "w-slab.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Content-addressed, reference-counted blocks on top of a BlockPool.
+ *
+ * - Filled blocks get interned: if an identical block (same length, same bytes) is already
+ *   held, that one is handed back with one more reference and the new one goes back to
+ *   the pool; otherwise the new one becomes the held copy
+ * - Blocks are found by their XXH64 and confirmed with a memcmp(), so a hash collision
+ *   never shares the wrong bytes; the (astronomically rare) loser just stays unshared
+ * - Interned blocks are shared, so they must never be written again
+ * - Every intern is paired with one release; the last release sends the block back to the pool
+ *
+ * Thread-safe; one mutex, held for a lookup and a memcmp() at most, and never while calling out.
+ */
+
+typedef struct
+{
+  uint8_t *block;
+  uint64_t hash;
+  uint32_t len;
+  uint32_t refs;
+} DedupEntry;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  BlockPool      *pool;    // Where blocks come from and go back to
+  Slab            entries; // DedupEntry per distinct block held
+  SlotIndex       by_hash; // hash -> slot in entries
+} DedupCache;
+
+/**
+ * @brief Set up an empty cache
+ * @param cache The cache to initialize
+ * @param pool The pool every block handed to it comes from
+ * @param expected How many distinct blocks to size for; grows past that on its own
+ * @returns true on success, false if out of memory
+ */
+bool dedup_init(DedupCache *cache, BlockPool *pool, size_t expected);
+
+/**
+ * @brief Trade a freshly filled block for the shared copy of its contents
+ * @note Takes ownership of block no matter what; if it isn't what comes back, it's been freed
+ * @param cache The cache
+ * @param block A block from the cache's pool
+ * @param len Amt. of bytes in it that count
+ * @param seed Mixed into the hash; blocks only ever match others interned with the same seed
+ * @param hash Receives the block's hash; hand it to dedup_release() later
+ * @returns The shared block holding those bytes, one reference of which is now the caller's
+ */
+uint8_t *dedup_intern(DedupCache *cache, uint8_t *block, size_t len, uint64_t seed, uint64_t *hash);
+
+/**
+ * @brief Give back one reference to a block dedup_intern() returned
+ * @param cache The cache
+ * @param block The block; NULL is a no-op
+ * @param hash What dedup_intern() said its hash was
+ */
+void dedup_release(DedupCache *cache, uint8_t *block, uint64_t hash);
+
+#endif
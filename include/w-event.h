@@ -0,0 +1,168 @@
+#ifndef W_EVENT_H
+#define W_EVENT_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Readiness event loop with a pluggable backend:
+ *
+ * - Linux: epoll (edge-triggered where asked), or io_uring polls when EVLOOP_USE_IO_URING is
+ *   defined; interest changes then ride along with the next wait instead of costing a syscall
+ * - macOS/BSD: kqueue (EV_CLEAR where asked)
+ * - Anything else, or when EVLOOP_FORCE_SELECT is defined: select()
+ *
+ * Fds are registered ONCE and stay registered until evloop_del(); a wait only hands
+ * back the fds that are actually ready, instead of us rebuilding and scanning a set.
+ *
+ * Ring I/O (io_uring on 6.3+ kernels only; see evloop_enable_ring_io()): instead of saying an
+ * fd is ready, the loop does the accept, recv or send itself and the wait hands back what
+ * came of it. Everything queued between two waits goes to the kernel in the one syscall
+ * that starts the next wait, and a recv comes back with the bytes already in hand.
+ */
+
+// Interest/result flags
+enum
+{
+  EVT_READ  = 1u << 0, // Readable (or a pending connection on a listener)
+  EVT_WRITE = 1u << 1, // Writable
+  EVT_EDGE  = 1u << 2, // Only report on state changes; caller MUST drain until EAGAIN
+  EVT_HUP   = 1u << 3, // Peer hung up (result only)
+  EVT_ERR   = 1u << 4, // Error condition on the fd (result only)
+
+  // Ring I/O completions (result only)
+  EVT_RECV   = 1u << 5, // evloop_recv() got bytes; see LoopEvent.data
+  EVT_SENT   = 1u << 6, // An evloop_send() is done
+  EVT_ACCEPT = 1u << 7, // evloop_accept() took a connection, or failed to
+  EVT_DONE   = 1u << 8  // With EVT_ACCEPT: that was its last completion; evloop_accept() again to keep going
+};
+
+typedef struct EventLoop EventLoop; // Opaque; layout depends on the backend
+
+typedef struct
+{
+  void    *udata;  // Whatever was passed on registration
+  uint32_t events; // EVT_* flags that fired
+
+  // Ring I/O completions only
+  int32_t        res;  // EVT_RECV: bytes in data; EVT_SENT: bytes written; EVT_ACCEPT: the new fd; -errno on failure
+  const uint8_t *data; // EVT_RECV: the bytes; good until evloop_recycle()
+  uint16_t       buf;  // Which receive buffer data sits in; the loop's business
+} LoopEvent;
+
+/**
+ * @brief Create an event loop using the best backend available on this platform
+ * @returns The new loop, or NULL on failure (errno is set)
+ */
+EventLoop *evloop_create(void);
+
+/**
+ * @brief Tear down an event loop; registered fds are NOT closed
+ * @param loop The loop to destroy; NULL is a no-op
+ */
+void evloop_destroy(EventLoop *loop);
+
+/**
+ * @brief Start watching an fd
+ * @note EVT_EDGE is a hint; the select() backend is level-triggered and will just report again
+ * @param loop The loop to register with
+ * @param fd The fd to watch
+ * @param events EVT_READ and/or EVT_WRITE, optionally with EVT_EDGE
+ * @param udata Handed back verbatim in every LoopEvent for this fd
+ * @returns 0 on success, -1 on failure (errno is set)
+ */
+int evloop_add(EventLoop *loop, int fd, uint32_t events, void *udata);
+
+/**
+ * @brief Change the interest set of an already registered fd
+ * @param loop The loop the fd was registered with
+ * @param fd The fd to modify
+ * @param events The new interest set; replaces the old one
+ * @param udata The new user data
+ * @returns 0 on success, -1 on failure (errno is set)
+ */
+int evloop_mod(EventLoop *loop, int fd, uint32_t events, void *udata);
+
+/**
+ * @brief Stop watching an fd; do this BEFORE closing it
+ * @note Also stops an evloop_accept() or evloop_recv() on it, and cancels its evloop_send() if one's out
+ * @param loop The loop the fd was registered with
+ * @param fd The fd to forget
+ * @returns 0 on success, -1 on failure (errno is set)
+ */
+int evloop_del(EventLoop *loop, int fd);
+
+/**
+ * @brief Block until at least one watched fd is ready or the timeout expires
+ * @note Each udata's readiness shows up at most once per batch, with everything that fired for it OR'd
+ * together; ring I/O completions come one per LoopEvent, so those can repeat a udata
+ * @param loop The loop to wait on
+ * @param out Array that receives the ready events
+ * @param max_events Capacity of out
+ * @param timeout_ms How long to wait; -1 waits forever, 0 just polls
+ * @returns Amt. of events written to out (0 on timeout), or -1 on failure (errno is set; EINTR is worth retrying)
+ */
+int evloop_wait(EventLoop *loop, LoopEvent *out, int max_events, int timeout_ms);
+
+/**
+ * @brief Have the loop do socket I/O itself too, through evloop_accept(), evloop_recv() and evloop_send()
+ * @note Only the io_uring backend can, on 6.3+ kernels; everywhere else this fails with ENOTSUP and the
+ * loop is a readiness loop like it always was. Readiness registrations keep working either way
+ * @param loop The loop
+ * @param recv_buffers Amt. of EVLOOP_RECV_BUFFER-sized buffers every evloop_recv() on this loop draws from; 0 if
+ * it will never receive. Rounded up to a power of two
+ * @returns 0 on success, -1 on failure (errno is set)
+ */
+int evloop_enable_ring_io(EventLoop *loop, unsigned recv_buffers);
+
+#define EVLOOP_RECV_BUFFER 4096 // Most bytes one EVT_RECV carries
+
+/**
+ * @brief Keep accepting on a listener; every connection comes back as an EVT_ACCEPT with the new fd in res
+ * @note The fds come out non-blocking and close-on-exec, like accept_nonblocking()'s. Once an EVT_ACCEPT
+ * also has EVT_DONE (out of fds, say), the listener counts as unregistered again
+ * @param loop A loop with ring I/O enabled
+ * @param fd The listening socket
+ * @param udata Handed back in every EVT_ACCEPT
+ * @returns 0 on success, -1 on failure (errno is set)
+ */
+int evloop_accept(EventLoop *loop, int fd, void *udata);
+
+/**
+ * @brief Keep receiving on a socket; whatever arrives comes back as EVT_RECV, in order
+ * @note Registers fd like evloop_add() would; evloop_del() stops it. The peer hanging up comes back as
+ * EVT_HUP, a failed receive as EVT_ERR; either is the last event for it
+ * @param loop A loop with ring I/O enabled and receive buffers set aside
+ * @param fd The socket
+ * @param udata Handed back in every event for it
+ * @returns 0 on success, -1 on failure (errno is set)
+ */
+int evloop_recv(EventLoop *loop, int fd, void *udata);
+
+/**
+ * @brief Hand an EVT_RECV's buffer back; every EVT_RECV needs this once, whatever became of its udata
+ * @param loop The loop the event came from
+ * @param ev The event; anything but an EVT_RECV is ignored
+ */
+void evloop_recycle(EventLoop *loop, const LoopEvent *ev);
+
+/**
+ * @brief Write an iovec array out in one go; comes back as an EVT_SENT, with how much went out in res
+ * @note One at a time per fd. The EVT_SENT always comes, even after evloop_del(); until it has, keep
+ * fd open and don't touch iov or what it points to
+ * @param loop A loop with ring I/O enabled
+ * @param fd The socket
+ * @param iov What to send
+ * @param count Amt. of iovecs
+ * @param udata Handed back in the EVT_SENT
+ * @returns 0 on success, -1 on failure (errno is set; EBUSY if a send on fd is still out)
+ */
+int evloop_send(EventLoop *loop, int fd, const struct iovec *iov, int count, void *udata);
+
+/**
+ * @brief Name of the backend compiled in; handy for startup logs
+ * @returns "epoll", "io_uring", "kqueue" or "select"
+ */
+const char *evloop_backend_name(void);
+
+#endif
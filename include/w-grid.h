@@ -0,0 +1,84 @@
+#ifndef W_GRID_H
+#define W_GRID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Uniform spatial hash grid over the play area.
+ *
+ * - The world is cut into GRID_CELL_SIZE squares; every cell keeps an intrusive list of
+ *   whatever is standing in it
+ * - Moving within a cell is free; crossing into another one is an O(1) unlink + link
+ * - "Nearby" means the same cell or one of its 8 neighbours, so anything within
+ *   GRID_CELL_SIZE of you is always nearby, and nothing past 2 * GRID_CELL_SIZE ever is
+ *
+ * Not thread-safe; callers bring their own lock. A zeroed SpatialGrid is a valid empty grid.
+ */
+
+// Play area; positions are whole pixels in [0, WORLD_W) x [0, WORLD_H)
+#define WORLD_W 500
+#define WORLD_H 500
+
+#define GRID_CELL_SIZE 64
+#define GRID_COLS ((WORLD_W + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE)
+#define GRID_ROWS ((WORLD_H + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE)
+#define GRID_CELLS (GRID_COLS * GRID_ROWS)
+
+typedef struct GridNode
+{
+  struct GridNode  *next;
+  struct GridNode **pprev; // Whatever points at us; NULL while not in the grid
+  uint32_t          cell;
+} GridNode;
+
+typedef struct
+{
+  GridNode *cells[GRID_CELLS];
+  size_t    count;
+} SpatialGrid;
+
+/**
+ * @brief Which cell a position falls in; positions outside the world count as its edge
+ */
+uint32_t grid_cell_at(int32_t x, int32_t y);
+
+/**
+ * @brief Are two cells the same or neighbours?
+ */
+bool grid_cells_near(uint32_t a, uint32_t b);
+
+/**
+ * @brief Add something at a position
+ * @param grid The grid
+ * @param node Its node; must not be in any grid yet
+ * @param x X position
+ * @param y Y position
+ */
+void grid_insert(SpatialGrid *grid, GridNode *node, int32_t x, int32_t y);
+
+/**
+ * @brief Something moved; rehome it if it crossed into another cell
+ * @param grid The grid
+ * @param node Its node; must be in the grid
+ * @param x New X position
+ * @param y New Y position
+ */
+void grid_move(SpatialGrid *grid, GridNode *node, int32_t x, int32_t y);
+
+/**
+ * @brief Take something out of the grid; no-op if it isn't in it
+ * @param grid The grid
+ * @param node Its node
+ */
+void grid_remove(SpatialGrid *grid, GridNode *node);
+
+/**
+ * @brief First node in a cell; follow ->next for the rest
+ * @param grid The grid
+ * @param cell A cell below GRID_CELLS
+ */
+static inline GridNode *grid_cell_head(const SpatialGrid *grid, uint32_t cell) { return grid->cells[cell]; }
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef W_HASH_H
+#define W_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * XXH64: fast, well-mixed non-cryptographic hashing, for telling contents apart cheaply.
+ *
+ * Same output as the reference xxHash implementation, on any byte order; fine for hash
+ * tables and dedup, useless against anybody crafting collisions on purpose.
+ */
+
+/**
+ * @brief Hash a buffer
+ * @param data The bytes
+ * @param len Amt. of bytes
+ * @param seed Starting value; different seeds give unrelated hashes for the same bytes
+ * @returns The 64-bit XXH64 hash
+ */
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef S_STATE_H
 #define S_STATE_H
 
+#include <stdint.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 
 /**
@@ -12,6 +14,13 @@
  */
 int irand(int a, int b);
 
+/**
+ * @brief Return 64 random bits from the OS, good enough for secrets like session tokens
+ * @note Unlike irand(), these are unpredictable; never derived from rand()
+ * @returns The random number; never 0, so 0 can mean "none"
+ */
+uint64_t secure_rand64(void);
+
 /**
  * @brief Receives exactly len bytes from a given connection
  * @note If necessary, we'll keep calling recv() until we meet the quota specified by len
@@ -32,4 +41,22 @@ ssize_t recvall(int fd, void *buf, size_t len);
  */
 ssize_t sendall(int fd, const void *buf, size_t len);
 
+/**
+ * @brief Put a socket into non-blocking mode
+ * @note recv()/send() on it will then fail with EAGAIN instead of waiting
+ * @param fd The socket file desc. to modify
+ * @returns 0 on success, or -1 on failure
+ */
+int set_nonblocking(int fd);
+
+/**
+ * @brief Accept a connection that comes out non-blocking and close-on-exec already
+ * @note One accept4() on Linux; elsewhere accept() plus the two fcntl()s, closing the fd again if those fail
+ * @param listen_fd The listening socket
+ * @param addr Receives the peer's address, as with accept()
+ * @param addrlen In: room at addr; out: size of the address
+ * @returns The new socket, or -1 with errno set (EAGAIN/EWOULDBLOCK once nobody else is waiting)
+ */
+int accept_nonblocking(int listen_fd, struct sockaddr *addr, socklen_t *addrlen);
+
 #endif
@@ -0,0 +1,75 @@
+#ifndef W_INDEX_H
+#define W_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Open-addressing hash index from a 64-bit key to a table slot.
+ *
+ * - Linear probing over a power-of-two array; stays at most half full
+ * - Removal shifts later entries back instead of leaving tombstones, so lookups never
+ *   slow down as things come and go
+ * - Keys are 64 bits so an IPv4 address, IP:port or a hashed IPv6 address all fit
+ *
+ * Not thread-safe; callers bring their own lock. A zeroed SlotIndex is a valid empty index.
+ */
+
+#define SLOT_INDEX_NONE UINT32_MAX // Returned by slot_index_find() on a miss
+
+typedef struct
+{
+  uint64_t key;
+  uint32_t slot;
+  uint32_t used; // 0 = empty bucket
+} SlotIndexEntry;
+
+typedef struct
+{
+  SlotIndexEntry *entries;
+  size_t          cap;   // Amt. of buckets; 0 or a power of two
+  size_t          count; // Amt. of keys stored
+} SlotIndex;
+
+/**
+ * @brief Pre-size an index so that expected keys fit without growing
+ * @param idx The index to initialize
+ * @param expected How many keys we plan on storing; 0 is fine
+ * @returns true on success, false if out of memory
+ */
+bool slot_index_init(SlotIndex *idx, size_t expected);
+
+/**
+ * @brief Release an index's memory; it's left empty and reusable
+ * @param idx The index to free
+ */
+void slot_index_free(SlotIndex *idx);
+
+/**
+ * @brief Look up the slot stored under a key
+ * @param idx The index to search
+ * @param key The key to find
+ * @returns The slot, or SLOT_INDEX_NONE if the key is not there
+ */
+uint32_t slot_index_find(const SlotIndex *idx, uint64_t key);
+
+/**
+ * @brief Map a key to a slot, replacing any previous mapping for that key
+ * @note May grow (and so move) the bucket array
+ * @param idx The index to insert into
+ * @param key The key
+ * @param slot The slot it maps to
+ * @returns true on success, false if out of memory
+ */
+bool slot_index_insert(SlotIndex *idx, uint64_t key, uint32_t slot);
+
+/**
+ * @brief Forget a key
+ * @param idx The index to remove from
+ * @param key The key to remove
+ * @returns true if the key was there, false otherwise
+ */
+bool slot_index_remove(SlotIndex *idx, uint64_t key);
+
+#endif
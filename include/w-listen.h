@@ -0,0 +1,70 @@
+#ifndef W_LISTEN_H
+#define W_LISTEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * TCP listeners, and the socket options that decide how fast connections get accepted and
+ * how much kernel memory each one holds on to.
+ *
+ * - IPv4 or IPv6, whichever the bind address is written in; "::" is dual-stack, so IPv4
+ *   clients land on the same socket as IPv4-mapped addresses
+ * - Options that don't exist on this platform (SO_REUSEPORT, TCP_QUICKACK, TCP_DEFER_ACCEPT)
+ *   are skipped with a warning rather than failing the whole listener
+ * - Buffer sizes are set on the listener, so every accepted socket inherits them, and before
+ *   listen(), so the window scale the kernel offers accounts for them
+ */
+
+#define LISTEN_BACKLOG 1024 // Pending connections the kernel holds; still capped by somaxconn
+
+typedef struct
+{
+  int  backlog;          // 0 = LISTEN_BACKLOG
+  bool reuseport;        // SO_REUSEPORT; lets several servers share the port, the kernel spreads connections
+  int  rcvbuf;           // SO_RCVBUF bytes; 0 = kernel default
+  int  sndbuf;           // SO_SNDBUF bytes; 0 = kernel default
+  int  defer_accept_sec; // TCP_DEFER_ACCEPT; accept() only once data arrives, for up to this long. 0 = off
+  bool nodelay;          // TCP_NODELAY on accepted sockets
+  bool quickack;         // TCP_QUICKACK on accepted sockets; ACK the first request right away
+} ListenOptions;
+
+/**
+ * @brief What a listener gets unless told otherwise: Nagle off, everything else the kernel's call
+ */
+ListenOptions listen_defaults(void);
+
+/**
+ * @brief Open a non-blocking TCP listener
+ * @note SO_REUSEADDR is always on; restarting right after a shutdown shouldn't have to wait out TIME_WAIT
+ * @param bind_ip IPv4 (dotted) or IPv6 address to bind to; "0.0.0.0" or "::" for every interface
+ * @param port Port to listen on, host order
+ * @param opts How to tune it
+ * @returns The listening socket, or -1 on failure
+ */
+int listen_open(const char *bind_ip, uint16_t port, const ListenOptions *opts);
+
+/**
+ * @brief Apply the per-connection options to a freshly accepted socket
+ * @note Best effort; a connection that won't take an option still works, just untuned
+ * @param fd The accepted socket
+ * @param opts Whatever its listener was opened with
+ */
+void listen_tune_accepted(int fd, const ListenOptions *opts);
+
+/**
+ * @brief Squash a peer address into the 32-bit key players are looked up by
+ * @note IPv4 and IPv4-mapped addresses come out as the address itself, network order; native
+ *       IPv6 ones get hashed, so two of those can (rarely) end up sharing a player
+ * @param addr What accept() filled in
+ * @returns The key
+ */
+uint32_t listen_peer_key(const struct sockaddr_storage *addr);
+
+/**
+ * @brief Is this address written as IPv6?
+ */
+bool listen_is_ipv6(const char *bind_ip);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef W_METRICS_HTTP_H
+#define W_METRICS_HTTP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The scrape endpoint for w-metrics.h.
+ *
+ * Scrapes come in on a port of their own and get served by a thread of their own, so a slow
+ * or stuck scraper never holds up the acceptor or a reactor. One scrape at a time, plain
+ * HTTP/1.0: GET /metrics (or just /) gets the Prometheus text from metrics_render(), anything
+ * else a 404, and the connection closes after every response.
+ */
+
+/**
+ * @brief Open the metrics listener and start serving scrapes on it
+ * @param bind_ip Address to listen on; none of the game listener's tuning, scrapes are one connection at a time
+ * @param port Port to listen on, host order
+ * @returns true on success, false on failure
+ */
+bool metrics_endpoint_start(const char *bind_ip, uint16_t port);
+
+/**
+ * @brief Stop the metrics thread and close its listener; no-op if it never started
+ */
+void metrics_endpoint_stop(void);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef W_METRICS_H
+#define W_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Process-wide counters and latency histograms, cheap enough for the hot path.
+ *
+ * - Every thread that records anything gets its own shard, on its own cache lines, the first
+ *   time it does; after that a bump is one relaxed atomic add nobody else is writing to
+ * - Histograms are HDR-style: each power of two is split into 1 << METRICS_HIST_SUB_BITS
+ *   linear buckets, so any value lands within ~12% of its bucket's edge, from 1ns up
+ * - Reading sums every shard without stopping anybody; totals may be a hair behind, never torn
+ * - metrics_render() turns it all into Prometheus text; serving that is the caller's business
+ *
+ * Shards live as long as the process, so counters of threads that have exited still count.
+ */
+
+#define METRICS_HIST_SUB_BITS 3 // 8 buckets per power of two
+#define METRICS_HIST_MAX_BITS 40 // Values from 2^40 ns (~18 minutes) on go in the last bucket
+
+typedef enum
+{
+  METRIC_ACCEPTS,
+
+  // Connections turned away with BUSY right after accept()
+  METRIC_REJECT_RATE, // Over the admission rate
+  METRIC_REJECT_FULL, // Every reactor full
+  METRIC_REJECT_FDS,  // Out of fds; shed through the spare one
+
+  METRIC_ACCEPT_PAUSES, // Out of fds with no spare to shed through; the listener sat out a backoff
+
+  METRIC_REGISTRATIONS,
+  METRIC_RESUMES,       // RESUMEs that got a player back without a REGISTER
+  METRIC_RESUME_MISSES, // ...and ones that were told to REGISTER after all
+  METRIC_REDIRECTS,     // REGISTERs and RESUMEs sent to the node that owns them
+
+  // Failed registrations by reason; keep these together, they render as one labelled family
+  METRIC_REG_FAIL_HEADER,     // Tag length, dimensions, channels or size out of bounds
+  METRIC_REG_FAIL_NO_BLOCK,   // Avatar pool ran dry
+  METRIC_REG_FAIL_DECODE,     // Packed avatar didn't decode to the declared image
+  METRIC_REG_FAIL_TABLE_FULL, // ensure_player() found no room, even after evicting
+  METRIC_REG_FAIL_AVATAR,     // adopt_player_avatar() refused the pixels
+  METRIC_REG_FAIL_REPLY,      // Reply queue too full for the ACK
+
+  // Avatars that turned out to be held already
+  METRIC_AVATAR_UNCHANGED, // The player's own; nothing to store or upload
+  METRIC_AVATAR_SHARED,    // Somebody else's; the block is shared
+
+  // Cluster replication records, by direction
+  METRIC_REPL_OUT, // Queued for peers; one per peer it goes to
+  METRIC_REPL_IN,  // Applied from peers
+
+  METRIC_TCP_BYTES_IN,
+  METRIC_UDP_BYTES_IN,
+  METRIC_TCP_BYTES_OUT,
+  METRIC_UDP_BYTES_OUT,
+  METRIC_EINTR_RETRIES,
+
+  METRIC_COUNTERS
+} MetricCounter;
+
+typedef enum
+{
+  METRIC_HIST_REGISTER,    // Whole REGISTER frame in to ACK queued
+  METRIC_HIST_PLAYERS_WAIT, // Waiting for g_players_lock as a writer
+  METRIC_HIST_PLAYERS_HOLD, // Holding g_players_lock as a writer
+
+  METRIC_HISTOGRAMS
+} MetricHistogram;
+
+/**
+ * @brief Add to a counter
+ * @param c Which one
+ * @param n How much
+ */
+void metrics_add(MetricCounter c, uint64_t n);
+
+/**
+ * @brief Add one to a counter
+ */
+static inline void metrics_inc(MetricCounter c) { metrics_add(c, 1); }
+
+/**
+ * @brief Record one value in a histogram
+ * @param h Which one
+ * @param ns The value, in nanoseconds
+ */
+void metrics_record(MetricHistogram h, uint64_t ns);
+
+/**
+ * @brief Nanoseconds on a clock that never jumps; what histogram values should be measured with
+ */
+int64_t metrics_now_ns(void);
+
+/**
+ * @brief Snapshot every counter and histogram as Prometheus text exposition
+ * @param out Receives a malloc()ed, NUL-terminated buffer; the caller frees it
+ * @returns Its length, or 0 (with *out NULL) if memory ran out
+ */
+size_t metrics_render(char **out);
+
+#endif
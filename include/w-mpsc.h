@@ -0,0 +1,63 @@
+#ifndef W_MPSC_H
+#define W_MPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded multi-producer / single-consumer queue of 64-bit values.
+ *
+ * - Producers claim a cell with one CAS on the tail, then publish it by bumping that
+ *   cell's sequence number; no locks, and a slow producer only holds up its own cell
+ * - The single consumer owns the head outright, so popping is plain loads and stores
+ * - Fixed capacity; a push into a full queue fails instead of allocating
+ */
+
+typedef struct
+{
+  _Atomic size_t seq; // == position when free for a push, position + 1 once it holds a value
+  uint64_t       value;
+} MpscCell;
+
+typedef struct
+{
+  MpscCell *cells;
+  size_t    mask; // Capacity - 1
+
+  _Alignas(64) _Atomic size_t tail; // Next position to push; shared by producers
+  _Alignas(64) size_t head;         // Next position to pop; consumer only
+} MpscQueue;
+
+/**
+ * @brief Set up an empty queue
+ * @param q The queue to initialize
+ * @param capacity Max values held at once; rounded up to a power of two
+ * @returns true on success, false if out of memory
+ */
+bool mpsc_init(MpscQueue *q, size_t capacity);
+
+/**
+ * @brief Free the queue's cells; anything still queued is lost
+ * @param q The queue to destroy
+ */
+void mpsc_destroy(MpscQueue *q);
+
+/**
+ * @brief Append a value; safe from any number of threads at once
+ * @param q The queue
+ * @param value The value to append
+ * @returns true if queued, false if the queue is full
+ */
+bool mpsc_push(MpscQueue *q, uint64_t value);
+
+/**
+ * @brief Take the oldest value; only ever call this from the one consumer thread
+ * @param q The queue
+ * @param value Receives the value
+ * @returns true if a value was taken, false if the queue is empty
+ */
+bool mpsc_pop(MpscQueue *q, uint64_t *value);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef W_PEER_H
+#define W_PEER_H
+
+#include "w-cluster.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Cluster replication over peer links; the wire format is in w-cluster.h.
+ *
+ * One thread of its own runs every peer link, so a slow peer never holds up a reactor. Every
+ * tick it walks the table once and diffs the players we own against what peers were last
+ * told (the shadow, one entry per slot); whatever changed goes out to every link.
+ *
+ * - Positions, tags and the connected flag go out as they change; an avatar goes out, pixels
+ *   and all, when its hash does. A player is sent whole when new, and whenever they connect,
+ *   so a peer that evicted its replica meanwhile gets all of it back
+ * - A player mid-registration (no avatar yet) is left for the next tick
+ * - A link that just came up gets a full snapshot instead of that tick's changes
+ * - A link that falls too far behind is dropped and redialed; the snapshot that follows
+ *   catches the peer back up
+ * - When a peer's link to us goes down, everybody it owns is marked disconnected here; the
+ *   next snapshot from it says who's really still around
+ *
+ * Records from peers go straight into the players table (see apply_replica()).
+ */
+
+/**
+ * @brief Open our peer listener, resolve every peer and start the replication thread
+ * @param cl The cluster; must outlive peer_stop()
+ * @param bind_ip Same address the game listens on; the port is ours in the node list
+ * @param tick_ms How often changes go out to peers
+ * @param changed Called, from the replication thread, whenever records from a peer changed the table; may be NULL
+ * @returns true on success, false on failure
+ */
+bool peer_start(const Cluster *cl, const char *bind_ip, uint32_t tick_ms, void (*changed)(void));
+
+/**
+ * @brief Stop the replication thread and let go of every link; no-op if it never started
+ */
+void peer_stop(void);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef W_PIXEL_H
+#define W_PIXEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel format conversion into RGBA32.
+ *
+ * Each source format gets its own kernel; pick one per avatar with pixel_kernel_for() and
+ * run it over the whole image, instead of branching on the channel count for every pixel.
+ * Kernels come in scalar, SSSE3, AVX2 and NEON flavours; the best one this CPU supports is
+ * picked at runtime, once.
+ *
+ * Overlap: dst and src may overlap as long as src ENDS where dst ends, i.e. the source
+ * pixels were written to the tail of the destination buffer. Every kernel walks front to
+ * back and loads a block before storing it, which never clobbers source bytes still unread.
+ */
+
+/**
+ * @brief Converts npixels pixels from some source format into RGBA
+ * @param dst Destination; room for npixels * 4 bytes
+ * @param src Source pixels, tightly packed
+ * @param npixels Amt. of pixels to convert
+ */
+typedef void (*PixelKernel)(uint8_t *dst, const uint8_t *src, size_t npixels);
+
+/**
+ * @brief Get the fastest kernel converting a given channel count to RGBA
+ * @param channels 1 (grayscale), 3 (RGB) or 4 (RGBA)
+ * @returns The kernel, or NULL for an unsupported channel count
+ */
+PixelKernel pixel_kernel_for(uint32_t channels);
+
+/**
+ * @brief Which instruction set pixel_kernel_for() ended up using; handy for startup logs
+ * @returns "avx2", "ssse3", "neon" or "scalar"
+ */
+const char *pixel_kernel_isa(void);
+
+#endif
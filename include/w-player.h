@@ -0,0 +1,433 @@
+#ifndef W_PLAYER_H
+#define W_PLAYER_H
+
+#include "w-grid.h"
+#include "w-slab.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// ==============================================================================
+// CONFIGURATION
+// ==============================================================================
+
+#define AVATAR_CHANNEL_COUNT 4 // We always want avatars to end up as RGBA
+#define MAX_AVATAR_W 8         // We expect an 8x8 sprite
+#define MAX_AVATAR_H 8
+#define MAX_AVATAR_BYTES (MAX_AVATAR_W * MAX_AVATAR_H * RGBA_CHANNEL_COUNT) // Biggest avatar, RGBA or raw
+#define MAX_PLAYERS 32 // Default cap on the players table; see set_player_capacity()
+#define MAX_NAMETAG_LEN 31
+#define GRAYSCALE_CHANNEL_COUNT 1 // Amnt. of channels in grayscale image
+#define RGB_CHANNEL_COUNT 3       // Amnt. of channels in an RGB image, no alpha data
+#define RGBA_CHANNEL_COUNT 4      // Amnt. of channels in an RGBA image
+#define PLAYER_LOCK_STRIPE_BITS 4
+#define PLAYER_LOCK_STRIPES (1u << PLAYER_LOCK_STRIPE_BITS) // Per-player field locks
+#define AVATAR_UPLOAD_QUEUE_CAP 1024 // Pending uploads tracked one by one; past that the renderer falls back to a scan
+
+// FIXME: Boundscheck these!
+#define MIN_PLAYER_X_POS 100
+#define MAX_PLAYER_X_POS 400
+#define MIN_PLAYER_Y_POS 100
+#define MAX_PLAYER_Y_POS 400
+
+// ==============================================================================
+// PLAYER DATA STRUCTURE
+// ==============================================================================
+
+typedef struct Player
+{
+  uint32_t    ip;
+  uint32_t    player_id;
+  uint32_t    slot;     // Where this player lives in g_players; stable until evicted
+  uint32_t    slot_gen; // Generation of that slot; together they make the player's SlabHandle
+  char        nametag[MAX_NAMETAG_LEN + 1]; // +1 for null terminator
+  int         pos_x, pos_y;
+  uint8_t    *avatar;      // Byte array containing image pixels (RGBA32); shared with everyone whose avatar is identical, so never written to
+  uint64_t    avatar_hash; // XXH64 of those pixels; what the avatar is filed under in the dedup cache
+  uint32_t    w, h, ch; // Width, height and channel count
+  bool        connected;
+  time_t      last_seen; // When was this player last connected?
+  GridNode    grid;      // Where they stand in the spatial grid; guarded by the grid lock, NOT the stripe
+
+  // UDP fast path; see apply_udp_update()
+  uint64_t    session_token; // Handed out in their ACK; proves a datagram comes from them. 0 = no UDP session
+  uint32_t    udp_ip;        // Where their datagrams come from, network order; 0 = not heard from yet
+  uint16_t    udp_port;
+  uint32_t    udp_seq; // Newest sequence number applied; older or repeated datagrams get dropped
+  uint32_t    udp_ack; // Newest WORLD tick they say they have; their delta baseline
+#ifndef SERVER_HEADLESS
+  bool        tex_inited,
+      tex_dirty; // Is the avatar in the player's atlas cell yet? / Has the avatar changed since it was uploaded?
+  atomic_bool upload_queued; // Already waiting in the upload queue? Keeps a player in there at most once
+#endif
+} Player;
+
+// ==============================================================================
+// GLOBAL SHARED STATE
+// ==============================================================================
+
+/*
+ * Thread locking system
+ *
+ * - g_players_lock guards table MEMBERSHIP: which slots of g_players are live, the indexes
+ *   and g_next_player_id. Lookups and the renderer take it shared; only adding or evicting
+ *   a player takes it exclusive
+ * - A player's mutable fields (tag, pos, avatar, connected, tex state) are guarded by one of
+ *   PLAYER_LOCK_STRIPES mutexes, picked by hashing the player's IP; see player_lock()
+ *
+ * - The spatial grid has a lock of its own, only ever taken last (after a stripe, if any)
+ *
+ * Order is always g_players_lock first, then a stripe; never hold two stripes at once
+ */
+
+extern Slab             g_players; // Player objects; iterate [0, high_water) and skip dead slots
+extern pthread_rwlock_t g_players_lock;
+
+// ==============================================================================
+// PLAYER TABLE OPERATIONS
+// ==============================================================================
+
+/**
+ * @brief Get the stripe lock guarding the mutable fields of the player bound to an IP
+ * @note Players never change IP, so the same player always maps to the same stripe
+ * @param ip The player's IP, network order
+ * @returns The mutex to hold while reading or writing that player's fields
+ */
+pthread_mutex_t *player_lock(uint32_t ip);
+
+/**
+ * @brief Change how many players the table may hold
+ * @note When the table is full, the longest-disconnected player gets evicted to make room
+ * @param max_players New cap; 0 for no cap at all
+ */
+void set_player_capacity(size_t max_players);
+
+/**
+ * @brief Look up a player by IP in the players table
+ * @note Caller must hold g_players_lock (shared is enough)
+ * @note Constant time; goes through an index instead of scanning g_players
+ * @param target_ip The IP of the player we wish to find
+ * @returns The address of the player if found; NULL if did not find
+ */
+Player *find_player_by_ip(uint32_t target_ip);
+
+/**
+ * @brief Look up a player by the ID we handed them in their ACK
+ * @note Caller must hold g_players_lock (shared is enough)
+ * @param player_id The player's ID
+ * @returns The address of the player if found; NULL if did not find
+ */
+Player *find_player_by_id(uint32_t player_id);
+
+/**
+ * @brief Ensure that the player registered under target_ip exists; if not, create an entry for a player bound to target_ip
+ * @note Takes g_players_lock itself
+ * @note The player comes back marked connected, which pins their slot: only disconnected players get evicted
+ * @note That pin is per IP, not per caller: another connection from the same address going away unpins them too, so
+ * hold g_players_lock (shared) and look them up again before relying on the address for more than a moment
+ * @param target_ip The player's IP
+ * @returns The player's address if found already, NULL if there is no room for a new player, or the new player's address if a new one had to be created
+ */
+Player *ensure_player(uint32_t target_ip);
+
+/**
+ * @brief Hand out new player IDs from every stride-th number only, starting at first
+ * @note Before any player is added; cluster nodes each get their own residue so IDs never clash
+ * @note A store with a higher next ID wins, rounded up to the next ID in the same residue
+ * @param first Lowest ID to hand out; never 0
+ * @param stride Gap between IDs; 1 = every number
+ */
+void set_player_id_space(uint32_t first, uint32_t stride);
+
+/**
+ * @brief Call a function for every live player
+ * @note Takes g_players_lock (shared) itself, and each player's stripe around their call
+ * @note fn may read or write the player's fields, but must not take any lock of its own
+ * @param fn Gets each player and arg
+ * @param arg Passed through
+ */
+void for_each_player(void (*fn)(Player *p, void *arg), void *arg);
+
+/**
+ * @brief Move the player bound to an IP
+ * @note Takes g_players_lock (shared) and the player's stripe itself
+ * @note Positions outside the world get clamped to its edge
+ * @param target_ip The player's IP
+ * @param pos_x New X position
+ * @param pos_y New Y position
+ * @returns true if the player was moved, false if nobody is registered under that IP
+ */
+bool move_player(uint32_t target_ip, int32_t pos_x, int32_t pos_y);
+
+/**
+ * @brief One client-to-server UDP state datagram, decoded
+ */
+typedef struct
+{
+  uint32_t player_id;
+  uint64_t token;
+  uint32_t seq;
+  uint32_t ack_tick;
+  int32_t  pos_x, pos_y;
+  uint32_t src_ip; // Where it came from, network order
+  uint16_t src_port;
+} UdpUpdate;
+
+/**
+ * @brief Apply a UDP state update: move the player and remember where and up to what they've heard from us
+ * @note Takes g_players_lock (shared) and the player's stripe itself
+ * @note Dropped unless the player is connected, the token matches their session and seq is newer
+ * than the last one applied (wrapping around is fine); that's what makes reordering and
+ * duplicates harmless
+ * @param u The update
+ * @returns true if it was applied, false if it got dropped
+ */
+bool apply_udp_update(const UdpUpdate *u);
+
+/**
+ * @brief Where to send a player's UDP state, if they have a UDP session going
+ * @note Takes g_players_lock (shared) and the player's stripe itself
+ * @param slot The player's slot
+ * @param player_id The player's ID; catches the slot having changed hands
+ * @param ip Receives their address, network order
+ * @param port Receives their port, network order
+ * @param ack_tick Receives the newest WORLD tick they acknowledged
+ * @returns true if they have a UDP session and we've heard from it, false otherwise
+ */
+bool get_player_udp_peer(uint32_t slot, uint32_t player_id, uint32_t *ip, uint16_t *port, uint32_t *ack_tick);
+
+/**
+ * @brief List every player's slot, grouped by the grid cell they stand in
+ * @note Caller must hold g_players_lock (shared is enough); takes the grid lock itself
+ * @note Walks the grid, not the table; no positions are read and nothing gets sorted
+ * @param slots Receives the slots, cell by cell
+ * @param cap Room in slots; g_players.live is always enough
+ * @param cell_start Room for GRID_CELLS + 1; cell c's players end up in slots[cell_start[c], cell_start[c + 1])
+ * @returns Amt. of slots written
+ */
+size_t collect_players_by_cell(uint32_t *slots, size_t cap, uint32_t *cell_start);
+
+/**
+ * @brief Write a player's nametag, position and last_seen through to the store; no-op without one
+ * @note Caller must hold the player's stripe; moves and avatars are written through on their own
+ * @param p The player
+ */
+void persist_player_locked(Player *p);
+
+/**
+ * @brief Sets the player avatar image
+ * @note The input image will always be converted to RGBA
+ * @note The conversion runs without any lock; the player's stripe is only held to swap the buffer in
+ * @note An avatar identical to the one the player has already changes nothing: no store write, no re-upload
+ * @param Player Address of the player whose avatar we wish to set
+ * @param av_pixels Byte array containing raw pixel data of new avatar
+ * @param av_w Width of new avatar
+ * @param av_h Height of new avatar
+ * @param av_ch Channel count of new avatar
+ * @returns true if player avatar was set, false otherwise
+ */
+bool set_player_avatar(Player        *target_player,
+                       const uint8_t *av_pixels,
+                       uint32_t       av_w,
+                       uint32_t       av_h,
+                       uint8_t        av_ch);
+
+// ==============================================================================
+// REPLICAS
+// ==============================================================================
+
+/*
+ * In cluster mode, players owned by other nodes are kept in the table too, as replicas; they
+ * render and show up in WORLD packets like anybody else, but only their owner changes them.
+ *
+ * - A replica keeps the ID its owner gave it; owners hand IDs out of disjoint residues, see
+ *   set_player_id_space()
+ * - Only the fields an update says it carries are touched; an avatar comes as RGBA and goes
+ *   through the dedup cache like any other
+ * - A player the table doesn't have yet is only created from an update carrying all fields
+ */
+
+// Which fields a PlayerReplica carries
+enum
+{
+  REPLICA_POS    = 1 << 0,
+  REPLICA_STATE  = 1 << 1, // connected
+  REPLICA_TAG    = 1 << 2,
+  REPLICA_AVATAR = 1 << 3,
+  REPLICA_ALL    = REPLICA_POS | REPLICA_STATE | REPLICA_TAG | REPLICA_AVATAR
+};
+
+typedef struct
+{
+  uint32_t       ip;
+  uint32_t       player_id;
+  uint8_t        fields; // REPLICA_* bits
+  int32_t        pos_x, pos_y;
+  bool           connected;
+  char           nametag[MAX_NAMETAG_LEN + 1];
+  uint64_t       avatar_hash;
+  uint32_t       w, h;
+  const uint8_t *avatar; // w * h RGBA pixels
+} PlayerReplica;
+
+/**
+ * @brief Apply an update from a player's owner, creating the replica if it's new
+ * @note Takes g_players_lock and the player's stripe itself
+ * @param u The update
+ * @returns true if applied, false if there's no room for them or the update doesn't make sense
+ */
+bool apply_replica(const PlayerReplica *u);
+
+/**
+ * @brief Forget a replica whose owner forgot them; connected ones stay, their owner will say so again
+ * @note Takes g_players_lock exclusively
+ * @param ip The player's IP
+ * @returns true if they were removed
+ */
+bool drop_replica(uint32_t ip);
+
+// ==============================================================================
+// PERSISTENCE
+// ==============================================================================
+
+/*
+ * The players table can be backed by a w-store file, so a restart doesn't lose anybody.
+ *
+ * - Record i holds whoever sits in slot i; every change to a player (ip, id, tag, pos,
+ *   avatar, last_seen) is written straight into the mapping, under the same lock as the change
+ * - g_next_player_id lives in the file's header, so IDs never get handed out twice
+ * - Opening the store brings everyone back, disconnected, at the same slot, position and ID;
+ *   reconnecting from the same IP picks them up like nothing happened
+ * - Without a store, nothing here does anything
+ */
+
+/**
+ * @brief Open (or create) the store and bring back everybody in it
+ * @note Before any other thread touches the table, and at most once
+ * @param path File to keep players in
+ * @param capacity Players it keeps; those in slots past that (or past the file's own size) aren't persisted
+ * @returns true on success, false if the file can't be used
+ */
+bool open_player_store(const char *path, uint32_t capacity);
+
+/**
+ * @brief Is there a store to flush?
+ */
+bool player_store_enabled(void);
+
+/**
+ * @brief Start writing what changed since the last flush back to disk; on Linux, doesn't wait for it
+ * @note Any thread, any time; only dirty pages are touched. See record_store_flush()
+ */
+void flush_player_store(void);
+
+/**
+ * @brief Write everything back, wait for the disk and let go of the file
+ * @note Only once no other thread is left touching players
+ */
+void close_player_store(void);
+
+#ifndef SERVER_HEADLESS
+
+// ==============================================================================
+// AVATAR UPLOADS
+// ==============================================================================
+
+/*
+ * Changed avatars are announced to the renderer through a lock-free queue, so it never has
+ * to scan the table to find them.
+ *
+ * - Setting an avatar marks the player tex_dirty and pushes their handle, unless they're
+ *   queued already
+ * - The render thread drains the queue once per frame, capped, so a burst of registrations
+ *   spreads over a few frames instead of stalling one
+ * - Handles are checked on the way out; a player evicted while queued is just skipped
+ * - If the queue ever fills up, the next drain does one full scan for tex_dirty instead
+ * - Off until set_avatar_uploads() turns it on; without a renderer nobody would drain it
+ */
+
+/**
+ * @brief Turn upload tracking on or off; on only makes sense with a render thread draining it
+ * @param enabled Should changed avatars be queued from now on?
+ */
+void set_avatar_uploads(bool enabled);
+
+/**
+ * @brief Queue a player for an avatar upload on the render thread
+ * @note set_player_avatar() and adopt_player_avatar() already do this; only needed when tex_dirty is set by hand
+ * @note The caller must have the player pinned (connected, or g_players_lock held)
+ * @param p The player
+ */
+void queue_avatar_upload(Player *p);
+
+/**
+ * @brief Hand queued players to an upload callback, oldest first
+ * @note Render thread only; takes g_players_lock (shared) itself, and only if something is queued
+ * @note The callback runs with the player's stripe held, and only for players still tex_dirty
+ * @param budget Max uploads to do; whatever's left waits for the next call
+ * @param upload Does the actual upload and clears tex_dirty; returns false if it can't yet, which re-queues the player and ends this drain
+ * @returns Amt. of players uploaded
+ */
+size_t drain_avatar_uploads(size_t budget, bool (*upload)(Player *p));
+
+#endif
+
+// ==============================================================================
+// ZERO-COPY AVATARS
+// ==============================================================================
+
+/*
+ * The receive path can skip set_player_avatar()'s copy altogether:
+ *
+ * 1. Grab a block with alloc_avatar_block()
+ * 2. Receive the raw pixels into it at avatar_tail_offset(); for RGBA that's the very start,
+ *    so the bytes land exactly where they'll stay
+ * 3. Hand the block to adopt_player_avatar(), which expands non-RGBA pixels in place
+ */
+
+/**
+ * @brief Where raw pixels must start in an avatar block so they can be converted in place
+ * @param av_w Width of the avatar
+ * @param av_h Height of the avatar
+ * @param av_ch Channel count of the raw pixels
+ * @returns Offset of the raw pixels; they end exactly where the RGBA image does
+ */
+static inline size_t avatar_tail_offset(uint32_t av_w, uint32_t av_h, uint8_t av_ch)
+{
+  return (size_t)av_w * av_h * (RGBA_CHANNEL_COUNT - av_ch);
+}
+
+/**
+ * @brief Take an avatar block from the pool; MAX_AVATAR_BYTES big
+ * @returns The block, or NULL if out of memory
+ */
+uint8_t *alloc_avatar_block(void);
+
+/**
+ * @brief Give back a block that never made it into a player
+ * @param block The block; NULL is a no-op
+ */
+void free_avatar_block(uint8_t *block);
+
+/**
+ * @brief Sets the player avatar from a block holding raw pixels at avatar_tail_offset()
+ * @note Takes ownership of the block no matter what; on failure it goes straight back to the pool
+ * @note Dimensions are not truncated; anything past MAX_AVATAR_W x MAX_AVATAR_H is rejected
+ * @note Like set_player_avatar(), an unchanged avatar changes nothing
+ * @param target_player Address of the player whose avatar we wish to set
+ * @param block Avatar block from alloc_avatar_block()
+ * @param av_w Width of new avatar
+ * @param av_h Height of new avatar
+ * @param av_ch Channel count of the raw pixels
+ * @returns true if player avatar was set, false otherwise
+ */
+bool adopt_player_avatar(Player  *target_player,
+                         uint8_t *block,
+                         uint32_t av_w,
+                         uint32_t av_h,
+                         uint8_t  av_ch);
+
+#endif
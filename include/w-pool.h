@@ -0,0 +1,62 @@
+#ifndef W_POOL_H
+#define W_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pool of fixed-size memory blocks, shared between threads.
+ *
+ * - Blocks are carved out of big chunks up front; alloc/free are a lock-free pop/push on
+ *   a free stack, so the hot path never goes near malloc() or its locks
+ * - The stack head carries a tag that bumps on every pop, which keeps a stale CAS from
+ *   succeeding after somebody else popped and pushed the same block (ABA)
+ * - Chunks are only ever added (under a mutex, when the stack runs dry), never given
+ *   back until block_pool_destroy()
+ */
+
+#define BLOCK_POOL_CHUNK_BLOCKS 64  // Blocks carved out of every chunk
+#define BLOCK_POOL_MAX_CHUNKS 4096 // Hard cap: 256k blocks per pool
+
+typedef struct
+{
+  size_t           stride;    // Header + payload, rounded up for alignment
+  _Atomic uint64_t free_head; // (tag << 32) | (index + 1); index + 1 == 0 means empty
+  uint8_t         *chunks[BLOCK_POOL_MAX_CHUNKS];
+  _Atomic size_t   chunk_count;
+  pthread_mutex_t  grow_lock;
+} BlockPool;
+
+/**
+ * @brief Set up a pool and pre-carve enough blocks for the expected load
+ * @param pool The pool to initialize
+ * @param block_size Usable bytes per block
+ * @param prealloc Amt. of blocks to have ready right away
+ * @returns true on success, false if the up-front allocation failed
+ */
+bool block_pool_init(BlockPool *pool, size_t block_size, size_t prealloc);
+
+/**
+ * @brief Release every chunk; all blocks become invalid
+ * @param pool The pool to destroy
+ */
+void block_pool_destroy(BlockPool *pool);
+
+/**
+ * @brief Take a block; grows the pool if it's empty
+ * @param pool The pool to allocate from
+ * @returns A block of at least block_size bytes (16-byte aligned; contents undefined), or NULL if out of memory
+ */
+void *block_pool_alloc(BlockPool *pool);
+
+/**
+ * @brief Give a block back
+ * @param pool The pool it came from
+ * @param block The block; NULL is a no-op
+ */
+void block_pool_free(BlockPool *pool, void *block);
+
+#endif
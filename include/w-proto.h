@@ -0,0 +1,77 @@
+#ifndef W_PROTO_H
+#define W_PROTO_H
+
+/*
+ * The client protocol's numbers: opcodes, field widths and frame sizes, for the server and
+ * anything that talks to it (loadgen). Everything multi-byte is big endian.
+ *
+ * What each frame means, and when it's sent, is in server.c (CLIENT HANDLING); only its
+ * layout is pinned down here. Peer links between cluster nodes speak their own protocol, see
+ * w-cluster.h.
+ */
+
+enum
+{
+  OPC_REGISTER    = 0x01,
+  OPC_HEARTBEAT   = 0x02,
+  OPC_MOVE        = 0x03,
+  OPC_RESUME      = 0x04,
+  OPC_ACK         = 0x81,
+  OPC_WORLD       = 0x82,
+  OPC_ACK_UDP     = 0x83,
+  OPC_BUSY        = 0x84,
+  OPC_RESUME_FAIL = 0x85,
+  OPC_REDIRECT    = 0x86,
+  OPC_SHUTDOWN    = 0xFF
+};
+
+// v2 REGISTER flags; the low bits say how the avatar is packed, the rest must be 0
+enum
+{
+  AVATAR_RAW          = 0,
+  AVATAR_RLE          = 1,
+  AVATAR_QOI          = 2,
+  V2_FLAG_AVATAR_MASK = 0x03
+};
+
+#define MAX_STR_LEN 1024 // Tags this long or longer are turned away
+
+// REGISTER header fields, after the opcode
+#define EXPECTED_NETWORK_ORDER_NAMETAG_LEN 2
+#define EXPECTED_NETWORK_ORDER_AVATAR_WIDTH 4
+#define EXPECTED_NETWORK_ORDER_AVATAR_HEIGHT 4
+#define EXPECTED_NETWORK_ORDER_AVATAR_CHANNELS 1
+#define EXPECTED_NETWORK_ORDER_AVATAR_SIZE 4
+#define REG_HEADER_BYTES 16 // OPCODE through CHANNELS
+
+#define RESUME_BYTES 13 // OPCODE through AVATAR_HASH
+
+// ACK and ACK_UDP
+#define ACK_OPCODE_SIZE 1
+#define ACK_OPCODE_OFFSET 0
+#define ACK_ID_OFFSET 1
+#define ACK_POS_X_OFFSET 5
+#define ACK_POS_Y_OFFSET 9
+#define ACK_TOKEN_OFFSET 13    // ACK_UDP only
+#define ACK_UDP_PORT_OFFSET 21 // ACK_UDP only
+#define ACK_BYTES 13
+#define ACK_UDP_BYTES 23
+
+#define BUSY_BYTES 3            // OPCODE through RETRY_MS
+#define REDIRECT_HEADER_BYTES 4 // OPCODE through HOST_LEN; the host follows
+#define WORLD_HEADER_BYTES 11   // OPCODE through LEN; the body follows
+#define WORLD_LEN_OFFSET 9
+#define UDP_STATE_BYTES 29 // A MOVE datagram, OPCODE through Y
+
+// v2 framing
+#define V2_MAGIC 0x5756 // "WV"; its first byte is no v1 opcode, so one byte tells the versions apart
+#define V2_VERSION 2
+#define V2_HEADER_BYTES 9 // MAGIC through LENGTH
+#define V2_MAGIC_OFFSET 0
+#define V2_VERSION_OFFSET 2
+#define V2_OPCODE_OFFSET 3
+#define V2_FLAGS_OFFSET 4
+#define V2_LENGTH_OFFSET 5
+#define V2_REGISTER_BYTES 7 // TAG_LEN through CHANNELS
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef W_RING_H
+#define W_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Fixed-size byte ring; a connection's outbound queue.
+ *
+ * - Messages are pushed whole or not at all, so a reader never sees half of one
+ * - The queued bytes are exposed as (at most) two iovecs, one per side of the wrap, so
+ *   everything pending goes out in a single writev()
+ * - Storage is inline; a zeroed ByteRing is an empty ring
+ *
+ * Not thread-safe; a ring belongs to whoever owns the connection.
+ */
+
+#define BYTE_RING_CAP 4096 // Must be a power of two
+
+typedef struct
+{
+  size_t  head; // Offset of the oldest queued byte
+  size_t  len;  // Amt. of bytes queued
+  uint8_t data[BYTE_RING_CAP];
+} ByteRing;
+
+/**
+ * @brief Queue a message at the back of the ring
+ * @param ring The ring to push into
+ * @param msg The bytes to queue
+ * @param len Amt. of bytes in msg
+ * @returns true if queued, false if it doesn't fit (nothing is queued in that case)
+ */
+bool ring_push(ByteRing *ring, const void *msg, size_t len);
+
+/**
+ * @brief Describe the queued bytes, oldest first, for writev()
+ * @param ring The ring to look at
+ * @param iov Receives up to two iovecs
+ * @returns Amt. of iovecs filled; 0 if the ring is empty
+ */
+int ring_iov(const ByteRing *ring, struct iovec iov[2]);
+
+/**
+ * @brief Drop bytes off the front once they've been sent
+ * @param ring The ring to consume from
+ * @param len Amt. of bytes sent; at most what's queued
+ */
+void ring_consume(ByteRing *ring, size_t len);
+
+static inline bool ring_empty(const ByteRing *ring)
+{
+  return ring->len == 0;
+}
+
+// How many more bytes ring_push() would take right now
+static inline size_t ring_space(const ByteRing *ring)
+{
+  return BYTE_RING_CAP - ring->len;
+}
+
+#endif
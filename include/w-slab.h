@@ -0,0 +1,117 @@
+#ifndef W_SLAB_H
+#define W_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Growable table of fixed-size elements.
+ *
+ * - Storage comes in chunks that never move, so an element's address is stable for as
+ *   long as it's alive; growing just adds a chunk
+ * - Freed slots go on a free list and get reused before the table grows
+ * - Every slot carries a generation that bumps on free, so a SlabHandle taken before a
+ *   slot was recycled is detected as stale instead of silently aliasing the new owner
+ *
+ * Not thread-safe; callers bring their own lock.
+ */
+
+#define SLAB_CHUNK_SHIFT 6 // 64 elements per chunk
+#define SLAB_NONE UINT32_MAX
+
+typedef struct
+{
+  uint32_t index;
+  uint32_t gen;
+} SlabHandle;
+
+typedef struct
+{
+  uint32_t gen;
+  uint32_t next_free; // Free list link; SLAB_NONE at the tail
+  bool     live;
+} SlabSlot;
+
+typedef struct
+{
+  size_t    elem_size;
+  uint8_t **chunks;
+  size_t    chunk_count;
+  SlabSlot *slots;      // One per element ever handed out; may be reallocated
+  size_t    high_water; // Amt. of slots ever handed out; iterate [0, high_water)
+  size_t    live;       // Amt. of slots in use
+  size_t    limit;      // Max. live slots; 0 = unbounded
+  uint32_t  free_head;
+} Slab;
+
+/**
+ * @brief Set up an empty slab; nothing is allocated until the first slab_alloc()
+ * @param slab The slab to initialize
+ * @param elem_size Size of one element
+ * @param limit Max. amt. of live elements; 0 for no limit
+ */
+void slab_init(Slab *slab, size_t elem_size, size_t limit);
+
+/**
+ * @brief Release all of a slab's memory; every element and handle becomes invalid
+ * @param slab The slab to destroy
+ */
+void slab_destroy(Slab *slab);
+
+/**
+ * @brief Change the max. amt. of live elements
+ * @note Lowering it below the current live count doesn't evict anything; it just stops new allocations
+ * @param slab The slab to modify
+ * @param limit New limit; 0 for no limit
+ */
+void slab_set_limit(Slab *slab, size_t limit);
+
+/**
+ * @brief Hand out a zeroed element, reusing a freed slot if there is one
+ * @param slab The slab to allocate from
+ * @param out If not NULL, receives the element's handle
+ * @returns The element's (stable) address, or NULL if the limit is reached or memory ran out
+ */
+void *slab_alloc(Slab *slab, SlabHandle *out);
+
+/**
+ * @brief Return a slot to the free list; outstanding handles to it go stale
+ * @param slab The slab owning the slot
+ * @param index The slot to free
+ */
+void slab_free(Slab *slab, uint32_t index);
+
+/**
+ * @brief Address of whatever lives in a slot, without any liveness check
+ * @param slab The slab to look in
+ * @param index A slot below high_water
+ * @returns The element's address
+ */
+void *slab_at(const Slab *slab, uint32_t index);
+
+/**
+ * @brief Resolve a handle
+ * @param slab The slab to look in
+ * @param h The handle
+ * @returns The element's address, or NULL if the slot was freed (and maybe reused) since
+ */
+void *slab_get(const Slab *slab, SlabHandle h);
+
+/**
+ * @brief Is a slot currently in use?
+ * @param slab The slab to look in
+ * @param index The slot to check
+ * @returns true if live, false if free or out of range
+ */
+bool slab_live(const Slab *slab, uint32_t index);
+
+/**
+ * @brief Current handle of a live slot
+ * @param slab The slab to look in
+ * @param index A live slot
+ * @returns The handle
+ */
+SlabHandle slab_handle(const Slab *slab, uint32_t index);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef W_SNAPSHOT_H
+#define W_SNAPSHOT_H
+
+#include "w-player.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * What the renderer needs to draw a frame, copied out of the players table.
+ *
+ * - The network side rebuilds it whenever something visible changes and publishes it with
+ *   an atomic index swap between three buffers: one being written, one ready, one being drawn
+ * - The renderer grabs the newest ready buffer without any lock, and keeps drawing from it
+ *   until it asks again; a fresh snapshot never touches the one it's holding
+ * - Rebuilds coalesce; if one is already running, asking for another just flags it as stale
+ */
+
+typedef struct
+{
+  int      pos_x, pos_y;
+  uint32_t slot, slot_gen; // Atlas cell and who should be in it
+  uint32_t w, h;
+  char     nametag[MAX_NAMETAG_LEN + 1];
+} RenderItem;
+
+typedef struct
+{
+  RenderItem *items; // Connected players that have an avatar
+  size_t      count;
+  size_t      cap;
+  size_t      slot_limit; // Every slot in items is below this
+} RenderSnapshot;
+
+/**
+ * @brief Rebuild the snapshot from the players table and publish it
+ * @note Call after changing anything the renderer draws (position, tag, avatar, connected)
+ * @note Takes g_players_lock and the stripes itself; the caller must hold none of them
+ * @note If another thread is already rebuilding, this returns right away and that thread rebuilds again for us
+ */
+void render_snapshot_publish(void);
+
+/**
+ * @brief Get the newest published snapshot
+ * @note Render thread only; never blocks, never locks
+ * @returns The snapshot; valid until the next call
+ */
+const RenderSnapshot *render_snapshot_acquire(void);
+
+/**
+ * @brief Free all three buffers; nobody may publish or acquire afterwards
+ */
+void render_snapshot_free(void);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef W_STORE_H
+#define W_STORE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-record file, memory-mapped; what the players table persists into.
+ *
+ * - One header page, then `capacity` records of `record_size` bytes each; records are plain
+ *   memory, written in place with no syscall at all
+ * - Whoever writes a record says so with record_store_touch(); that marks the pages it
+ *   covers dirty, and record_store_flush() writes just those back, in runs
+ * - The mapping is shared, so whatever was written survives the process dying at any point;
+ *   flushing is about getting it to disk before the machine does too
+ * - The file is flock()ed while open; two servers can't share one
+ *
+ * Touching and flushing are thread-safe (the dirty bits are atomic); keeping writers to the
+ * same record apart is up to the caller. A record being written while a flush picks up its
+ * page can land torn on disk, so loaders should sanity-check what they read back.
+ */
+
+#define RECORD_STORE_USER_BYTES 64 // Caller's own header space, e.g. counters that must survive restarts
+
+typedef struct
+{
+  int                   fd;
+  uint8_t              *base; // Whole file, header included
+  size_t                size;
+  size_t                page_size;
+  size_t                record_size;
+  uint32_t              capacity;
+  atomic_uint_fast64_t *dirty; // One bit per page of the file
+  size_t                dirty_words;
+} RecordStore;
+
+/**
+ * @brief Open (or create) a store and map it in
+ * @note An existing file keeps its records; if it has room for fewer than capacity, it's grown
+ * @param s The store to set up
+ * @param path File to use
+ * @param magic Identifies the kind of record; a file with another magic or record size is refused, never overwritten
+ * @param record_size Size of one record
+ * @param capacity Amt. of records wanted
+ * @param created Receives whether the file was brand new (all records zero)
+ * @returns true on success; false (with a message on stderr) otherwise
+ */
+bool record_store_open(RecordStore *s, const char *path, uint64_t magic, size_t record_size, uint32_t capacity,
+                       bool *created);
+
+/**
+ * @brief Where a record lives
+ * @param s The store
+ * @param index The record
+ * @returns Its address, or NULL if index is past the capacity
+ */
+void *record_store_at(const RecordStore *s, uint32_t index);
+
+/**
+ * @brief The caller's RECORD_STORE_USER_BYTES of header space; zero in a fresh file
+ */
+void *record_store_user(const RecordStore *s);
+
+/**
+ * @brief Note that bytes in the mapping changed, so the next flush picks their pages up
+ * @param s The store
+ * @param addr Start of what changed; inside the mapping
+ * @param len Amt. of bytes that changed
+ */
+void record_store_touch(RecordStore *s, const void *addr, size_t len);
+
+/**
+ * @brief Start writing every dirty page back
+ * @note On Linux this only queues the writes (sync_file_range()); elsewhere it waits for them (msync(MS_SYNC))
+ * @param s The store
+ * @returns Amt. of pages handed to the kernel; any it refused stay dirty for the next flush
+ */
+size_t record_store_flush(RecordStore *s);
+
+/**
+ * @brief Write everything back, wait for it, and unmap
+ * @param s The store; zeroed afterwards
+ */
+void record_store_close(RecordStore *s);
+
+#endif
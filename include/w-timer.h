@@ -0,0 +1,97 @@
+#ifndef W_TIMER_H
+#define W_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * - Time moves in fixed ticks. Level 0 has one slot per tick for the next 64 ticks; every
+ *   level above covers 64 times the span of the one below, one slot per 64 of its ticks
+ * - Scheduling, rescheduling and cancelling are O(1): link/unlink in one slot's list
+ * - A timer far out sits in a coarse slot and moves down a level each time its slot comes
+ *   up ("cascading"), until it lands in level 0 and fires on its exact tick
+ * - Per-level bitmaps of non-empty slots make "when's the next thing due?" cheap, so an
+ *   event loop can sleep until exactly then instead of polling
+ *
+ * Timers are intrusive: embed a TimerNode wherever the state lives. Not thread-safe.
+ */
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 64^4 ticks; at 100ms ticks that's over 19 days
+
+typedef struct TimerNode
+{
+  struct TimerNode  *next;
+  struct TimerNode **pprev;   // Whatever points at us; NULL while not scheduled
+  uint64_t           expires; // Tick this fires on
+  uint8_t            level, slot; // Where it's linked; lets unlinking clear the slot's bit
+} TimerNode;
+
+typedef struct
+{
+  TimerNode *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  uint64_t   occupied[TIMER_WHEEL_LEVELS]; // Bit i set = slot i has timers
+  uint64_t   now_tick;                     // Last tick processed
+  int64_t    origin_ms;                    // Time of tick 0
+  uint32_t   tick_ms;
+  size_t     count; // Scheduled timers
+} TimerWheel;
+
+/**
+ * @brief Called for every timer that expires; the node is already unscheduled by then
+ * @param node The expired timer
+ * @param arg Whatever was given to timer_advance()
+ */
+typedef void (*TimerFn)(TimerNode *node, void *arg);
+
+/**
+ * @brief Set up an empty wheel
+ * @param w The wheel to initialize
+ * @param tick_ms Resolution; timers fire on the first tick at or after their deadline
+ * @param now_ms Current time, on the same clock as every later call
+ */
+void timer_wheel_init(TimerWheel *w, uint32_t tick_ms, int64_t now_ms);
+
+/**
+ * @brief Schedule a timer, or move it if it's already scheduled
+ * @param w The wheel
+ * @param node The timer
+ * @param at_ms When it should fire; anything already due fires on the next tick
+ */
+void timer_schedule(TimerWheel *w, TimerNode *node, int64_t at_ms);
+
+/**
+ * @brief Unschedule a timer; no-op if it isn't scheduled
+ * @param w The wheel
+ * @param node The timer
+ */
+void timer_cancel(TimerWheel *w, TimerNode *node);
+
+static inline bool timer_pending(const TimerNode *node)
+{
+  return node->pprev != NULL;
+}
+
+/**
+ * @brief Process every tick up to now, firing whatever expired
+ * @note The callback may schedule or cancel any timer, including the one it was called for
+ * @param w The wheel
+ * @param now_ms Current time
+ * @param fn Called once per expired timer
+ * @param arg Passed through to fn
+ */
+void timer_advance(TimerWheel *w, int64_t now_ms, TimerFn fn, void *arg);
+
+/**
+ * @brief How long until the wheel needs timer_advance() again
+ * @param w The wheel
+ * @param now_ms Current time
+ * @returns Milliseconds to wait; -1 if nothing is scheduled (wait forever), 0 if something is due already
+ */
+int timer_next_timeout(const TimerWheel *w, int64_t now_ms);
+
+#endif
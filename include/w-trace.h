@@ -0,0 +1,99 @@
+#ifndef W_TRACE_H
+#define W_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Trace points for the hot paths, dumped as Chrome trace_event JSON (opens in Perfetto or
+ * chrome://tracing).
+ *
+ * - Only built in with WALL_TRACE (cmake -DTRACING=ON); without it every TRACE_* macro is
+ *   `((void)0)` and the functions below don't exist, so call sites cost nothing at all
+ * - Each span is recorded once, when it ends, as a complete ("X") event: name, start, duration
+ * - Every thread writes into a ring of its own with plain stores; nobody else writes there, so
+ *   tracing never takes a lock. Once a ring is full, the oldest events get overwritten:
+ *   it's a flight recorder, a dump always shows the most recent TRACE_RING_EVENTS per thread
+ * - trace_request_dump() (async-signal-safe; meant for a SIGUSR1 handler) gets a background
+ *   thread to snapshot every ring into trace-<pid>-<n>.json; tracing carries on meanwhile
+ *
+ * Span names must outlive the process's tracing, i.e. be string literals.
+ */
+
+#define TRACE_RING_EVENTS 16384 // Per thread; a power of two
+
+#ifdef WALL_TRACE
+
+#include <time.h>
+
+typedef struct
+{
+  const char *name;
+  int64_t     start_ns;
+} TraceSpan;
+
+/**
+ * @brief Nanoseconds on the clock every trace timestamp uses
+ */
+static inline int64_t trace_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline TraceSpan trace_span_begin(const char *name) { return (TraceSpan){name, trace_now_ns()}; }
+
+/**
+ * @brief Close a span and record it in this thread's ring
+ * @param span What trace_span_begin() returned
+ */
+void trace_span_end(TraceSpan *span);
+
+/**
+ * @brief Name this thread in dumps, e.g. "reactor 2"
+ * @param fmt printf() format; the result is truncated to 31 bytes
+ */
+void trace_thread_name(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Start the dump thread
+ * @returns 0 on success, -1 on failure
+ */
+int trace_start(void);
+
+/**
+ * @brief Ask for a dump; returns right away
+ * @note Async-signal-safe; a no-op before trace_start() or after trace_stop()
+ */
+void trace_request_dump(void);
+
+/**
+ * @brief Stop the dump thread; safe to call even if it never started
+ */
+void trace_stop(void);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Span that ends wherever the enclosing block is left, returns included
+#define TRACE_SCOPE(name)                                                                                          \
+  TraceSpan TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(trace_span_end))) = trace_span_begin(name)
+
+// Span with explicit ends, for stretches that aren't a block of their own
+#define TRACE_BEGIN(span, name) TraceSpan span = trace_span_begin(name)
+#define TRACE_END(span) trace_span_end(&(span))
+
+#define TRACE_THREAD_NAME(...) trace_thread_name(__VA_ARGS__)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_BEGIN(span, name) ((void)0)
+#define TRACE_END(span) ((void)0)
+#define TRACE_THREAD_NAME(...) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef W_UDP_H
+#define W_UDP_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Batched datagram I/O for the UDP fast path.
+ *
+ * - On Linux, a whole batch goes through one recvmmsg()/sendmmsg(); elsewhere it falls back
+ *   to one recvfrom()/sendto() per datagram, same interface
+ * - Everything is non-blocking and best effort: a datagram the kernel can't take right now
+ *   is dropped, which is fine for state that's resent until acknowledged anyway
+ * - Any number of threads may send on the same socket at once; datagrams never interleave
+ */
+
+#define UDP_MAX_PAYLOAD 1200 // Stays under any sane path MTU, so nothing ever gets fragmented
+#define UDP_BATCH 32         // Datagrams per recvmmsg()/sendmmsg()
+
+typedef struct
+{
+  struct sockaddr_in addr; // Source for received datagrams, destination for sent ones
+  size_t             len;
+  uint8_t            data[UDP_MAX_PAYLOAD];
+} Datagram;
+
+/**
+ * @brief Open a non-blocking UDP socket
+ * @param bind_ip IPv4 address to bind to, dotted; "0.0.0.0" for every interface
+ * @param port Port to bind to, host order
+ * @returns The socket, or -1 on failure
+ */
+int udp_open(const char *bind_ip, uint16_t port);
+
+/**
+ * @brief Receive whatever datagrams are waiting, up to a batch
+ * @param fd The UDP socket
+ * @param out Receives the datagrams; anything cut off at UDP_MAX_PAYLOAD keeps only that much
+ * @param max Room in out
+ * @returns Amt. of datagrams received; 0 once the socket is drained
+ */
+size_t udp_recv_batch(int fd, Datagram *out, size_t max);
+
+/**
+ * @brief Send a batch of datagrams
+ * @param fd The UDP socket
+ * @param msgs The datagrams
+ * @param count Amt. of datagrams
+ * @returns Amt. actually handed to the kernel; the rest were dropped
+ */
+size_t udp_send_batch(int fd, const Datagram *msgs, size_t count);
+
+#endif
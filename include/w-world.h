@@ -0,0 +1,89 @@
+#ifndef W_WORLD_H
+#define W_WORLD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * World state history, for delta-compressed broadcasts.
+ *
+ * - Every world tick, world_capture() copies each connected player's (id, x, y) into a
+ *   frame, grouped by spatial grid cell; the last WORLD_HISTORY frames are kept around
+ * - A client only sees players in its own grid cell and the 8 around it; see w-grid.h
+ * - A client's baseline is the last tick it was sent; world_encode_delta() diffs what it
+ *   sees now against what it saw then, so only changes nearby cost bytes, and the work is
+ *   proportional to how many players are near it, not to how many there are in total
+ * - Walking out of someone's view reads as WORLD_GONE, walking into it as WORLD_APPEARED
+ * - Clients standing in the same cell with the same baseline get the exact same bytes;
+ *   WorldView is what to key a cache of encodings by
+ * - A baseline that fell out of the history gets a keyframe instead: a delta against the
+ *   empty world (base tick 0)
+ *
+ * Positions are whole pixels; that IS the quantization, no float ever hits the wire.
+ *
+ * Body encoding, one entry per player that changed:
+ *
+ * KEY  varint  player_id << 2 | kind
+ * DX   zigzag varint  (WORLD_MOVED: delta from the baseline; WORLD_APPEARED: absolute)
+ * DY   zigzag varint  (same; neither is present for WORLD_GONE)
+ *
+ * Varints are LEB128: 7 bits a byte, low bits first, high bit set on every byte but the last.
+ *
+ * Thread-safe; frames are behind their own rwlock, taken before g_players_lock.
+ */
+
+#define WORLD_HISTORY 32 // Frames kept as potential baselines; at 50ms ticks that's 1.6s of lag tolerated
+
+enum
+{
+  WORLD_MOVED    = 0,
+  WORLD_APPEARED = 1,
+  WORLD_GONE     = 2
+};
+
+// Everything a delta depends on, apart from the tick itself
+typedef struct
+{
+  uint32_t base_tick; // 0 = keyframe
+  uint32_t base_cell; // Where the viewer stood at base_tick; meaningless for keyframes
+  uint32_t cell;      // Where the viewer stands now
+} WorldView;
+
+/**
+ * @brief Record the world as it is right now as the frame for a tick
+ * @note No-op if this tick (or a later one) was captured already; reactors all call this on
+ * their own world tick and only the first one through does the work
+ * @param tick The tick being captured; never 0, that's reserved for the empty world
+ * @returns true if this call captured a frame that differs from the previous one
+ */
+bool world_capture(uint32_t tick);
+
+/**
+ * @brief Work out what a client sees at a tick, and what it's diffed against
+ * @param tick A tick passed to world_capture() before
+ * @param base_tick The client's baseline; becomes a keyframe if it's gone from the history
+ * @param viewer_slot The client's own player's slot
+ * @param viewer_id The client's own player's ID; catches the slot having changed hands
+ * @param view Receives the view
+ * @returns false if tick is gone from the history, or the viewer isn't connected in it
+ */
+bool world_view(uint32_t tick, uint32_t base_tick, uint32_t viewer_slot, uint32_t viewer_id, WorldView *view);
+
+/**
+ * @brief Encode what changed nearby between a view's baseline and a tick
+ * @param tick The tick world_view() was asked about
+ * @param view From world_view()
+ * @param out Where the body goes
+ * @param cap Room in out
+ * @param len Receives the body's length; 0 if nothing changed
+ * @returns true on success, false if a frame left the history meanwhile or the body doesn't fit in cap
+ */
+bool world_encode_delta(uint32_t tick, const WorldView *view, uint8_t *out, size_t cap, size_t *len);
+
+/**
+ * @brief Free the history; only once no network thread is left
+ */
+void world_free(void);
+
+#endif
@@ -0,0 +1,385 @@
+// ==============================================================================
+// INCLUDES
+// ==============================================================================
+
+#include "w-helper.h"
+#include "w-pixel.h"
+#include "w-player.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Micro-benchmarks for the hot primitives, as JSON on stdout:
+ *
+ * - recvall()/sendall() over a socketpair, at a few chunk sizes
+ * - set_player_avatar() for each channel count it converts from
+ * - find_player_by_ip() and ensure_player() (returning player) at table sizes up to 64k
+ *
+ * Every case runs for at least BENCH_MIN_MS (a tenth of that with --quick) after a warm-up,
+ * scaling its iteration count up until it does, so numbers are comparable between runs and
+ * machines of the same kind. Diff two outputs to catch a regression; nothing here asserts.
+ */
+
+// ==============================================================================
+// CONFIGURATION
+// ==============================================================================
+
+#define BENCH_MIN_MS 200
+#define BENCH_MAX_TABLE 65536
+#define BENCH_IP_BASE 0x0A000000u // 10.0.0.0; every player gets the next address up
+
+static const size_t   k_chunk_sizes[] = {64, 1024, 16384, 262144};
+static const uint32_t k_channels[]    = {GRAYSCALE_CHANNEL_COUNT, RGB_CHANNEL_COUNT, RGBA_CHANNEL_COUNT};
+static const size_t   k_table_sizes[] = {32, 256, 2048, 16384, BENCH_MAX_TABLE};
+
+// ==============================================================================
+// HARNESS
+// ==============================================================================
+
+typedef void (*BenchFn)(void *arg, uint64_t iterations);
+
+static int64_t g_min_ns = (int64_t)BENCH_MIN_MS * 1000000;
+static bool    g_first  = true; // Nothing printed yet; decides where commas go
+
+static int64_t monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief Run fn with more and more iterations until one run takes long enough to trust
+ * @param iterations Receives the iteration count of the run that counted
+ * @returns Nanoseconds that run took
+ */
+static int64_t bench_run(BenchFn fn, void *arg, uint64_t *iterations)
+{
+  uint64_t n = 1;
+
+  fn(arg, 1); // Warm-up: page faults, lazy init, cold caches
+
+  for (;;)
+  {
+    int64_t start   = monotonic_ns();
+    fn(arg, n);
+    int64_t elapsed = monotonic_ns() - start;
+
+    if (elapsed >= g_min_ns || n >= (UINT64_C(1) << 40))
+    {
+      *iterations = n;
+
+      return elapsed;
+    }
+
+    // Aim straight for the target instead of doubling all the way there
+    uint64_t next = elapsed > 0 ? (uint64_t)((double)n * (double)g_min_ns * 1.2 / (double)elapsed) : n * 100;
+
+    n = next > n * 100 ? n * 100 : next > n ? next : n * 2;
+  }
+}
+
+/**
+ * @brief Print one result as a JSON object inside the "results" array
+ * @param name Which primitive
+ * @param param_name What's being varied; NULL if nothing is
+ * @param param Its value
+ * @param bytes_per_op Bytes each iteration moves; 0 to leave out throughput
+ */
+static void bench_report(const char *name, const char *param_name, uint64_t param, uint64_t iterations,
+                         int64_t elapsed, uint64_t bytes_per_op)
+{
+  double ns_per_op = (double)elapsed / (double)iterations;
+
+  printf("%s\n    {\"name\": \"%s\"", g_first ? "" : ",", name);
+
+  if (param_name)
+  {
+    printf(", \"%s\": %llu", param_name, (unsigned long long)param);
+  }
+
+  printf(", \"iterations\": %llu, \"ns_per_op\": %.2f", (unsigned long long)iterations, ns_per_op);
+
+  if (bytes_per_op)
+  {
+    printf(", \"mb_per_s\": %.1f", (double)bytes_per_op * 1e3 / ns_per_op);
+  }
+
+  printf("}");
+  fflush(stdout);
+
+  g_first = false;
+}
+
+// ==============================================================================
+// RECVALL / SENDALL
+// ==============================================================================
+
+typedef struct
+{
+  int      fds[2];
+  size_t   chunk;
+  uint8_t *tx, *rx;
+} SocketCase;
+
+typedef struct
+{
+  SocketCase *sc;
+  uint64_t    iterations;
+} Sender;
+
+static void *sender_main(void *arg)
+{
+  Sender *s = (Sender *)arg;
+
+  for (uint64_t i = 0; i < s->iterations; ++i)
+  {
+    if (sendall(s->sc->fds[0], s->sc->tx, s->sc->chunk) < 0)
+    {
+      break;
+    }
+  }
+
+  return NULL;
+}
+
+// One iteration = one chunk through sendall() on one thread and recvall() on this one
+static void bench_socketpair(void *arg, uint64_t iterations)
+{
+  SocketCase *sc = (SocketCase *)arg;
+  Sender      s  = {sc, iterations};
+  pthread_t   t;
+
+  pthread_create(&t, NULL, sender_main, &s);
+
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    if (recvall(sc->fds[1], sc->rx, sc->chunk) <= 0)
+    {
+      break;
+    }
+  }
+
+  pthread_join(t, NULL);
+}
+
+static void run_socket_benches(void)
+{
+  for (size_t i = 0; i < sizeof k_chunk_sizes / sizeof *k_chunk_sizes; ++i)
+  {
+    SocketCase sc = {.chunk = k_chunk_sizes[i]};
+
+    sc.tx = (uint8_t *)calloc(1, sc.chunk);
+    sc.rx = (uint8_t *)malloc(sc.chunk);
+
+    if (!sc.tx || !sc.rx || socketpair(AF_UNIX, SOCK_STREAM, 0, sc.fds) < 0)
+    {
+      perror("bench: socketpair");
+      exit(1);
+    }
+
+    uint64_t iterations;
+    int64_t  elapsed = bench_run(bench_socketpair, &sc, &iterations);
+
+    bench_report("sendall_recvall", "chunk_bytes", sc.chunk, iterations, elapsed, sc.chunk);
+
+    close(sc.fds[0]);
+    close(sc.fds[1]);
+    free(sc.tx);
+    free(sc.rx);
+  }
+}
+
+// ==============================================================================
+// AVATARS
+// ==============================================================================
+
+typedef struct
+{
+  Player  *player;
+  uint8_t  pixels[MAX_AVATAR_BYTES];
+  uint32_t channels;
+} AvatarCase;
+
+static void bench_avatar(void *arg, uint64_t iterations)
+{
+  AvatarCase *ac = (AvatarCase *)arg;
+
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    set_player_avatar(ac->player, ac->pixels, MAX_AVATAR_W, MAX_AVATAR_H, (uint8_t)ac->channels);
+  }
+}
+
+static void run_avatar_benches(void)
+{
+  AvatarCase ac;
+
+  // Somebody outside the range the table benchmarks use
+  ac.player = ensure_player(htonl(BENCH_IP_BASE - 1));
+
+  if (!ac.player)
+  {
+    fprintf(stderr, "bench: can't create a player\n");
+    exit(1);
+  }
+
+  for (size_t i = 0; i < sizeof ac.pixels; ++i)
+  {
+    ac.pixels[i] = (uint8_t)(i * 31);
+  }
+
+  for (size_t i = 0; i < sizeof k_channels / sizeof *k_channels; ++i)
+  {
+    ac.channels = k_channels[i];
+
+    uint64_t iterations;
+    int64_t  elapsed = bench_run(bench_avatar, &ac, &iterations);
+
+    bench_report("set_player_avatar", "channels", ac.channels, iterations, elapsed,
+                 (uint64_t)MAX_AVATAR_W * MAX_AVATAR_H * ac.channels);
+  }
+}
+
+// ==============================================================================
+// PLAYER TABLE
+// ==============================================================================
+
+typedef struct
+{
+  uint32_t *ips; // Shuffled, so lookups don't walk the index in insertion order
+  size_t    count;
+} TableCase;
+
+static void bench_find(void *arg, uint64_t iterations)
+{
+  TableCase        *tc   = (TableCase *)arg;
+  volatile uint32_t sink = 0; // Keeps the lookups from being optimized away
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    Player *p = find_player_by_ip(tc->ips[i % tc->count]);
+
+    sink += p ? p->slot : 0;
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  (void)sink;
+}
+
+static void bench_ensure(void *arg, uint64_t iterations)
+{
+  TableCase *tc = (TableCase *)arg;
+
+  for (uint64_t i = 0; i < iterations; ++i)
+  {
+    ensure_player(tc->ips[i % tc->count]);
+  }
+}
+
+static void run_table_benches(void)
+{
+  TableCase tc;
+  uint64_t  rng = 0x9E3779B97F4A7C15ull;
+
+  tc.ips   = (uint32_t *)malloc(BENCH_MAX_TABLE * sizeof *tc.ips);
+  tc.count = 0;
+
+  if (!tc.ips)
+  {
+    perror("bench: malloc");
+    exit(1);
+  }
+
+  set_player_capacity(0);
+
+  // The table only ever grows, so each size builds on the one before
+  for (size_t s = 0; s < sizeof k_table_sizes / sizeof *k_table_sizes; ++s)
+  {
+    size_t  target = k_table_sizes[s];
+    int64_t start  = monotonic_ns();
+
+    for (; tc.count < target; ++tc.count)
+    {
+      uint32_t ip = htonl(BENCH_IP_BASE + (uint32_t)tc.count);
+
+      if (!ensure_player(ip))
+      {
+        fprintf(stderr, "bench: table full at %zu\n", tc.count);
+        exit(1);
+      }
+
+      // Insert at a random spot among those so far; keeps the array a uniform shuffle
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+
+      size_t j = (size_t)(rng % (tc.count + 1));
+
+      tc.ips[tc.count] = tc.ips[j];
+      tc.ips[j]        = ip;
+    }
+
+    size_t added = target - (s > 0 ? k_table_sizes[s - 1] : 0);
+
+    bench_report("ensure_player_new", "table_size", target, added, monotonic_ns() - start, 0);
+
+    uint64_t iterations;
+    int64_t  elapsed = bench_run(bench_find, &tc, &iterations);
+
+    bench_report("find_player_by_ip", "table_size", target, iterations, elapsed, 0);
+
+    elapsed = bench_run(bench_ensure, &tc, &iterations);
+
+    bench_report("ensure_player_existing", "table_size", target, iterations, elapsed, 0);
+  }
+
+  free(tc.ips);
+}
+
+// ==============================================================================
+// MAIN
+// ==============================================================================
+
+int main(int argc, char *argv[])
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--quick") == 0)
+    {
+      g_min_ns /= 10;
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [--quick]\n", argv[0]);
+
+      return 1;
+    }
+  }
+
+  printf("{\n  \"pixel_kernels\": \"%s\",\n  \"min_ms\": %lld,\n  \"results\": [",
+         pixel_kernel_isa(),
+         (long long)(g_min_ns / 1000000));
+
+  run_socket_benches();
+  run_avatar_benches();
+  run_table_benches();
+
+  printf("\n  ]\n}\n");
+
+  return 0;
+}
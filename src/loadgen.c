@@ -0,0 +1,950 @@
+// ==============================================================================
+// INCLUDES
+// ==============================================================================
+
+#include "w-event.h"
+#include "w-hash.h"
+#include "w-helper.h"
+#include "w-proto.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Load generator: lots of concurrent clients hammering REGISTER, timing every ACK.
+ *
+ * - Every connection sends one REGISTER, waits for its ACK, then sends the next one (or, with
+ *   --reconnect, closes and does it all again on a fresh connection, accept() included)
+ * - --resume makes reconnects send a RESUME for the player the last ACK named instead, falling
+ *   back to a full REGISTER on the same connection if the server doesn't know them any more
+ * - A REDIRECT from a cluster node sends that client to the node it names, from then on
+ * - Latency is measured from the first byte of a frame going out to the last byte of its ACK
+ *   coming in, so it's what a client would see: queueing in the server included
+ * - The server keys players by source IP; on loopback, --sources spreads the connections over
+ *   that many addresses in 127.0.0.0/8 so they register as different players
+ * - Single thread, one event loop; the server should run out of steam long before this does
+ */
+
+// ==============================================================================
+// CONFIGURATION
+// ==============================================================================
+
+#define LG_MAX_EVENTS 256
+#define LG_RECV_CHUNK 65536
+#define LG_MAX_SAMPLES (1u << 22) // Latencies kept for percentiles; past that, a uniform reservoir of them
+#define LG_REPORT_MS 1000         // How often progress goes to stderr
+#define LG_WAIT_MS 100
+#define MAX_AVATAR_SIDE 8
+
+// ==============================================================================
+// OUR PROTOCOL
+// ==============================================================================
+
+// Opcodes and frame sizes are in w-proto.h
+#define REPLY_MAX_FIXED (REDIRECT_HEADER_BYTES + UINT8_MAX) // A REDIRECT is kept whole, host and all
+
+// ==============================================================================
+// STATE
+// ==============================================================================
+
+typedef struct
+{
+  const char *host;
+  uint16_t    port;
+  size_t      conns;
+  uint64_t    total; // Registrations to do; 0 = run for duration_ms instead
+  int64_t     duration_ms;
+  uint32_t    tag_len;
+  uint32_t    width, height, channels;
+  uint32_t    sources; // Source addresses to spread over; 0 = let the kernel pick
+  bool        reconnect;
+  bool        resume; // Reconnects RESUME instead of REGISTERing again
+} Options;
+
+typedef enum
+{
+  CL_CONNECTING,
+  CL_SENDING,
+  CL_WAITING
+} ClientState;
+
+typedef struct
+{
+  int         fd;
+  uint32_t    index;
+  ClientState state;
+  size_t      sent;       // Bytes of the frame out so far
+  int64_t     started_ns; // When the frame's first byte went out
+
+  // What's going out; g_frame, or resume below
+  const uint8_t *out;
+  size_t         out_len;
+
+  // RESUME for the player the last ACK named; only valid once one has come in
+  uint8_t resume[RESUME_BYTES];
+  bool    resumable;
+
+  struct sockaddr_in server; // Where this client registers; g_server until a REDIRECT says otherwise
+
+  // Reply parser; only fixed-size parts are kept, WORLD bodies are skipped
+  uint8_t reply[REPLY_MAX_FIXED];
+  size_t  reply_have;
+  size_t  reply_want;
+  size_t  skip;
+} Client;
+
+typedef struct
+{
+  uint64_t *samples; // Nanoseconds
+  size_t    count;
+  size_t    cap;
+  uint64_t  seen;
+  uint64_t  rng;
+} Latencies;
+
+static volatile sig_atomic_t g_stop = 0;
+
+static Options            g_opt;
+static EventLoop         *g_loop;
+static uint8_t           *g_frame; // The one REGISTER frame everybody sends
+static size_t             g_frame_len;
+static uint64_t           g_avatar_hash; // Of that frame's avatar, as the server keeps it
+static struct sockaddr_in g_server;
+
+static uint64_t  g_done;          // ACKs received
+static uint64_t  g_connect_fails; // connect()s that didn't work out
+static uint64_t  g_drops;         // Server closed on us before the ACK
+static uint64_t  g_busy;          // Server turned the connection away with BUSY
+static uint64_t  g_resumed;       // ACKs that answered a RESUME
+static uint64_t  g_resume_misses; // RESUMEs the server didn't take
+static uint64_t  g_redirects;     // Sent to another cluster node
+static Latencies g_lat;
+
+// ==============================================================================
+// HELPERS
+// ==============================================================================
+
+static int64_t monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+  uint64_t x = *s;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+
+  return *s = x;
+}
+
+/**
+ * @brief Keep a latency sample; once the buffer is full, it's a reservoir, so percentiles stay unbiased
+ */
+static void latency_record(Latencies *l, uint64_t ns)
+{
+  l->seen++;
+
+  if (l->count < l->cap)
+  {
+    l->samples[l->count++] = ns;
+
+    return;
+  }
+
+  uint64_t j = xorshift64(&l->rng) % l->seen;
+
+  if (j < l->cap)
+  {
+    l->samples[j] = ns;
+  }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest-rank percentile; samples must be sorted
+ */
+static double percentile_us(const Latencies *l, double p)
+{
+  if (l->count == 0)
+  {
+    return 0.0;
+  }
+
+  size_t rank = (size_t)(p * (double)l->count);
+
+  if (rank >= l->count)
+  {
+    rank = l->count - 1;
+  }
+
+  return (double)l->samples[rank] / 1000.0;
+}
+
+/**
+ * @brief Work out the AVATAR_HASH a RESUME carries: the avatar widened to RGBA, like the server does
+ * @param pixels The avatar as it goes out in the REGISTER frame
+ * @returns false if out of memory
+ */
+static bool hash_avatar(const uint8_t *pixels)
+{
+  size_t   count = (size_t)g_opt.width * g_opt.height;
+  uint8_t *rgba  = (uint8_t *)malloc(count * 4);
+
+  if (!rgba)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    const uint8_t *src = pixels + i * g_opt.channels;
+    uint8_t       *dst = rgba + i * 4;
+
+    dst[0] = src[0];
+    dst[1] = g_opt.channels == 1 ? src[0] : src[1];
+    dst[2] = g_opt.channels == 1 ? src[0] : src[2];
+    dst[3] = g_opt.channels == 4 ? src[3] : 255;
+  }
+
+  g_avatar_hash = xxh64(rgba, count * 4, (uint64_t)g_opt.width << 32 | g_opt.height);
+  free(rgba);
+
+  return true;
+}
+
+/**
+ * @brief Build the one REGISTER frame every client sends
+ * @returns false if out of memory
+ */
+static bool build_frame(void)
+{
+  uint32_t size = g_opt.width * g_opt.height * g_opt.channels;
+
+  g_frame_len = REG_HEADER_BYTES + g_opt.tag_len + size;
+  g_frame     = (uint8_t *)malloc(g_frame_len);
+
+  if (!g_frame)
+  {
+    return false;
+  }
+
+  uint16_t be_tag_len = htons((uint16_t)g_opt.tag_len);
+  uint32_t be_w       = htonl(g_opt.width);
+  uint32_t be_h       = htonl(g_opt.height);
+  uint32_t be_size    = htonl(size);
+
+  g_frame[0] = OPC_REGISTER;
+  memcpy(g_frame + 1, &be_tag_len, 2);
+  memcpy(g_frame + 3, &be_w, 4);
+  memcpy(g_frame + 7, &be_h, 4);
+  memcpy(g_frame + 11, &be_size, 4);
+  g_frame[15] = (uint8_t)g_opt.channels;
+
+  for (uint32_t i = 0; i < g_opt.tag_len; ++i)
+  {
+    g_frame[REG_HEADER_BYTES + i] = (uint8_t)('a' + i % 26);
+  }
+
+  for (uint32_t i = 0; i < size; ++i)
+  {
+    g_frame[REG_HEADER_BYTES + g_opt.tag_len + i] = (uint8_t)(i * 37);
+  }
+
+  return hash_avatar(g_frame + REG_HEADER_BYTES + g_opt.tag_len);
+}
+
+// ==============================================================================
+// CLIENTS
+// ==============================================================================
+
+/**
+ * @brief Open a fresh connection for a client and start connecting
+ * @returns false if not even the socket could be set up (counted as a connect failure)
+ */
+static bool client_connect(Client *c)
+{
+  c->fd         = socket(AF_INET, SOCK_STREAM, 0);
+  c->state      = CL_CONNECTING;
+  c->sent       = 0;
+  c->reply_have = 0;
+  c->skip       = 0;
+
+  if (c->fd < 0)
+  {
+    g_connect_fails++;
+
+    return false;
+  }
+
+  // Same as the server: frames go out whole already, Nagle would just sit on them
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+  if (g_opt.sources)
+  {
+    struct sockaddr_in src = {0};
+
+    src.sin_family      = AF_INET;
+    src.sin_addr.s_addr = htonl(0x7F000001u + c->index % g_opt.sources);
+
+    if (bind(c->fd, (struct sockaddr *)&src, sizeof src) < 0)
+    {
+      perror("loadgen: bind");
+      close(c->fd);
+      c->fd = -1;
+      g_connect_fails++;
+
+      return false;
+    }
+  }
+
+  if (set_nonblocking(c->fd) < 0 ||
+      (connect(c->fd, (struct sockaddr *)&c->server, sizeof c->server) < 0 && errno != EINPROGRESS) ||
+      evloop_add(g_loop, c->fd, EVT_WRITE, c) < 0)
+  {
+    close(c->fd);
+    c->fd = -1;
+    g_connect_fails++;
+
+    return false;
+  }
+
+  return true;
+}
+
+static void client_close(Client *c)
+{
+  if (c->fd >= 0)
+  {
+    evloop_del(g_loop, c->fd);
+    close(c->fd);
+    c->fd = -1;
+  }
+}
+
+/**
+ * @brief Start over on a new connection; used on drops and with --reconnect
+ */
+static void client_restart(Client *c)
+{
+  client_close(c);
+
+  if (!g_stop)
+  {
+    client_connect(c);
+  }
+}
+
+/**
+ * @brief Push out as much of the frame as the socket takes
+ */
+static void client_send(Client *c)
+{
+  if (c->state != CL_SENDING)
+  {
+    bool resuming = g_opt.resume && c->resumable;
+
+    c->state      = CL_SENDING;
+    c->sent       = 0;
+    c->started_ns = monotonic_ns();
+    c->out        = resuming ? c->resume : g_frame;
+    c->out_len    = resuming ? sizeof c->resume : g_frame_len;
+  }
+
+  while (c->sent < c->out_len)
+  {
+    ssize_t n = send(c->fd, c->out + c->sent, c->out_len - c->sent, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      evloop_mod(g_loop, c->fd, EVT_READ | EVT_WRITE, c);
+
+      return;
+    }
+
+    if (n <= 0)
+    {
+      g_drops++;
+      client_restart(c);
+
+      return;
+    }
+
+    c->sent += (size_t)n;
+  }
+
+  c->state = CL_WAITING;
+  evloop_mod(g_loop, c->fd, EVT_READ, c);
+}
+
+/**
+ * @brief An ACK is in; that's one registration done
+ */
+static void client_on_ack(Client *c)
+{
+  latency_record(&g_lat, (uint64_t)(monotonic_ns() - c->started_ns));
+  g_done++;
+
+  if (c->out == c->resume)
+  {
+    g_resumed++;
+  }
+
+  // The ACK names the player right after its opcode; that's who the next reconnect resumes
+  if (g_opt.resume)
+  {
+    uint64_t hash = g_avatar_hash;
+
+    c->resume[0] = OPC_RESUME;
+    memcpy(c->resume + 1, c->reply + 1, sizeof(uint32_t));
+
+    for (int i = 12; i >= 5; --i)
+    {
+      c->resume[i] = (uint8_t)hash;
+      hash >>= 8;
+    }
+
+    c->resumable = true;
+  }
+
+  if (g_opt.total && g_done >= g_opt.total)
+  {
+    g_stop = 1;
+
+    return;
+  }
+
+  if (g_opt.reconnect)
+  {
+    client_restart(c);
+  }
+  else
+  {
+    client_send(c);
+  }
+}
+
+/**
+ * @brief Follow a REDIRECT: that node owns this client's player, so it goes there from now on
+ * @note Only IPv4 hosts; anything else is reported and the client keeps trying where it was
+ */
+static void client_redirect(Client *c)
+{
+  char     host[UINT8_MAX + 1];
+  uint16_t be_port;
+  size_t   host_len = c->reply[3];
+
+  memcpy(&be_port, c->reply + 1, sizeof be_port);
+  memcpy(host, c->reply + REDIRECT_HEADER_BYTES, host_len);
+  host[host_len] = '\0';
+
+  struct sockaddr_in to = {.sin_family = AF_INET, .sin_port = be_port};
+
+  if (inet_pton(AF_INET, host, &to.sin_addr) == 1)
+  {
+    c->server = to;
+  }
+  else
+  {
+    fprintf(stderr, "loadgen: can't follow a redirect to %s\n", host);
+  }
+
+  // Whatever the old node knew about us doesn't count over there
+  g_redirects++;
+  c->resumable = false;
+  client_restart(c);
+}
+
+/**
+ * @brief How long a reply is before any variable-size body, by its opcode
+ * @returns 0 for anything we don't expect to ever hear
+ */
+static size_t reply_fixed_bytes(uint8_t opcode)
+{
+  switch (opcode)
+  {
+  case OPC_ACK:
+    return ACK_BYTES;
+  case OPC_ACK_UDP:
+    return ACK_UDP_BYTES;
+  case OPC_WORLD:
+    return WORLD_HEADER_BYTES;
+  case OPC_BUSY:
+    return BUSY_BYTES;
+  case OPC_REDIRECT:
+    return REDIRECT_HEADER_BYTES;
+  case OPC_HEARTBEAT:
+  case OPC_RESUME_FAIL:
+  case OPC_SHUTDOWN:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Run received bytes through the reply parser
+ * @returns false if the connection is done for (shutdown, garbage, or restarted from in here)
+ */
+static bool client_feed(Client *c, const uint8_t *data, size_t len)
+{
+  while (len > 0)
+  {
+    if (c->skip > 0)
+    {
+      size_t take = len < c->skip ? len : c->skip;
+
+      c->skip -= take;
+      data += take;
+      len -= take;
+      continue;
+    }
+
+    if (c->reply_have == 0 && !(c->reply_want = reply_fixed_bytes(data[0])))
+    {
+      fprintf(stderr, "loadgen: unexpected opcode 0x%02x\n", data[0]);
+
+      return false;
+    }
+
+    size_t take = c->reply_want - c->reply_have;
+
+    if (take > len)
+    {
+      take = len;
+    }
+
+    memcpy(c->reply + c->reply_have, data, take);
+    c->reply_have += take;
+    data += take;
+    len -= take;
+
+    if (c->reply_have < c->reply_want)
+    {
+      break;
+    }
+
+    // The host comes after the fixed part; keep going until it's in too
+    if (c->reply[0] == OPC_REDIRECT && c->reply_want == REDIRECT_HEADER_BYTES && c->reply[3] > 0)
+    {
+      c->reply_want += c->reply[3];
+      continue;
+    }
+
+    c->reply_have = 0;
+
+    switch (c->reply[0])
+    {
+    case OPC_ACK:
+    case OPC_ACK_UDP:
+      client_on_ack(c);
+
+      // A reconnect swapped the socket out from under us; whatever's left belonged to the old one
+      if (g_stop || c->state == CL_CONNECTING)
+      {
+        return false;
+      }
+      break;
+    case OPC_WORLD:
+    {
+      uint16_t be_len;
+
+      memcpy(&be_len, c->reply + WORLD_LEN_OFFSET, sizeof be_len);
+      c->skip = ntohs(be_len);
+      break;
+    }
+    case OPC_BUSY:
+      // Not backing off on purpose; the point is to see how the server holds up, and it closes on us anyway
+      g_busy++;
+      client_restart(c);
+
+      return false;
+    case OPC_RESUME_FAIL:
+      // Forgotten (evicted, restarted without a store); REGISTER on the same connection, same clock
+      g_resume_misses++;
+      c->resumable = false;
+      c->out       = g_frame;
+      c->out_len   = g_frame_len;
+      c->state     = CL_SENDING;
+      c->sent      = 0;
+      client_send(c);
+
+      if (c->state == CL_CONNECTING)
+      {
+        return false;
+      }
+      break;
+    case OPC_REDIRECT:
+      client_redirect(c);
+
+      return false;
+    case OPC_SHUTDOWN:
+      fprintf(stderr, "loadgen: server is shutting down\n");
+      g_stop = 1;
+
+      return false;
+    default:
+      break;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief Read everything the socket has
+ */
+static void client_read(Client *c)
+{
+  static uint8_t chunk[LG_RECV_CHUNK];
+
+  for (;;)
+  {
+    ssize_t n = recv(c->fd, chunk, sizeof chunk, 0);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return;
+    }
+
+    // Closed (or broken) before our ACK; registration failed, server full, or it went away
+    if (n <= 0)
+    {
+      g_drops++;
+      client_restart(c);
+
+      return;
+    }
+
+    if (!client_feed(c, chunk, (size_t)n))
+    {
+      return;
+    }
+  }
+}
+
+static void client_on_event(Client *c, uint32_t events)
+{
+  if (c->state == CL_CONNECTING)
+  {
+    int       err = 0;
+    socklen_t len = sizeof err;
+
+    if ((events & EVT_ERR) || getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+    {
+      g_connect_fails++;
+      client_restart(c);
+
+      return;
+    }
+
+    client_send(c);
+
+    return;
+  }
+
+  if ((events & EVT_WRITE) && c->state == CL_SENDING)
+  {
+    client_send(c);
+
+    if (c->state == CL_CONNECTING)
+    {
+      return;
+    }
+  }
+
+  if (events & (EVT_READ | EVT_HUP | EVT_ERR))
+  {
+    client_read(c);
+  }
+}
+
+// ==============================================================================
+// MAIN
+// ==============================================================================
+
+static void on_signal(int sig)
+{
+  (void)sig;
+
+  g_stop = 1;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s <host> <port> [-c conns] [-n registrations | -d seconds] [--tag-len N]\n"
+          "          [--width N] [--height N] [--channels 1|3|4] [--sources N] [--reconnect]\n"
+          "          [--resume]\n",
+          prog);
+}
+
+/**
+ * @brief Parse a numeric option, with bounds
+ * @returns false if it isn't a number in [lo, hi]
+ */
+static bool parse_u64(const char *s, uint64_t lo, uint64_t hi, uint64_t *out)
+{
+  char              *end;
+  unsigned long long v = strtoull(s, &end, 10);
+
+  if (*s == '\0' || *end != '\0' || v < lo || v > hi)
+  {
+    return false;
+  }
+
+  *out = v;
+
+  return true;
+}
+
+static bool parse_args(int argc, char *argv[])
+{
+  if (argc < 3)
+  {
+    return false;
+  }
+
+  uint64_t v;
+
+  g_opt.host        = argv[1];
+  g_opt.conns       = 100;
+  g_opt.duration_ms = 10000;
+  g_opt.tag_len     = 8;
+  g_opt.width       = MAX_AVATAR_SIDE;
+  g_opt.height      = MAX_AVATAR_SIDE;
+  g_opt.channels    = 4;
+
+  if (!parse_u64(argv[2], 1, UINT16_MAX, &v))
+  {
+    return false;
+  }
+
+  g_opt.port = (uint16_t)v;
+
+  for (int i = 3; i < argc; ++i)
+  {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : "";
+
+    if (strcmp(arg, "--reconnect") == 0)
+    {
+      g_opt.reconnect = true;
+      continue;
+    }
+
+    if (strcmp(arg, "--resume") == 0)
+    {
+      g_opt.resume = true;
+      continue;
+    }
+
+    i++;
+
+    if (strcmp(arg, "-c") == 0 && parse_u64(val, 1, 1000000, &v))
+    {
+      g_opt.conns = (size_t)v;
+    }
+    else if (strcmp(arg, "-n") == 0 && parse_u64(val, 1, UINT64_MAX, &v))
+    {
+      g_opt.total = v;
+    }
+    else if (strcmp(arg, "-d") == 0 && parse_u64(val, 1, 86400, &v))
+    {
+      g_opt.duration_ms = (int64_t)v * 1000;
+    }
+    else if (strcmp(arg, "--tag-len") == 0 && parse_u64(val, 0, MAX_STR_LEN - 1, &v))
+    {
+      g_opt.tag_len = (uint32_t)v;
+    }
+    else if (strcmp(arg, "--width") == 0 && parse_u64(val, 1, MAX_AVATAR_SIDE, &v))
+    {
+      g_opt.width = (uint32_t)v;
+    }
+    else if (strcmp(arg, "--height") == 0 && parse_u64(val, 1, MAX_AVATAR_SIDE, &v))
+    {
+      g_opt.height = (uint32_t)v;
+    }
+    else if (strcmp(arg, "--channels") == 0 && parse_u64(val, 1, 4, &v) && v != 2)
+    {
+      g_opt.channels = (uint32_t)v;
+    }
+    else if (strcmp(arg, "--sources") == 0 && parse_u64(val, 0, 1u << 24, &v))
+    {
+      g_opt.sources = (uint32_t)v;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  if (!parse_args(argc, argv))
+  {
+    usage(argv[0]);
+
+    return 1;
+  }
+
+  g_server.sin_family = AF_INET;
+  g_server.sin_port   = htons(g_opt.port);
+
+  if (inet_pton(AF_INET, g_opt.host, &g_server.sin_addr) != 1)
+  {
+    fprintf(stderr, "loadgen: bad host address %s\n", g_opt.host);
+
+    return 1;
+  }
+
+  g_lat.cap     = LG_MAX_SAMPLES;
+  g_lat.samples = (uint64_t *)malloc(g_lat.cap * sizeof *g_lat.samples);
+  g_lat.rng     = (uint64_t)monotonic_ns() | 1;
+
+  Client *clients = (Client *)calloc(g_opt.conns, sizeof *clients);
+
+  if (!g_lat.samples || !clients || !build_frame() || !(g_loop = evloop_create()))
+  {
+    perror("loadgen: setup");
+
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  printf("loadgen: %zu connection(s) to %s:%u, %zu byte frames (tag %u, %ux%u x%u), %s\n",
+         g_opt.conns,
+         g_opt.host,
+         g_opt.port,
+         g_frame_len,
+         g_opt.tag_len,
+         g_opt.width,
+         g_opt.height,
+         g_opt.channels,
+         g_opt.reconnect ? (g_opt.resume ? "reconnecting and resuming" : "reconnecting every time")
+                         : "reusing connections");
+
+  int64_t  start_ns    = monotonic_ns();
+  int64_t  deadline_ns = g_opt.total ? INT64_MAX : start_ns + g_opt.duration_ms * 1000000;
+  int64_t  report_ns   = start_ns + (int64_t)LG_REPORT_MS * 1000000;
+  uint64_t last_done   = 0;
+
+  for (size_t i = 0; i < g_opt.conns; ++i)
+  {
+    clients[i].index  = (uint32_t)i;
+    clients[i].fd     = -1;
+    clients[i].server = g_server;
+    client_connect(&clients[i]);
+  }
+
+  while (!g_stop)
+  {
+    LoopEvent events[LG_MAX_EVENTS];
+    int       ready = evloop_wait(g_loop, events, LG_MAX_EVENTS, LG_WAIT_MS);
+
+    if (ready < 0 && errno != EINTR)
+    {
+      perror("loadgen: evloop_wait");
+
+      break;
+    }
+
+    for (int e = 0; e < ready && !g_stop; ++e)
+    {
+      client_on_event((Client *)events[e].udata, events[e].events);
+    }
+
+    int64_t now = monotonic_ns();
+
+    if (now >= deadline_ns)
+    {
+      break;
+    }
+
+    if (now >= report_ns)
+    {
+      fprintf(stderr, "loadgen: %llu registrations/s\n", (unsigned long long)(g_done - last_done));
+      last_done = g_done;
+      report_ns += (int64_t)LG_REPORT_MS * 1000000;
+    }
+  }
+
+  double elapsed = (double)(monotonic_ns() - start_ns) / 1e9;
+
+  for (size_t i = 0; i < g_opt.conns; ++i)
+  {
+    client_close(&clients[i]);
+  }
+
+  qsort(g_lat.samples, g_lat.count, sizeof *g_lat.samples, cmp_u64);
+
+  printf("loadgen: %llu registrations in %.2fs = %.1f/s\n",
+         (unsigned long long)g_done,
+         elapsed,
+         elapsed > 0 ? (double)g_done / elapsed : 0.0);
+  printf("loadgen: ACK latency (us): p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+         percentile_us(&g_lat, 0.50),
+         percentile_us(&g_lat, 0.99),
+         percentile_us(&g_lat, 0.999),
+         g_lat.count ? (double)g_lat.samples[g_lat.count - 1] / 1000.0 : 0.0);
+  printf("loadgen: %llu connect failure(s), %llu turned away busy, %llu dropped before ACK, %llu redirected\n",
+         (unsigned long long)g_connect_fails,
+         (unsigned long long)g_busy,
+         (unsigned long long)g_drops,
+         (unsigned long long)g_redirects);
+
+  if (g_opt.resume)
+  {
+    printf("loadgen: %llu resumed, %llu resume miss(es)\n",
+           (unsigned long long)g_resumed,
+           (unsigned long long)g_resume_misses);
+  }
+
+  evloop_destroy(g_loop);
+  free(clients);
+  free(g_frame);
+  free(g_lat.samples);
+
+  return 0;
+}
@@ -1 +0,0 @@
-int main(int argc, char *argv[]) { return 1; }
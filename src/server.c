@@ -2,442 +2,688 @@
 // INCLUDES
 // ==============================================================================
 
+#include "w-cluster.h"
+#include "w-codec.h"
+#include "w-event.h"
 #include "w-helper.h"
+#include "w-listen.h"
+#include "w-metrics-http.h"
+#include "w-metrics.h"
+#include "w-peer.h"
+#include "w-pixel.h"
+#include "w-player.h"
+#include "w-proto.h"
+#include "w-ring.h"
+#include "w-slab.h"
+#include "w-timer.h"
+#include "w-trace.h"
+#include "w-udp.h"
+#include "w-world.h"
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
-#include <raylib.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifndef SERVER_HEADLESS
+#include "w-atlas.h"
+#include "w-snapshot.h"
+#include <raylib.h>
+#include <rlgl.h>
+#endif
+
 // ==============================================================================
 // CONFIGURATION
 // ==============================================================================
 
-#define AVATAR_CHANNEL_COUNT 4 // We always want avatars to end up as RGBA
-#define MAX_AVATAR_W 8         // We expect an 8x8 sprite
-#define MAX_AVATAR_H 8
-#define MAX_CLIENTS 32          // Not too many!
-#define MAX_PLAYERS MAX_CLIENTS // Alias for readability
-#define MAX_STR_LEN 1024
-#define MAX_NAMETAG_LEN 31
-#define EXPECTED_NETWORK_ORDER_NAMETAG_LEN 2
-#define EXPECTED_NETWORK_ORDER_AVATAR_WIDTH 4
-#define EXPECTED_NETWORK_ORDER_AVATAR_HEIGHT 4
-#define EXPECTED_NETWORK_ORDER_AVATAR_CHANNELS 1
-#define EXPECTED_NETWORK_ORDER_AVATAR_SIZE 4
-#define ACK_OPCODE_SIZE 1
-#define ACK_OPCODE_OFFSET 0
-#define ACK_ID_OFFSET 1
-#define ACK_POS_X_OFFSET 5
-#define ACK_POS_Y_OFFSET 9
-#define GRAYSCALE_CHANNEL_COUNT 1 // Amnt. of channels in grayscale image
-#define RGB_CHANNEL_COUNT 3       // Amnt. of channels in an RGB image, no alpha data
-#define RGBA_CHANNEL_COUNT 4      // Amnt. of channels in an RGBA image
+#define MAX_CLIENTS 32 // Default cap on connections per reactor; not too many!
+#define V2_MAX_PACKED_AVATAR QOI_MAX_BYTES(MAX_AVATAR_W * MAX_AVATAR_H) // Biggest compressed avatar taken; RLE's worst case is smaller
 #define WINDOW_W 500
 #define WINDOW_H 500
-#define SELECT_TIMEOUT 200000
-
-// FIXME: Boundscheck these!
-#define MIN_PLAYER_X_POS 100
-#define MAX_PLAYER_X_POS 400
-#define MIN_PLAYER_Y_POS 100
-#define MAX_PLAYER_Y_POS 400
-
-// ==============================================================================
-// OUR PROTOCOL
-// ==============================================================================
-
-enum
-{
-  OPC_REGISTER = 0x01,
-  OPC_ACK      = 0x81,
-  OPC_SHUTDOWN = 0xFF
-};
-
-// ==============================================================================
-// PLAYER DATA STRUCTURE
-// ==============================================================================
-
-typedef struct Player
-{
-  uint32_t  ip;
-  uint32_t  player_id;
-  char      nametag[MAX_NAMETAG_LEN + 1]; // +1 for null terminator
-  int       pos_x, pos_y;
-  uint8_t  *avatar;   // Byte array containing image pixels (RGBA32)
-  uint32_t  w, h, ch; // Width, height and channel count
-  bool      connected;
-  time_t    last_seen; // When was this player last connected?
-  Texture2D tex;       // Created from avatar
-  bool      tex_inited,
-      tex_dirty; // Has avatar texture been initialized? / Has avatar texture been modified since initialization?
-} Player;
+#define AVATAR_DRAW_SCALE 3.0f // Avatars are tiny; blow them up on screen
+#define NAMETAG_FONT_SIZE 10
+#define MAX_UPLOADS_PER_FRAME 32 // Avatar uploads per frame; a burst of registrations trickles in over a few frames
+#define NET_MAX_EVENTS 64           // Ready events handled per wakeup
+#define MAX_REACTORS 64             // Upper bound on network worker threads
+#define SHUTDOWN_GRACE_MS 250       // How long shutdown waits on clients that can't take the goodbye byte yet
+#define CONN_IDLE_TIMEOUT_MS 15000  // A connection that sends nothing (not even a heartbeat) for this long gets dropped
+#define TIMER_TICK_MS 100           // Idle timers resolve to this; nobody cares if an eviction is 100ms late
+#define WORLD_TICK_MS 50            // How often clients hear where everybody is; also how often the renderer sees moves
+#define STORE_FLUSH_MS 1000         // How often dirty store pages get pushed to disk; the mapping itself is always current
+#define ACCEPT_BATCH 256            // accept()s per wakeup before the wake pipe and UDP socket get a turn again
+#define ADMIT_RATE 5000             // Default cap on new connections per second; a second's worth can come at once
+#define BUSY_FULL_RETRY_MS 1000     // What BUSY tells clients to wait when every reactor is full
+#define ACCEPT_BACKOFF_MS 100       // How long the listener sits out when we're out of fds and can't even shed
+#define RING_RECV_BUFFERS 256       // Receive buffers per reactor with ring I/O; EVLOOP_RECV_BUFFER bytes each
 
 // ==============================================================================
 // GLOBAL SHARED STATE
 // ==============================================================================
 
-// TODO: I don't want to keep this here; might want to turn into externs
-// Because I've never used that before, though, defer to when everything else is done!
+// The players table and its locking live in w-player.{h,c}
 
-static Player   g_players[MAX_PLAYERS]; // Player objects
-static size_t   g_player_count = 0;
-static int      g_client_fds[MAX_CLIENTS]; // Open connection file descriptors
-static size_t   g_client_count = 0;
-static uint32_t g_next_player_id =
-    1; // Counter used to keep track of player IDs; we assign these incrementally as new players come in
+static volatile bool g_running = true; // Is server running?
 
-// Thread locking system
-static pthread_mutex_t g_lock    = PTHREAD_MUTEX_INITIALIZER;
-static volatile bool   g_running = true; // Is server running?
+// UDP fast path; settled in net_thread_main() before any reactor starts, read-only after that
+static int      g_udp_fd   = -1;
+static uint16_t g_udp_port = 0; // Host order; 0 = no UDP channel
 
-// ==============================================================================
-// PLAYER TABLE OPERATIONS
-// ==============================================================================
+// Pokes the acceptor out of its wait; see request_stop()
+// The write end is atomic since signal handlers and other threads read it while the acceptor may be closing it
+static int        g_wake_rd = -1;
+static atomic_int g_wake_wr = -1;
+
+// Held open for the one moment we're out of fds: closing it makes room to accept and turn somebody away
+static int g_spare_fd = -1; // Acceptor only
 
 /**
- * @brief Linear-search for a player by IP the players table
- * @param target_ip The IP of the player we wish to find
- * @returns The address of the player if found; NULL if did not find
+ * @brief Ask every network loop to wind down
+ * @note Async-signal-safe; nobody polls g_running on a timer, so the acceptor gets woken through a pipe
  */
-static Player *find_player_by_ip(uint32_t target_ip)
+static void request_stop(void)
 {
-  for (size_t i = 0; i < g_player_count; ++i)
+  g_running = false;
+
+  int  fd   = atomic_load(&g_wake_wr);
+  char poke = 0;
+
+  if (fd >= 0)
   {
-    if (g_players[i].ip == target_ip)
-    {
-      return &g_players[i];
-    }
+    ssize_t ignored = write(fd, &poke, 1);
+    (void)ignored;
   }
-
-  return NULL;
 }
 
+#ifndef SERVER_HEADLESS
+static bool g_windowed = false; // Is anybody drawing? Settled in main() before any thread starts
+#endif
+
+// Cluster mode; NULL = standalone. Settled in main() before any thread starts, read-only after that
+static Cluster *g_cluster = NULL;
+
 /**
- * @brief Ensure that the player registered under target_ip exists; if not, create an entry for a player bound to target_ip
- * @param target_ip The player's IP
- * @returns The player's address if found already, NULL if there is no room for a new player, or the new player's address if a new one had to be created
+ * @brief Is the player behind a peer key ours to register? Always, unless we're in a cluster
  */
-static Player *ensure_player(uint32_t target_ip)
+static bool player_is_mine(uint32_t key)
 {
+  return !g_cluster || cluster_is_mine(g_cluster, key);
+}
 
-  Player *p = find_player_by_ip(target_ip);
-
-  // If the player is in the table, they exist; we #stillguhd
-  if (p)
-  {
-    return p;
-  }
-
-  // If the player does NOT exist, we wanna make sure they do
-  // Check that there is room for a new player
-
-  if (g_player_count >= MAX_PLAYERS)
+/**
+ * @brief Let the renderer know something it draws changed; no-op when running headless
+ */
+static void notify_renderer(void)
+{
+#ifndef SERVER_HEADLESS
+  if (g_windowed)
   {
-    return NULL;
+    render_snapshot_publish();
   }
+#endif
+}
 
-  // Add the new player
-  size_t  new_player_index = g_player_count + 1;
-  Player *new_player       = &g_players[new_player_index];
+// ==============================================================================
+// CLIENT HANDLING
+// ==============================================================================
 
-  // Ensure memory spot for new player is clean!
-  memset(new_player, 0, sizeof(*new_player));
+/*
+ * REGISTER frames are parsed incrementally: every connection carries its own little
+ * state machine, and whatever bytes happen to be on the socket get fed into it.
+ * A client that sends half a header just leaves its state parked at that stage;
+ * nobody else waits on it.
+ *
+ * Stages, in wire order (big endian):
+ *
+ * OPCODE   u8  == OPC_REGISTER (or OPC_HEARTBEAT, see below)
+ * TAG_LEN  u16
+ * WIDTH    u32
+ * HEIGHT   u32
+ * SIZE     u32 == w * h * channels
+ * CHANNELS u8  (1/3/4)
+ * TAG      bytes[tag_len]
+ * AVATAR   bytes[size]
+ *
+ * The fixed header is read on its own; once we know the tag length and avatar size, the tag
+ * and the pixels come in through a single readv() that scatters them straight into place.
+ * Raw pixels land in the avatar block the player will end up owning, so a registration
+ * never copies them; see adopt_player_avatar().
+ *
+ * A connection the server won't take right now (it's accepting faster than its admission rate,
+ * or every reactor is full) gets a BUSY right after accept(), then gets closed; it's always v1
+ * since the client hasn't said anything yet:
+ *
+ * OPCODE   u8  == OPC_BUSY
+ * RETRY_MS u16 How long to back off before trying again; a storm spreads itself out that way
+ *
+ * RESUME picks a player back up without sending the tag and avatar again; a client that's been
+ * ACKed before sends it in place of a REGISTER:
+ *
+ * OPCODE      u8  == OPC_RESUME
+ * PLAYER_ID   u32 From their last ACK
+ * AVATAR_HASH u64 XXH64 (see w-hash.h) of the avatar as the server keeps it: RGBA, rows packed,
+ *                 grayscale g as (g, g, g, 255) and RGB as (r, g, b, 255); seeded with WIDTH << 32 | HEIGHT
+ *
+ * If the player registered from this address has that ID and that avatar, they're connected
+ * again and the reply is the same ACK (or ACK_UDP) a REGISTER gets, tag and position untouched.
+ * Otherwise it's a lone OPC_RESUME_FAIL byte and the connection stays open for a full REGISTER.
+ *
+ * In cluster mode (see w-cluster.h), a REGISTER or RESUME for a player another node owns gets
+ * sent there instead; nothing after the opcode is looked at. Everything else the client sends
+ * on that connection is ignored until it hangs up:
+ *
+ * OPCODE   u8  == OPC_REDIRECT
+ * PORT     u16 The owner's game port
+ * HOST_LEN u8
+ * HOST     bytes[host_len] The owner's address, as the node list spells it
+ *
+ * HEARTBEAT is a lone OPC_HEARTBEAT byte, allowed wherever a new frame could start; the server
+ * echoes it back. Any bytes at all keep a connection alive, so clients only need heartbeats
+ * while they have nothing else to say; one that stays quiet for CONN_IDLE_TIMEOUT_MS is dropped.
+ *
+ * MOVE, only after a REGISTER on the same connection:
+ *
+ * OPCODE   u8  == OPC_MOVE
+ * X        i32
+ * Y        i32
+ *
+ * Every WORLD_TICK_MS, each registered client gets at most one WORLD packet holding only the
+ * players near it that moved, came into view or left it since the last one it was sent:
+ *
+ * OPCODE   u8  == OPC_WORLD
+ * TICK     u32 Apply this on top of the state at BASE; the result is the state at TICK
+ * BASE     u32 0 = keyframe; start from an empty world
+ * LEN      u16
+ * BODY     bytes[len]; varint entries, see w-world.h
+ *
+ * Nothing changed, nothing sent. TCP delivers in order or not at all, so a packet that made it
+ * into a connection's queue counts as acknowledged; a client too backed up to take one keeps
+ * its old baseline and gets one bigger delta later instead.
+ *
+ * UDP fast path (only when the server was started with a UDP channel):
+ *
+ * - The REGISTER reply is an ACK_UDP instead of an ACK: the same 13 bytes, followed by a
+ *   u64 session token and the server's u16 UDP port
+ * - The client may then send MOVEs as datagrams to that port:
+ *
+ *   OPCODE    u8  == OPC_MOVE
+ *   PLAYER_ID u32
+ *   TOKEN     u64 From the ACK_UDP; anything else is dropped
+ *   SEQ       u32 Starts at 1, +1 per datagram; anything not newer than the last applied is dropped
+ *   ACK       u32 Newest WORLD tick the client has applied, over either channel; 0 = none
+ *   X, Y      i32
+ *
+ * - Once one arrives, its WORLD packets come back as datagrams to wherever that came from,
+ *   diffed against ACK rather than against the last one sent; a lost datagram just means the
+ *   next one carries a bigger delta. Clients keep the last few ticks they applied around, so
+ *   they can apply a delta to whichever BASE it names
+ * - WORLD packets too big for one datagram still go over TCP; same format
+ * - Registration, heartbeats and goodbyes stay on TCP
+ *
+ * v2 framing: every frame starts with the same fixed header, which says up front how long the
+ * whole thing is:
+ *
+ * MAGIC    u16 == V2_MAGIC
+ * VERSION  u8  == V2_VERSION
+ * OPCODE   u8  Same opcodes as v1
+ * FLAGS    u8  0 unless the opcode says otherwise
+ * LENGTH   u32 Whole frame, header included
+ *
+ * - After the header comes what v1 has after its opcode byte, except for REGISTER:
+ *
+ *   TAG_LEN  u16
+ *   WIDTH    u16
+ *   HEIGHT   u16
+ *   CHANNELS u8  (1/3/4)
+ *   TAG      bytes[tag_len]
+ *   AVATAR   bytes, up to LENGTH; how they're packed is in FLAGS (AVATAR_RAW/RLE/QOI, see w-codec.h)
+ *
+ *   A QOI avatar always comes out RGBA, whatever CHANNELS says
+ * - A v2 REGISTER's fixed part is exactly as long as v1's header, so either comes in with the
+ *   same single read, and the tag and avatar still go straight into place after it
+ * - Whichever version a client's last frame used, its replies (ACK, HEARTBEAT, WORLD and the
+ *   goodbye) use too; v2 replies are a v2 header with the v1 reply, minus its opcode, after it
+ * - Datagrams on the UDP fast path don't change; they're fixed size already
+ *
+ * The opcodes, field widths and frame sizes for all of the above are in w-proto.h.
+ */
 
-  // Set their attributes
-  new_player->ip = target_ip;
 
-  uint32_t new_player_id = g_next_player_id + 1;
-  new_player->player_id  = new_player_id;
+_Static_assert(V2_HEADER_BYTES + V2_REGISTER_BYTES == REG_HEADER_BYTES,
+               "a v2 REGISTER's fixed part must take the same single read as v1's");
 
-  // Assign random pos
-  new_player->pos_x = irand(MIN_PLAYER_X_POS, WINDOW_W - MAX_PLAYER_X_POS);
-  new_player->pos_y = irand(MIN_PLAYER_Y_POS, WINDOW_H - MAX_PLAYER_Y_POS);
+// Where each header stage ends, counted from the opcode byte; indexed by RegStage
+static const uint8_t k_reg_stage_end[] = {1, 3, 7, 11, 15, 16};
 
-  new_player->connected  = false;
-  new_player->tex_inited = false;
-  new_player->tex_dirty  = false;
+typedef enum
+{
+  REG_STAGE_OPCODE,
+  REG_STAGE_TAG_LEN,
+  REG_STAGE_WIDTH,
+  REG_STAGE_HEIGHT,
+  REG_STAGE_SIZE,
+  REG_STAGE_CHANNELS,
+  REG_STAGE_TAG,
+  REG_STAGE_AVATAR,
+
+  // MOVE and RESUME frames share the parser; they sit after the REGISTER stages, so header capping skips them
+  REG_STAGE_MOVE_X,
+  REG_STAGE_MOVE_Y,
+  REG_STAGE_RESUME_ID,
+  REG_STAGE_RESUME_HASH,
+  REG_STAGE_DISCARD, // Redirected; nothing more from them means anything here
+
+  // v2 frames; everything after their fixed part goes through the stages above
+  REG_STAGE_V2_HEADER,
+  REG_STAGE_V2_REGISTER
+} RegStage;
+
+typedef struct Conn
+{
+  int      fd;
+  uint32_t peer_ip; // What players know them by; see listen_peer_key(). Grabbed once at accept time
+  uint32_t slot;    // Where this connection sits in its reactor's clients slab
+
+  // Parser state
+  RegStage stage;
+  size_t   want;     // Bytes the current stage needs in total
+  size_t   have;     // Bytes the current stage has received so far
+  uint8_t  field[8]; // Scratch for the fixed-size field being read; largest is a v2 header, less its first byte
+  bool     v2;       // Did the last frame use v2 framing? Replies follow suit
+  uint32_t v2_len;   // LENGTH of the v2 frame being parsed
+
+  // Decoded header, host order
+  uint32_t nametag_len;
+  uint32_t av_width, av_height, av_size, av_channels; // av_size is what's on the wire, packed or not
+  uint8_t  av_encoding;
+  int32_t  move_x;
+  uint32_t resume_id;
+
+  // Tag lives right here so a frame never needs malloc()
+  // Tag bytes past MAX_NAMETAG_LEN get truncated anyway, so we don't keep them
+  char nametag_buf[MAX_NAMETAG_LEN + 1];
+
+  // Avatar block from the pool; raw pixels go in at av_pixels and the player takes it over as-is
+  // Packed avatars land in packed first, then get expanded to av_pixels once they're whole
+  uint8_t *av_block;
+  uint8_t *av_pixels;
+  uint8_t *av_dst; // Where the avatar bytes off the wire go; av_pixels or packed
+  uint8_t  packed[V2_MAX_PACKED_AVATAR];
+
+  // Outbound queue; handlers only ever append to it, conn_flush() is what hits the socket
+  bool     want_write; // Is EVT_WRITE currently part of our registration?
+  ByteRing out;
+
+  // Ring I/O sends straight out of the queue; while one's out, the queue only ever grows at the back
+  bool         sending;     // Is a send out? Then the kernel may still read send_iov and what it points to
+  bool         closing;     // Removed while a send was out; the slot and the fd go once it's back, see conn_sent()
+  struct iovec send_iov[2];
+
+  TimerNode idle; // Fires once the peer has been quiet for too long; pushed back on every read
+
+  // World broadcasts
+  bool     in_world;    // Registered on this connection, so it gets WORLD packets and may MOVE
+  uint32_t world_tick;  // Last tick it was sent; its delta baseline
+  uint32_t player_slot; // Who they are; what they see depends on where that player stands
+  uint32_t player_id;
+} Conn;
+
+#define CONN_RECV_CHUNK 4096 // Scratch size for a single non-blocking recv()
 
-  return new_player;
+/**
+ * @brief Put a connection back at the start of a fresh REGISTER frame
+ * @param c The connection to reset
+ */
+static void conn_reset_frame(Conn *c)
+{
+  c->stage = REG_STAGE_OPCODE;
+  c->want  = 1;
+  c->have  = 0;
 }
 
 /**
- * @brief Sets the player avatar image
- * @note The input image will always be converted to RGBA
- * @param Player Address of the player whose avatar we wish to set
- * @param av_pixels Byte array containing raw pixel data of new avatar
- * @param av_w Width of new avatar
- * @param av_h Height of new avatar
- * @param av_ch Channel count of new avatar
- * @returns true if player avatar was set, false otherwise
+ * @brief Where the next byte for the current stage should be written
+ * @param c The connection being parsed
+ * @param room Receives how many bytes fit at that address before the stage has to be asked again
+ * @returns Address inside the scratch field, the nametag or the avatar buffer; NULL if the bytes should be dropped
  */
-static bool set_player_avatar(Player        *target_player,
-                              const uint8_t *av_pixels,
-                              uint32_t       av_w,
-                              uint32_t       av_h,
-                              uint8_t        av_ch)
+static uint8_t *conn_stage_dst(Conn *c, size_t *room)
 {
-  // Check the received avatar dimensions; if they exceed our maximums, we truncate
-  // This is sensible and avoids crashing and dying and failing horribly
+  *room = c->want - c->have;
 
-  if (av_w > MAX_AVATAR_W)
+  switch (c->stage)
   {
-    av_w = MAX_AVATAR_W;
+  case REG_STAGE_TAG:
+    // Only the first MAX_NAMETAG_LEN bytes survive truncation; skip over the rest
+    if (c->have >= MAX_NAMETAG_LEN)
+    {
+      return NULL;
+    }
+
+    if (*room > MAX_NAMETAG_LEN - c->have)
+    {
+      *room = MAX_NAMETAG_LEN - c->have;
+    }
+
+    return (uint8_t *)c->nametag_buf + c->have;
+  case REG_STAGE_AVATAR:
+    return c->av_dst + c->have;
+  case REG_STAGE_DISCARD:
+    return NULL;
+  default:
+    return c->field + c->have;
   }
+}
 
-  if (av_h > MAX_AVATAR_H)
+/**
+ * @brief Queue a message for a client, framed the way it spoke to us last
+ * @param c The connection to queue on
+ * @param msg A whole v1 message, opcode first; for v2, a v2 header takes the opcode byte's place
+ * @param len Amt. of bytes in msg
+ * @returns true if queued, false if it doesn't fit (nothing is queued in that case)
+ */
+static bool conn_push(Conn *c, const uint8_t *msg, size_t len)
+{
+  if (!c->v2)
   {
-    av_h = MAX_AVATAR_H;
+    return ring_push(&c->out, msg, len);
   }
 
-  // Allocate space for an RGBA image of the width and height we want
-  // Regardless of the supplied channel count, we always want to convert into our expected channel count
+  uint8_t  hdr[V2_HEADER_BYTES];
+  uint16_t be_magic = htons(V2_MAGIC);
+  uint32_t frame    = V2_HEADER_BYTES + len - 1;
+  uint32_t be_len   = htonl(frame);
 
-  size_t image_buf_len =
-      (size_t)av_w * av_h * RGBA_CHANNEL_COUNT; // Width * height * n. of channels we want
-  uint8_t *image_buf = (uint8_t *)malloc(image_buf_len);
-
-  if (!image_buf)
+  // Both pieces or neither
+  if (ring_space(&c->out) < frame)
   {
     return false;
   }
 
-  // Write avatar pixel values to allocated image buffer
-  // We expect avatar to be RGBA; as such, we will convert as needed
+  memcpy(&hdr[V2_MAGIC_OFFSET], &be_magic, sizeof be_magic);
+  hdr[V2_VERSION_OFFSET] = V2_VERSION;
+  hdr[V2_OPCODE_OFFSET]  = msg[0];
+  hdr[V2_FLAGS_OFFSET]   = 0;
+  memcpy(&hdr[V2_LENGTH_OFFSET], &be_len, sizeof be_len);
 
-  for (uint32_t y = 0; y < av_h; ++y)
-  {
-    for (uint32_t x = 0; x < av_w; ++x)
-    {
-      // Get the flat index of the xth pixel at the current column
-      size_t i = (size_t)y * av_w + x;
+  ring_push(&c->out, hdr, sizeof hdr);
+  ring_push(&c->out, msg + 1, len - 1);
 
-      // Compute its R, G, B, and A
-      uint8_t r, g, b, a;
+  return true;
+}
 
-      // RGBA to RGBA; basically no conversion we just pull all values as-is
-      if (av_ch == RGBA_CHANNEL_COUNT)
-      {
-        r = av_pixels[i * RGBA_CHANNEL_COUNT + 0];
-        g = av_pixels[i * RGBA_CHANNEL_COUNT + 1];
-        b = av_pixels[i * RGBA_CHANNEL_COUNT + 2];
-        a = av_pixels[i * RGBA_CHANNEL_COUNT + 3];
-      }
+/**
+ * @brief Give up on a REGISTER frame, counting why
+ * @param reason Which METRIC_REG_FAIL_* it was
+ * @returns false, always; meant for `return reject_register(...)`
+ */
+static bool reject_register(MetricCounter reason)
+{
+  metrics_inc(reason);
 
-      // RGB to RGBA; grab all RGB values and then just assume alpha is always max
-      else if (av_ch == RGB_CHANNEL_COUNT)
-      {
-        r = av_pixels[i * RGB_CHANNEL_COUNT + 0];
-        g = av_pixels[i * RGB_CHANNEL_COUNT + 1];
-        b = av_pixels[i * RGB_CHANNEL_COUNT + 2];
-        a = 255; // Since we're converting no alpha to alpha, we just set max alpha for all pixels
-      }
+  return false;
+}
 
-      // Grayscale to RGBA; just grab the single pixel value's brightness (0-255); assign it to all channels, and assume alpha is max
-      else
-      {
-        r = g = b = av_pixels[i];
-        a         = 255;
-      }
 
-      // Write pixels to image buffer
-      image_buf[i * RGBA_CHANNEL_COUNT + 0] = r;
-      image_buf[i * RGBA_CHANNEL_COUNT + 1] = g;
-      image_buf[i * RGBA_CHANNEL_COUNT + 2] = b;
-      image_buf[i * RGBA_CHANNEL_COUNT + 3] = a;
-    }
-  }
+/**
+ * @brief Send a client to the node that owns their player, and stop listening to them
+ * @param c The connection; its peer key belongs to another node
+ * @returns true if the REDIRECT was queued
+ */
+static bool conn_redirect(Conn *c)
+{
+  const ClusterNode *owner    = &g_cluster->nodes[cluster_owner(g_cluster, c->peer_ip)];
+  size_t             host_len = strlen(owner->host);
+  uint16_t           be_port  = htons(owner->port);
+  uint8_t            msg[REDIRECT_HEADER_BYTES + CLUSTER_MAX_HOST];
 
-  free(target_player->avatar);
+  msg[0] = OPC_REDIRECT;
+  memcpy(&msg[1], &be_port, sizeof be_port);
+  msg[3] = (uint8_t)host_len;
+  memcpy(&msg[REDIRECT_HEADER_BYTES], owner->host, host_len);
 
-  target_player->avatar = image_buf;
-  target_player->w      = av_w;
-  target_player->h      = av_h;
-  target_player->ch     = RGBA_CHANNEL_COUNT; // Avatar is always RGBA!
-  target_player->tex_dirty =
-      true; // We have now modified the texture; WARNING: Shouldn't this also modify tex_inited? Isn't this where we initialize the texture?
+  metrics_inc(METRIC_REDIRECTS);
 
-  return true;
+  // Whatever's behind the opcode is the owner's business; let it fall on the floor until they hang up
+  c->stage = REG_STAGE_DISCARD;
+  c->want  = SIZE_MAX;
+  c->have  = 0;
+
+  return conn_push(c, msg, REDIRECT_HEADER_BYTES + host_len);
 }
 
-// ==============================================================================
-// CLIENT HANDLING
-// ==============================================================================
+// What an ACK tells a player; gathered under their stripe, sent after it's let go
+typedef struct
+{
+  uint32_t player_id;
+  uint32_t slot;
+  uint32_t pos_x, pos_y; // Signed, really; they go out as raw u32s
+  uint64_t token;        // 0 = plain ACK
+} PlayerWelcome;
+
+static PlayerWelcome start_session_locked(Player *p, uint64_t token);
+static bool          conn_welcome(Conn *c, const PlayerWelcome *w);
 
 /**
  * @brief Receive registration request packet for a new player and register that player
- * @param cfd The file descriptor via which the request will arrive
- * @param peer_ip_net The IP address of the new player's client under which they'll be registered
+ * @note Only called once the parser holds a complete frame, so nothing in here blocks on the peer
+ * @param c The connection which sent the frame
  * @returns true if registration successful, false otherwise
  */
-static bool handle_register(int cfd, uint32_t peer_ip_net)
+static bool handle_register(Conn *c)
 {
-  uint8_t opcode;
+  TRACE_SCOPE("handle_register");
 
-  // Get opcode sent by client
-  if (recvall(cfd, &opcode, 1) <= 0)
-  {
-    return false;
-  }
+  int64_t start = metrics_now_ns();
 
-  // Ignore if received opcode isn't for this handler
-  if (opcode != OPC_REGISTER)
-  {
-    return false;
-  }
+  // Register the player
+  // ensure_player() deals with the table lock for the insert; we go back to it for the update below
+  TRACE_BEGIN(ensure_span, "register.ensure_player");
 
-  // Receive all registration info from the socket fd.
-  // Will be in big endian (network order)
+  Player *new_player = ensure_player(c->peer_ip);
 
-  // "be" = Big endian
-  // "av" = Avatar
-  uint16_t be_nametag_len;
-  if (recvall(cfd, &be_nametag_len, EXPECTED_NETWORK_ORDER_NAMETAG_LEN) <= 0)
-  {
-    return false;
-  }
+  TRACE_END(ensure_span);
 
-  uint32_t be_av_width;
-  if (recvall(cfd, &be_av_width, EXPECTED_NETWORK_ORDER_AVATAR_WIDTH) <= 0)
+  // Exit if player registration failed
+  if (new_player == NULL)
   {
-    return false;
+    return reject_register(METRIC_REG_FAIL_TABLE_FULL);
   }
 
-  uint32_t be_av_height;
-  if (recvall(cfd, &be_av_height, EXPECTED_NETWORK_ORDER_AVATAR_HEIGHT) <= 0)
-  {
-    return false;
-  }
+  // No syscall under any lock; the token is drawn up front
+  uint64_t token = g_udp_port ? secure_rand64() : 0;
 
-  uint32_t be_av_size;
-  if (recvall(cfd, &be_av_size, EXPECTED_NETWORK_ORDER_AVATAR_SIZE) <= 0)
-  {
-    return false;
-  }
+  // Being connected only pins them until ANY connection from their IP goes away, and another one
+  // may be doing just that; the shared lock is what keeps them from being evicted under us now
+  // Look them up again under it: the address from ensure_player() may already be somebody else's
+  pthread_rwlock_rdlock(&g_players_lock);
 
-  uint32_t be_av_channels;
-  if (recvall(cfd, &be_av_channels, EXPECTED_NETWORK_ORDER_AVATAR_CHANNELS) <= 0)
+  new_player = find_player_by_ip(c->peer_ip);
+
+  // The block belongs to the player from here on, whatever the outcome
+  uint8_t *block = c->av_block;
+
+  c->av_block  = NULL;
+  c->av_pixels = NULL;
+
+  if (!new_player)
   {
-    return false;
+    pthread_rwlock_unlock(&g_players_lock);
+    free_avatar_block(block);
+
+    return reject_register(METRIC_REG_FAIL_TABLE_FULL);
   }
 
-  // Convert all to host order
+  // Pixel conversion happens in here, in place, before the stripe is taken
+  TRACE_BEGIN(avatar_span, "register.adopt_avatar");
 
-  uint32_t nametag_len = ntohs(be_nametag_len);
-  uint32_t av_width    = ntohs(be_av_width);
-  uint32_t av_height   = ntohs(be_av_height);
-  uint32_t av_size     = ntohs(be_av_size);
-  uint32_t av_channels = ntohs(be_av_channels);
+  bool adopted = adopt_player_avatar(new_player, block, c->av_width, c->av_height, c->av_channels);
 
-  // Ensure integrity
+  TRACE_END(avatar_span);
 
-  // Requested nametag's length is within bounds
-  if (nametag_len >= MAX_STR_LEN)
+  if (!adopted)
   {
-    return false;
-  }
+    pthread_rwlock_unlock(&g_players_lock);
 
-  // Requested dimensions are in bounds
-  if (av_width == 0 || av_height == 0 || av_width > MAX_AVATAR_W ||
-      av_height > MAX_AVATAR_H)
-  {
-    return false;
+    return reject_register(METRIC_REG_FAIL_AVATAR);
   }
 
-  // Avatar image is either grayscale, RGB, or RGBA
-  if (!(av_channels == GRAYSCALE_CHANNEL_COUNT || av_channels != RGB_CHANNEL_COUNT ||
-        av_channels != RGBA_CHANNEL_COUNT))
-  {
-    return false;
-  }
+  // Lock this player in before touching their fields
+  // This avoids fucking up the entry with async bullshit; other players stay available meanwhile
+  pthread_mutex_t *lock = player_lock(new_player->ip);
 
-  // Avatar image size coincides with its channel count and dimensions
-  if (av_size != av_width * av_height * av_channels)
+  TRACE_BEGIN(update_span, "register.update_player");
+
+  pthread_mutex_lock(lock);
+
+  // Truncate given nametag if it exceeds our max length
+  size_t nametag_cpy_len = c->nametag_len;
+  if (nametag_cpy_len > MAX_NAMETAG_LEN)
   {
-    return false;
+    nametag_cpy_len = MAX_NAMETAG_LEN;
   }
 
-  // Allocate space for nametag and avatar
+  memcpy(new_player->nametag, c->nametag_buf, nametag_cpy_len);
+  new_player->nametag[nametag_cpy_len] = '\0'; // A shorter tag must not inherit the old one's tail
+
+  // Gather info for ACK
+  // Involves polling player table entry; this is why we don't unlock thread first)
+  PlayerWelcome welcome = start_session_locked(new_player, token);
+
+  pthread_mutex_unlock(lock);
+  pthread_rwlock_unlock(&g_players_lock);
+
+  TRACE_END(update_span);
+
+  // New tag, avatar or connected flag; let the renderer know
+  notify_renderer();
 
-  char *nametag_buf = (char *)malloc(nametag_len + 1);
-  if (!nametag_buf)
+  // A client that lets a whole ring of replies pile up isn't reading them; drop it
+  if (!conn_welcome(c, &welcome))
   {
-    return false;
+    return reject_register(METRIC_REG_FAIL_REPLY);
   }
 
-  uint8_t *av_buf = (uint8_t *)malloc(av_size);
-  if (!av_buf)
-  {
-    free(nametag_buf);
+  metrics_inc(METRIC_REGISTRATIONS);
+  metrics_record(METRIC_HIST_REGISTER, (uint64_t)(metrics_now_ns() - start));
 
-    return false;
-  }
+  return true;
+}
+
+/**
+ * @brief Pick a player back up from a RESUME, if they're who they say they are
+ * @note Never touches the avatar, so nothing gets received, converted, stored or uploaded
+ * @param c The connection which sent the frame; resume_id is set
+ * @param avatar_hash The AVATAR_HASH it carried
+ * @returns true if the client was answered (ACK or RESUME_FAIL), false if their reply queue is full
+ */
+static bool handle_resume(Conn *c, uint64_t avatar_hash)
+{
+  TRACE_SCOPE("handle_resume");
 
-  // Now that we know what their sizes are, receive them
+  // No syscall under the stripe; the token is drawn up front
+  uint64_t      token = g_udp_port ? secure_rand64() : 0;
+  PlayerWelcome welcome;
+  bool          resumed = false;
 
-  if (recvall(cfd, nametag_buf, nametag_len) <= 0)
-  {
-    free(nametag_buf);
-    free(av_buf);
+  // The shared lock keeps them from being evicted until they're marked connected, which pins them
+  pthread_rwlock_rdlock(&g_players_lock);
 
-    return false;
-  }
+  Player *p = find_player_by_ip(c->peer_ip);
 
-  if (recvall(cfd, av_buf, av_size) <= 0)
+  if (p)
   {
-    free(nametag_buf);
-    free(av_buf);
+    pthread_mutex_t *lock = player_lock(p->ip);
 
-    return false;
-  }
+    pthread_mutex_lock(lock);
 
-  // Lock this thread in before actually doing reg
-  // This avoids fucking up the players table with async bullshit
-  pthread_mutex_lock(&g_lock);
+    // Same player, and we still hold the avatar they think we do; anything else goes the long way
+    if (p->player_id == c->resume_id && p->avatar && p->avatar_hash == avatar_hash)
+    {
+      welcome = start_session_locked(p, token);
+      resumed = true;
+    }
 
-  // Register the player
-  Player *new_player = ensure_player(peer_ip_net);
+    pthread_mutex_unlock(lock);
+  }
 
-  // Exit if player registration failed
-  if (new_player == NULL)
+  pthread_rwlock_unlock(&g_players_lock);
+
+  if (!resumed)
   {
-    pthread_mutex_unlock(&g_lock);
+    uint8_t fail = OPC_RESUME_FAIL;
 
-    free(nametag_buf);
-    free(av_buf);
+    metrics_inc(METRIC_RESUME_MISSES);
 
-    return false;
+    return conn_push(c, &fail, sizeof fail);
   }
 
-  // Truncate given nametag if it exceeds our max length
-  size_t nametag_cpy_len = nametag_len;
-  if (nametag_cpy_len > MAX_NAMETAG_LEN)
+  // Back on screen
+  notify_renderer();
+
+  if (!conn_welcome(c, &welcome))
   {
-    nametag_cpy_len = MAX_NAMETAG_LEN;
+    return reject_register(METRIC_REG_FAIL_REPLY);
   }
 
-  memcpy(new_player->nametag, nametag_buf, nametag_cpy_len);
+  metrics_inc(METRIC_RESUMES);
 
-  set_player_avatar(new_player, av_buf, av_width, av_height, av_channels);
-
-  new_player->connected = true;
-  new_player->last_seen = time(NULL); // NOTE: Pulling time in C! Neat
+  return true;
+}
 
-  // Gather info for ACK
-  // Involves polling player table entry; this is why we don't unlock thread first)
-  uint32_t new_player_id    = new_player->player_id;
-  uint32_t new_player_pos_x = new_player->pos_x;
-  uint32_t new_player_pos_y = new_player->pos_y;
+/**
+ * @brief Mark a player connected, on a fresh session, and write them through
+ * @note Caller holds the player's stripe; REGISTER and RESUME both end up here
+ * @param p The player
+ * @param token Their new session token; 0 = no UDP session
+ * @returns What their ACK needs to say
+ */
+static PlayerWelcome start_session_locked(Player *p, uint64_t token)
+{
+  p->connected = true;
+  p->last_seen = time(NULL); // NOTE: Pulling time in C! Neat
+
+  // Fresh session; datagrams from an older one (or anybody guessing) no longer count
+  p->session_token = token;
+  p->udp_ip        = 0;
+  p->udp_port      = 0;
+  p->udp_seq       = 0;
+  p->udp_ack       = 0;
+
+  persist_player_locked(p);
+
+  return (PlayerWelcome){
+      .player_id = p->player_id,
+      .slot      = p->slot,
+      .pos_x     = (uint32_t)p->pos_x,
+      .pos_y     = (uint32_t)p->pos_y,
+      .token     = token,
+  };
+}
 
-  pthread_mutex_unlock(&g_lock);
+/**
+ * @brief Queue a player's ACK (ACK_UDP if they got a token) and put the connection in the world
+ * @param c The connection they're on
+ * @param w Who they are, from start_session_locked()
+ * @returns true if queued, false if the reply queue is full
+ */
+static bool conn_welcome(Conn *c, const PlayerWelcome *w)
+{
+  uint64_t token = w->token;
 
   // Structure and send the ACK packet
 
@@ -448,277 +694,2722 @@ static bool handle_register(int cfd, uint32_t peer_ip_net)
    * Player pos X = 4 bytes, 5-8
    * Player pos Y = 4 bytes, 8-11
    *
+   * ACK_UDP tacks on:
+   *
+   * Session token = 8 bytes, 13-20
+   * UDP port = 2 bytes, 21-22
+   *
    */
-  uint8_t ack[ACK_OPCODE_SIZE + sizeof new_player_id + sizeof new_player_pos_x +
-              sizeof new_player_pos_y];
+  uint8_t ack[ACK_OPCODE_SIZE + sizeof w->player_id + sizeof w->pos_x + sizeof w->pos_y + sizeof token +
+              sizeof g_udp_port];
+  size_t  ack_len = ACK_BYTES;
 
   ack[0] = OPC_ACK;
 
   // Must convert back to network order!
-  uint32_t be_new_player_id    = htonl(new_player_id);
-  uint32_t be_new_player_pos_x = htonl(new_player_pos_x);
-  uint32_t be_new_player_pos_y = htonl(new_player_pos_y);
+  uint32_t be_new_player_id    = htonl(w->player_id);
+  uint32_t be_new_player_pos_x = htonl(w->pos_x);
+  uint32_t be_new_player_pos_y = htonl(w->pos_y);
 
   // Assemble packet
   memcpy(&ack[ACK_ID_OFFSET], &be_new_player_id, sizeof be_new_player_id);
   memcpy(&ack[ACK_POS_X_OFFSET], &be_new_player_pos_x, sizeof be_new_player_pos_x);
   memcpy(&ack[ACK_POS_Y_OFFSET], &be_new_player_pos_y, sizeof be_new_player_pos_y);
 
-  // Send over wire!
-  sendall(cfd, ack, sizeof ack);
+  if (token)
+  {
+    uint16_t be_port = htons(g_udp_port);
 
-  free(nametag_buf);
-  free(av_buf);
+    // No htonll(); spell out the big endian bytes
+    for (int i = 0; i < 8; ++i)
+    {
+      ack[ACK_TOKEN_OFFSET + i] = (uint8_t)(token >> (56 - 8 * i));
+    }
 
-  return true;
-}
+    memcpy(&ack[ACK_UDP_PORT_OFFSET], &be_port, sizeof be_port);
 
-// ==============================================================================
-// NETWORK THREAD
-// ==============================================================================
+    ack[0]  = OPC_ACK_UDP;
+    ack_len = sizeof ack;
+  }
 
-typedef struct
-{
-  int listen_fd;
-} NetArgs; // FIXME: This is probably not necessary; why do we pack it like this? Do we receive this in generic form?
+  // Everybody they can see comes in the next WORLD packet, as a keyframe
+  c->in_world    = true;
+  c->world_tick  = 0;
+  c->player_slot = w->slot;
+  c->player_id   = w->player_id;
+
+  // Queue it up; it goes out with whatever else this wakeup produces, see conn_flush()
+  return conn_push(c, ack, ack_len);
+}
 
 /**
- * @brief Add a new client to the clients table
- * @note This should take place in a thread locked context
- * @param fd The file descriptor of that client's socket
+ * @brief The header's all in; get the avatar's landing spot ready and move on to the tag
+ * @param c The connection being parsed; dimensions, channels and encoding are settled
+ * @returns false if there's no avatar block to be had
  */
-static void add_client_fd_locked(int fd)
+static bool conn_begin_payload(Conn *c)
 {
-  // Add new client if we have room for them
-  if (g_client_count < MAX_CLIENTS)
+  // A frame that failed before handle_register() may have left its block behind; reuse it
+  if (!c->av_block && !(c->av_block = alloc_avatar_block()))
   {
-    size_t new_client_index        = g_client_count + 1;
-    g_client_fds[new_client_index] = fd;
+    return reject_register(METRIC_REG_FAIL_NO_BLOCK);
   }
 
-  // FIXME: Shouldn't this return some kind of error code?
+  c->av_pixels = c->av_block + avatar_tail_offset(c->av_width, c->av_height, c->av_channels);
+  c->av_dst    = c->av_encoding == AVATAR_RAW ? c->av_pixels : c->packed;
+
+  c->stage = REG_STAGE_TAG;
+  c->want  = c->nametag_len;
+  c->have  = 0;
+
+  return true;
 }
 
 /**
- * @brief Removes a client from the clients table
- * @param idx The index of the client we wish to remove
- * @note Should take place in thread locked context
+ * @brief Expand a packed avatar into raw pixels at av_pixels; no-op for raw ones
+ * @param c The connection being parsed; the whole avatar is in
+ * @returns false if it doesn't decode to exactly the declared image
  */
-static void remove_client_index_locked(size_t idx)
+static bool conn_unpack_avatar(Conn *c)
 {
-  // Ensure we're clearing a client within bounds
-  if (idx >= g_client_count)
+  switch (c->av_encoding)
   {
-    return;
+  case AVATAR_RLE:
+    return rle_decode(c->av_pixels, c->packed, c->av_size, (size_t)c->av_width * c->av_height, c->av_channels);
+  case AVATAR_QOI:
+    return qoi_decode(c->av_pixels, c->packed, c->av_size, c->av_width, c->av_height);
+  default:
+    return true;
   }
-
-  // Remove by replacing n client with one at the end
-  // Clever :)
-  // Maybe
-  // I think...
-  g_client_fds[idx] = g_client_fds[g_client_count - 1];
-  g_client_count--;
 }
 
-// TODO: Dissect this a little more
-// This is fucking crazy
-static void *net_thread_main(void *arg_)
+/**
+ * @brief A v2 header is in (minus the magic's first byte, which got us here); see where it leads
+ * @param c The connection being parsed
+ * @returns true if the frame is still valid, false if the client sent garbage
+ */
+static bool conn_finish_v2_header(Conn *c)
 {
-  NetArgs *args = (NetArgs *)arg_;
+  // field[] holds the header from its second byte on, so every offset is one less
+  uint32_t be_len;
 
-  int listener_fd = args->listen_fd;
+  memcpy(&be_len, &c->field[V2_LENGTH_OFFSET - 1], sizeof be_len);
 
-  free(args);
+  uint8_t opcode = c->field[V2_OPCODE_OFFSET - 1];
+  uint8_t flags  = c->field[V2_FLAGS_OFFSET - 1];
 
-  // Network handling loop
-  while (g_running)
+  c->v2_len = ntohl(be_len);
+
+  if (c->field[V2_MAGIC_OFFSET] != (V2_MAGIC & 0xFF) || c->field[V2_VERSION_OFFSET - 1] != V2_VERSION)
   {
-    // Create socket set bitmask
-    fd_set rfds;
-    FD_ZERO(&rfds); // Initialize to 0; no sockets added yet
-    int maxfd =
-        listener_fd; // This will be largest file descriptor in the set; every fd below it will be considered "valid"; in-use
+    return false;
+  }
 
-    pthread_mutex_lock(&g_lock); // Requires glob state mod, should lock!
+  // From here on, replies are v2 as well
+  c->v2   = true;
+  c->have = 0;
 
-    for (size_t i = 0; i < g_client_count; ++i)
-    {
-      FD_SET(g_client_fds[i], &rfds);
+  if (opcode == OPC_HEARTBEAT && flags == 0 && c->v2_len == V2_HEADER_BYTES)
+  {
+    uint8_t echo = OPC_HEARTBEAT;
 
-      /*
-       * If this new socket's fd is larger than the one we initially assigned,
-       * then make this new one the maxfd
-       *
-       * This ensures that all sockets in the client fds are valid, and also our listener
-       */
-      if (g_client_fds[i] > maxfd)
-      {
-        maxfd = g_client_fds[i];
-      }
-    }
+    conn_reset_frame(c);
 
-    pthread_mutex_unlock(&g_lock);
+    return conn_push(c, &echo, sizeof echo);
+  }
 
-    // Mask away sockets we want to ignore
-    struct timeval select_timeout = {.tv_sec = 0, .tv_usec = SELECT_TIMEOUT};
-    int            ready          = select(maxfd + 1, &rfds, NULL, NULL, &select_timeout);
-    if (ready < 0)
-    {
-      // Retry if we were interrupted by async bullshit
-      if (errno == EINTR)
-      {
-        continue;
-      }
+  // Same payload as v1 from here; the MOVE stages take it
+  if (opcode == OPC_MOVE && c->in_world && flags == 0 && c->v2_len == V2_HEADER_BYTES + 2 * sizeof be_len)
+  {
+    c->stage = REG_STAGE_MOVE_X;
+    c->want  = sizeof be_len;
 
-      perror("server: select");
+    return true;
+  }
 
-      break;
-    }
+  if ((opcode == OPC_RESUME || opcode == OPC_REGISTER) && !player_is_mine(c->peer_ip))
+  {
+    return conn_redirect(c);
+  }
 
-    // Ensure this file descriptor is set in the socket watchlist
-    // If so, poll it!
-    if (FD_ISSET(listener_fd, &rfds))
-    {
-      // Note that we assume client's address to be IPv4
+  if (opcode == OPC_RESUME && flags == 0 && c->v2_len == V2_HEADER_BYTES + sizeof be_len + sizeof(uint64_t))
+  {
+    c->stage = REG_STAGE_RESUME_ID;
+    c->want  = sizeof be_len;
 
-      struct sockaddr_in client_addr;
-      socklen_t          client_addrlen = sizeof client_addr;
+    return true;
+  }
 
-      // FIXME: Was sockaddr the best practice here?
-      int client_sockfd =
-          accept(listener_fd, (struct sockaddr *)&client_addr, &client_addrlen);
+  if (opcode != OPC_REGISTER)
+  {
+    return false;
+  }
 
-      // If client did connect, register their file desc.
-      if (client_sockfd >= 0)
-      {
-        pthread_mutex_lock(&g_lock);
+  c->av_encoding = flags & V2_FLAG_AVATAR_MASK;
 
-        add_client_fd_locked(client_sockfd);
+  if ((flags & ~V2_FLAG_AVATAR_MASK) || c->av_encoding > AVATAR_QOI || c->v2_len < REG_HEADER_BYTES)
+  {
+    return reject_register(METRIC_REG_FAIL_HEADER);
+  }
 
-        pthread_mutex_unlock(&g_lock);
-      }
-    }
+  c->stage = REG_STAGE_V2_REGISTER;
+  c->want  = V2_REGISTER_BYTES;
 
-    pthread_mutex_lock(&g_lock);
+  return true;
+}
 
-    // Go over all client connections
-    // Register new players for clients that don't have one
+/**
+ * @brief The fixed part of a v2 REGISTER is in; validate it, then on to the tag like v1
+ * @param c The connection being parsed
+ * @returns true if the frame is still valid, false if the client sent garbage
+ */
+static bool conn_finish_v2_register(Conn *c)
+{
+  uint16_t be16[3];
 
-    // FIXME: Cursed for loop...
-    for (size_t i = 0; i < g_client_count;)
-    {
-      int  client_fd = g_client_fds[i];
-      bool advance   = true;
+  memcpy(be16, c->field, sizeof be16);
 
-      // Again, if this file descriptor is awake, move forward with it!
-      if (FD_ISSET(client_fd, &rfds))
-      {
-        struct sockaddr_in peer_addr;
-        socklen_t          peer_addrlen = sizeof peer_addr;
+  c->nametag_len = ntohs(be16[0]);
+  c->av_width    = ntohs(be16[1]);
+  c->av_height   = ntohs(be16[2]);
+  c->av_channels = c->field[6];
 
-        if (getpeername(client_fd, (struct sockaddr *)&peer_addr, &peer_addrlen) < 0)
-        {
-          // FIXME: A lil spaghetti might be boiling here cousin...
-          goto drop_locked;
-        }
+  // Same bounds as v1
+  if (c->nametag_len >= MAX_STR_LEN || c->av_width == 0 || c->av_height == 0 || c->av_width > MAX_AVATAR_W ||
+      c->av_height > MAX_AVATAR_H ||
+      !(c->av_channels == GRAYSCALE_CHANNEL_COUNT || c->av_channels == RGB_CHANNEL_COUNT ||
+        c->av_channels == RGBA_CHANNEL_COUNT))
+  {
+    return reject_register(METRIC_REG_FAIL_HEADER);
+  }
 
-        uint32_t peer_ip = peer_addr.sin_addr.s_addr;
+  // Whatever LENGTH leaves after the tag is the avatar
+  if (c->v2_len - REG_HEADER_BYTES < c->nametag_len)
+  {
+    return reject_register(METRIC_REG_FAIL_HEADER);
+  }
 
-        pthread_mutex_unlock(&g_lock); // FIXME: Why the fuck is this here?
+  size_t npixels = (size_t)c->av_width * c->av_height;
 
-        // Try and register a new player
-        bool did_register = handle_register(client_fd, peer_ip);
+  c->av_size = c->v2_len - REG_HEADER_BYTES - c->nametag_len;
 
-        // If failed to register, this player's client is probably not connected... FIXME: WHAT???
-        // Find the player registered under this IP and mark them as disconnected
+  switch (c->av_encoding)
+  {
+  case AVATAR_RAW:
+    if (c->av_size != npixels * c->av_channels)
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+    break;
+  case AVATAR_RLE:
+    if (c->av_size > RLE_MAX_BYTES(npixels, c->av_channels))
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+    break;
+  case AVATAR_QOI:
+    // QOI carries alpha no matter what; take it as RGBA
+    c->av_channels = RGBA_CHANNEL_COUNT;
 
-        if (!did_register)
-        {
-          pthread_mutex_lock(&g_lock);
+    if (c->av_size > QOI_MAX_BYTES(npixels))
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+    break;
+  }
 
-          Player *client_player = find_player_by_ip(peer_ip);
-          if (client_player)
-          {
-            client_player->connected = false;
+  return conn_begin_payload(c);
+}
 
-            goto drop_locked;
-          }
-        }
+/**
+ * @brief A stage just got all of its bytes; decode it, validate it and move on to the next one
+ * @param c The connection being parsed
+ * @returns true if the frame is still valid, false if the client sent garbage
+ */
+static bool conn_finish_stage(Conn *c)
+{
+  uint16_t be16;
+  uint32_t be32;
+
+  switch (c->stage)
+  {
+  case REG_STAGE_OPCODE:
+    // No v1 opcode looks like the start of a v2 header
+    if (c->field[0] == V2_MAGIC >> 8)
+    {
+      c->stage = REG_STAGE_V2_HEADER;
+      c->want  = V2_HEADER_BYTES - 1;
+      break;
+    }
+
+    c->v2 = false;
+
+    // Heartbeats are the whole frame; echo it and wait for the next opcode
+    // The read that brought it in already pushed the idle timer back
+    if (c->field[0] == OPC_HEARTBEAT)
+    {
+      uint8_t echo = OPC_HEARTBEAT;
+
+      conn_reset_frame(c);
+
+      return conn_push(c, &echo, sizeof echo);
+    }
+
+    // Moving is only for players who exist
+    if (c->field[0] == OPC_MOVE && c->in_world)
+    {
+      c->stage = REG_STAGE_MOVE_X;
+      c->want  = sizeof be32;
+      break;
+    }
+
+    // Only the owner gets to hand out sessions; tell anybody else where that is before they send any more
+    if ((c->field[0] == OPC_RESUME || c->field[0] == OPC_REGISTER) && !player_is_mine(c->peer_ip))
+    {
+      return conn_redirect(c);
+    }
+
+    if (c->field[0] == OPC_RESUME)
+    {
+      c->stage = REG_STAGE_RESUME_ID;
+      c->want  = sizeof be32;
+      break;
+    }
+
+    // Ignore if received opcode isn't for this handler
+    if (c->field[0] != OPC_REGISTER)
+    {
+      return false;
+    }
+
+    c->stage = REG_STAGE_TAG_LEN;
+    c->want  = EXPECTED_NETWORK_ORDER_NAMETAG_LEN;
+    break;
+
+  case REG_STAGE_TAG_LEN:
+    memcpy(&be16, c->field, sizeof be16);
+    c->nametag_len = ntohs(be16);
+
+    // Requested nametag's length is within bounds
+    if (c->nametag_len >= MAX_STR_LEN)
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+
+    c->stage = REG_STAGE_WIDTH;
+    c->want  = EXPECTED_NETWORK_ORDER_AVATAR_WIDTH;
+    break;
+
+  case REG_STAGE_WIDTH:
+    memcpy(&be32, c->field, sizeof be32);
+    c->av_width = ntohl(be32); // u32 on the wire; ntohs() would chop it
+
+    c->stage = REG_STAGE_HEIGHT;
+    c->want  = EXPECTED_NETWORK_ORDER_AVATAR_HEIGHT;
+    break;
+
+  case REG_STAGE_HEIGHT:
+    memcpy(&be32, c->field, sizeof be32);
+    c->av_height = ntohl(be32);
+
+    // Requested dimensions are in bounds
+    if (c->av_width == 0 || c->av_height == 0 || c->av_width > MAX_AVATAR_W ||
+        c->av_height > MAX_AVATAR_H)
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+
+    c->stage = REG_STAGE_SIZE;
+    c->want  = EXPECTED_NETWORK_ORDER_AVATAR_SIZE;
+    break;
+
+  case REG_STAGE_SIZE:
+    memcpy(&be32, c->field, sizeof be32);
+    c->av_size = ntohl(be32);
+
+    c->stage = REG_STAGE_CHANNELS;
+    c->want  = EXPECTED_NETWORK_ORDER_AVATAR_CHANNELS;
+    break;
+
+  case REG_STAGE_CHANNELS:
+    c->av_channels = c->field[0]; // Single byte; nothing to swap
+
+    // Avatar image is either grayscale, RGB, or RGBA
+    if (!(c->av_channels == GRAYSCALE_CHANNEL_COUNT ||
+          c->av_channels == RGB_CHANNEL_COUNT || c->av_channels == RGBA_CHANNEL_COUNT))
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+
+    // Avatar image size coincides with its channel count and dimensions
+    // Dimensions are capped already, so this also means it fits in an avatar block
+    if (c->av_size != c->av_width * c->av_height * c->av_channels)
+    {
+      return reject_register(METRIC_REG_FAIL_HEADER);
+    }
+
+    c->av_encoding = AVATAR_RAW;
+
+    return conn_begin_payload(c);
+
+  case REG_STAGE_TAG:
+    c->stage = REG_STAGE_AVATAR;
+    c->want  = c->av_size;
+    break;
+
+  case REG_STAGE_AVATAR:
+    // Packed avatars get expanded to where raw pixels would have landed; the rest doesn't care
+    if (!conn_unpack_avatar(c))
+    {
+      return reject_register(METRIC_REG_FAIL_DECODE);
+    }
+
+    // Full frame is here; only now do we touch the player table
+    if (!handle_register(c))
+    {
+      return false;
+    }
+
+    conn_reset_frame(c);
+
+    return true;
+
+  case REG_STAGE_MOVE_X:
+    memcpy(&be32, c->field, sizeof be32);
+    c->move_x = (int32_t)ntohl(be32);
+
+    c->stage = REG_STAGE_MOVE_Y;
+    c->want  = sizeof be32;
+    break;
+
+  case REG_STAGE_MOVE_Y:
+    memcpy(&be32, c->field, sizeof be32);
+
+    // Nobody is told right away; the next world tick picks the new position up
+    if (!move_player(c->peer_ip, c->move_x, (int32_t)ntohl(be32)))
+    {
+      return false;
+    }
+
+    conn_reset_frame(c);
+
+    return true;
+
+  case REG_STAGE_RESUME_ID:
+    memcpy(&be32, c->field, sizeof be32);
+    c->resume_id = ntohl(be32);
+
+    c->stage = REG_STAGE_RESUME_HASH;
+    c->want  = sizeof(uint64_t);
+    break;
+
+  case REG_STAGE_RESUME_HASH:
+  {
+    uint64_t avatar_hash = 0;
+
+    // No ntohll(); spell out the big endian bytes
+    for (int i = 0; i < 8; ++i)
+    {
+      avatar_hash = avatar_hash << 8 | c->field[i];
+    }
+
+    if (!handle_resume(c, avatar_hash))
+    {
+      return false;
+    }
+
+    conn_reset_frame(c);
+
+    return true;
+  }
+
+  case REG_STAGE_V2_HEADER:
+    return conn_finish_v2_header(c);
+
+  case REG_STAGE_V2_REGISTER:
+    return conn_finish_v2_register(c);
+
+  case REG_STAGE_DISCARD:
+    // Never filled up; there's no end to what gets ignored
+    c->have = 0;
+
+    return true;
+  }
+
+  c->have = 0;
+
+  return true;
+}
+
+/**
+ * @brief Feed freshly received bytes into a connection's parser
+ * @param c The connection being parsed
+ * @param data The bytes that just arrived
+ * @param len Amt. of bytes in data
+ * @returns true if all bytes were consumed fine, false on a protocol error
+ */
+static bool conn_feed(Conn *c, const uint8_t *data, size_t len)
+{
+  for (;;)
+  {
+    // Zero-length stages (e.g. an empty nametag) complete without any input
+    if (c->have == c->want)
+    {
+      if (!conn_finish_stage(c))
+      {
+        return false;
+      }
+
+      continue;
+    }
+
+    if (len == 0)
+    {
+      return true;
+    }
+
+    size_t   take;
+    uint8_t *dst = conn_stage_dst(c, &take);
+
+    if (take > len)
+    {
+      take = len;
+    }
+
+    if (dst)
+    {
+      memcpy(dst, data, take);
+    }
+
+    c->have += take;
+    data += take;
+    len -= take;
+  }
+}
+
+/**
+ * @brief Account for bytes that readv() already put at conn_stage_dst()
+ * @param c The connection being parsed
+ * @param len Amt. of bytes that landed; never more than the current stage has room for
+ * @returns true if the frame is still valid, false on a protocol error
+ */
+static bool conn_advance(Conn *c, size_t len)
+{
+  c->have += len;
+
+  return c->have < c->want || conn_finish_stage(c);
+}
+
+/**
+ * @brief Is the parser somewhere in a REGISTER header (v1 or v2), before the tag?
+ * @param c The connection being parsed
+ */
+static bool conn_in_header(const Conn *c)
+{
+  return c->stage < REG_STAGE_TAG || c->stage == REG_STAGE_V2_HEADER || c->stage == REG_STAGE_V2_REGISTER;
+}
+
+/**
+ * @brief Header bytes still missing before the parser reaches the tag
+ * @param c The connection being parsed; must be in a header stage
+ */
+static size_t conn_header_left(const Conn *c)
+{
+  switch (c->stage)
+  {
+  case REG_STAGE_V2_HEADER:
+    // Might be a REGISTER yet; its fixed part comes right after
+    return c->want - c->have + V2_REGISTER_BYTES;
+  case REG_STAGE_V2_REGISTER:
+    return c->want - c->have;
+  default:
+    return REG_HEADER_BYTES - k_reg_stage_end[c->stage] + (c->want - c->have);
+  }
+}
+
+/**
+ * @brief Pull everything the socket has right now and run it through the parser
+ * @note Never blocks; we stop at EAGAIN and pick up where we left off on the next edge
+ * @param c The connection to read from
+ * @returns true to keep the connection, false if it closed, broke or sent garbage
+ */
+static bool conn_read(Conn *c)
+{
+  uint8_t chunk[CONN_RECV_CHUNK];
+
+  for (;;)
+  {
+    // Payload bytes go straight to their final home; only what follows them (or a header) hits the chunk
+    struct iovec iov[3];
+    int          direct = 0;
+
+    if (c->stage == REG_STAGE_TAG)
+    {
+      size_t   room;
+      uint8_t *dst = conn_stage_dst(c, &room);
+
+      if (dst)
+      {
+        iov[direct++] = (struct iovec){.iov_base = dst, .iov_len = room};
+
+        // The pixels can only follow if the tag is being kept whole; dropped tag bytes go through the chunk
+        if (room == c->want - c->have)
+        {
+          iov[direct++] = (struct iovec){.iov_base = c->av_dst, .iov_len = c->av_size};
+        }
+      }
+    }
+    else if (c->stage == REG_STAGE_AVATAR)
+    {
+      size_t   room;
+      uint8_t *dst = conn_stage_dst(c, &room);
+
+      iov[direct++] = (struct iovec){.iov_base = dst, .iov_len = room};
+    }
+
+    // Stop at the end of a header, so the payload after it isn't pulled into the chunk
+    size_t chunk_len = sizeof chunk;
+
+    if (direct == 0 && conn_in_header(c))
+    {
+      chunk_len = conn_header_left(c);
+    }
+
+    iov[direct] = (struct iovec){.iov_base = chunk, .iov_len = chunk_len};
+
+    ssize_t nbytes = readv(c->fd, iov, direct + 1);
+
+    // If we get 0 bytes, the peer is closed
+    if (nbytes == 0)
+    {
+      return false;
+    }
+
+    if (nbytes < 0)
+    {
+      if (errno == EINTR)
+      {
+        metrics_inc(METRIC_EINTR_RETRIES);
+        continue;
+      }
+
+      // Drained; edge-triggered loop will wake us when more shows up
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return true;
+      }
+
+      return false;
+    }
+
+    size_t left = (size_t)nbytes;
+
+    metrics_add(METRIC_TCP_BYTES_IN, left);
+
+    for (int i = 0; i < direct && left > 0; ++i)
+    {
+      size_t take = left < iov[i].iov_len ? left : iov[i].iov_len;
+
+      if (!conn_advance(c, take))
+      {
+        return false;
+      }
+
+      left -= take;
+    }
+
+    if (left > 0 && !conn_feed(c, chunk, left))
+    {
+      return false;
+    }
+  }
+}
+
+// ==============================================================================
+// NETWORK THREAD
+// ==============================================================================
+
+/*
+ * Threading model:
+ *
+ * - One acceptor (net_thread_main) owns the listener. It accepts, and hands every new fd
+ *   to whichever reactor currently has the fewest connections.
+ * - N reactors each own a slice of the clients plus their own event loop. Nobody else
+ *   ever touches a reactor's client table, so it needs no lock.
+ * - Handoff goes through a pipe per reactor; the pipe IS the queue, and writing to it
+ *   also wakes the reactor up.
+ *
+ * The players table has its own locking; see GLOBAL SHARED STATE.
+ */
+
+typedef struct
+{
+  int      listen_fd;
+  size_t   reactor_count;   // 0 = one per online CPU
+  size_t   max_clients;     // Per reactor; 0 = MAX_CLIENTS
+  size_t   max_players;     // 0 = MAX_PLAYERS
+  uint32_t idle_timeout_ms; // 0 = CONN_IDLE_TIMEOUT_MS
+  int      udp_fd;          // Bound UDP socket for the fast path; only looked at if udp_port is set
+  uint16_t udp_port;        // Host order; 0 = TCP only
+  int64_t  admit_rate;      // New connections per second; < 0 = ADMIT_RATE, 0 = unlimited
+  ListenOptions listen_opts; // What listen_fd was opened with; the per-connection ones get applied at accept
+} NetArgs; // FIXME: This is probably not necessary; why do we pack it like this? Do we receive this in generic form?
+
+typedef struct
+{
+  int      fd;
+  uint32_t peer_ip;
+} Handoff; // What the acceptor pushes through a reactor's pipe; well below PIPE_BUF, so writes are atomic
+
+
+/**
+ * @brief Turn a fresh connection away with a BUSY, then close it
+ * @note The socket's send buffer is empty this early, so three bytes never have to wait
+ * @param fd The connection; closed by the time this returns
+ * @param retry_ms What to tell the client to wait; capped to what fits the field
+ * @param reason Which METRIC_REJECT_* to count it under
+ */
+static void reject_busy(int fd, uint32_t retry_ms, MetricCounter reason)
+{
+  uint8_t  busy[BUSY_BYTES];
+  uint16_t be_retry = htons(retry_ms > UINT16_MAX ? UINT16_MAX : (uint16_t)retry_ms);
+
+  busy[0] = OPC_BUSY;
+  memcpy(&busy[1], &be_retry, sizeof be_retry);
+
+  // Best effort; a peer that's already gone just doesn't hear it
+  ssize_t ignored = send(fd, busy, sizeof busy, 0);
+  (void)ignored;
+
+  metrics_inc(reason);
+  close(fd);
+}
+
+#define WORLD_PACKET_CACHE 8  // Encodings a reactor keeps per tick; clients sharing a view share one
+
+// The whole packet has to fit in an empty ring, or it could never go out; a v2 frame is 8 bytes longer
+// than the v1 packet, and the cache serves both framings, so everyone gets the v2 limit
+#define WORLD_MAX_PACKET (BYTE_RING_CAP - (V2_HEADER_BYTES - 1))
+
+typedef struct
+{
+  uint32_t  tick; // What tick this was encoded for; anything older is as good as empty
+  WorldView view;
+  size_t    len; // Header + body
+  uint8_t   bytes[WORLD_MAX_PACKET];
+} WorldPacket; // A WORLD packet, ready to push to every client with the same view
+
+typedef struct Reactor
+{
+  size_t     id;
+  pthread_t  thread;
+  EventLoop *loop;
+  int        handoff_fds[2]; // [0] = read end (reactor), [1] = write end (acceptor)
+
+  Slab clients; // Conn objects; owned by this reactor's thread only
+  bool ring_io; // Does the loop do the recv()s and writev()s itself? See evloop_enable_ring_io()
+
+  // Idle eviction; also what decides how long a wait may sleep
+  TimerWheel timers;
+  int64_t    now_ms; // Refreshed once per wakeup; plenty precise for idle timers
+  uint32_t   idle_timeout_ms;
+
+  // World broadcasts; runs only while this reactor has clients
+  TimerNode   world_timer;
+  TimerNode   flush_timer; // Store flushes; only reactor 0 runs these
+  WorldPacket world_cache[WORLD_PACKET_CACHE];
+  Datagram    udp_out[UDP_BATCH]; // WORLD datagrams waiting for this tick's sendmmsg()
+  size_t      udp_count;
+
+  atomic_size_t load; // Amt. of connections assigned; read by the acceptor to balance
+} Reactor;
+
+static Reactor *g_reactors      = NULL;
+static size_t   g_reactor_count = 0;
+
+/**
+ * @brief Milliseconds on a clock that never jumps; only good for measuring intervals
+ */
+static int64_t monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Add a new client to a reactor's clients table
+ * @note Only ever called from the reactor's own thread
+ * @note The fd is registered with the event loop here, once; it stays registered until removal
+ * @param r The reactor that will own the client
+ * @param fd The file descriptor of that client's socket; must already be non-blocking
+ * @param peer_ip The client's player key; their IPv4 address, network order, unless they came over IPv6
+ * @returns true if the client was added, false if the table is full or registration failed
+ */
+static bool reactor_add_client(Reactor *r, int fd, uint32_t peer_ip)
+{
+  // Add new client if we have room for them; the slab enforces the cap
+  SlabHandle handle;
+  Conn      *c = (Conn *)slab_alloc(&r->clients, &handle);
+  if (!c)
+  {
+    return false;
+  }
+
+  c->fd      = fd;
+  c->peer_ip = peer_ip;
+  c->slot    = handle.index;
+  conn_reset_frame(c);
+
+  // Edge-triggered: we only hear about this fd again once NEW data arrives
+  // That means whoever handles the wakeup has to drain the socket; see conn_read()
+  // With ring I/O the loop does the reading and hands us the bytes instead; see serve_client()
+  if ((r->ring_io ? evloop_recv(r->loop, fd, c) : evloop_add(r->loop, fd, EVT_READ | EVT_EDGE, c)) < 0)
+  {
+    perror("server: evloop_add");
+    slab_free(&r->clients, c->slot);
+
+    return false;
+  }
+
+  // Start the idle clock; anyone who connects and says nothing gets dropped too
+  timer_schedule(&r->timers, &c->idle, r->now_ms + r->idle_timeout_ms);
+
+  // First client in; the world starts ticking for this reactor
+  if (!timer_pending(&r->world_timer))
+  {
+    timer_schedule(&r->timers, &r->world_timer, r->now_ms + WORLD_TICK_MS);
+  }
+
+  return true;
+}
+
+/**
+ * @brief Is this connection still in its reactor's table?
+ * @note Only meaningful within one batch of events; a freed slot can be handed to someone new after that
+ * @note One that's only waiting for its last send to come back isn't; see conn_sent()
+ */
+static bool conn_live(const Reactor *r, const Conn *c)
+{
+  return slab_live(&r->clients, c->slot) && slab_at(&r->clients, c->slot) == c && !c->closing;
+}
+
+/**
+ * @brief Removes a client from a reactor's clients table
+ * @note Only ever called from the reactor's own thread
+ * @note Unregisters the fd from the event loop and frees the connection, but does NOT close the fd
+ * @note Nobody else moves; the slot just goes on the free list for the next client
+ * @note Removing a client twice is a no-op; the slab keeps the memory around, so c->slot is still there to check
+ * @note With a ring send still out, the slot and the fd stay until it's back; conn_sent() frees and closes them then
+ * @param r The reactor owning the client
+ * @param c The client we wish to remove
+ * @returns false if it was already gone, or conn_sent() is closing it; leave its fd alone either way
+ */
+static bool reactor_remove_client(Reactor *r, Conn *c)
+{
+  if (!conn_live(r, c))
+  {
+    return false;
+  }
+
+  evloop_del(r->loop, c->fd);
+  timer_cancel(&r->timers, &c->idle);
+  conn_reset_frame(c);
+
+  // A half-received avatar never reached a player; it's still ours to give back
+  free_avatar_block(c->av_block);
+  c->av_block = NULL;
+
+  atomic_fetch_sub(&r->load, 1);
+
+  // The kernel may still be reading out of c->out; evloop_del() cancelled the send, but it has to come back first
+  if (c->sending)
+  {
+    c->closing = true;
+
+    return false;
+  }
+
+  slab_free(&r->clients, c->slot);
+
+  return true;
+}
+
+/**
+ * @brief Send as much of a client's outbound queue as the socket takes right now
+ * @note Never blocks; everything queued goes out through one writev() per pass
+ * @note While bytes are left over, the fd is also watched for EVT_WRITE; that's dropped again once the queue drains
+ * @note With ring I/O, the writev() is queued instead; it goes out with the next wait, alongside every other
+ * connection's, and conn_sent() picks up from there
+ * @param r The reactor owning the client
+ * @param c The client to flush
+ * @returns true to keep the connection, false if the socket broke
+ */
+static bool conn_flush(Reactor *r, Conn *c)
+{
+  if (r->ring_io)
+  {
+    // One at a time; what gets queued meanwhile goes once it's back
+    if (c->sending || ring_empty(&c->out))
+    {
+      return true;
+    }
+
+    int count = ring_iov(&c->out, c->send_iov);
+
+    if (evloop_send(r->loop, c->fd, c->send_iov, count, c) < 0)
+    {
+      return false;
+    }
+
+    c->sending = true;
+
+    return true;
+  }
+
+  while (!ring_empty(&c->out))
+  {
+    struct iovec iov[2];
+    int          count = ring_iov(&c->out, iov);
+    ssize_t      nsent = writev(c->fd, iov, count);
+
+    if (nsent < 0)
+    {
+      if (errno == EINTR)
+      {
+        metrics_inc(METRIC_EINTR_RETRIES);
+        continue;
+      }
+
+      // Socket buffer is full; the edge-triggered loop tells us once it has room again
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        if (!c->want_write)
+        {
+          if (evloop_mod(r->loop, c->fd, EVT_READ | EVT_WRITE | EVT_EDGE, c) < 0)
+          {
+            return false;
+          }
+
+          c->want_write = true;
+        }
+
+        return true;
+      }
+
+      return false;
+    }
+
+    ring_consume(&c->out, (size_t)nsent);
+    metrics_add(METRIC_TCP_BYTES_OUT, (size_t)nsent);
+  }
+
+  // All caught up; stop hearing about writability
+  if (c->want_write)
+  {
+    if (evloop_mod(r->loop, c->fd, EVT_READ | EVT_EDGE, c) < 0)
+    {
+      return false;
+    }
+
+    c->want_write = false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief A client is gone (hung up, broke, or went quiet); mark their player offline and close them
+ * @param r The reactor owning the client
+ * @param c The client's connection; freed by the time this returns
+ */
+static void reactor_disconnect_client(Reactor *r, Conn *c)
+{
+  if (!conn_live(r, c))
+  {
+    return;
+  }
+
+  // Find the player registered under this IP and mark them as disconnected
+  int fd = c->fd;
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  // A replica is connected somewhere else; it's not a redirected connection's to disconnect
+  // Nor is anyone this connection never registered; another one from their IP may still be playing
+  Player *client_player = c->in_world && player_is_mine(c->peer_ip) ? find_player_by_ip(c->peer_ip) : NULL;
+  if (client_player && client_player->player_id != c->player_id)
+  {
+    client_player = NULL;
+  }
+
+  if (client_player)
+  {
+    pthread_mutex_t *lock = player_lock(client_player->ip);
+
+    pthread_mutex_lock(lock);
+    client_player->connected = false;
+    client_player->last_seen = time(NULL); // Eviction picks whoever left longest ago
+    persist_player_locked(client_player);
+    pthread_mutex_unlock(lock);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  // They should vanish from the screen
+  if (client_player)
+  {
+    notify_renderer();
+  }
+
+  if (reactor_remove_client(r, c))
+  {
+    close(fd);
+  }
+}
+
+/**
+ * @brief A ring send came back; account for it, then send whatever got queued meanwhile
+ * @note Also where a connection removed while its send was out finally goes, fd and all
+ * @param r The reactor owning the client
+ * @param c The client's connection
+ * @param res Bytes written, or -errno
+ */
+static void conn_sent(Reactor *r, Conn *c, int32_t res)
+{
+  c->sending = false;
+
+  if (c->closing)
+  {
+    int fd = c->fd;
+
+    c->closing = false;
+    slab_free(&r->clients, c->slot);
+    close(fd);
+
+    return;
+  }
+
+  if (res < 0)
+  {
+    reactor_disconnect_client(r, c);
+
+    return;
+  }
+
+  ring_consume(&c->out, (size_t)res);
+  metrics_add(METRIC_TCP_BYTES_OUT, (size_t)res);
+
+  if (!conn_flush(r, c))
+  {
+    reactor_disconnect_client(r, c);
+  }
+}
+
+/**
+ * @brief Service a client whose socket the event loop reported as ready (or, with ring I/O, got bytes or finished a send)
+ * @param r The reactor owning the client
+ * @param c The client's connection
+ * @param ev What the loop reported for it
+ */
+static void serve_client(Reactor *r, Conn *c, const LoopEvent *ev)
+{
+  bool     keep   = true;
+  uint32_t events = ev->events;
+
+  // Comes back whatever became of the connection since; it might be all that's keeping it around
+  if (events & EVT_SENT)
+  {
+    conn_sent(r, c, ev->res);
+
+    return;
+  }
+
+  // Gone earlier in this batch; nothing left to serve
+  if (!conn_live(r, c))
+  {
+    evloop_recycle(r->loop, ev);
+
+    return;
+  }
+
+  // The loop read it for us; it just has to go through the parser
+  if (events & EVT_RECV)
+  {
+    timer_schedule(&r->timers, &c->idle, r->now_ms + r->idle_timeout_ms);
+    metrics_add(METRIC_TCP_BYTES_IN, (size_t)ev->res);
+
+    keep = conn_feed(c, ev->data, (size_t)ev->res);
+    evloop_recycle(r->loop, ev);
+  }
+  // Hang-ups with data still queued show up as READ | HUP; read what's left first
+  else if (events & EVT_READ)
+  {
+    // Hearing from them at all counts as a sign of life; just move their timer back
+    timer_schedule(&r->timers, &c->idle, r->now_ms + r->idle_timeout_ms);
+
+    keep = conn_read(c);
+  }
+  else if (events & (EVT_HUP | EVT_ERR))
+  {
+    keep = false;
+  }
+
+  // Whatever the reads queued up (or a write wakeup left pending) goes out in one go
+  if (keep && conn_flush(r, c))
+  {
+    return;
+  }
+
+  reactor_disconnect_client(r, c);
+}
+
+/**
+ * @brief Get the WORLD packet for a view, encoding it unless another client already needed the same one
+ * @param r The reactor owning the cache
+ * @param tick The tick being broadcast
+ * @param view What the client sees, from world_view()
+ * @returns The packet, or NULL if none can be made for that view
+ */
+static const WorldPacket *reactor_world_packet(Reactor *r, uint32_t tick, const WorldView *view)
+{
+  size_t       hash = ((size_t)view->base_tick * 31 + view->base_cell) * 31 + view->cell;
+  WorldPacket *pkt  = &r->world_cache[hash % WORLD_PACKET_CACHE];
+
+  if (pkt->tick == tick && memcmp(&pkt->view, view, sizeof *view) == 0)
+  {
+    return pkt;
+  }
+
+  size_t body_len;
+
+  // Bigger than WORLD_MAX_PACKET can't be queued in either framing; see there
+  if (!world_encode_delta(tick, view, pkt->bytes + WORLD_HEADER_BYTES, sizeof pkt->bytes - WORLD_HEADER_BYTES,
+                          &body_len))
+  {
+    pkt->tick = 0;
+
+    return NULL;
+  }
+
+  uint32_t be_tick = htonl(tick);
+  uint32_t be_base = htonl(view->base_tick);
+  uint16_t be_len  = htons((uint16_t)body_len);
+
+  pkt->bytes[0] = OPC_WORLD;
+  memcpy(&pkt->bytes[1], &be_tick, sizeof be_tick);
+  memcpy(&pkt->bytes[5], &be_base, sizeof be_base);
+  memcpy(&pkt->bytes[9], &be_len, sizeof be_len);
+
+  pkt->tick = tick;
+  pkt->view = *view;
+  pkt->len  = WORLD_HEADER_BYTES + body_len;
+
+  return pkt;
+}
+
+/**
+ * @brief Send every WORLD datagram queued this tick, in as few sendmmsg() calls as possible
+ * @param r The reactor
+ */
+static void reactor_flush_datagrams(Reactor *r)
+{
+  if (r->udp_count > 0)
+  {
+    size_t sent  = udp_send_batch(g_udp_fd, r->udp_out, r->udp_count);
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < sent; ++i)
+    {
+      bytes += r->udp_out[i].len;
+    }
+
+    metrics_add(METRIC_UDP_BYTES_OUT, bytes);
+    r->udp_count = 0;
+  }
+}
+
+/**
+ * @brief Queue a WORLD packet as a datagram; goes out with the rest of the tick's, see reactor_flush_datagrams()
+ * @param r The reactor
+ * @param pkt The packet; must fit in UDP_MAX_PAYLOAD
+ * @param ip Destination address, network order
+ * @param port Destination port, network order
+ */
+static void reactor_queue_datagram(Reactor *r, const WorldPacket *pkt, uint32_t ip, uint16_t port)
+{
+  if (r->udp_count == UDP_BATCH)
+  {
+    reactor_flush_datagrams(r);
+  }
+
+  Datagram *d = &r->udp_out[r->udp_count++];
+
+  memset(&d->addr, 0, sizeof d->addr);
+  d->addr.sin_family      = AF_INET;
+  d->addr.sin_addr.s_addr = ip;
+  d->addr.sin_port        = port;
+  d->len                  = pkt->len;
+  memcpy(d->data, pkt->bytes, pkt->len);
+}
+
+/**
+ * @brief One world tick: capture where everybody is, then send each of our clients what changed for them
+ * @param r The reactor whose world timer fired
+ */
+static void reactor_world_tick(Reactor *r)
+{
+  TRACE_SCOPE("reactor.world_tick");
+
+  uint32_t tick = (uint32_t)(r->now_ms / WORLD_TICK_MS) + 1; // Tick 0 is the empty world
+
+  // Whichever reactor gets here first does the capture; the rest just encode from it
+  if (world_capture(tick))
+  {
+    notify_renderer();
+  }
+
+  for (uint32_t i = 0; i < r->clients.high_water; ++i)
+  {
+    if (!slab_live(&r->clients, i))
+    {
+      continue;
+    }
+
+    Conn *c = (Conn *)slab_at(&r->clients, i);
+
+    if (c->closing || !c->in_world || c->world_tick == tick)
+    {
+      continue;
+    }
+
+    // Over UDP, nothing counts until the client says so; diff against what they acknowledged
+    uint32_t ip, ack_tick;
+    uint16_t port;
+    bool     udp  = g_udp_fd >= 0 && get_player_udp_peer(c->player_slot, c->player_id, &ip, &port, &ack_tick);
+    uint32_t base = udp ? ack_tick : c->world_tick;
+
+    WorldView          view;
+    const WorldPacket *pkt;
+
+    if (!world_view(tick, base, c->player_slot, c->player_id, &view) || !(pkt = reactor_world_packet(r, tick, &view)))
+    {
+      continue;
+    }
+
+    // Nothing changed around them; they're caught up without a single byte
+    if (pkt->len == WORLD_HEADER_BYTES)
+    {
+      c->world_tick = tick;
+
+      continue;
+    }
+
+    // Until they ack, they get their (growing) delta again every tick; that's what makes loss harmless
+    if (udp && pkt->len <= UDP_MAX_PAYLOAD)
+    {
+      reactor_queue_datagram(r, pkt, ip, port);
+      c->world_tick = tick;
+
+      continue;
+    }
+
+    // Not enough room right now; they keep their baseline and catch up later
+    if (!conn_push(c, pkt->bytes, pkt->len))
+    {
+      continue;
+    }
+
+    c->world_tick = tick;
+
+    if (!conn_flush(r, c))
+    {
+      reactor_disconnect_client(r, c);
+    }
+  }
+
+  reactor_flush_datagrams(r);
+
+  if (r->clients.live > 0)
+  {
+    timer_schedule(&r->timers, &r->world_timer, r->now_ms + WORLD_TICK_MS);
+  }
+}
+
+/**
+ * @brief Something on the reactor's wheel expired: the world tick, a store flush or some connection's idle timer
+ * @param node The expired timer
+ * @param arg The reactor owning it
+ */
+static void reactor_on_timer(TimerNode *node, void *arg)
+{
+  Reactor *r = (Reactor *)arg;
+
+  if (node == &r->world_timer)
+  {
+    reactor_world_tick(r);
+
+    return;
+  }
+
+  if (node == &r->flush_timer)
+  {
+    flush_player_store();
+    timer_schedule(&r->timers, &r->flush_timer, r->now_ms + STORE_FLUSH_MS);
+
+    return;
+  }
+
+  // They've been quiet too long, so drop them
+  reactor_disconnect_client(r, (Conn *)((char *)node - offsetof(Conn, idle)));
+}
+
+/**
+ * @brief Adopt every connection the acceptor has queued up for us
+ * @param r The reactor whose handoff pipe became readable
+ */
+static void reactor_drain_handoffs(Reactor *r)
+{
+  Handoff h;
+
+  for (;;)
+  {
+    ssize_t nbytes = read(r->handoff_fds[0], &h, sizeof h);
+
+    if (nbytes < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    // EAGAIN (drained), EOF or a short read; either way nothing more to adopt
+    if (nbytes != (ssize_t)sizeof h)
+    {
+      return;
+    }
+
+    // No socket; the acceptor is just waking us up to notice g_running
+    if (h.fd < 0)
+    {
+      continue;
+    }
+
+    if (!reactor_add_client(r, h.fd, h.peer_ip))
+    {
+      // No room for them after all; tell them so, and don't leak the socket
+      reject_busy(h.fd, BUSY_FULL_RETRY_MS, METRIC_REJECT_FULL);
+      atomic_fetch_sub(&r->load, 1);
+    }
+  }
+}
+
+/**
+ * @brief Close a connection right away, whatever is still queued for it
+ */
+static void reactor_drop_client(Reactor *r, Conn *c)
+{
+  int fd = c->fd;
+
+  if (reactor_remove_client(r, c))
+  {
+    close(fd);
+  }
+}
+
+/**
+ * @brief One wait while shutting down: flush whoever has room now, drop whoever hung up
+ * @note Anything clients still send comes too late to matter
+ * @param r The reactor shutting down
+ * @param timeout_ms How long to wait at most
+ */
+static void reactor_goodbye_wait(Reactor *r, int timeout_ms)
+{
+  LoopEvent events[NET_MAX_EVENTS];
+  int       ready = evloop_wait(r->loop, events, NET_MAX_EVENTS, timeout_ms);
+
+  for (int e = 0; e < ready; ++e)
+  {
+    // New handoffs are left in the pipe; reactor_destroy() closes those
+    if (events[e].udata == r)
+    {
+      continue;
+    }
+
+    Conn *c = (Conn *)events[e].udata;
+
+    evloop_recycle(r->loop, &events[e]);
+
+    if (events[e].events & EVT_SENT)
+    {
+      conn_sent(r, c, events[e].res);
+
+      continue;
+    }
+
+    // Hung up, or broke on the flush; either way they're not getting the byte
+    if (conn_live(r, c) && ((events[e].events & (EVT_HUP | EVT_ERR)) || !conn_flush(r, c)))
+    {
+      reactor_drop_client(r, c);
+    }
+  }
+}
+
+/**
+ * @brief Gracefully shut down by notifying clients, then close every connection
+ * @note The goodbye byte is queued like any other message; clients whose socket buffer is full
+ * get up to SHUTDOWN_GRACE_MS to make room, and nobody is ever waited on alone
+ * @param r The reactor shutting down
+ */
+static void reactor_say_goodbye(Reactor *r)
+{
+  uint8_t bye = OPC_SHUTDOWN;
+
+  for (uint32_t i = 0; i < r->clients.high_water; ++i)
+  {
+    if (!slab_live(&r->clients, i) || ((Conn *)slab_at(&r->clients, i))->closing)
+    {
+      continue;
+    }
+
+    Conn *c = (Conn *)slab_at(&r->clients, i);
+
+    if (!conn_push(c, &bye, sizeof bye) || !conn_flush(r, c))
+    {
+      reactor_drop_client(r, c);
+    }
+  }
+
+  // Keep flushing whoever still has bytes queued; stop as soon as everyone is done or time is up
+  int64_t deadline = monotonic_ms() + SHUTDOWN_GRACE_MS;
+
+  for (;;)
+  {
+    bool pending = false;
+
+    for (uint32_t i = 0; i < r->clients.high_water && !pending; ++i)
+    {
+      Conn *c = (Conn *)slab_at(&r->clients, i);
+
+      pending = slab_live(&r->clients, i) && !c->closing && (c->sending || !ring_empty(&c->out));
+    }
+
+    int64_t left = deadline - monotonic_ms();
+
+    if (!pending || left <= 0)
+    {
+      break;
+    }
+
+    reactor_goodbye_wait(r, (int)left);
+  }
+
+  // The byte is either out or not coming; close everyone
+  for (uint32_t i = 0; i < r->clients.high_water; ++i)
+  {
+    if (slab_live(&r->clients, i))
+    {
+      reactor_drop_client(r, (Conn *)slab_at(&r->clients, i));
+    }
+  }
+
+  // Ring sends still out (cancelled by now) read from their connection's queue; the slab can't go before they're back
+  deadline = monotonic_ms() + SHUTDOWN_GRACE_MS;
+
+  while (r->clients.live > 0 && monotonic_ms() < deadline)
+  {
+    reactor_goodbye_wait(r, (int)(deadline - monotonic_ms()));
+  }
+}
+
+static void *reactor_main(void *arg_)
+{
+  Reactor *r = (Reactor *)arg_;
+
+  TRACE_THREAD_NAME("reactor %zu", r->id);
+
+  // Network handling loop
+  while (g_running)
+  {
+    // Evict whoever went quiet, then sleep until either a socket is ready or the next timer is due
+    // With nobody connected that's forever; the acceptor wakes us through the pipe to stop
+    r->now_ms = monotonic_ms();
+
+    TRACE_BEGIN(timers_span, "reactor.timers");
+    timer_advance(&r->timers, r->now_ms, reactor_on_timer, r);
+    TRACE_END(timers_span);
+
+    // Only the sockets that are actually ready come back; no set rebuilding, no scanning
+    LoopEvent events[NET_MAX_EVENTS];
+
+    TRACE_BEGIN(wait_span, "reactor.wait");
+    int ready = evloop_wait(r->loop, events, NET_MAX_EVENTS, timer_next_timeout(&r->timers, r->now_ms));
+    TRACE_END(wait_span);
+
+    if (ready < 0)
+    {
+      // Retry if we were interrupted by async bullshit
+      if (errno == EINTR)
+      {
+        metrics_inc(METRIC_EINTR_RETRIES);
+        continue;
+      }
+
+      perror("server: evloop_wait");
+
+      break;
+    }
+
+    TRACE_SCOPE("reactor.events");
+
+    bool handoffs = false;
+
+    for (int e = 0; e < ready; ++e)
+    {
+      // The reactor itself is registered as the udata of its handoff pipe
+      if (events[e].udata == r)
+      {
+        handoffs = true;
+
+        continue;
+      }
+
+      serve_client(r, (Conn *)events[e].udata, &events[e]);
+    }
+
+    // Adopting only after the batch means no slot freed in it gets handed to someone new while
+    // a later event in the same batch still points there
+    if (handoffs)
+    {
+      reactor_drain_handoffs(r);
+    }
+  }
+
+  reactor_say_goodbye(r);
+
+  return NULL;
+}
+
+/**
+ * @brief Set up a reactor's event loop and handoff pipe
+ * @param r The (zeroed) reactor to initialize
+ * @param id Its index in g_reactors; only used for logs
+ * @param max_clients Cap on connections this reactor will take
+ * @param idle_timeout_ms How long a connection may stay quiet before it's dropped
+ * @returns true on success, false on failure
+ */
+static bool reactor_init(Reactor *r, size_t id, size_t max_clients, uint32_t idle_timeout_ms)
+{
+  r->id              = id;
+  r->handoff_fds[0]  = r->handoff_fds[1] = -1;
+  r->now_ms          = monotonic_ms();
+  r->idle_timeout_ms = idle_timeout_ms;
+  atomic_init(&r->load, 0);
+  slab_init(&r->clients, sizeof(Conn), max_clients);
+  timer_wheel_init(&r->timers, TIMER_TICK_MS, r->now_ms);
+
+  // One flusher is plenty; it's just msync() on whatever pages changed
+  if (id == 0 && player_store_enabled())
+  {
+    timer_schedule(&r->timers, &r->flush_timer, r->now_ms + STORE_FLUSH_MS);
+  }
+
+  r->loop = evloop_create();
+  if (!r->loop)
+  {
+    perror("server: evloop_create");
+
+    return false;
+  }
+
+  // Where the backend can't, connections just go through readiness and conn_read()/conn_flush() as always
+  r->ring_io = evloop_enable_ring_io(r->loop, RING_RECV_BUFFERS) == 0;
+
+  // Only the read end is non-blocking; if a reactor is that far behind, the acceptor can wait
+  if (pipe(r->handoff_fds) < 0 || set_nonblocking(r->handoff_fds[0]) < 0 ||
+      evloop_add(r->loop, r->handoff_fds[0], EVT_READ | EVT_EDGE, r) < 0)
+  {
+    perror("server: reactor_init");
+
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Undo reactor_init(); safe on a partially initialized reactor
+ * @param r The reactor to tear down
+ */
+static void reactor_destroy(Reactor *r)
+{
+  // Anything still sitting in the pipe never got adopted; close those fds too
+  if (r->handoff_fds[0] >= 0)
+  {
+    Handoff h;
+    while (read(r->handoff_fds[0], &h, sizeof h) == (ssize_t)sizeof h)
+    {
+      if (h.fd >= 0)
+      {
+        close(h.fd);
+      }
+    }
+
+    close(r->handoff_fds[0]);
+  }
+
+  if (r->handoff_fds[1] >= 0)
+  {
+    close(r->handoff_fds[1]);
+  }
+
+  evloop_destroy(r->loop);
+  slab_destroy(&r->clients);
+}
+
+/**
+ * @brief Pick the reactor with the fewest connections
+ * @note Loads are read without any lock; a slightly stale answer is fine for balancing
+ * @returns The least-loaded reactor
+ */
+static Reactor *pick_reactor(void)
+{
+  Reactor *best      = &g_reactors[0];
+  size_t   best_load = atomic_load(&best->load);
+
+  for (size_t i = 1; i < g_reactor_count && best_load > 0; ++i)
+  {
+    size_t load = atomic_load(&g_reactors[i].load);
+    if (load < best_load)
+    {
+      best      = &g_reactors[i];
+      best_load = load;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * @brief Set up request_stop()'s pipe and have the acceptor's loop watch it
+ * @param loop The acceptor's event loop
+ * @returns true on success, false on failure
+ */
+static bool open_wake_pipe(EventLoop *loop)
+{
+  int fds[2];
+
+  if (pipe(fds) < 0)
+  {
+    return false;
+  }
+
+  g_wake_rd = fds[0];
+  atomic_store(&g_wake_wr, fds[1]);
+
+  return set_nonblocking(fds[0]) == 0 && set_nonblocking(fds[1]) == 0 &&
+         evloop_add(loop, g_wake_rd, EVT_READ, &g_wake_rd) == 0;
+}
+
+/**
+ * @brief Tear down request_stop()'s pipe; the write end goes first so a late signal finds nothing to write to
+ */
+static void close_wake_pipe(void)
+{
+  int wr = atomic_exchange(&g_wake_wr, -1);
+
+  if (wr >= 0)
+  {
+    close(wr);
+  }
+
+  if (g_wake_rd >= 0)
+  {
+    close(g_wake_rd);
+    g_wake_rd = -1;
+  }
+}
+
+#define UDP_DRAIN_BATCHES 4 // recvmmsg() calls per wakeup before accept() gets a turn again
+
+/**
+ * @brief Decode a client-to-server state datagram
+ * @param d The datagram
+ * @param u Receives the update
+ * @returns false if it isn't one
+ */
+static bool parse_udp_state(const Datagram *d, UdpUpdate *u)
+{
+  if (d->len != UDP_STATE_BYTES || d->data[0] != OPC_MOVE)
+  {
+    return false;
+  }
+
+  uint32_t be32[5];
+
+  memcpy(&be32[0], d->data + 1, 4);
+  memcpy(&be32[1], d->data + 13, 4);
+  memcpy(&be32[2], d->data + 17, 4);
+  memcpy(&be32[3], d->data + 21, 4);
+  memcpy(&be32[4], d->data + 25, 4);
+
+  u->player_id = ntohl(be32[0]);
+  u->token     = 0;
+
+  for (int i = 0; i < 8; ++i)
+  {
+    u->token = u->token << 8 | d->data[5 + i];
+  }
+
+  u->seq      = ntohl(be32[1]);
+  u->ack_tick = ntohl(be32[2]);
+  u->pos_x    = (int32_t)ntohl(be32[3]);
+  u->pos_y    = (int32_t)ntohl(be32[4]);
+  u->src_ip   = d->addr.sin_addr.s_addr;
+  u->src_port = d->addr.sin_port;
+
+  return true;
+}
+
+/**
+ * @brief Apply whatever state datagrams are waiting, a batch per recvmmsg()
+ * @note Level-triggered; anything left after UDP_DRAIN_BATCHES wakes us right back up
+ */
+static void net_drain_udp(void)
+{
+  TRACE_SCOPE("acceptor.drain_udp");
+
+  Datagram batch[UDP_BATCH];
+
+  for (int round = 0; round < UDP_DRAIN_BATCHES; ++round)
+  {
+    size_t n = udp_recv_batch(g_udp_fd, batch, UDP_BATCH);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      UdpUpdate u;
+
+      metrics_add(METRIC_UDP_BYTES_IN, batch[i].len);
+
+      // Stale, duplicate, forged or junk; all the same to us, drop it
+      if (parse_udp_state(&batch[i], &u))
+      {
+        apply_udp_update(&u);
+      }
+    }
+
+    if (n < UDP_BATCH)
+    {
+      return;
+    }
+  }
+}
+
+typedef struct
+{
+  uint64_t rate;        // Tokens per second; 0 = unlimited
+  uint64_t millitokens; // Banked, in thousandths of a token; never more than a second's worth
+  int64_t  last_ms;     // When it was last topped up
+} AdmitBucket; // Token bucket deciding which new connections get in; acceptor only
+
+/**
+ * @brief Top the bucket up for the time that passed, then take a token if there is one
+ * @param b The bucket
+ * @param now_ms Current time, monotonic_ms()
+ * @param retry_ms Receives how long until the next token, if there wasn't one
+ * @returns true if the connection may come in
+ */
+static bool admit_take(AdmitBucket *b, int64_t now_ms, uint32_t *retry_ms)
+{
+  if (b->rate == 0)
+  {
+    return true;
+  }
+
+  // rate tokens/s is rate millitokens/ms; filling past a full second's worth would just be thrown away
+  uint64_t cap     = b->rate * 1000;
+  uint64_t elapsed = now_ms > b->last_ms ? (uint64_t)(now_ms - b->last_ms) : 0;
+
+  b->millitokens = elapsed >= 1000 ? cap : b->millitokens + elapsed * b->rate;
+  b->millitokens = b->millitokens > cap ? cap : b->millitokens;
+  b->last_ms     = now_ms;
+
+  if (b->millitokens >= 1000)
+  {
+    b->millitokens -= 1000;
+
+    return true;
+  }
+
+  *retry_ms = (uint32_t)((1000 - b->millitokens + b->rate - 1) / b->rate);
+
+  return false;
+}
+
+/**
+ * @brief Grab the spare fd back, if it's not held already
+ */
+static void spare_fd_open(void)
+{
+  if (g_spare_fd < 0)
+  {
+    g_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  }
+}
+
+/**
+ * @brief Out of fds with somebody waiting; give up the spare, accept them, tell them BUSY, take the spare back
+ * @param listener_fd The listening socket
+ * @returns true if somebody was shed, false if there was no spare or somebody else took its place
+ */
+static bool shed_with_spare_fd(int listener_fd)
+{
+  if (g_spare_fd < 0)
+  {
+    return false;
+  }
+
+  close(g_spare_fd);
+  g_spare_fd = -1;
+
+  int fd = accept_nonblocking(listener_fd, NULL, NULL);
+
+  if (fd >= 0)
+  {
+    metrics_inc(METRIC_ACCEPTS);
+    reject_busy(fd, BUSY_FULL_RETRY_MS, METRIC_REJECT_FDS);
+  }
+
+  spare_fd_open();
+
+  return fd >= 0;
+}
+
+/**
+ * @brief A connection just came in; hand it to a reactor, or turn it away
+ * @param fd The connection; non-blocking already. Handed off or closed by the time this returns
+ * @param client_addr Who it's from
+ * @param bucket Admission control
+ * @param max_clients Connections a reactor takes; with every one that full, new ones get BUSY
+ * @param opts What the listener was opened with
+ * @param now_ms Current time, monotonic_ms()
+ */
+static void net_take_client(int fd, const struct sockaddr_storage *client_addr, AdmitBucket *bucket,
+                            size_t max_clients, const ListenOptions *opts, int64_t now_ms)
+{
+  uint32_t retry_ms;
+
+  if (!admit_take(bucket, now_ms, &retry_ms))
+  {
+    reject_busy(fd, retry_ms, METRIC_REJECT_RATE);
+
+    return;
+  }
+
+  // Least loaded is full, so everybody is; no point handing them over just to be dropped
+  Reactor *r = pick_reactor();
+
+  if (atomic_load(&r->load) >= max_clients)
+  {
+    reject_busy(fd, BUSY_FULL_RETRY_MS, METRIC_REJECT_FULL);
+
+    return;
+  }
+
+  listen_tune_accepted(fd, opts);
+
+  // Count it against the reactor right away so the next pick sees it
+  Handoff h = {.fd = fd, .peer_ip = listen_peer_key(client_addr)};
+
+  atomic_fetch_add(&r->load, 1);
+
+  ssize_t nbytes;
+  do
+  {
+    nbytes = write(r->handoff_fds[1], &h, sizeof h);
+  } while (nbytes < 0 && errno == EINTR);
+
+  if (nbytes != (ssize_t)sizeof h)
+  {
+    atomic_fetch_sub(&r->load, 1);
+    close(fd);
+  }
+}
+
+/**
+ * @brief Accept everybody who's waiting (up to ACCEPT_BATCH), and hand each one to a reactor or turn them away
+ * @note The listener is level-triggered, so whoever's left after a full batch wakes us right back up
+ * @note Out of fds, that goes for everybody still waiting too; they get shed through the spare fd, and if
+ * even that doesn't work, the caller has to stop watching the listener for a while or we'd spin
+ * @param listener_fd The listening socket; non-blocking
+ * @param bucket Admission control
+ * @param max_clients Connections a reactor takes; with every one that full, new ones get BUSY
+ * @param opts What the listener was opened with
+ * @returns false if we're out of fds and couldn't shed; true otherwise
+ */
+static bool net_accept_batch(int listener_fd, AdmitBucket *bucket, size_t max_clients, const ListenOptions *opts)
+{
+  int64_t now_ms = monotonic_ms();
+
+  for (int n = 0; n < ACCEPT_BATCH; ++n)
+  {
+    // Either family; players only ever see the 32-bit key it boils down to
+    struct sockaddr_storage client_addr;
+    socklen_t          client_addrlen = sizeof client_addr;
+
+    // Comes out non-blocking already; every read from here on is, and the parser copes with partial frames
+    int client_sockfd = accept_nonblocking(listener_fd, (struct sockaddr *)&client_addr, &client_addrlen);
+
+    if (client_sockfd < 0)
+    {
+      if (errno == EINTR)
+      {
+        metrics_inc(METRIC_EINTR_RETRIES);
+        continue;
+      }
+
+      // Gave up before we got to them; whoever's behind them is still worth a try
+      if (errno == ECONNABORTED || errno == EPROTO)
+      {
+        continue;
+      }
+
+      // Out of fds; everyone waiting keeps the listener ready, so they can't just be left there
+      if (errno == EMFILE || errno == ENFILE)
+      {
+        if (shed_with_spare_fd(listener_fd))
+        {
+          continue;
+        }
+
+        return false;
+      }
+
+      // Drained; done
+      return true;
+    }
+
+    metrics_inc(METRIC_ACCEPTS);
+
+    net_take_client(client_sockfd, &client_addr, bucket, max_clients, opts, now_ms);
+  }
+
+  return true;
+}
+
+/**
+ * @brief See what came of the listener's ring accept: one connection, or the reason it stopped
+ * @note Once it's stopped (out of fds, most likely), net_accept_batch() sheds whoever it can by hand,
+ * and the ring only takes over again after that
+ * @param loop The acceptor's event loop
+ * @param ev The EVT_ACCEPT
+ * @param listener_fd The listening socket
+ * @param bucket Admission control
+ * @param max_clients Connections a reactor takes; with every one that full, new ones get BUSY
+ * @param opts What the listener was opened with
+ * @returns false if the listener needs to sit out a backoff; true otherwise
+ */
+static bool net_ring_accept(EventLoop *loop, const LoopEvent *ev, int listener_fd, AdmitBucket *bucket,
+                            size_t max_clients, const ListenOptions *opts)
+{
+  if (ev->res >= 0)
+  {
+    // A multishot accept shares one address buffer between every connection it takes, so we ask
+    struct sockaddr_storage client_addr;
+    socklen_t               client_addrlen = sizeof client_addr;
+
+    metrics_inc(METRIC_ACCEPTS);
+
+    if (getpeername(ev->res, (struct sockaddr *)&client_addr, &client_addrlen) < 0)
+    {
+      // Gone again already
+      close(ev->res);
+    }
+    else
+    {
+      net_take_client(ev->res, &client_addr, bucket, max_clients, opts, monotonic_ms());
+    }
+  }
+
+  if (!(ev->events & EVT_DONE))
+  {
+    return true;
+  }
+
+  if (!net_accept_batch(listener_fd, bucket, max_clients, opts))
+  {
+    return false;
+  }
+
+  if (evloop_accept(loop, listener_fd, NULL) < 0)
+  {
+    perror("server: evloop_accept");
+
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief (Re)start watching the listener
+ * @param ring_io Through a multishot accept (see net_ring_accept()), rather than level-triggered readiness?
+ */
+static int net_watch_listener(EventLoop *loop, int listener_fd, bool ring_io)
+{
+  return ring_io ? evloop_accept(loop, listener_fd, NULL) : evloop_add(loop, listener_fd, EVT_READ, NULL);
+}
+
+static void *net_thread_main(void *arg_)
+{
+  NetArgs *args = (NetArgs *)arg_;
+
+  TRACE_THREAD_NAME("acceptor");
+
+  int      listener_fd   = args->listen_fd;
+  size_t   reactor_count = args->reactor_count;
+  size_t   max_clients   = args->max_clients ? args->max_clients : MAX_CLIENTS;
+  uint32_t idle_ms       = args->idle_timeout_ms ? args->idle_timeout_ms : CONN_IDLE_TIMEOUT_MS;
+
+  ListenOptions listen_opts = args->listen_opts;
+
+  AdmitBucket bucket = {.rate = args->admit_rate < 0 ? ADMIT_RATE : (uint64_t)args->admit_rate};
+
+  bucket.last_ms     = monotonic_ms();
+  bucket.millitokens = bucket.rate * 1000; // Start full; the storm right after a restart is exactly what it's for
+
+  set_player_capacity(args->max_players ? args->max_players : MAX_PLAYERS);
+
+  if (args->udp_port)
+  {
+    g_udp_fd   = args->udp_fd;
+    g_udp_port = args->udp_port;
+  }
+
+  free(args);
+
+  if (reactor_count == 0)
+  {
+    long ncpu     = sysconf(_SC_NPROCESSORS_ONLN);
+    reactor_count = ncpu > 0 ? (size_t)ncpu : 1;
+  }
+
+  if (reactor_count > MAX_REACTORS)
+  {
+    reactor_count = MAX_REACTORS;
+  }
+
+  EventLoop *loop = evloop_create();
+  g_reactors      = (Reactor *)calloc(reactor_count, sizeof *g_reactors);
+  if (!loop || !g_reactors || !open_wake_pipe(loop))
+  {
+    perror("server: net_thread_main");
+
+    close_wake_pipe();
+    evloop_destroy(loop);
+    free(g_reactors);
+    g_reactors = NULL;
+
+    return NULL;
+  }
+
+  // Spin up the reactors; if some fail, run with the ones we got
+  for (g_reactor_count = 0; g_reactor_count < reactor_count; ++g_reactor_count)
+  {
+    Reactor *r = &g_reactors[g_reactor_count];
+
+    if (!reactor_init(r, g_reactor_count, max_clients, idle_ms))
+    {
+      reactor_destroy(r);
+
+      break;
+    }
+
+    if (pthread_create(&r->thread, NULL, reactor_main, r) != 0)
+    {
+      perror("server: pthread_create");
+      reactor_destroy(r);
+
+      break;
+    }
+  }
+
+  // The listener stays level-triggered; as long as connections are pending, every wait reports it
+  // With ring I/O it's a multishot accept instead, and every wait hands back connections already taken
+  // The UDP socket is always level-triggered; datagrams are few and tiny, so the acceptor takes those too
+  bool ring_accept = evloop_enable_ring_io(loop, 0) == 0;
+
+  if (g_reactor_count == 0 || net_watch_listener(loop, listener_fd, ring_accept) < 0 ||
+      (g_udp_fd >= 0 && evloop_add(loop, g_udp_fd, EVT_READ, &g_udp_fd) < 0))
+  {
+    fprintf(stderr, "server: could not start networking\n");
+
+    g_running = false;
+  }
+  else
+  {
+    printf("server: event backend: %s%s, %zu reactor(s), pixel kernels: %s, udp: %s, admit: %llu/s\n",
+           evloop_backend_name(),
+           ring_accept ? " (ring I/O)" : "",
+           g_reactor_count,
+           pixel_kernel_isa(),
+           g_udp_fd >= 0 ? "on" : "off",
+           (unsigned long long)bucket.rate);
+  }
+
+  spare_fd_open();
+
+  // Accept loop; everything past accept() is the reactors' business
+  // Waits are untimed: new connections and request_stop() are the only things that wake us
+  // Unless the listener is sitting out a backoff; then it's back in once that's over
+  int64_t paused_until = 0;
+
+  while (g_running)
+  {
+    int timeout_ms = -1;
+
+    if (paused_until)
+    {
+      int64_t left = paused_until - monotonic_ms();
+
+      if (left <= 0)
+      {
+        paused_until = 0;
+        spare_fd_open();
+
+        if (net_watch_listener(loop, listener_fd, ring_accept) < 0)
+        {
+          perror("server: evloop_add");
+
+          break;
+        }
+
+        continue;
+      }
 
-        // If we did manage to register, keep that client's connection alive by peeking (receive 1 byte but don't consume it)!
+      timeout_ms = (int)left;
+    }
 
-        // FIXME: But if we keep the connection alive, won't that recreate the new player every time we poll its client's socket?
+    LoopEvent events[1];
+    int       ready = evloop_wait(loop, events, 1, timeout_ms);
+    if (ready < 0)
+    {
+      // Retry if we were interrupted by async bullshit
+      if (errno == EINTR)
+      {
+        metrics_inc(METRIC_EINTR_RETRIES);
+        continue;
+      }
 
-        else
-        {
-          char tmp;
+      perror("server: evloop_wait");
 
-          // PEEK = don't consume from buffer; DONTWAIT = make this non-blocking
-          ssize_t nbytes = recv(client_fd, &tmp, 1, MSG_PEEK | MSG_DONTWAIT);
+      break;
+    }
 
-          pthread_mutex_lock(&g_lock);
+    TRACE_SCOPE("acceptor.iteration");
 
-          // If peek didn't receive anything, then we probably need to drop this
-          // FIXME: Shouldn't we add a -1 case here as well?
-          if (nbytes == 0)
-          {
-            goto drop_locked;
-          }
-        }
+    // Woken up to stop, or a backoff ran out; the top of the loop takes it from here
+    if (ready == 0 || events[0].udata == &g_wake_rd)
+    {
+      continue;
+    }
 
-        goto next_locked;
+    if (events[0].udata == &g_udp_fd)
+    {
+      net_drain_udp();
 
-      drop_locked:
-        close(client_fd);
-        remove_client_index_locked(i);
-        advance = false;
-      next_locked:;
-      }
+      continue;
+    }
 
-      if (advance)
+    bool accepting = (events[0].events & EVT_ACCEPT)
+                         ? net_ring_accept(loop, &events[0], listener_fd, &bucket, max_clients, &listen_opts)
+                         : net_accept_batch(listener_fd, &bucket, max_clients, &listen_opts);
+
+    // Out of fds, without even a spare to shed through; the listener would just report again right away
+    // A ring accept has stopped by then; there's nothing to unregister
+    if (!accepting)
+    {
+      metrics_inc(METRIC_ACCEPT_PAUSES);
+
+      if (!ring_accept)
       {
-        i++;
+        evloop_del(loop, listener_fd);
       }
+
+      paused_until = monotonic_ms() + ACCEPT_BACKOFF_MS;
     }
   }
 
-  // Gracefully shut down by notifying clients
-  pthread_mutex_lock(&g_lock);
+  // Make sure the reactors notice too, then wait for them to say bye to their clients
+  // They sleep until something happens, so hand each one an empty connection to wake them
+  g_running = false;
 
-  uint8_t bye = OPC_SHUTDOWN;
-  for (size_t i = 0; i < g_client_count; ++i)
+  for (size_t i = 0; i < g_reactor_count; ++i)
+  {
+    Handoff wake = {.fd = -1, .peer_ip = 0};
+    ssize_t nbytes;
+
+    do
+    {
+      nbytes = write(g_reactors[i].handoff_fds[1], &wake, sizeof wake);
+    } while (nbytes < 0 && errno == EINTR);
+  }
+
+  for (size_t i = 0; i < g_reactor_count; ++i)
   {
-    sendall(g_client_fds[i], &bye, 1);
-    close(g_client_fds[i]);
+    pthread_join(g_reactors[i].thread, NULL);
+    reactor_destroy(&g_reactors[i]);
   }
 
-  g_client_count = 0;
+  free(g_reactors);
+  g_reactors      = NULL;
+  g_reactor_count = 0;
+
+  world_free();
+
+  g_udp_fd   = -1;
+  g_udp_port = 0;
 
-  pthread_mutex_unlock(&g_lock);
+  close_wake_pipe();
+  evloop_destroy(loop);
+
+  if (g_spare_fd >= 0)
+  {
+    close(g_spare_fd);
+    g_spare_fd = -1;
+  }
 
   return NULL;
 }
 
 // ==============================================================================
-// LISTENER HANDLING
+// RAYLIB HELPER
 // ==============================================================================
 
-// TODO: Resume here
+#ifndef SERVER_HEADLESS
+
+/*
+ * Every avatar lives in one atlas texture (see w-atlas.h), cell = player slot. A frame is:
+ *
+ * 1. Grab the newest render snapshot (see w-snapshot.h); no locks
+ * 2. Push changed avatars into their cells; sub-rect uploads only, at most MAX_UPLOADS_PER_FRAME,
+ *    and only for players the network side queued (see drain_avatar_uploads())
+ * 3. Draw every avatar as a quad off the atlas; one texture, so one batch
+ * 4. Draw every nametag; they all share the font texture, so that's one more batch
+ *
+ * Drawing only ever reads the snapshot; the players table is only touched by step 2, and
+ * only when there's something to upload.
+ */
 
-static int make_listener(const char *bind_ip, uint16_t port);
+static AvatarAtlas g_atlas; // Render thread only
 
-// ==============================================================================
-// RAYLIB HELPER
-// ==============================================================================
+/**
+ * @brief Push a player's avatar into their atlas cell if it changed since the last upload
+ * @note Caller holds the player's stripe; this is the callback handed to drain_avatar_uploads()
+ * @param p The player
+ * @returns false if their cell doesn't exist yet (the snapshot that grows the atlas hasn't landed), true otherwise
+ */
+static bool upload_texture_if_needed(Player *p)
+{
+  TRACE_SCOPE("render.texture_upload");
+
+  if (!p->tex_dirty || !p->avatar)
+  {
+    return true;
+  }
+
+  if (!atlas_has_cell(&g_atlas, p->slot))
+  {
+    return false;
+  }
+
+  atlas_upload(&g_atlas, p->slot, p->slot_gen + 1, p->avatar, p->w, p->h);
+
+  p->tex_inited = true;
+  p->tex_dirty  = false;
+
+  return true;
+}
+
+/**
+ * @brief Queue one textured quad into the current rlgl batch
+ * @param src Source rectangle in the atlas, in texels
+ * @param dst Destination rectangle on screen
+ */
+static void draw_atlas_quad(Rectangle src, Rectangle dst)
+{
+  float tw = (float)g_atlas.tex.width;
+  float th = (float)g_atlas.tex.height;
+
+  float u0 = src.x / tw, v0 = src.y / th;
+  float u1 = (src.x + src.width) / tw, v1 = (src.y + src.height) / th;
+
+  // Flushes (and keeps our texture bound) if the batch is full
+  rlCheckRenderBatchLimit(4);
+
+  // Same winding as DrawTexturePro(): top-left, bottom-left, bottom-right, top-right
+  rlTexCoord2f(u0, v0);
+  rlVertex2f(dst.x, dst.y);
+  rlTexCoord2f(u0, v1);
+  rlVertex2f(dst.x, dst.y + dst.height);
+  rlTexCoord2f(u1, v1);
+  rlVertex2f(dst.x + dst.width, dst.y + dst.height);
+  rlTexCoord2f(u1, v0);
+  rlVertex2f(dst.x + dst.width, dst.y);
+}
+
+/**
+ * @brief The atlas just grew and lost its contents; have everyone upload again
+ */
+static void mark_all_avatars_dirty(void)
+{
+  pthread_rwlock_rdlock(&g_players_lock);
 
-static void upload_texture_if_needed(
-    Player *
-        p); // FIXME: Is this even necessary? If we get a new texture from client, maybe...
+  for (uint32_t i = 0; i < g_players.high_water; ++i)
+  {
+    if (!slab_live(&g_players, i))
+    {
+      continue;
+    }
+
+    Player          *p    = (Player *)slab_at(&g_players, i);
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+    p->tex_inited = false;
+    p->tex_dirty  = p->avatar != NULL;
+
+    bool requeue = p->tex_dirty;
+
+    pthread_mutex_unlock(lock);
+
+    if (requeue)
+    {
+      queue_avatar_upload(p);
+    }
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+}
+
+static void render_scene(void)
+{
+  TRACE_SCOPE("render.frame");
+
+  BeginDrawing();
+  ClearBackground((Color){12, 16, 24, 255});
+
+  // The atlas needs a GL context, so it's made on the first frame rather than at startup
+  if (!g_atlas.ready && !atlas_init(&g_atlas, MAX_AVATAR_W, MAX_AVATAR_H))
+  {
+    EndDrawing();
+
+    return;
+  }
+
+  const RenderSnapshot *snap = render_snapshot_acquire();
+
+  // Make sure the highest slot has a cell before anything gets uploaded
+  if (snap->slot_limit > 0 && atlas_reserve(&g_atlas, (uint32_t)snap->slot_limit - 1))
+  {
+    mark_all_avatars_dirty();
+  }
+
+  TRACE_BEGIN(uploads_span, "render.uploads");
+  drain_avatar_uploads(MAX_UPLOADS_PER_FRAME, upload_texture_if_needed);
+  TRACE_END(uploads_span);
+
+  // Avatars; every quad samples the atlas, so rlgl never has to switch textures
+  // A cell still holding somebody else (or nothing) hasn't seen this player's upload yet; skip it
+  rlSetTexture(g_atlas.tex.id);
+  rlBegin(RL_QUADS);
+  rlColor4ub(255, 255, 255, 255);
+  rlNormal3f(0.0f, 0.0f, 1.0f);
+
+  for (size_t i = 0; i < snap->count; ++i)
+  {
+    const RenderItem *item = &snap->items[i];
+
+    if (atlas_cell_owner(&g_atlas, item->slot) != item->slot_gen + 1)
+    {
+      continue;
+    }
 
-static void render_scene();
+    Rectangle src = atlas_cell_rect(&g_atlas, item->slot, item->w, item->h);
+    Rectangle dst = {(float)item->pos_x,
+                     (float)item->pos_y,
+                     item->w * AVATAR_DRAW_SCALE,
+                     item->h * AVATAR_DRAW_SCALE};
+
+    draw_atlas_quad(src, dst);
+  }
+
+  rlEnd();
+  rlSetTexture(0);
+
+  // Nametags, above their avatars
+  for (size_t i = 0; i < snap->count; ++i)
+  {
+    const RenderItem *item = &snap->items[i];
+
+    if (atlas_cell_owner(&g_atlas, item->slot) == item->slot_gen + 1)
+    {
+      DrawText(item->nametag,
+               item->pos_x,
+               item->pos_y - NAMETAG_FONT_SIZE - 2,
+               NAMETAG_FONT_SIZE,
+               RAYWHITE);
+    }
+  }
+
+  TRACE_BEGIN(present_span, "render.present");
+  EndDrawing();
+  TRACE_END(present_span);
+}
+
+#endif
 
 // ==============================================================================
 // MAIN LOOP
 // ==============================================================================
 
-int main(int argc, char *argv[]) { return 0; }
+/**
+ * @brief SIGINT/SIGTERM; wakes the network loops so they wind down
+ */
+static void stop_server(int sig)
+{
+  (void)sig;
+
+  request_stop();
+}
+
+#ifdef WALL_TRACE
+/**
+ * @brief SIGUSR1; snapshot every thread's trace ring into trace-<pid>-<n>.json
+ */
+static void dump_trace(int sig)
+{
+  (void)sig;
+
+  trace_request_dump();
+}
+#endif
+
+/**
+ * @brief Let go of the sockets and the player store on the way out
+ * @note Only once the network side is done with them
+ */
+static void close_server_files(int listen_fd, int udp_fd)
+{
+  peer_stop();
+  metrics_endpoint_stop();
+  close(listen_fd);
+
+#ifdef WALL_TRACE
+  trace_stop();
+#endif
+
+  if (udp_fd >= 0)
+  {
+    close(udp_fd);
+  }
+
+  close_player_store();
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s <bind_ip> <port> [--headless] [--udp] [--store <file>] [--reactors N] [--max-clients N] [--max-players N] [--metrics <port>] [--admit-rate N]\n"
+                  "       [--backlog N] [--reuseport] [--rcvbuf BYTES] [--sndbuf BYTES] [--defer-accept SECS] [--no-nodelay] [--quickack]\n"
+                  "       [--cluster host:port:peer_port,... --node N]\n",
+          prog);
+}
+
+/**
+ * @brief Parse a whole decimal number in [lo, hi]; anything else (garbage, a sign, overflow) is refused
+ * @returns true if it parsed, with the value in out
+ */
+static bool parse_u64(const char *s, uint64_t lo, uint64_t hi, uint64_t *out)
+{
+  char              *end;
+  unsigned long long v;
+
+  // strtoull() would take "-1" and wrap it
+  if (*s < '0' || *s > '9')
+  {
+    return false;
+  }
+
+  errno = 0;
+  v     = strtoull(s, &end, 10);
+
+  if (errno == ERANGE || *end != '\0' || v < lo || v > hi)
+  {
+    return false;
+  }
+
+  *out = v;
+
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t v;
+
+  if (argc < 3 || !parse_u64(argv[2], 1, UINT16_MAX, &v))
+  {
+    usage(argv[0]);
+
+    return 1;
+  }
+
+  const char *bind_ip = argv[1];
+  uint16_t    port    = (uint16_t)v;
+
+  // Headless: no window, no GPU; the main thread runs the acceptor itself
+#ifdef SERVER_HEADLESS
+  bool headless = true;
+#else
+  bool headless = false;
+#endif
+
+  bool        udp         = false;
+  const char *store_path  = NULL;
+  size_t      reactors    = 0;
+  size_t      max_clients = 0;
+  size_t      max_players = 0;
+  uint16_t    metrics     = 0;
+  int64_t     admit_rate  = -1;
+  const char *cluster     = NULL;
+  long        node        = -1;
+
+  ListenOptions listen_opts = listen_defaults();
+
+  for (int i = 3; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--headless") == 0)
+    {
+      headless = true;
+    }
+    else if (strcmp(argv[i], "--udp") == 0)
+    {
+      udp = true;
+    }
+    else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc)
+    {
+      store_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--reactors") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, MAX_REACTORS, &v))
+    {
+      reactors = (size_t)v;
+    }
+    else if (strcmp(argv[i], "--max-clients") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, UINT32_MAX, &v))
+    {
+      max_clients = (size_t)v;
+    }
+    else if (strcmp(argv[i], "--max-players") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, UINT32_MAX, &v))
+    {
+      max_players = (size_t)v;
+    }
+    else if (strcmp(argv[i], "--admit-rate") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, UINT32_MAX, &v))
+    {
+      admit_rate = (int64_t)v;
+    }
+    else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc && parse_u64(argv[++i], 1, UINT16_MAX, &v))
+    {
+      metrics = (uint16_t)v;
+    }
+    else if (strcmp(argv[i], "--backlog") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, INT_MAX, &v))
+    {
+      listen_opts.backlog = (int)v;
+    }
+    else if (strcmp(argv[i], "--reuseport") == 0)
+    {
+      listen_opts.reuseport = true;
+    }
+    else if (strcmp(argv[i], "--rcvbuf") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, INT_MAX, &v))
+    {
+      listen_opts.rcvbuf = (int)v;
+    }
+    else if (strcmp(argv[i], "--sndbuf") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, INT_MAX, &v))
+    {
+      listen_opts.sndbuf = (int)v;
+    }
+    else if (strcmp(argv[i], "--defer-accept") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, INT_MAX, &v))
+    {
+      listen_opts.defer_accept_sec = (int)v;
+    }
+    else if (strcmp(argv[i], "--no-nodelay") == 0)
+    {
+      listen_opts.nodelay = false;
+    }
+    else if (strcmp(argv[i], "--quickack") == 0)
+    {
+      listen_opts.quickack = true;
+    }
+    else if (strcmp(argv[i], "--cluster") == 0 && i + 1 < argc)
+    {
+      cluster = argv[++i];
+    }
+    else if (strcmp(argv[i], "--node") == 0 && i + 1 < argc && parse_u64(argv[++i], 0, CLUSTER_MAX_NODES - 1, &v))
+    {
+      node = (long)v;
+    }
+    else
+    {
+      usage(argv[0]);
+
+      return 1;
+    }
+  }
+
+  // One without the other is a typo, not a choice
+  if ((cluster == NULL) != (node < 0))
+  {
+    usage(argv[0]);
+
+    return 1;
+  }
+
+  // Big enough (the ring) that it has no business on the stack
+  static Cluster cluster_config;
+
+  if (cluster)
+  {
+    if (!cluster_init(&cluster_config, cluster, (size_t)node))
+    {
+      return 1;
+    }
+
+    g_cluster = &cluster_config;
+
+    // Node N hands out N + 1, N + 1 + count, ...; replicas never clash with our own players
+    set_player_id_space((uint32_t)node + 1, (uint32_t)g_cluster->count);
+  }
+
+  srand((unsigned)time(NULL));
+
+  // A peer vanishing mid-writev() must not take the whole server down
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stop_server);
+  signal(SIGTERM, stop_server);
+
+  // Everybody from last time is back before the first connection comes in
+  if (store_path && !open_player_store(store_path, max_players ? (uint32_t)max_players : MAX_PLAYERS))
+  {
+    return 1;
+  }
+
+  int listen_fd = listen_open(bind_ip, port, &listen_opts);
+  if (listen_fd < 0)
+  {
+    close_player_store();
+
+    return 1;
+  }
+
+  // Same port number as TCP; one less thing for clients to be told
+  // The fast path is IPv4 only; behind "::" it takes every IPv4 interface, any other IPv6 address can't have it
+  const char *udp_ip = listen_is_ipv6(bind_ip) && strcmp(bind_ip, "::") == 0 ? "0.0.0.0" : bind_ip;
+
+  int udp_fd = -1;
+  if (udp && (udp_fd = udp_open(udp_ip, port)) < 0)
+  {
+    close_server_files(listen_fd, -1);
+
+    return 1;
+  }
+
+  // Same address as the game, port of its own
+  if (metrics && !metrics_endpoint_start(bind_ip, metrics))
+  {
+    close_server_files(listen_fd, udp_fd);
+
+    return 1;
+  }
+
+  if (g_cluster && !peer_start(g_cluster, bind_ip, WORLD_TICK_MS, notify_renderer))
+  {
+    close_server_files(listen_fd, udp_fd);
+
+    return 1;
+  }
+
+  NetArgs *net_args = (NetArgs *)calloc(1, sizeof *net_args);
+  if (!net_args)
+  {
+    close_server_files(listen_fd, udp_fd);
+
+    return 1;
+  }
+
+  net_args->listen_fd     = listen_fd;
+  net_args->reactor_count = reactors;
+  net_args->max_clients   = max_clients;
+  net_args->max_players   = max_players;
+  net_args->udp_fd        = udp_fd;
+  net_args->udp_port      = udp ? port : 0;
+  net_args->admit_rate    = admit_rate;
+  net_args->listen_opts   = listen_opts;
+
+#ifdef WALL_TRACE
+  if (trace_start() == 0)
+  {
+    signal(SIGUSR1, dump_trace);
+    printf("server: tracing; kill -USR1 %d to dump\n", (int)getpid());
+  }
+#endif
+
+  if (headless)
+  {
+    printf("server: headless on %s:%u\n", bind_ip, port);
+
+    net_thread_main(net_args);
+    close_server_files(listen_fd, udp_fd);
+
+    return 0;
+  }
+
+#ifndef SERVER_HEADLESS
+  // Only now is there anybody to consume uploads and snapshots
+  g_windowed = true;
+  set_avatar_uploads(true);
+
+  SetConfigFlags(FLAG_WINDOW_RESIZABLE | FLAG_MSAA_4X_HINT);
+  InitWindow(WINDOW_W, WINDOW_H, "Avatar Wall (raylib)");
+  SetTargetFPS(60);
+
+  // Start network thread
+  pthread_t net_thread;
+  if (pthread_create(&net_thread, NULL, net_thread_main, net_args) != 0)
+  {
+    perror("server: pthread_create");
+    free(net_args);
+    CloseWindow();
+    close_server_files(listen_fd, udp_fd);
+
+    return 1;
+  }
+
+  TRACE_THREAD_NAME("render");
+
+  // Main render loop; raylib closes the window on ESC by itself
+  while (g_running && !WindowShouldClose())
+  {
+    render_scene();
+  }
+
+  // Signal stop and wait for the network side to say bye to everyone
+  request_stop();
+  pthread_join(net_thread, NULL);
+
+  atlas_unload(&g_atlas);
+  render_snapshot_free();
+  CloseWindow();
+#endif
+
+  close_server_files(listen_fd, udp_fd);
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include "w-atlas.h"
+
+#include <stdlib.h>
+
+/**
+ * @brief (Re)create the texture with the atlas' current row count, all cells transparent
+ */
+static bool atlas_create_texture(AvatarAtlas *atlas)
+{
+  Image blank = GenImageColor((int)(ATLAS_COLS * atlas->cell_w),
+                              (int)(atlas->rows * atlas->cell_h),
+                              (Color){0, 0, 0, 0});
+
+  atlas->tex = LoadTextureFromImage(blank);
+  UnloadImage(blank);
+
+  // Every cell starts out blank, owners included
+  free(atlas->owners);
+  atlas->owners = (uint32_t *)calloc((size_t)ATLAS_COLS * atlas->rows, sizeof *atlas->owners);
+
+  atlas->ready = atlas->tex.id != 0 && atlas->owners;
+
+  return atlas->ready;
+}
+
+bool atlas_init(AvatarAtlas *atlas, uint32_t cell_w, uint32_t cell_h)
+{
+  atlas->owners = NULL;
+  atlas->cell_w = cell_w;
+  atlas->cell_h = cell_h;
+  atlas->rows   = ATLAS_INITIAL_ROWS;
+
+  return atlas_create_texture(atlas);
+}
+
+void atlas_unload(AvatarAtlas *atlas)
+{
+  if (atlas->ready)
+  {
+    UnloadTexture(atlas->tex);
+  }
+
+  free(atlas->owners);
+  atlas->owners = NULL;
+  atlas->ready  = false;
+}
+
+bool atlas_reserve(AvatarAtlas *atlas, uint32_t slot)
+{
+  if (!atlas->ready || atlas_has_cell(atlas, slot))
+  {
+    return false;
+  }
+
+  uint32_t rows = atlas->rows;
+
+  while (slot / ATLAS_COLS >= rows)
+  {
+    rows *= 2;
+  }
+
+  // GPU textures can't be resized in place; swap in a bigger one and let everyone re-upload
+  UnloadTexture(atlas->tex);
+  atlas->rows = rows;
+
+  return atlas_create_texture(atlas);
+}
+
+Rectangle atlas_cell_rect(const AvatarAtlas *atlas, uint32_t slot, uint32_t w, uint32_t h)
+{
+  return (Rectangle){(float)((slot % ATLAS_COLS) * atlas->cell_w),
+                     (float)((slot / ATLAS_COLS) * atlas->cell_h),
+                     (float)w,
+                     (float)h};
+}
+
+void atlas_upload(AvatarAtlas   *atlas,
+                  uint32_t       slot,
+                  uint32_t       owner,
+                  const uint8_t *pixels,
+                  uint32_t       w,
+                  uint32_t       h)
+{
+  UpdateTextureRec(atlas->tex, atlas_cell_rect(atlas, slot, w, h), pixels);
+
+  atlas->owners[slot] = owner;
+}
@@ -0,0 +1,390 @@
+#include "w-cluster.h"
+
+#include "w-hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Parse a port; false unless it's a whole number in [1, 65535]
+ */
+static bool parse_port(const char *s, size_t len, uint16_t *out)
+{
+  unsigned long v = 0;
+
+  if (len == 0 || len > 5)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < len; ++i)
+  {
+    if (s[i] < '0' || s[i] > '9')
+    {
+      return false;
+    }
+
+    v = v * 10 + (unsigned long)(s[i] - '0');
+  }
+
+  if (v == 0 || v > UINT16_MAX)
+  {
+    return false;
+  }
+
+  *out = (uint16_t)v;
+
+  return true;
+}
+
+/**
+ * @brief Parse one host:port:peer_port entry
+ */
+static bool parse_node(const char *s, size_t len, ClusterNode *node)
+{
+  const char *end  = s + len;
+  const char *host = s;
+  const char *host_end;
+  const char *rest;
+
+  // Brackets let an IPv6 host keep its colons
+  if (len > 0 && s[0] == '[')
+  {
+    host     = s + 1;
+    host_end = memchr(host, ']', (size_t)(end - host));
+
+    if (!host_end || host_end + 1 >= end || host_end[1] != ':')
+    {
+      return false;
+    }
+
+    rest = host_end + 2;
+  }
+  else
+  {
+    host_end = memchr(s, ':', len);
+
+    if (!host_end)
+    {
+      return false;
+    }
+
+    rest = host_end + 1;
+  }
+
+  const char *sep  = memchr(rest, ':', (size_t)(end - rest));
+  size_t      hlen = (size_t)(host_end - host);
+
+  if (!sep || hlen == 0 || hlen >= CLUSTER_MAX_HOST)
+  {
+    return false;
+  }
+
+  memcpy(node->host, host, hlen);
+  node->host[hlen] = '\0';
+
+  return parse_port(rest, (size_t)(sep - rest), &node->port) &&
+         parse_port(sep + 1, (size_t)(end - sep - 1), &node->peer_port);
+}
+
+static int cmp_point(const void *a, const void *b)
+{
+  uint64_t pa = ((const ClusterPoint *)a)->point;
+  uint64_t pb = ((const ClusterPoint *)b)->point;
+
+  return pa < pb ? -1 : pa > pb;
+}
+
+bool cluster_init(Cluster *cl, const char *spec, size_t self)
+{
+  memset(cl, 0, sizeof *cl);
+
+  for (const char *s = spec; *s;)
+  {
+    const char *comma = strchr(s, ',');
+    size_t      len   = comma ? (size_t)(comma - s) : strlen(s);
+
+    if (cl->count == CLUSTER_MAX_NODES || !parse_node(s, len, &cl->nodes[cl->count]))
+    {
+      fprintf(stderr, "server: bad cluster node \"%.*s\"\n", (int)len, s);
+
+      return false;
+    }
+
+    cl->count++;
+    s += len + (comma != NULL);
+  }
+
+  if (self >= cl->count)
+  {
+    fprintf(stderr, "server: node index %zu isn't in a cluster of %zu\n", self, cl->count);
+
+    return false;
+  }
+
+  cl->self = self;
+
+  // Nodes are zeroed past their NUL, so the same list always hashes the same
+  cl->digest = xxh64(cl->nodes, cl->count * sizeof *cl->nodes, CLUSTER_VERSION);
+
+  // Points come from what a node is, not where it is in the list; reordering moves nobody
+  for (size_t n = 0; n < cl->count; ++n)
+  {
+    for (uint32_t v = 0; v < CLUSTER_VNODES; ++v)
+    {
+      cl->ring[cl->ring_len++] = (ClusterPoint){
+          .point = xxh64(&cl->nodes[n], sizeof cl->nodes[n], v),
+          .node  = (uint32_t)n,
+      };
+    }
+  }
+
+  qsort(cl->ring, cl->ring_len, sizeof *cl->ring, cmp_point);
+
+  return true;
+}
+
+size_t cluster_owner(const Cluster *cl, uint32_t key)
+{
+  uint64_t h  = xxh64(&key, sizeof key, 0);
+  size_t   lo = 0;
+  size_t   hi = cl->ring_len;
+
+  // First point at or past the key, wrapping around to the first one
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (cl->ring[mid].point < h)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+
+  return cl->ring[lo == cl->ring_len ? 0 : lo].node;
+}
+
+// ==============================================================================
+// WIRE FORMAT
+// ==============================================================================
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+
+  return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+  for (int i = 3; i >= 0; --i)
+  {
+    *p++ = (uint8_t)(v >> (i * 8));
+  }
+
+  return p;
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+  for (int i = 7; i >= 0; --i)
+  {
+    *p++ = (uint8_t)(v >> (i * 8));
+  }
+
+  return p;
+}
+
+static uint16_t get_u16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t get_u64(const uint8_t *p) { return (uint64_t)get_u32(p) << 32 | get_u32(p + 4); }
+
+void cluster_encode_hello(const Cluster *cl, uint8_t *out)
+{
+  out    = put_u16(out, CLUSTER_MAGIC);
+  *out++ = CLUSTER_VERSION;
+  *out++ = (uint8_t)cl->self;
+  put_u64(out, cl->digest);
+}
+
+bool cluster_decode_hello(const Cluster *cl, const uint8_t *in, size_t *node)
+{
+  if (get_u16(in) != CLUSTER_MAGIC || in[2] != CLUSTER_VERSION || in[3] >= cl->count || in[3] == cl->self ||
+      get_u64(in + 4) != cl->digest)
+  {
+    return false;
+  }
+
+  *node = in[3];
+
+  return true;
+}
+
+size_t cluster_encode_record(const ClusterRecord *rec, uint8_t *out)
+{
+  const PlayerReplica *r = &rec->player;
+  uint8_t             *p = out + 2; // LEN goes in last
+
+  *p++ = rec->kind;
+  memcpy(p, &r->ip, sizeof r->ip);
+  p += sizeof r->ip;
+
+  if (rec->kind == CLUSTER_REC_PLAYER)
+  {
+    p    = put_u32(p, r->player_id);
+    *p++ = r->fields;
+
+    if (r->fields & REPLICA_POS)
+    {
+      p = put_u32(p, (uint32_t)r->pos_x);
+      p = put_u32(p, (uint32_t)r->pos_y);
+    }
+
+    if (r->fields & REPLICA_STATE)
+    {
+      *p++ = r->connected;
+    }
+
+    if (r->fields & REPLICA_TAG)
+    {
+      size_t tag_len = strnlen(r->nametag, MAX_NAMETAG_LEN);
+
+      *p++ = (uint8_t)tag_len;
+      memcpy(p, r->nametag, tag_len);
+      p += tag_len;
+    }
+
+    if (r->fields & REPLICA_AVATAR)
+    {
+      size_t len = (size_t)r->w * r->h * RGBA_CHANNEL_COUNT;
+
+      p    = put_u64(p, r->avatar_hash);
+      *p++ = (uint8_t)r->w;
+      *p++ = (uint8_t)r->h;
+      memcpy(p, r->avatar, len);
+      p += len;
+    }
+  }
+
+  put_u16(out, (uint16_t)(p - out - 2));
+
+  return (size_t)(p - out);
+}
+
+long cluster_decode_record(const uint8_t *in, size_t len, ClusterRecord *rec)
+{
+  if (len < 2)
+  {
+    return 0;
+  }
+
+  size_t body = get_u16(in);
+
+  if (body > CLUSTER_MAX_RECORD - 2 || body < 1 + sizeof(uint32_t))
+  {
+    return -1;
+  }
+
+  if (len < 2 + body)
+  {
+    return 0;
+  }
+
+  // Every field gets bounds-checked against the record, never against the buffer behind it
+  const uint8_t *p   = in + 2;
+  const uint8_t *end = p + body;
+  PlayerReplica *r   = &rec->player;
+
+  memset(rec, 0, sizeof *rec);
+
+  rec->kind = *p++;
+  memcpy(&r->ip, p, sizeof r->ip);
+  p += sizeof r->ip;
+
+  if (rec->kind == CLUSTER_REC_GONE)
+  {
+    return p == end ? (long)(2 + body) : -1;
+  }
+
+  if (rec->kind != CLUSTER_REC_PLAYER || end - p < 5)
+  {
+    return -1;
+  }
+
+  r->player_id = get_u32(p);
+  r->fields    = p[4];
+  p += 5;
+
+  if (r->fields & ~REPLICA_ALL)
+  {
+    return -1;
+  }
+
+  if (r->fields & REPLICA_POS)
+  {
+    if (end - p < 8)
+    {
+      return -1;
+    }
+
+    r->pos_x = (int32_t)get_u32(p);
+    r->pos_y = (int32_t)get_u32(p + 4);
+    p += 8;
+  }
+
+  if (r->fields & REPLICA_STATE)
+  {
+    if (end - p < 1)
+    {
+      return -1;
+    }
+
+    r->connected = *p++ != 0;
+  }
+
+  if (r->fields & REPLICA_TAG)
+  {
+    if (end - p < 1 || p[0] > MAX_NAMETAG_LEN || end - p - 1 < p[0])
+    {
+      return -1;
+    }
+
+    memcpy(r->nametag, p + 1, p[0]);
+    p += 1 + p[0];
+  }
+
+  if (r->fields & REPLICA_AVATAR)
+  {
+    if (end - p < 10)
+    {
+      return -1;
+    }
+
+    r->avatar_hash = get_u64(p);
+    r->w           = p[8];
+    r->h           = p[9];
+    p += 10;
+
+    size_t pixels = (size_t)r->w * r->h * RGBA_CHANNEL_COUNT;
+
+    if (r->w == 0 || r->h == 0 || r->w > MAX_AVATAR_W || r->h > MAX_AVATAR_H || (size_t)(end - p) < pixels)
+    {
+      return -1;
+    }
+
+    r->avatar = p;
+    p += pixels;
+  }
+
+  return p == end ? (long)(2 + body) : -1;
+}
@@ -0,0 +1,154 @@
+#include "w-codec.h"
+
+#include <string.h>
+
+bool rle_decode(uint8_t *dst, const uint8_t *src, size_t len, size_t npixels, uint32_t channels)
+{
+  size_t in  = 0;
+  size_t out = 0;
+
+  while (out < npixels)
+  {
+    if (len - in < 1 + (size_t)channels)
+    {
+      return false;
+    }
+
+    size_t run = (size_t)src[in] + 1;
+
+    if (run > npixels - out)
+    {
+      return false;
+    }
+
+    const uint8_t *px = src + in + 1;
+
+    for (size_t i = 0; i < run; ++i, ++out)
+    {
+      memcpy(dst + out * channels, px, channels);
+    }
+
+    in += 1 + channels;
+  }
+
+  return in == len;
+}
+
+// ==============================================================================
+// QOI
+// ==============================================================================
+
+#define QOI_OP_INDEX 0x00 // 00xxxxxx
+#define QOI_OP_DIFF 0x40  // 01xxxxxx
+#define QOI_OP_LUMA 0x80  // 10xxxxxx
+#define QOI_OP_RUN 0xC0   // 11xxxxxx
+#define QOI_OP_RGB 0xFE   // 11111110
+#define QOI_OP_RGBA 0xFF  // 11111111
+#define QOI_MASK_2 0xC0
+
+static const uint8_t k_qoi_magic[4]           = {'q', 'o', 'i', 'f'};
+static const uint8_t k_qoi_end[QOI_END_BYTES] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+static uint32_t read_be32(const uint8_t *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t qoi_hash(const uint8_t px[4])
+{
+  return (px[0] * 3u + px[1] * 5u + px[2] * 7u + px[3] * 11u) % 64;
+}
+
+bool qoi_decode(uint8_t *dst, const uint8_t *src, size_t len, uint32_t width, uint32_t height)
+{
+  if (len < QOI_HEADER_BYTES + QOI_END_BYTES || memcmp(src, k_qoi_magic, sizeof k_qoi_magic) != 0)
+  {
+    return false;
+  }
+
+  // The channel count and colorspace are only hints; the pixels decode the same either way
+  uint8_t channels   = src[12];
+  uint8_t colorspace = src[13];
+
+  if (read_be32(src + 4) != width || read_be32(src + 8) != height || (channels != 3 && channels != 4) ||
+      colorspace > 1)
+  {
+    return false;
+  }
+
+  // Chunks stop where the end marker begins
+  size_t  in      = QOI_HEADER_BYTES;
+  size_t  end     = len - QOI_END_BYTES;
+  size_t  npixels = (size_t)width * height;
+  size_t  run     = 0;
+  uint8_t px[4]   = {0, 0, 0, 255};
+  uint8_t index[64][4];
+
+  memset(index, 0, sizeof index);
+
+  for (size_t out = 0; out < npixels; ++out)
+  {
+    if (run > 0)
+    {
+      run--;
+    }
+    else
+    {
+      if (in >= end)
+      {
+        return false;
+      }
+
+      uint8_t b1 = src[in++];
+
+      if (b1 == QOI_OP_RGB || b1 == QOI_OP_RGBA)
+      {
+        size_t n = b1 == QOI_OP_RGB ? 3 : 4;
+
+        if (end - in < n)
+        {
+          return false;
+        }
+
+        memcpy(px, src + in, n);
+        in += n;
+      }
+      else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+      {
+        memcpy(px, index[b1], sizeof px);
+      }
+      else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+      {
+        px[0] += ((b1 >> 4) & 0x03) - 2;
+        px[1] += ((b1 >> 2) & 0x03) - 2;
+        px[2] += (b1 & 0x03) - 2;
+      }
+      else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+      {
+        if (in >= end)
+        {
+          return false;
+        }
+
+        uint8_t b2 = src[in++];
+        int     vg = (b1 & 0x3f) - 32;
+
+        px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += vg;
+        px[2] += vg - 8 + (b2 & 0x0f);
+      }
+      else
+      {
+        // This pixel plus up to 61 more just like it
+        run = b1 & 0x3f;
+      }
+
+      memcpy(index[qoi_hash(px)], px, sizeof px);
+    }
+
+    memcpy(dst + out * 4, px, sizeof px);
+  }
+
+  // A run spilling past the last pixel, or chunks left over, means the image isn't what it claims
+  return run == 0 && in == end && memcmp(src + end, k_qoi_end, sizeof k_qoi_end) == 0;
+}
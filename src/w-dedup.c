@@ -0,0 +1,106 @@
+#include "w-dedup.h"
+
+#include "w-hash.h"
+#include <string.h>
+
+bool dedup_init(DedupCache *cache, BlockPool *pool, size_t expected)
+{
+  cache->pool = pool;
+
+  pthread_mutex_init(&cache->lock, NULL);
+  slab_init(&cache->entries, sizeof(DedupEntry), 0);
+
+  return slot_index_init(&cache->by_hash, expected);
+}
+
+uint8_t *dedup_intern(DedupCache *cache, uint8_t *block, size_t len, uint64_t seed, uint64_t *hash)
+{
+  // Hashing is the expensive part, and needs nothing but the block
+  uint64_t h = xxh64(block, len, seed);
+
+  *hash = h;
+
+  pthread_mutex_lock(&cache->lock);
+
+  uint32_t slot = slot_index_find(&cache->by_hash, h);
+
+  if (slot != SLOT_INDEX_NONE)
+  {
+    DedupEntry *e = (DedupEntry *)slab_at(&cache->entries, slot);
+
+    if (e->len == len && memcmp(e->block, block, len) == 0)
+    {
+      e->refs++;
+
+      pthread_mutex_unlock(&cache->lock);
+
+      block_pool_free(cache->pool, block);
+
+      return e->block;
+    }
+
+    // Same hash, different bytes; the first one keeps the entry, this one just doesn't get shared
+    pthread_mutex_unlock(&cache->lock);
+
+    return block;
+  }
+
+  SlabHandle  handle;
+  DedupEntry *e = (DedupEntry *)slab_alloc(&cache->entries, &handle);
+
+  if (!e || !slot_index_insert(&cache->by_hash, h, handle.index))
+  {
+    if (e)
+    {
+      slab_free(&cache->entries, handle.index);
+    }
+
+    // Out of memory for bookkeeping; still a perfectly good block, it's just nobody else's
+    pthread_mutex_unlock(&cache->lock);
+
+    return block;
+  }
+
+  *e = (DedupEntry){.block = block, .hash = h, .len = (uint32_t)len, .refs = 1};
+
+  pthread_mutex_unlock(&cache->lock);
+
+  return block;
+}
+
+void dedup_release(DedupCache *cache, uint8_t *block, uint64_t hash)
+{
+  if (!block)
+  {
+    return;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+
+  uint32_t    slot = slot_index_find(&cache->by_hash, hash);
+  DedupEntry *e    = slot != SLOT_INDEX_NONE ? (DedupEntry *)slab_at(&cache->entries, slot) : NULL;
+
+  // Not the block held under that hash: one that lost a collision, or never got an entry
+  if (!e || e->block != block)
+  {
+    pthread_mutex_unlock(&cache->lock);
+
+    block_pool_free(cache->pool, block);
+
+    return;
+  }
+
+  if (--e->refs > 0)
+  {
+    pthread_mutex_unlock(&cache->lock);
+
+    return;
+  }
+
+  slot_index_remove(&cache->by_hash, hash);
+  slab_free(&cache->entries, slot);
+
+  pthread_mutex_unlock(&cache->lock);
+
+  block_pool_free(cache->pool, block);
+}
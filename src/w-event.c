@@ -0,0 +1,1397 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // POLLRDHUP, for the io_uring backend
+#endif
+
+#include "w-event.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Pick a backend; select() is the portable fallback and can be forced for testing
+// io_uring is opt-in (EVLOOP_USE_IO_URING); it wants a 5.13+ kernel, and plenty of sandboxes filter it out
+#if !defined(EVLOOP_FORCE_SELECT) && defined(__linux__) && defined(EVLOOP_USE_IO_URING)
+#define EVLOOP_IO_URING 1
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#elif !defined(EVLOOP_FORCE_SELECT) && defined(__linux__)
+#define EVLOOP_EPOLL 1
+#include <sys/epoll.h>
+#elif !defined(EVLOOP_FORCE_SELECT) &&                                                   \
+    (defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) ||               \
+     defined(__NetBSD__))
+#define EVLOOP_KQUEUE 1
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#define EVLOOP_SELECT 1
+#include <stdbool.h>
+#include <sys/select.h>
+#endif
+
+#if defined(EVLOOP_IO_URING) || defined(EVLOOP_KQUEUE)
+/**
+ * @brief Report an event, folding it into one already in this batch for the same udata
+ * @note epoll and select() hand back one entry per fd; kqueue has a filter per direction, and multishot
+ * polls can complete more than once per wait. Callers may free their udata on the first event, so the
+ * same udata showing up a second time in a batch would be a use-after-free
+ * @note Ring I/O completions stay on their own; see uring_report()
+ * @param out The batch so far
+ * @param n Amt. of events in it
+ * @returns The new amt. of events
+ */
+static int merge_event(LoopEvent *out, int n, void *udata, uint32_t events)
+{
+  for (int i = 0; i < n; ++i)
+  {
+    if (out[i].udata == udata && !(out[i].events & (EVT_RECV | EVT_SENT | EVT_ACCEPT)))
+    {
+      out[i].events |= events;
+
+      return n;
+    }
+  }
+
+  out[n].udata  = udata;
+  out[n].events = events;
+
+  return n + 1;
+}
+#endif
+
+// ==============================================================================
+// EPOLL
+// ==============================================================================
+
+#if defined(EVLOOP_EPOLL)
+
+#define EVLOOP_BATCH 64 // Max. events pulled from the kernel per wait
+
+struct EventLoop
+{
+  int epfd;
+};
+
+static uint32_t to_epoll(uint32_t events)
+{
+  uint32_t ep = 0;
+
+  if (events & EVT_READ)
+  {
+    ep |= EPOLLIN | EPOLLRDHUP;
+  }
+
+  if (events & EVT_WRITE)
+  {
+    ep |= EPOLLOUT;
+  }
+
+  if (events & EVT_EDGE)
+  {
+    ep |= EPOLLET;
+  }
+
+  return ep;
+}
+
+EventLoop *evloop_create(void)
+{
+  EventLoop *loop = (EventLoop *)calloc(1, sizeof *loop);
+  if (!loop)
+  {
+    return NULL;
+  }
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epfd < 0)
+  {
+    free(loop);
+
+    return NULL;
+  }
+
+  return loop;
+}
+
+void evloop_destroy(EventLoop *loop)
+{
+  if (!loop)
+  {
+    return;
+  }
+
+  close(loop->epfd);
+  free(loop);
+}
+
+int evloop_add(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  struct epoll_event ev = {.events = to_epoll(events), .data.ptr = udata};
+
+  return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int evloop_mod(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  struct epoll_event ev = {.events = to_epoll(events), .data.ptr = udata};
+
+  return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+int evloop_del(EventLoop *loop, int fd)
+{
+  // Pre-2.6.9 kernels want a non-NULL event even for DEL
+  struct epoll_event ev = {0};
+
+  return epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+int evloop_wait(EventLoop *loop, LoopEvent *out, int max_events, int timeout_ms)
+{
+  struct epoll_event evs[EVLOOP_BATCH];
+
+  if (max_events > EVLOOP_BATCH)
+  {
+    max_events = EVLOOP_BATCH;
+  }
+
+  int n = epoll_wait(loop->epfd, evs, max_events, timeout_ms);
+
+  for (int i = 0; i < n; ++i)
+  {
+    uint32_t got = 0;
+
+    if (evs[i].events & EPOLLIN)
+    {
+      got |= EVT_READ;
+    }
+
+    if (evs[i].events & EPOLLOUT)
+    {
+      got |= EVT_WRITE;
+    }
+
+    if (evs[i].events & (EPOLLHUP | EPOLLRDHUP))
+    {
+      got |= EVT_HUP;
+    }
+
+    if (evs[i].events & EPOLLERR)
+    {
+      got |= EVT_ERR;
+    }
+
+    out[i].udata  = evs[i].data.ptr;
+    out[i].events = got;
+  }
+
+  return n;
+}
+
+const char *evloop_backend_name(void) { return "epoll"; }
+
+// ==============================================================================
+// IO_URING
+// ==============================================================================
+
+#elif defined(EVLOOP_IO_URING)
+
+/*
+ * Readiness through io_uring polls, no liburing; just the three syscalls and the shared rings.
+ *
+ * - Every registration is a poll request: multishot for EVT_EDGE (it fires on every wakeup,
+ *   which is exactly the edge-triggered contract), one-shot and re-armed after each
+ *   completion otherwise, so it keeps reporting for as long as the fd stays ready
+ * - evloop_add/mod/del only queue SQEs; they go to the kernel in the same io_uring_enter()
+ *   as the next wait, so toggling EVT_WRITE costs no syscall of its own
+ * - user_data is (generation << 32 | kind << 29 | fd); completions for a request that's since
+ *   been replaced or removed carry an old generation and get dropped
+ *
+ * Ring I/O puts three more kinds of request next to the polls:
+ *
+ * - Multishot accepts and receives, armed once and re-armed only when the kernel gives up on
+ *   them. Receives pick their buffer from a provided-buffer ring, so nothing is allocated or
+ *   copied per recv; a buffer goes back on the ring once evloop_recycle() says it's consumed
+ * - One writev per evloop_send(). Its completion is reported whatever became of the fd's
+ *   registration since; the caller's memory is tied up until it's back
+ */
+
+#define EVLOOP_BATCH 64
+#define URING_ENTRIES 256       // SQ slots; the CQ gets twice that, and the kernel keeps any overflow
+#define URING_IGNORE UINT64_MAX // user_data for requests whose completions nobody cares about
+#define URING_FD_BITS 29        // Low bits of user_data; the kind sits above them
+#define URING_BGID 0            // Our one provided-buffer group
+#define URING_MAX_BUFFERS 32768 // Most a provided-buffer ring holds
+
+// There's no feature bit for multishot recv (6.0); REG_REG_RING came after it, in 6.3
+#ifndef IORING_FEAT_REG_REG_RING
+#define IORING_FEAT_REG_REG_RING (1U << 13)
+#endif
+
+typedef enum
+{
+  URING_POLL,
+  URING_ACCEPT,
+  URING_RECV,
+  URING_SEND
+} UringKind;
+
+typedef struct
+{
+  bool     used;
+  uint8_t  kind;    // What's registered; any UringKind but URING_SEND
+  bool     sending; // Is an evloop_send() out? That's separate from the registration
+  uint32_t gen;     // Bumped on every (re)registration
+  uint32_t events;
+  void    *udata;
+  void    *send_udata;
+} UringSlot;
+
+struct EventLoop
+{
+  int      ring_fd;
+  unsigned features; // IORING_FEAT_* the kernel has
+  bool     ring_io;  // Set by evloop_enable_ring_io()
+
+  void  *ring_mem; // SQ and CQ rings share one mapping (IORING_FEAT_SINGLE_MMAP)
+  size_t ring_len;
+
+  struct io_uring_sqe *sqes;
+  size_t               sqes_len;
+  unsigned            *sq_head, *sq_tail, *sq_array;
+  unsigned             sq_mask, sq_entries;
+
+  struct io_uring_cqe *cqes;
+  unsigned            *cq_head, *cq_tail;
+  unsigned             cq_mask;
+
+  UringSlot *slots; // Indexed by fd; grows as needed
+  size_t     slot_count;
+
+  // Receive buffers; only once evloop_enable_ring_io() asked for some
+  struct io_uring_buf_ring *bufs;     // What the kernel picks from
+  size_t                    bufs_len; // The ring and the buffers after it share one mapping
+  uint8_t                  *buf_mem;  // buf_count buffers of EVLOOP_RECV_BUFFER bytes, by buffer ID
+  unsigned                  buf_count;
+  unsigned                  buf_tail; // Ours; only its low 16 bits are shared
+};
+
+static int uring_enter(EventLoop *loop, unsigned to_submit, unsigned min_complete, unsigned flags,
+                       struct io_uring_getevents_arg *arg)
+{
+  return (int)syscall(__NR_io_uring_enter, loop->ring_fd, to_submit, min_complete, flags, arg,
+                      arg ? sizeof *arg : 0);
+}
+
+/**
+ * @brief SQEs queued that the kernel hasn't picked up yet
+ */
+static unsigned uring_unsubmitted(const EventLoop *loop)
+{
+  return *loop->sq_tail - __atomic_load_n(loop->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Grab the next free SQE, zeroed; pushes what's queued to the kernel first if the SQ is full
+ * @returns The SQE, or NULL (errno is set; EBUSY if the kernel wouldn't take anything off a full SQ)
+ */
+static struct io_uring_sqe *uring_sqe(EventLoop *loop)
+{
+  unsigned waiting = uring_unsubmitted(loop);
+
+  if (waiting == loop->sq_entries)
+  {
+    if (uring_enter(loop, waiting, 0, 0, NULL) < 0)
+    {
+      return NULL;
+    }
+
+    // It may take fewer than it's handed (it stops at the first SQE it can't even start); handing out
+    // another one now would be writing over an SQE nobody's submitted
+    if (uring_unsubmitted(loop) == loop->sq_entries)
+    {
+      errno = EBUSY;
+
+      return NULL;
+    }
+  }
+
+  unsigned             tail = *loop->sq_tail;
+  struct io_uring_sqe *sqe  = &loop->sqes[tail & loop->sq_mask];
+
+  memset(sqe, 0, sizeof *sqe);
+
+  return sqe;
+}
+
+/**
+ * @brief Hand the SQE from uring_sqe() over; it goes out with the next io_uring_enter()
+ */
+static void uring_queue(EventLoop *loop)
+{
+  __atomic_store_n(loop->sq_tail, *loop->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t uring_key(int fd, uint32_t gen, UringKind kind)
+{
+  return (uint64_t)gen << 32 | (uint64_t)kind << URING_FD_BITS | (uint32_t)fd;
+}
+
+static int uring_key_fd(uint64_t key) { return (int)(key & ((1u << URING_FD_BITS) - 1)); }
+
+static UringKind uring_key_kind(uint64_t key) { return (UringKind)((key >> URING_FD_BITS) & 7); }
+
+/**
+ * @brief Queue whatever request the slot's registration stands for
+ */
+static int uring_arm(EventLoop *loop, int fd, const UringSlot *slot)
+{
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe)
+  {
+    return -1;
+  }
+
+  sqe->fd        = fd;
+  sqe->user_data = uring_key(fd, slot->gen, (UringKind)slot->kind);
+
+  switch (slot->kind)
+  {
+  case URING_ACCEPT:
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    break;
+  case URING_RECV:
+    // No buffer of our own; the kernel takes the next one off the ring when bytes show up
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    break;
+  default:
+  {
+    uint32_t mask = 0;
+
+    if (slot->events & EVT_READ)
+    {
+      mask |= POLLIN | POLLRDHUP;
+    }
+
+    if (slot->events & EVT_WRITE)
+    {
+      mask |= POLLOUT;
+    }
+
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->poll32_events = mask; // HUP and ERR always come along, asked for or not
+    sqe->len           = (slot->events & EVT_EDGE) ? IORING_POLL_ADD_MULTI : 0;
+    break;
+  }
+  }
+
+  uring_queue(loop);
+
+  return 0;
+}
+
+/**
+ * @brief Queue the removal of a request; whatever it was, its completions stop mattering
+ * @param key The request's user_data
+ */
+static int uring_cancel(EventLoop *loop, uint64_t key)
+{
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe)
+  {
+    return -1;
+  }
+
+  // A request that already finished is gone; the ENOENT this gets then is ignored like the rest
+  sqe->opcode    = uring_key_kind(key) == URING_POLL ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+  sqe->addr      = key;
+  sqe->user_data = URING_IGNORE;
+
+  uring_queue(loop);
+
+  return 0;
+}
+
+static int uring_disarm(EventLoop *loop, int fd, const UringSlot *slot)
+{
+  return uring_cancel(loop, uring_key(fd, slot->gen, (UringKind)slot->kind));
+}
+
+/**
+ * @brief The slot for an fd, growing the table if asked to
+ * @returns The slot, or NULL if fd is out of range (or memory ran out); errno is set
+ */
+static UringSlot *uring_slot(EventLoop *loop, int fd, bool grow)
+{
+  if (fd < 0 || fd >= (1 << URING_FD_BITS))
+  {
+    errno = EINVAL;
+
+    return NULL;
+  }
+
+  if ((size_t)fd >= loop->slot_count)
+  {
+    if (!grow)
+    {
+      errno = ENOENT;
+
+      return NULL;
+    }
+
+    size_t     count = loop->slot_count ? loop->slot_count : 64;
+    UringSlot *slots;
+
+    while (count <= (size_t)fd)
+    {
+      count *= 2;
+    }
+
+    if (!(slots = (UringSlot *)realloc(loop->slots, count * sizeof *slots)))
+    {
+      errno = ENOMEM;
+
+      return NULL;
+    }
+
+    memset(&slots[loop->slot_count], 0, (count - loop->slot_count) * sizeof *slots);
+    loop->slots      = slots;
+    loop->slot_count = count;
+  }
+
+  return &loop->slots[fd];
+}
+
+/**
+ * @brief Put a receive buffer (back) on the ring for the kernel to pick
+ * @param bid Its buffer ID
+ */
+static void uring_buf_put(EventLoop *loop, uint16_t bid)
+{
+  struct io_uring_buf *b = &loop->bufs->bufs[loop->buf_tail & (loop->buf_count - 1)];
+
+  b->addr = (uint64_t)(uintptr_t)(loop->buf_mem + (size_t)bid * EVLOOP_RECV_BUFFER);
+  b->len  = EVLOOP_RECV_BUFFER;
+  b->bid  = bid;
+
+  loop->buf_tail += 1;
+  __atomic_store_n(&loop->bufs->tail, (uint16_t)loop->buf_tail, __ATOMIC_RELEASE);
+}
+
+void evloop_destroy(EventLoop *loop)
+{
+  if (!loop)
+  {
+    return;
+  }
+
+  if (loop->sqes)
+  {
+    munmap(loop->sqes, loop->sqes_len);
+  }
+
+  if (loop->ring_mem)
+  {
+    munmap(loop->ring_mem, loop->ring_len);
+  }
+
+  if (loop->ring_fd >= 0)
+  {
+    close(loop->ring_fd);
+  }
+
+  // Only once the ring is gone; receives still out could pick these up until then
+  if (loop->bufs)
+  {
+    munmap(loop->bufs, loop->bufs_len);
+  }
+
+  free(loop->slots);
+  free(loop);
+}
+
+EventLoop *evloop_create(void)
+{
+  EventLoop *loop = (EventLoop *)calloc(1, sizeof *loop);
+  if (!loop)
+  {
+    return NULL;
+  }
+
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof p);
+  loop->ring_fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+
+  if (loop->ring_fd < 0)
+  {
+    free(loop);
+
+    return NULL;
+  }
+
+  // There's no feature bit for multishot poll; RSRC_TAGS came with it in 5.13
+  const unsigned need = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG | IORING_FEAT_RSRC_TAGS;
+
+  if ((p.features & need) != need)
+  {
+    evloop_destroy(loop);
+    errno = ENOSYS;
+
+    return NULL;
+  }
+
+  loop->features = p.features;
+
+  size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  loop->ring_len = sq_len > cq_len ? sq_len : cq_len;
+  loop->ring_mem = mmap(NULL, loop->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, loop->ring_fd,
+                        IORING_OFF_SQ_RING);
+  if (loop->ring_mem == MAP_FAILED)
+  {
+    loop->ring_mem = NULL;
+    evloop_destroy(loop);
+
+    return NULL;
+  }
+
+  loop->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  loop->sqes     = (struct io_uring_sqe *)mmap(NULL, loop->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                               loop->ring_fd, IORING_OFF_SQES);
+  if (loop->sqes == MAP_FAILED)
+  {
+    loop->sqes = NULL;
+    evloop_destroy(loop);
+
+    return NULL;
+  }
+
+  char *ring = (char *)loop->ring_mem;
+
+  loop->sq_head    = (unsigned *)(ring + p.sq_off.head);
+  loop->sq_tail    = (unsigned *)(ring + p.sq_off.tail);
+  loop->sq_array   = (unsigned *)(ring + p.sq_off.array);
+  loop->sq_mask    = *(unsigned *)(ring + p.sq_off.ring_mask);
+  loop->sq_entries = p.sq_entries;
+  loop->cq_head    = (unsigned *)(ring + p.cq_off.head);
+  loop->cq_tail    = (unsigned *)(ring + p.cq_off.tail);
+  loop->cq_mask    = *(unsigned *)(ring + p.cq_off.ring_mask);
+  loop->cqes       = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+  // SQEs are always used in ring order, so the indirection array never changes
+  for (unsigned i = 0; i < p.sq_entries; ++i)
+  {
+    loop->sq_array[i] = i;
+  }
+
+  return loop;
+}
+
+int evloop_enable_ring_io(EventLoop *loop, unsigned recv_buffers)
+{
+  if (!(loop->features & IORING_FEAT_REG_REG_RING))
+  {
+    errno = ENOTSUP;
+
+    return -1;
+  }
+
+  if (recv_buffers > URING_MAX_BUFFERS)
+  {
+    recv_buffers = URING_MAX_BUFFERS;
+  }
+
+  if (recv_buffers > 0 && !loop->bufs)
+  {
+    unsigned count = 1;
+
+    while (count < recv_buffers)
+    {
+      count *= 2;
+    }
+
+    // The ring has to start on a page; the buffers go right after it
+    size_t page      = (size_t)sysconf(_SC_PAGESIZE);
+    size_t ring_len  = (count * sizeof(struct io_uring_buf) + page - 1) & ~(page - 1);
+    size_t total_len = ring_len + (size_t)count * EVLOOP_RECV_BUFFER;
+    void  *mem       = mmap(NULL, total_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED)
+    {
+      return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr    = (uint64_t)(uintptr_t)mem;
+    reg.ring_entries = count;
+    reg.bgid         = URING_BGID;
+
+    if (syscall(__NR_io_uring_register, loop->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+      int saved = errno;
+
+      munmap(mem, total_len);
+      errno = saved;
+
+      return -1;
+    }
+
+    loop->bufs      = (struct io_uring_buf_ring *)mem;
+    loop->bufs_len  = total_len;
+    loop->buf_mem   = (uint8_t *)mem + ring_len;
+    loop->buf_count = count;
+
+    for (unsigned bid = 0; bid < count; ++bid)
+    {
+      uring_buf_put(loop, (uint16_t)bid);
+    }
+  }
+
+  loop->ring_io = true;
+
+  return 0;
+}
+
+/**
+ * @brief Register fd for whatever kind of request, and queue its first one
+ */
+static int uring_register(EventLoop *loop, int fd, UringKind kind, uint32_t events, void *udata)
+{
+  UringSlot *slot = uring_slot(loop, fd, true);
+
+  if (!slot)
+  {
+    return -1;
+  }
+
+  if (slot->used)
+  {
+    errno = EEXIST;
+
+    return -1;
+  }
+
+  slot->used   = true;
+  slot->kind   = (uint8_t)kind;
+  slot->gen   += 1;
+  slot->events = events;
+  slot->udata  = udata;
+
+  if (uring_arm(loop, fd, slot) < 0)
+  {
+    slot->used = false;
+
+    return -1;
+  }
+
+  return 0;
+}
+
+int evloop_add(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  return uring_register(loop, fd, URING_POLL, events, udata);
+}
+
+int evloop_mod(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  UringSlot *slot = uring_slot(loop, fd, false);
+
+  if (!slot || !slot->used)
+  {
+    errno = ENOENT;
+
+    return -1;
+  }
+
+  // Accepts and receives have no interest set to change
+  if (slot->kind != URING_POLL)
+  {
+    errno = EINVAL;
+
+    return -1;
+  }
+
+  if (uring_disarm(loop, fd, slot) < 0)
+  {
+    return -1;
+  }
+
+  slot->gen   += 1;
+  slot->events = events;
+  slot->udata  = udata;
+
+  return uring_arm(loop, fd, slot);
+}
+
+int evloop_del(EventLoop *loop, int fd)
+{
+  UringSlot *slot = uring_slot(loop, fd, false);
+
+  if (!slot || (!slot->used && !slot->sending))
+  {
+    errno = ENOENT;
+
+    return -1;
+  }
+
+  // The send's EVT_SENT still comes (cancelled or not); whoever queued it is waiting on that
+  if (slot->sending && uring_cancel(loop, uring_key(fd, 0, URING_SEND)) < 0)
+  {
+    return -1;
+  }
+
+  if (!slot->used)
+  {
+    return 0;
+  }
+
+  // The request keeps the file alive until the removal goes out with the next wait; close() is fine meanwhile
+  int rc = uring_disarm(loop, fd, slot);
+
+  slot->used   = false;
+  slot->gen   += 1;
+  slot->events = 0;
+  slot->udata  = NULL;
+
+  return rc;
+}
+
+int evloop_accept(EventLoop *loop, int fd, void *udata)
+{
+  if (!loop->ring_io)
+  {
+    errno = ENOTSUP;
+
+    return -1;
+  }
+
+  return uring_register(loop, fd, URING_ACCEPT, 0, udata);
+}
+
+int evloop_recv(EventLoop *loop, int fd, void *udata)
+{
+  if (!loop->ring_io || !loop->bufs)
+  {
+    errno = ENOTSUP;
+
+    return -1;
+  }
+
+  return uring_register(loop, fd, URING_RECV, 0, udata);
+}
+
+void evloop_recycle(EventLoop *loop, const LoopEvent *ev)
+{
+  if (ev->events & EVT_RECV)
+  {
+    uring_buf_put(loop, ev->buf);
+  }
+}
+
+int evloop_send(EventLoop *loop, int fd, const struct iovec *iov, int count, void *udata)
+{
+  if (!loop->ring_io)
+  {
+    errno = ENOTSUP;
+
+    return -1;
+  }
+
+  UringSlot *slot = uring_slot(loop, fd, true);
+
+  if (!slot)
+  {
+    return -1;
+  }
+
+  if (slot->sending)
+  {
+    errno = EBUSY;
+
+    return -1;
+  }
+
+  struct io_uring_sqe *sqe = uring_sqe(loop);
+  if (!sqe)
+  {
+    return -1;
+  }
+
+  // Sockets take no offset; anything but 0 gets ESPIPE
+  sqe->opcode    = IORING_OP_WRITEV;
+  sqe->fd        = fd;
+  sqe->addr      = (uint64_t)(uintptr_t)iov;
+  sqe->len       = (uint32_t)count;
+  sqe->user_data = uring_key(fd, 0, URING_SEND);
+
+  uring_queue(loop);
+
+  slot->sending    = true;
+  slot->send_udata = udata;
+
+  return 0;
+}
+
+/**
+ * @brief Put a completion in the batch as an event of its own; those never fold into another
+ */
+static int uring_report(LoopEvent *out, int n, void *udata, uint32_t events, int32_t res)
+{
+  out[n].udata  = udata;
+  out[n].events = events;
+  out[n].res    = res;
+  out[n].data   = NULL;
+
+  return n + 1;
+}
+
+/**
+ * @brief Turn one CQE into (at most) one event, and pick back up whatever request it ended
+ * @param out The batch so far
+ * @param n Amt. of events in it
+ * @returns The new amt. of events
+ */
+static int uring_complete(EventLoop *loop, const struct io_uring_cqe *cqe, LoopEvent *out, int n)
+{
+  int        fd   = uring_key_fd(cqe->user_data);
+  UringKind  kind = uring_key_kind(cqe->user_data);
+  UringSlot *slot = uring_slot(loop, fd, false);
+  bool       more = cqe->flags & IORING_CQE_F_MORE;
+
+  if (kind == URING_SEND)
+  {
+    if (!slot || !slot->sending)
+    {
+      return n;
+    }
+
+    slot->sending = false;
+
+    return uring_report(out, n, slot->send_udata, EVT_SENT, cqe->res);
+  }
+
+  // Registration changed or went away since this was armed
+  if (!slot || !slot->used || slot->kind != kind || slot->gen != (uint32_t)(cqe->user_data >> 32))
+  {
+    // A receive that got cancelled may have picked a buffer already; nobody's going to recycle it
+    if (cqe->flags & IORING_CQE_F_BUFFER)
+    {
+      uring_buf_put(loop, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+    }
+
+    return n;
+  }
+
+  if (kind == URING_ACCEPT)
+  {
+    void *udata = slot->udata;
+
+    if (!more)
+    {
+      slot->used = false;
+      slot->gen += 1;
+    }
+
+    return uring_report(out, n, udata, EVT_ACCEPT | (more ? 0 : EVT_DONE), cqe->res);
+  }
+
+  if (kind == URING_RECV)
+  {
+    if (cqe->res > 0)
+    {
+      uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+      // The kernel gives up on a multishot receive now and then (its CQ overflowing, say); same fix
+      if (!more && uring_arm(loop, fd, slot) < 0)
+      {
+        uring_buf_put(loop, bid);
+
+        return merge_event(out, n, slot->udata, EVT_ERR);
+      }
+
+      n = uring_report(out, n, slot->udata, EVT_RECV, cqe->res);
+
+      out[n - 1].data = loop->buf_mem + (size_t)bid * EVLOOP_RECV_BUFFER;
+      out[n - 1].buf  = bid;
+
+      return n;
+    }
+
+    // Every buffer is out with the caller; they're all back before this goes to the kernel
+    if (cqe->res == -ENOBUFS)
+    {
+      return uring_arm(loop, fd, slot) < 0 ? merge_event(out, n, slot->udata, EVT_ERR) : n;
+    }
+
+    // EOF or a broken socket; nothing more comes from this one either way
+    return merge_event(out, n, slot->udata, cqe->res == 0 ? EVT_HUP : EVT_ERR);
+  }
+
+  // The poll itself failed; say so, and don't re-arm a poll that can't work
+  if (cqe->res < 0)
+  {
+    return merge_event(out, n, slot->udata, EVT_ERR);
+  }
+
+  // One-shot polls always end here, multishot ones when the kernel gives up on them; same fix
+  if (!more && uring_arm(loop, fd, slot) < 0)
+  {
+    return merge_event(out, n, slot->udata, EVT_ERR);
+  }
+
+  uint32_t revents = (uint32_t)cqe->res;
+  uint32_t got     = 0;
+
+  if (revents & POLLIN)
+  {
+    got |= EVT_READ;
+  }
+
+  if (revents & POLLOUT)
+  {
+    got |= EVT_WRITE;
+  }
+
+  if (revents & (POLLHUP | POLLRDHUP))
+  {
+    got |= EVT_HUP;
+  }
+
+  if (revents & POLLERR)
+  {
+    got |= EVT_ERR;
+  }
+
+  return got ? merge_event(out, n, slot->udata, got) : n;
+}
+
+int evloop_wait(EventLoop *loop, LoopEvent *out, int max_events, int timeout_ms)
+{
+  if (max_events > EVLOOP_BATCH)
+  {
+    max_events = EVLOOP_BATCH;
+  }
+
+  // Completions can all turn out stale; that's no reason to report a timeout that didn't happen
+  for (;;)
+  {
+    // Submit whatever's queued and wait, in one go; don't block if completions are already there
+    bool     ready   = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE) != *loop->cq_head;
+    unsigned wait_nr = (ready || timeout_ms == 0) ? 0 : 1;
+    unsigned pending = uring_unsubmitted(loop);
+    bool     expired = false;
+
+    if (pending || wait_nr)
+    {
+      struct __kernel_timespec      ts  = {.tv_sec = timeout_ms / 1000, .tv_nsec = (long long)(timeout_ms % 1000) * 1000000};
+      struct io_uring_getevents_arg arg = {.ts = timeout_ms > 0 ? (uint64_t)(uintptr_t)&ts : 0};
+
+      if (uring_enter(loop, pending, wait_nr, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg) < 0)
+      {
+        if (errno != ETIME)
+        {
+          return -1;
+        }
+
+        expired = true;
+      }
+    }
+
+    unsigned head = *loop->cq_head;
+    unsigned tail = __atomic_load_n(loop->cq_tail, __ATOMIC_ACQUIRE);
+    int      n    = 0;
+
+    for (; head != tail && n < max_events; ++head)
+    {
+      const struct io_uring_cqe *cqe = &loop->cqes[head & loop->cq_mask];
+
+      if (cqe->user_data != URING_IGNORE)
+      {
+        n = uring_complete(loop, cqe, out, n);
+      }
+    }
+
+    __atomic_store_n(loop->cq_head, head, __ATOMIC_RELEASE);
+
+    // A stale completion ending a timed wait restarts the full timeout; late, never early
+    if (n > 0 || timeout_ms == 0 || expired)
+    {
+      return n;
+    }
+  }
+}
+
+const char *evloop_backend_name(void) { return "io_uring"; }
+
+// ==============================================================================
+// KQUEUE
+// ==============================================================================
+
+#elif defined(EVLOOP_KQUEUE)
+
+#define EVLOOP_BATCH 64
+
+struct EventLoop
+{
+  int kqfd;
+};
+
+EventLoop *evloop_create(void)
+{
+  EventLoop *loop = (EventLoop *)calloc(1, sizeof *loop);
+  if (!loop)
+  {
+    return NULL;
+  }
+
+  loop->kqfd = kqueue();
+  if (loop->kqfd < 0)
+  {
+    free(loop);
+
+    return NULL;
+  }
+
+  return loop;
+}
+
+void evloop_destroy(EventLoop *loop)
+{
+  if (!loop)
+  {
+    return;
+  }
+
+  close(loop->kqfd);
+  free(loop);
+}
+
+/**
+ * @brief Apply an interest set; kqueue tracks read and write as two separate filters
+ * @note Deleting a filter that was never added gives ENOENT, which we don't care about
+ */
+static int kq_apply(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  struct kevent  changes[2];
+  unsigned short clear = (events & EVT_EDGE) ? EV_CLEAR : 0;
+
+  EV_SET(&changes[0],
+         fd,
+         EVFILT_READ,
+         (events & EVT_READ) ? (EV_ADD | EV_ENABLE | clear) : EV_DELETE,
+         0,
+         0,
+         udata);
+  EV_SET(&changes[1],
+         fd,
+         EVFILT_WRITE,
+         (events & EVT_WRITE) ? (EV_ADD | EV_ENABLE | clear) : EV_DELETE,
+         0,
+         0,
+         udata);
+
+  for (int i = 0; i < 2; ++i)
+  {
+    if (kevent(loop->kqfd, &changes[i], 1, NULL, 0, NULL) < 0 &&
+        !(errno == ENOENT && (changes[i].flags & EV_DELETE)))
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int evloop_add(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  return kq_apply(loop, fd, events, udata);
+}
+
+int evloop_mod(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  return kq_apply(loop, fd, events, udata);
+}
+
+int evloop_del(EventLoop *loop, int fd) { return kq_apply(loop, fd, 0, NULL); }
+
+int evloop_wait(EventLoop *loop, LoopEvent *out, int max_events, int timeout_ms)
+{
+  struct kevent   evs[EVLOOP_BATCH];
+  struct timespec ts;
+  struct timespec *tsp = NULL;
+
+  if (max_events > EVLOOP_BATCH)
+  {
+    max_events = EVLOOP_BATCH;
+  }
+
+  if (timeout_ms >= 0)
+  {
+    ts.tv_sec  = timeout_ms / 1000;
+    ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+    tsp        = &ts;
+  }
+
+  int got_n = kevent(loop->kqfd, NULL, 0, evs, max_events, tsp);
+  int n     = 0;
+
+  if (got_n < 0)
+  {
+    return -1;
+  }
+
+  // Read and write arrive as separate kevents; one LoopEvent per fd, like the other backends
+  for (int i = 0; i < got_n; ++i)
+  {
+    uint32_t got = (evs[i].filter == EVFILT_READ) ? EVT_READ : EVT_WRITE;
+
+    if (evs[i].flags & EV_EOF)
+    {
+      got |= EVT_HUP;
+    }
+
+    if (evs[i].flags & EV_ERROR)
+    {
+      got |= EVT_ERR;
+    }
+
+    n = merge_event(out, n, evs[i].udata, got);
+  }
+
+  return n;
+}
+
+const char *evloop_backend_name(void) { return "kqueue"; }
+
+// ==============================================================================
+// SELECT (FALLBACK)
+// ==============================================================================
+
+#else
+
+// select() can't watch an fd >= FD_SETSIZE; registration refuses those up front
+typedef struct
+{
+  bool     used;
+  uint32_t events;
+  void    *udata;
+} SelectSlot;
+
+struct EventLoop
+{
+  SelectSlot slots[FD_SETSIZE];
+  int        maxfd; // Highest registered fd, or -1
+};
+
+EventLoop *evloop_create(void)
+{
+  EventLoop *loop = (EventLoop *)calloc(1, sizeof *loop);
+  if (!loop)
+  {
+    return NULL;
+  }
+
+  loop->maxfd = -1;
+
+  return loop;
+}
+
+void evloop_destroy(EventLoop *loop) { free(loop); }
+
+int evloop_add(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  if (fd < 0 || fd >= FD_SETSIZE)
+  {
+    errno = EINVAL;
+
+    return -1;
+  }
+
+  if (loop->slots[fd].used)
+  {
+    errno = EEXIST;
+
+    return -1;
+  }
+
+  loop->slots[fd].used   = true;
+  loop->slots[fd].events = events;
+  loop->slots[fd].udata  = udata;
+
+  if (fd > loop->maxfd)
+  {
+    loop->maxfd = fd;
+  }
+
+  return 0;
+}
+
+int evloop_mod(EventLoop *loop, int fd, uint32_t events, void *udata)
+{
+  if (fd < 0 || fd >= FD_SETSIZE || !loop->slots[fd].used)
+  {
+    errno = ENOENT;
+
+    return -1;
+  }
+
+  loop->slots[fd].events = events;
+  loop->slots[fd].udata  = udata;
+
+  return 0;
+}
+
+int evloop_del(EventLoop *loop, int fd)
+{
+  if (fd < 0 || fd >= FD_SETSIZE || !loop->slots[fd].used)
+  {
+    errno = ENOENT;
+
+    return -1;
+  }
+
+  memset(&loop->slots[fd], 0, sizeof loop->slots[fd]);
+
+  while (loop->maxfd >= 0 && !loop->slots[loop->maxfd].used)
+  {
+    loop->maxfd--;
+  }
+
+  return 0;
+}
+
+int evloop_wait(EventLoop *loop, LoopEvent *out, int max_events, int timeout_ms)
+{
+  fd_set rfds, wfds;
+  FD_ZERO(&rfds);
+  FD_ZERO(&wfds);
+
+  for (int fd = 0; fd <= loop->maxfd; ++fd)
+  {
+    if (loop->slots[fd].events & EVT_READ)
+    {
+      FD_SET(fd, &rfds);
+    }
+
+    if (loop->slots[fd].events & EVT_WRITE)
+    {
+      FD_SET(fd, &wfds);
+    }
+  }
+
+  struct timeval  tv;
+  struct timeval *tvp = NULL;
+
+  if (timeout_ms >= 0)
+  {
+    tv.tv_sec  = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    tvp        = &tv;
+  }
+
+  int ready = select(loop->maxfd + 1, &rfds, &wfds, NULL, tvp);
+  if (ready <= 0)
+  {
+    return ready;
+  }
+
+  int n = 0;
+  for (int fd = 0; fd <= loop->maxfd && n < max_events; ++fd)
+  {
+    uint32_t got = 0;
+
+    if (FD_ISSET(fd, &rfds))
+    {
+      got |= EVT_READ;
+    }
+
+    if (FD_ISSET(fd, &wfds))
+    {
+      got |= EVT_WRITE;
+    }
+
+    if (got)
+    {
+      out[n].udata  = loop->slots[fd].udata;
+      out[n].events = got;
+      n++;
+    }
+  }
+
+  return n;
+}
+
+const char *evloop_backend_name(void) { return "select"; }
+
+#endif
+
+// ==============================================================================
+// RING I/O ELSEWHERE
+// ==============================================================================
+
+// Only io_uring does it; evloop_enable_ring_io() failing is what keeps callers off the rest
+#if !defined(EVLOOP_IO_URING)
+
+int evloop_enable_ring_io(EventLoop *loop, unsigned recv_buffers)
+{
+  (void)loop;
+  (void)recv_buffers;
+  errno = ENOTSUP;
+
+  return -1;
+}
+
+int evloop_accept(EventLoop *loop, int fd, void *udata)
+{
+  (void)loop;
+  (void)fd;
+  (void)udata;
+  errno = ENOTSUP;
+
+  return -1;
+}
+
+int evloop_recv(EventLoop *loop, int fd, void *udata)
+{
+  (void)loop;
+  (void)fd;
+  (void)udata;
+  errno = ENOTSUP;
+
+  return -1;
+}
+
+void evloop_recycle(EventLoop *loop, const LoopEvent *ev)
+{
+  (void)loop;
+  (void)ev;
+}
+
+int evloop_send(EventLoop *loop, int fd, const struct iovec *iov, int count, void *udata)
+{
+  (void)loop;
+  (void)fd;
+  (void)iov;
+  (void)count;
+  (void)udata;
+  errno = ENOTSUP;
+
+  return -1;
+}
+
+#endif
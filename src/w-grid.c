@@ -0,0 +1,87 @@
+#include "w-grid.h"
+
+static uint32_t clamp_index(int32_t pos, int32_t limit, uint32_t count)
+{
+  if (pos < 0)
+  {
+    return 0;
+  }
+
+  if (pos >= limit)
+  {
+    return count - 1;
+  }
+
+  return (uint32_t)pos / GRID_CELL_SIZE;
+}
+
+uint32_t grid_cell_at(int32_t x, int32_t y)
+{
+  return clamp_index(y, WORLD_H, GRID_ROWS) * GRID_COLS + clamp_index(x, WORLD_W, GRID_COLS);
+}
+
+bool grid_cells_near(uint32_t a, uint32_t b)
+{
+  int32_t dx = (int32_t)(a % GRID_COLS) - (int32_t)(b % GRID_COLS);
+  int32_t dy = (int32_t)(a / GRID_COLS) - (int32_t)(b / GRID_COLS);
+
+  return dx >= -1 && dx <= 1 && dy >= -1 && dy <= 1;
+}
+
+static void link_node(SpatialGrid *grid, GridNode *node, uint32_t cell)
+{
+  GridNode **head = &grid->cells[cell];
+
+  node->next = *head;
+  if (*head)
+  {
+    (*head)->pprev = &node->next;
+  }
+
+  *head       = node;
+  node->pprev = head;
+  node->cell  = cell;
+}
+
+static void unlink_node(GridNode *node)
+{
+  *node->pprev = node->next;
+  if (node->next)
+  {
+    node->next->pprev = node->pprev;
+  }
+
+  node->next  = NULL;
+  node->pprev = NULL;
+}
+
+void grid_insert(SpatialGrid *grid, GridNode *node, int32_t x, int32_t y)
+{
+  link_node(grid, node, grid_cell_at(x, y));
+  grid->count++;
+}
+
+void grid_move(SpatialGrid *grid, GridNode *node, int32_t x, int32_t y)
+{
+  uint32_t cell = grid_cell_at(x, y);
+
+  // Most moves stay inside the cell; those cost nothing
+  if (cell == node->cell)
+  {
+    return;
+  }
+
+  unlink_node(node);
+  link_node(grid, node, cell);
+}
+
+void grid_remove(SpatialGrid *grid, GridNode *node)
+{
+  if (!node->pprev)
+  {
+    return;
+  }
+
+  unlink_node(node);
+  grid->count--;
+}
@@ -0,0 +1,116 @@
+#include "w-hash.h"
+
+#include <string.h>
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME64_3 0x165667B19E3779F9ull
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ull
+#define XXH_STRIPE 32 // Bytes consumed per round of the four lanes
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) { return (x << r) | (x >> (64 - r)); }
+
+// The spec reads everything little-endian; memcpy keeps unaligned input legal
+static inline uint64_t read64(const uint8_t *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof v);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+
+  return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof v);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+
+  return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input)
+{
+  acc += input * XXH_PRIME64_2;
+  acc  = rotl64(acc, 31);
+
+  return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t lane)
+{
+  acc ^= xxh_round(0, lane);
+
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed)
+{
+  const uint8_t *p   = (const uint8_t *)data;
+  const uint8_t *end = p + len;
+  uint64_t       h;
+
+  if (len >= XXH_STRIPE)
+  {
+    uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = seed + XXH_PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - XXH_PRIME64_1;
+
+    for (; end - p >= XXH_STRIPE; p += XXH_STRIPE)
+    {
+      v1 = xxh_round(v1, read64(p));
+      v2 = xxh_round(v2, read64(p + 8));
+      v3 = xxh_round(v3, read64(p + 16));
+      v4 = xxh_round(v4, read64(p + 24));
+    }
+
+    h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h = xxh_merge(h, v1);
+    h = xxh_merge(h, v2);
+    h = xxh_merge(h, v3);
+    h = xxh_merge(h, v4);
+  }
+  else
+  {
+    h = seed + XXH_PRIME64_5;
+  }
+
+  h += (uint64_t)len;
+
+  // Whatever's left over after the stripes: 8 bytes, then 4, then one at a time
+  for (; end - p >= 8; p += 8)
+  {
+    h ^= xxh_round(0, read64(p));
+    h  = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+
+  if (end - p >= 4)
+  {
+    h ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+    h  = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+
+  for (; p < end; ++p)
+  {
+    h ^= (uint64_t)*p * XXH_PRIME64_5;
+    h  = rotl64(h, 11) * XXH_PRIME64_1;
+  }
+
+  // Avalanche, so every input bit reaches every output bit
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
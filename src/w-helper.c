@@ -1,9 +1,22 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // accept4()
+#endif
+
 #include "w-helper.h"
+#include "w-metrics.h"
+#include "w-trace.h"
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
 
 int irand(int a, int b)
 {
@@ -11,8 +24,28 @@ int irand(int a, int b)
   return a + rand() % (b - a + 1);
 }
 
+uint64_t secure_rand64(void)
+{
+  uint64_t v = 0;
+
+#if defined(__linux__)
+  while (getrandom(&v, sizeof v, 0) != (ssize_t)sizeof v && errno == EINTR)
+  {
+  }
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+  arc4random_buf(&v, sizeof v);
+#else
+  // Nothing better around; mix the clock in so at least it isn't the same every run
+  v = ((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ (uint64_t)time(NULL) * 0x9e3779b97f4a7c15ull;
+#endif
+
+  return v ? v : 1;
+}
+
 ssize_t recvall(int fd, void *buf, size_t len)
 {
+  TRACE_SCOPE("recvall");
+
   uint8_t *curr  = (uint8_t *)buf; // Current location on buffer
   size_t   nrecv = 0;              // Amt. of received bytes out of len thus far
 
@@ -31,16 +64,17 @@ ssize_t recvall(int fd, void *buf, size_t len)
 
     if (nbytes < 0)
     {
-      perror("server: recvall");
-
       // EINTR = An async function interrupted this call; looks like we may recover from this by simply redoing loop
+      // Counted rather than printed; shows up on the metrics endpoint
       if (errno == EINTR)
       {
-        printf("server: recvall: resuming\n");
+        metrics_inc(METRIC_EINTR_RETRIES);
         continue;
       }
 
       // Any other signal is deadly
+      perror("server: recvall");
+
       return -1;
     }
 
@@ -53,6 +87,8 @@ ssize_t recvall(int fd, void *buf, size_t len)
 
 ssize_t sendall(int fd, const void *buf, size_t len)
 {
+  TRACE_SCOPE("sendall");
+
   const uint8_t *curr  = (const uint8_t *)buf;
   size_t         nsent = 0;
 
@@ -67,6 +103,7 @@ ssize_t sendall(int fd, const void *buf, size_t len)
     {
       if (errno == EINTR)
       {
+        metrics_inc(METRIC_EINTR_RETRIES);
         continue;
       }
 
@@ -79,4 +116,42 @@ ssize_t sendall(int fd, const void *buf, size_t len)
   return (ssize_t)nsent;
 }
 
+int set_nonblocking(int fd)
+{
+  // Keep whatever flags are already there; just OR ours in
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+  {
+    return -1;
+  }
+
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+int accept_nonblocking(int listen_fd, struct sockaddr *addr, socklen_t *addrlen)
+{
+#if defined(__linux__)
+  return accept4(listen_fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  int fd = accept(listen_fd, addr, addrlen);
+
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  if (set_nonblocking(fd) < 0 || fcntl(fd, F_SETFD, FD_CLOEXEC) < 0)
+  {
+    int err = errno;
+
+    close(fd);
+    errno = err;
+
+    return -1;
+  }
+
+  return fd;
+#endif
+}
+
 // NOTE: We're using all-or-error semantics; we either return nsent/nrecv (which must be the length) or -1
@@ -0,0 +1,185 @@
+#include "w-index.h"
+
+#include <stdlib.h>
+
+#define SLOT_INDEX_MIN_CAP 16
+
+/**
+ * @brief Scramble a key so that sequential keys (IPs in one subnet...) land far apart
+ * @note splitmix64 finalizer
+ */
+static uint64_t mix64(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ull;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebull;
+  x ^= x >> 31;
+
+  return x;
+}
+
+/**
+ * @brief Place an entry without any growth or duplicate checks; the key must not be present
+ */
+static void place(SlotIndexEntry *entries, size_t cap, uint64_t key, uint32_t slot)
+{
+  size_t mask = cap - 1;
+  size_t i    = (size_t)mix64(key) & mask;
+
+  while (entries[i].used)
+  {
+    i = (i + 1) & mask;
+  }
+
+  entries[i].key  = key;
+  entries[i].slot = slot;
+  entries[i].used = 1;
+}
+
+/**
+ * @brief Rehash everything into a bucket array of new_cap buckets
+ */
+static bool resize(SlotIndex *idx, size_t new_cap)
+{
+  SlotIndexEntry *entries = (SlotIndexEntry *)calloc(new_cap, sizeof *entries);
+  if (!entries)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < idx->cap; ++i)
+  {
+    if (idx->entries[i].used)
+    {
+      place(entries, new_cap, idx->entries[i].key, idx->entries[i].slot);
+    }
+  }
+
+  free(idx->entries);
+
+  idx->entries = entries;
+  idx->cap     = new_cap;
+
+  return true;
+}
+
+/**
+ * @brief Find the bucket holding key
+ * @returns The bucket index, or cap if the key is not there
+ */
+static size_t find_bucket(const SlotIndex *idx, uint64_t key)
+{
+  if (idx->cap == 0)
+  {
+    return 0;
+  }
+
+  size_t mask = idx->cap - 1;
+  size_t i    = (size_t)mix64(key) & mask;
+
+  // Never more than half full, so this always hits an empty bucket eventually
+  while (idx->entries[i].used)
+  {
+    if (idx->entries[i].key == key)
+    {
+      return i;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return idx->cap;
+}
+
+bool slot_index_init(SlotIndex *idx, size_t expected)
+{
+  idx->entries = NULL;
+  idx->cap     = 0;
+  idx->count   = 0;
+
+  size_t cap = SLOT_INDEX_MIN_CAP;
+  while (cap < expected * 2)
+  {
+    cap <<= 1;
+  }
+
+  return resize(idx, cap);
+}
+
+void slot_index_free(SlotIndex *idx)
+{
+  free(idx->entries);
+
+  idx->entries = NULL;
+  idx->cap     = 0;
+  idx->count   = 0;
+}
+
+uint32_t slot_index_find(const SlotIndex *idx, uint64_t key)
+{
+  size_t i = find_bucket(idx, key);
+
+  return i < idx->cap ? idx->entries[i].slot : SLOT_INDEX_NONE;
+}
+
+bool slot_index_insert(SlotIndex *idx, uint64_t key, uint32_t slot)
+{
+  size_t i = find_bucket(idx, key);
+  if (i < idx->cap)
+  {
+    idx->entries[i].slot = slot;
+
+    return true;
+  }
+
+  // Keep the load factor at or below 1/2; probe chains stay short
+  if ((idx->count + 1) * 2 > idx->cap &&
+      !resize(idx, idx->cap ? idx->cap * 2 : SLOT_INDEX_MIN_CAP))
+  {
+    return false;
+  }
+
+  place(idx->entries, idx->cap, key, slot);
+  idx->count++;
+
+  return true;
+}
+
+bool slot_index_remove(SlotIndex *idx, uint64_t key)
+{
+  size_t hole = find_bucket(idx, key);
+  if (hole >= idx->cap)
+  {
+    return false;
+  }
+
+  // Backward-shift deletion: pull later members of the probe chain into the hole, as long
+  // as that doesn't move them in front of their home bucket
+  size_t mask = idx->cap - 1;
+  size_t i    = hole;
+
+  for (;;)
+  {
+    i = (i + 1) & mask;
+
+    if (!idx->entries[i].used)
+    {
+      break;
+    }
+
+    size_t home = (size_t)mix64(idx->entries[i].key) & mask;
+
+    // Distance from home to i vs. home to hole, both measured cyclically
+    if (((i - home) & mask) >= ((i - hole) & mask))
+    {
+      idx->entries[hole] = idx->entries[i];
+      hole               = i;
+    }
+  }
+
+  idx->entries[hole].used = 0;
+  idx->count--;
+
+  return true;
+}
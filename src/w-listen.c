@@ -0,0 +1,216 @@
+#include "w-listen.h"
+
+#include "w-helper.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+ListenOptions listen_defaults(void)
+{
+  // Replies are already batched into one writev(); Nagle would only hold them back
+  return (ListenOptions){.nodelay = true};
+}
+
+bool listen_is_ipv6(const char *bind_ip)
+{
+  return strchr(bind_ip, ':') != NULL;
+}
+
+/**
+ * @brief setsockopt() an int, saying so if the kernel won't have it
+ * @returns 0 on success, -1 on failure
+ */
+static int set_int_option(int fd, int level, int name, int value, const char *what)
+{
+  if (setsockopt(fd, level, name, &value, sizeof value) < 0)
+  {
+    fprintf(stderr, "server: %s: %s\n", what, strerror(errno));
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Everything that has to be set before bind()/listen() to count
+ * @returns 0 on success, -1 if an option that was asked for and exists here failed
+ */
+static int tune_listener(int fd, const ListenOptions *opts)
+{
+  if (set_int_option(fd, SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR") < 0)
+  {
+    return -1;
+  }
+
+  if (opts->reuseport)
+  {
+#ifdef SO_REUSEPORT
+    if (set_int_option(fd, SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT") < 0)
+    {
+      return -1;
+    }
+#else
+    fprintf(stderr, "server: SO_REUSEPORT isn't supported here; ignored\n");
+#endif
+  }
+
+  if (opts->rcvbuf > 0 && set_int_option(fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, "SO_RCVBUF") < 0)
+  {
+    return -1;
+  }
+
+  if (opts->sndbuf > 0 && set_int_option(fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, "SO_SNDBUF") < 0)
+  {
+    return -1;
+  }
+
+  if (opts->defer_accept_sec > 0)
+  {
+#ifdef TCP_DEFER_ACCEPT
+    if (set_int_option(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, opts->defer_accept_sec, "TCP_DEFER_ACCEPT") < 0)
+    {
+      return -1;
+    }
+#else
+    fprintf(stderr, "server: TCP_DEFER_ACCEPT isn't supported here; ignored\n");
+#endif
+  }
+
+  // Applied per connection, see listen_tune_accepted(); this is just the one place to say it won't be
+#ifndef TCP_QUICKACK
+  if (opts->quickack)
+  {
+    fprintf(stderr, "server: TCP_QUICKACK isn't supported here; ignored\n");
+  }
+#endif
+
+  return 0;
+}
+
+int listen_open(const char *bind_ip, uint16_t port, const ListenOptions *opts)
+{
+  struct sockaddr_storage addr;
+  socklen_t               addrlen;
+  int                     family = listen_is_ipv6(bind_ip) ? AF_INET6 : AF_INET;
+
+  memset(&addr, 0, sizeof addr);
+
+  if (family == AF_INET6)
+  {
+    struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)&addr;
+
+    a6->sin6_family = AF_INET6;
+    a6->sin6_port   = htons(port);
+    addrlen         = sizeof *a6;
+
+    if (inet_pton(AF_INET6, bind_ip, &a6->sin6_addr) != 1)
+    {
+      fprintf(stderr, "server: bad bind address %s\n", bind_ip);
+
+      return -1;
+    }
+  }
+  else
+  {
+    struct sockaddr_in *a4 = (struct sockaddr_in *)&addr;
+
+    a4->sin_family = AF_INET;
+    a4->sin_port   = htons(port);
+    addrlen        = sizeof *a4;
+
+    if (inet_pton(AF_INET, bind_ip, &a4->sin_addr) != 1)
+    {
+      fprintf(stderr, "server: bad bind address %s\n", bind_ip);
+
+      return -1;
+    }
+  }
+
+  int fd = socket(family, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    perror("server: socket");
+
+    return -1;
+  }
+
+  // Dual-stack, whatever the system default is; IPv4 clients show up as ::ffff:a.b.c.d
+  if (family == AF_INET6 && set_int_option(fd, IPPROTO_IPV6, IPV6_V6ONLY, 0, "IPV6_V6ONLY") < 0)
+  {
+    close(fd);
+
+    return -1;
+  }
+
+  if (tune_listener(fd, opts) < 0)
+  {
+    close(fd);
+
+    return -1;
+  }
+
+  // Non-blocking, so a connection that vanishes between readiness and accept() can't stall the acceptor
+  int backlog = opts->backlog > 0 ? opts->backlog : LISTEN_BACKLOG;
+
+  if (bind(fd, (struct sockaddr *)&addr, addrlen) < 0 || listen(fd, backlog) < 0 || set_nonblocking(fd) < 0)
+  {
+    perror("server: listen_open");
+    close(fd);
+
+    return -1;
+  }
+
+  return fd;
+}
+
+void listen_tune_accepted(int fd, const ListenOptions *opts)
+{
+  int one = 1;
+
+  if (opts->nodelay)
+  {
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  }
+
+  // Only lasts until the kernel decides otherwise, but that's past the first REGISTER's ACK
+#ifdef TCP_QUICKACK
+  if (opts->quickack)
+  {
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof one);
+  }
+#endif
+}
+
+uint32_t listen_peer_key(const struct sockaddr_storage *addr)
+{
+  if (addr->ss_family == AF_INET)
+  {
+    return ((const struct sockaddr_in *)addr)->sin_addr.s_addr;
+  }
+
+  const struct in6_addr *a6 = &((const struct sockaddr_in6 *)addr)->sin6_addr;
+  uint32_t               key;
+
+  // An IPv4 client on a dual-stack listener is the same player it'd be on an IPv4 one
+  if (IN6_IS_ADDR_V4MAPPED(a6))
+  {
+    memcpy(&key, &a6->s6_addr[12], sizeof key);
+
+    return key;
+  }
+
+  // FNV-1a; spreads the interface ID around, which is where clients on one network differ
+  key = 2166136261u;
+
+  for (size_t i = 0; i < sizeof a6->s6_addr; ++i)
+  {
+    key = (key ^ a6->s6_addr[i]) * 16777619u;
+  }
+
+  return key;
+}
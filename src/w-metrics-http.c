@@ -0,0 +1,212 @@
+#include "w-metrics-http.h"
+
+#include "w-event.h"
+#include "w-helper.h"
+#include "w-listen.h"
+#include "w-metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+
+#define METRICS_IO_TIMEOUT_MS 2000 // How long a scraper may take per read or write before it's dropped
+#define METRICS_MAX_REQUEST 2048   // Request line plus headers; whatever's past that goes unread
+
+static int       g_metrics_fd      = -1;       // Listener; -1 = no endpoint
+static int       g_metrics_stop[2] = {-1, -1}; // Poked once to make the thread return
+static pthread_t g_metrics_thread;
+
+/**
+ * @brief Answer one scrape, then hang up
+ * @param fd The scraper's socket; closed by the time this returns
+ */
+static void metrics_serve(int fd)
+{
+  // Blocking from here on, with timeouts; this thread has nothing better to do meanwhile
+  struct timeval tv    = {.tv_sec = METRICS_IO_TIMEOUT_MS / 1000, .tv_usec = METRICS_IO_TIMEOUT_MS % 1000 * 1000};
+  int            flags = fcntl(fd, F_GETFL, 0);
+
+  if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+  {
+    close(fd);
+
+    return;
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+
+  // Read up to the blank line that ends the headers; we don't care what they say
+  char   req[METRICS_MAX_REQUEST + 1];
+  size_t len = 0;
+
+  while (len < METRICS_MAX_REQUEST)
+  {
+    ssize_t n = recv(fd, req + len, METRICS_MAX_REQUEST - len, 0);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (n <= 0)
+    {
+      break;
+    }
+
+    len += (size_t)n;
+    req[len] = '\0';
+
+    if (strstr(req, "\r\n\r\n"))
+    {
+      break;
+    }
+  }
+
+  req[len] = '\0';
+
+  bool found = (strncmp(req, "GET /metrics", 12) == 0 && (req[12] == ' ' || req[12] == '?')) ||
+               strncmp(req, "GET / ", 6) == 0;
+
+  char  *body     = NULL;
+  size_t body_len = found ? metrics_render(&body) : 0;
+  char   head[160];
+  int    head_len;
+
+  if (found && body)
+  {
+    head_len = snprintf(head, sizeof head,
+                        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n",
+                        body_len);
+  }
+  else
+  {
+    head_len = snprintf(head, sizeof head, "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                        found ? "500 Internal Server Error" : "404 Not Found");
+  }
+
+  if (sendall(fd, head, (size_t)head_len) == head_len && body)
+  {
+    sendall(fd, body, body_len);
+  }
+
+  free(body);
+  close(fd);
+}
+
+static void *metrics_main(void *arg)
+{
+  (void)arg;
+
+  EventLoop *loop = evloop_create();
+
+  if (!loop || evloop_add(loop, g_metrics_fd, EVT_READ, NULL) < 0 ||
+      evloop_add(loop, g_metrics_stop[0], EVT_READ, g_metrics_stop) < 0)
+  {
+    perror("server: metrics endpoint");
+    evloop_destroy(loop);
+
+    return NULL;
+  }
+
+  for (;;)
+  {
+    LoopEvent events[1];
+    int       ready = evloop_wait(loop, events, 1, -1);
+
+    if (ready < 0 && errno == EINTR)
+    {
+      metrics_inc(METRIC_EINTR_RETRIES);
+      continue;
+    }
+
+    if (ready < 0 || (ready > 0 && events[0].udata == g_metrics_stop))
+    {
+      break;
+    }
+
+    // Listener is non-blocking; a scraper that gave up before we got here is no problem
+    int fd = accept(g_metrics_fd, NULL, NULL);
+
+    if (fd >= 0)
+    {
+      metrics_serve(fd);
+    }
+  }
+
+  evloop_destroy(loop);
+
+  return NULL;
+}
+
+bool metrics_endpoint_start(const char *bind_ip, uint16_t port)
+{
+  ListenOptions opts = listen_defaults();
+
+  g_metrics_fd = listen_open(bind_ip, port, &opts);
+
+  if (g_metrics_fd < 0)
+  {
+    return false;
+  }
+
+  if (pipe(g_metrics_stop) < 0)
+  {
+    perror("server: metrics endpoint");
+    g_metrics_stop[0] = g_metrics_stop[1] = -1;
+    close(g_metrics_fd);
+    g_metrics_fd = -1;
+
+    return false;
+  }
+
+  if (pthread_create(&g_metrics_thread, NULL, metrics_main, NULL) != 0)
+  {
+    perror("server: pthread_create");
+    close(g_metrics_stop[0]);
+    close(g_metrics_stop[1]);
+    g_metrics_stop[0] = g_metrics_stop[1] = -1;
+    close(g_metrics_fd);
+    g_metrics_fd = -1;
+
+    return false;
+  }
+
+  bool v6 = listen_is_ipv6(bind_ip);
+
+  printf("server: metrics on http://%s%s%s:%u/metrics\n", v6 ? "[" : "", bind_ip, v6 ? "]" : "", port);
+
+  return true;
+}
+
+void metrics_endpoint_stop(void)
+{
+  if (g_metrics_fd < 0)
+  {
+    return;
+  }
+
+  char    poke = 0;
+  ssize_t ignored;
+
+  do
+  {
+    ignored = write(g_metrics_stop[1], &poke, 1);
+  } while (ignored < 0 && errno == EINTR);
+
+  pthread_join(g_metrics_thread, NULL);
+
+  close(g_metrics_stop[0]);
+  close(g_metrics_stop[1]);
+  close(g_metrics_fd);
+
+  g_metrics_stop[0] = g_metrics_stop[1] = -1;
+  g_metrics_fd                          = -1;
+}
@@ -0,0 +1,357 @@
+#include "w-metrics.h"
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define METRICS_MAX_SHARDS 128 // Threads past this many share one overflow shard; still correct, just contended
+#define METRICS_CACHE_LINE 64
+#define HIST_SUB_COUNT (1u << METRICS_HIST_SUB_BITS)
+#define HIST_BUCKETS ((METRICS_HIST_MAX_BITS - METRICS_HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+#define HIST_RENDER_MIN_BITS 7  // Coarsest exposition bucket starts at 2^7 ns = 128ns
+#define HIST_RENDER_MAX_BITS 36 // ...and the last finite one ends at 2^36 ns, ~69s
+
+typedef struct
+{
+  atomic_uint_fast64_t count;
+  atomic_uint_fast64_t sum; // Nanoseconds
+  atomic_uint_fast64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef struct
+{
+  _Alignas(METRICS_CACHE_LINE) atomic_uint_fast64_t counters[METRIC_COUNTERS];
+  _Alignas(METRICS_CACHE_LINE) Histogram hist[METRIC_HISTOGRAMS];
+} MetricsShard;
+
+static _Atomic(MetricsShard *) g_shards[METRICS_MAX_SHARDS];
+static atomic_size_t           g_shard_count = 0;
+static MetricsShard            g_overflow_shard;
+
+static _Thread_local MetricsShard *t_shard = NULL;
+
+// Counters that share a name render as one family, told apart by their labels
+static const struct
+{
+  const char *name;
+  const char *labels; // NULL if none
+  const char *help;
+} k_counters[METRIC_COUNTERS] = {
+  [METRIC_ACCEPTS]             = {"wall_accepts_total", NULL, "TCP connections accepted"},
+  [METRIC_REJECT_RATE]         = {"wall_rejected_connections_total", "reason=\"rate\"", "Connections turned away with BUSY, by reason"},
+  [METRIC_REJECT_FULL]         = {"wall_rejected_connections_total", "reason=\"full\"", NULL},
+  [METRIC_REJECT_FDS]          = {"wall_rejected_connections_total", "reason=\"fds\"", NULL},
+  [METRIC_ACCEPT_PAUSES]       = {"wall_accept_pauses_total", NULL, "Times the listener was paused for running out of fds"},
+  [METRIC_REGISTRATIONS]       = {"wall_registrations_total", NULL, "REGISTER frames answered with an ACK"},
+  [METRIC_RESUMES]             = {"wall_resumes_total", "result=\"ok\"", "RESUME frames, by whether the player was picked back up"},
+  [METRIC_RESUME_MISSES]       = {"wall_resumes_total", "result=\"miss\"", NULL},
+  [METRIC_REDIRECTS]           = {"wall_redirects_total", NULL, "REGISTER and RESUME frames sent to the node owning their player"},
+  [METRIC_REG_FAIL_HEADER]     = {"wall_registration_failures_total", "reason=\"bad_header\"", "REGISTER frames dropped, by reason"},
+  [METRIC_REG_FAIL_NO_BLOCK]   = {"wall_registration_failures_total", "reason=\"no_avatar_block\"", NULL},
+  [METRIC_REG_FAIL_DECODE]     = {"wall_registration_failures_total", "reason=\"bad_packed_avatar\"", NULL},
+  [METRIC_REG_FAIL_TABLE_FULL] = {"wall_registration_failures_total", "reason=\"table_full\"", NULL},
+  [METRIC_REG_FAIL_AVATAR]     = {"wall_registration_failures_total", "reason=\"avatar_rejected\"", NULL},
+  [METRIC_REG_FAIL_REPLY]      = {"wall_registration_failures_total", "reason=\"reply_queue_full\"", NULL},
+  [METRIC_AVATAR_UNCHANGED]    = {"wall_avatars_deduplicated_total", "result=\"unchanged\"", "Avatars set that were already held, by whose they were"},
+  [METRIC_AVATAR_SHARED]       = {"wall_avatars_deduplicated_total", "result=\"shared\"", NULL},
+  [METRIC_REPL_OUT]            = {"wall_replication_records_total", "direction=\"out\"", "Cluster replication records, by direction"},
+  [METRIC_REPL_IN]             = {"wall_replication_records_total", "direction=\"in\"", NULL},
+  [METRIC_TCP_BYTES_IN]        = {"wall_received_bytes_total", "transport=\"tcp\"", "Bytes read off client sockets"},
+  [METRIC_UDP_BYTES_IN]        = {"wall_received_bytes_total", "transport=\"udp\"", NULL},
+  [METRIC_TCP_BYTES_OUT]       = {"wall_sent_bytes_total", "transport=\"tcp\"", "Bytes written to client sockets"},
+  [METRIC_UDP_BYTES_OUT]       = {"wall_sent_bytes_total", "transport=\"udp\"", NULL},
+  [METRIC_EINTR_RETRIES]       = {"wall_eintr_retries_total", NULL, "Syscalls redone after a signal interrupted them"},
+};
+
+static const struct
+{
+  const char *name;
+  const char *help;
+} k_histograms[METRIC_HISTOGRAMS] = {
+  [METRIC_HIST_REGISTER]     = {"wall_registration_seconds", "Time from a whole REGISTER frame to its ACK being queued"},
+  [METRIC_HIST_PLAYERS_WAIT] = {"wall_players_lock_wait_seconds", "Time spent waiting to write-lock the players table"},
+  [METRIC_HIST_PLAYERS_HOLD] = {"wall_players_lock_hold_seconds", "Time the players table stayed write-locked"},
+};
+
+/**
+ * @brief This thread's shard; made on first use
+ */
+static MetricsShard *shard(void)
+{
+  if (t_shard)
+  {
+    return t_shard;
+  }
+
+  size_t        index = atomic_fetch_add(&g_shard_count, 1);
+  MetricsShard *s     = NULL;
+
+  if (index < METRICS_MAX_SHARDS)
+  {
+    s = (MetricsShard *)aligned_alloc(METRICS_CACHE_LINE, sizeof *s);
+  }
+
+  if (s)
+  {
+    memset(s, 0, sizeof *s);
+    atomic_store_explicit(&g_shards[index], s, memory_order_release);
+  }
+  else
+  {
+    s = &g_overflow_shard;
+  }
+
+  t_shard = s;
+
+  return s;
+}
+
+void metrics_add(MetricCounter c, uint64_t n)
+{
+  atomic_fetch_add_explicit(&shard()->counters[c], n, memory_order_relaxed);
+}
+
+/**
+ * @brief Which bucket a value falls in
+ * @note Below 2^SUB_BITS every value has its own bucket; above, each power of two gets SUB_COUNT of them
+ */
+static size_t hist_bucket(uint64_t v)
+{
+  if (v < HIST_SUB_COUNT)
+  {
+    return (size_t)v;
+  }
+
+  if (v >> METRICS_HIST_MAX_BITS)
+  {
+    return HIST_BUCKETS - 1;
+  }
+
+  unsigned top = 63 - (unsigned)__builtin_clzll(v); // Highest set bit; >= SUB_BITS here
+  unsigned lo  = top - METRICS_HIST_SUB_BITS;
+
+  return (size_t)(top - METRICS_HIST_SUB_BITS + 1) * HIST_SUB_COUNT + (size_t)((v >> lo) - HIST_SUB_COUNT);
+}
+
+void metrics_record(MetricHistogram h, uint64_t ns)
+{
+  Histogram *hist = &shard()->hist[h];
+
+  atomic_fetch_add_explicit(&hist->buckets[hist_bucket(ns)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->sum, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+}
+
+int64_t metrics_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// ==============================================================================
+// RENDERING
+// ==============================================================================
+
+typedef struct
+{
+  char  *buf;
+  size_t len, cap;
+  bool   failed;
+} TextBuf;
+
+static void text_printf(TextBuf *t, const char *fmt, ...)
+{
+  for (;;)
+  {
+    if (t->failed)
+    {
+      return;
+    }
+
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(t->buf + t->len, t->cap - t->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+    {
+      t->failed = true;
+
+      return;
+    }
+
+    if ((size_t)n < t->cap - t->len)
+    {
+      t->len += (size_t)n;
+
+      return;
+    }
+
+    // Didn't fit; grow and redo it
+    size_t cap  = t->cap * 2 + (size_t)n;
+    char  *grown = (char *)realloc(t->buf, cap);
+
+    if (!grown)
+    {
+      t->failed = true;
+
+      return;
+    }
+
+    t->buf = grown;
+    t->cap = cap;
+  }
+}
+
+/**
+ * @brief Call fn on every shard there is, the overflow one included
+ */
+static void for_each_shard(void (*fn)(const MetricsShard *s, void *arg), void *arg)
+{
+  size_t count = atomic_load(&g_shard_count);
+
+  if (count > METRICS_MAX_SHARDS)
+  {
+    count = METRICS_MAX_SHARDS;
+  }
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    // Claimed but not published yet; whatever it holds shows up next time
+    const MetricsShard *s = atomic_load_explicit(&g_shards[i], memory_order_acquire);
+
+    if (s)
+    {
+      fn(s, arg);
+    }
+  }
+
+  fn(&g_overflow_shard, arg);
+}
+
+typedef struct
+{
+  uint64_t counters[METRIC_COUNTERS];
+  uint64_t count[METRIC_HISTOGRAMS];
+  uint64_t sum[METRIC_HISTOGRAMS];
+  uint64_t buckets[METRIC_HISTOGRAMS][HIST_BUCKETS];
+} MetricsTotals;
+
+static void add_shard(const MetricsShard *s, void *arg)
+{
+  MetricsTotals *t = (MetricsTotals *)arg;
+
+  for (int c = 0; c < METRIC_COUNTERS; ++c)
+  {
+    t->counters[c] += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+  }
+
+  for (int h = 0; h < METRIC_HISTOGRAMS; ++h)
+  {
+    t->count[h] += atomic_load_explicit(&s->hist[h].count, memory_order_relaxed);
+    t->sum[h] += atomic_load_explicit(&s->hist[h].sum, memory_order_relaxed);
+
+    for (size_t b = 0; b < HIST_BUCKETS; ++b)
+    {
+      t->buckets[h][b] += atomic_load_explicit(&s->hist[h].buckets[b], memory_order_relaxed);
+    }
+  }
+}
+
+static void render_histogram(TextBuf *t, const MetricsTotals *totals, int h)
+{
+  const char *name = k_histograms[h].name;
+
+  text_printf(t, "# HELP %s %s\n# TYPE %s histogram\n", name, k_histograms[h].help, name);
+
+  // Powers of two are bucket edges at every scale, so each exposition bucket is a whole run of fine ones
+  // The count comes from the buckets themselves, so +Inf always agrees with them mid-update too
+  uint64_t cumulative = 0;
+  size_t   b          = 0;
+
+  for (unsigned bits = HIST_RENDER_MIN_BITS; bits <= HIST_RENDER_MAX_BITS; ++bits)
+  {
+    size_t end = hist_bucket((uint64_t)1 << bits);
+
+    for (; b < end; ++b)
+    {
+      cumulative += totals->buckets[h][b];
+    }
+
+    text_printf(t, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)((uint64_t)1 << bits) * 1e-9,
+                (unsigned long long)cumulative);
+  }
+
+  for (; b < HIST_BUCKETS; ++b)
+  {
+    cumulative += totals->buckets[h][b];
+  }
+
+  text_printf(t, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+  text_printf(t, "%s_sum %.9f\n", name, (double)totals->sum[h] * 1e-9);
+  text_printf(t, "%s_count %llu\n", name, (unsigned long long)cumulative);
+}
+
+size_t metrics_render(char **out)
+{
+  MetricsTotals *totals = (MetricsTotals *)calloc(1, sizeof *totals);
+  TextBuf        t      = {.cap = 8192};
+
+  t.buf  = (char *)malloc(t.cap);
+  *out   = NULL;
+
+  if (!totals || !t.buf)
+  {
+    free(totals);
+    free(t.buf);
+
+    return 0;
+  }
+
+  for_each_shard(add_shard, totals);
+
+  for (int c = 0; c < METRIC_COUNTERS; ++c)
+  {
+    // First of its family; say what the family is
+    if (c == 0 || strcmp(k_counters[c].name, k_counters[c - 1].name) != 0)
+    {
+      text_printf(&t, "# HELP %s %s\n# TYPE %s counter\n", k_counters[c].name, k_counters[c].help, k_counters[c].name);
+    }
+
+    if (k_counters[c].labels)
+    {
+      text_printf(&t, "%s{%s} %llu\n", k_counters[c].name, k_counters[c].labels,
+                  (unsigned long long)totals->counters[c]);
+    }
+    else
+    {
+      text_printf(&t, "%s %llu\n", k_counters[c].name, (unsigned long long)totals->counters[c]);
+    }
+  }
+
+  for (int h = 0; h < METRIC_HISTOGRAMS; ++h)
+  {
+    render_histogram(&t, totals, h);
+  }
+
+  free(totals);
+
+  if (t.failed)
+  {
+    free(t.buf);
+
+    return 0;
+  }
+
+  *out = t.buf;
+
+  return t.len;
+}
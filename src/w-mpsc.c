@@ -0,0 +1,95 @@
+#include "w-mpsc.h"
+
+#include <stdlib.h>
+
+bool mpsc_init(MpscQueue *q, size_t capacity)
+{
+  size_t cap = 2;
+
+  while (cap < capacity)
+  {
+    cap *= 2;
+  }
+
+  q->cells = (MpscCell *)malloc(cap * sizeof *q->cells);
+  if (!q->cells)
+  {
+    return false;
+  }
+
+  for (size_t i = 0; i < cap; ++i)
+  {
+    atomic_init(&q->cells[i].seq, i);
+  }
+
+  q->mask = cap - 1;
+  q->head = 0;
+  atomic_init(&q->tail, 0);
+
+  return true;
+}
+
+void mpsc_destroy(MpscQueue *q)
+{
+  free(q->cells);
+  q->cells = NULL;
+}
+
+bool mpsc_push(MpscQueue *q, uint64_t value)
+{
+  size_t    pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  MpscCell *cell;
+
+  for (;;)
+  {
+    cell = &q->cells[pos & q->mask];
+
+    size_t    seq  = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    ptrdiff_t diff = (ptrdiff_t)(seq - pos);
+
+    // Cell is free at our position; try to claim it
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(
+              &q->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    // The consumer hasn't freed this cell from a lap ago; we're full
+    else if (diff < 0)
+    {
+      return false;
+    }
+    // Somebody else pushed past us; catch up
+    else
+    {
+      pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+  }
+
+  cell->value = value;
+  atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+  return true;
+}
+
+bool mpsc_pop(MpscQueue *q, uint64_t *value)
+{
+  MpscCell *cell = &q->cells[q->head & q->mask];
+  size_t    seq  = atomic_load_explicit(&cell->seq, memory_order_acquire);
+
+  // Not published yet (or never claimed); either way nothing to take
+  if (seq != q->head + 1)
+  {
+    return false;
+  }
+
+  *value = cell->value;
+
+  // Free the cell for whoever pushes at this index one lap from now
+  atomic_store_explicit(&cell->seq, q->head + q->mask + 1, memory_order_release);
+  q->head++;
+
+  return true;
+}
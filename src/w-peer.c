@@ -0,0 +1,910 @@
+#include "w-peer.h"
+
+#include "w-event.h"
+#include "w-helper.h"
+#include "w-listen.h"
+#include "w-metrics.h"
+#include "w-player.h"
+#include "w-trace.h"
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLUSTER_RETRY_MS 1000              // How long a failed peer link waits before it's redialed
+#define CLUSTER_LINK_MAX_QUEUED (4u << 20) // Bytes a peer may fall behind by before its link gets reset
+#define CLUSTER_RECV_CHUNK 65536
+#define CLUSTER_MAX_EVENTS 64                       // Ready events handled per wakeup
+#define CLUSTER_MAX_INBOUND (2 * CLUSTER_MAX_NODES) // Room for a peer's new link while its old one winds down
+
+// Bytes waiting to go out, or waiting to be parsed
+typedef struct
+{
+  uint8_t *data;
+  size_t   len;
+  size_t   off; // Already sent (or parsed) from the front
+  size_t   cap;
+} PeerBuffer;
+
+// Our link to a peer; we only ever write to it
+typedef struct
+{
+  int        fd; // -1 = down
+  bool       connecting;
+  bool       needs_snapshot; // Up, HELLO queued; the next tick sends everything instead of changes
+  bool       want_write;
+  int64_t    retry_ms; // When to dial again, while down
+  PeerBuffer out;
+
+  // Resolved once in peer_start(); a DNS lookup on every redial would stall the whole thread
+  struct sockaddr_storage addr;
+  socklen_t               addr_len;
+} PeerLink;
+
+// A peer's link to us; we only ever read from it
+typedef struct
+{
+  int        fd; // -1 = free
+  bool       hello;
+  size_t     node; // Who it is, once hello is set
+  PeerBuffer in;
+} PeerInbound;
+
+// What peers were last told about whoever sits in a slot
+typedef struct
+{
+  uint32_t gen; // That player's slot_gen + 1; 0 = nobody was ever sent from this slot
+  uint32_t ip;
+  uint32_t player_id;
+  int32_t  pos_x, pos_y;
+  bool     connected;
+  uint64_t avatar_hash;
+  char     nametag[MAX_NAMETAG_LEN + 1];
+  uint32_t seen; // Last scan that found them; anyone left behind is gone
+} PeerShadow;
+
+static const Cluster *g_cluster;                     // Settled in peer_start(), read-only after that
+static uint32_t       g_tick_ms;                     // How often changes go out to peers
+static void (*g_changed)(void);                      // Told whenever peers' records land in the table
+static int            g_peer_fd         = -1;        // Listener for peers' links
+static int            g_cluster_stop[2] = {-1, -1};  // Poked once to make the thread return
+static pthread_t      g_cluster_thread;
+static EventLoop     *g_peer_loop;
+static PeerLink       g_links[CLUSTER_MAX_NODES];    // Indexed by node; ours stays down
+static PeerInbound    g_inbound[CLUSTER_MAX_INBOUND];
+static PeerShadow    *g_shadow;
+static size_t         g_shadow_cap;
+static uint32_t       g_scan_epoch;
+
+/**
+ * @brief Milliseconds on a clock that never jumps; only good for measuring intervals
+ */
+static int64_t peer_now_ms(void)
+{
+  return metrics_now_ns() / 1000000;
+}
+
+/**
+ * @brief Let whoever started us know peers changed the table
+ */
+static void peer_changed(void)
+{
+  if (g_changed)
+  {
+    g_changed();
+  }
+}
+
+/**
+ * @brief Append bytes, growing as needed
+ * @note What's been consumed off the front is only reclaimed once the tail runs out, and only if that's at
+ * least as much as is still live; every byte then gets moved O(1) times, however far behind a link falls
+ * @returns false if out of memory
+ */
+static bool peer_buffer_put(PeerBuffer *b, const void *data, size_t len)
+{
+  // All consumed; start over at the front for free
+  if (b->off == b->len)
+  {
+    b->off = b->len = 0;
+  }
+
+  if (b->len + len > b->cap && b->off >= b->len - b->off)
+  {
+    memmove(b->data, b->data + b->off, b->len - b->off);
+    b->len -= b->off;
+    b->off = 0;
+  }
+
+  if (b->len + len > b->cap)
+  {
+    size_t   cap  = b->cap ? b->cap : CLUSTER_RECV_CHUNK;
+    uint8_t *grow = NULL;
+
+    while (cap < b->len + len)
+    {
+      cap *= 2;
+    }
+
+    if (!(grow = (uint8_t *)realloc(b->data, cap)))
+    {
+      return false;
+    }
+
+    b->data = grow;
+    b->cap  = cap;
+  }
+
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+
+  return true;
+}
+
+static void peer_buffer_free(PeerBuffer *b)
+{
+  free(b->data);
+  *b = (PeerBuffer){0};
+}
+
+/**
+ * @brief Take a link down; it gets redialed once CLUSTER_RETRY_MS is up
+ */
+static void peer_link_reset(PeerLink *l, int64_t now_ms)
+{
+  if (l->fd >= 0)
+  {
+    evloop_del(g_peer_loop, l->fd);
+    close(l->fd);
+  }
+
+  l->fd             = -1;
+  l->connecting     = false;
+  l->needs_snapshot = false;
+  l->want_write     = false;
+  l->retry_ms       = now_ms + CLUSTER_RETRY_MS;
+  l->out.len = l->out.off = 0;
+}
+
+/**
+ * @brief Look a peer's address up, for every dial to come
+ * @note Blocks; only ever called before the replication thread starts
+ * @returns false if the host doesn't resolve
+ */
+static bool peer_link_resolve(PeerLink *l, const ClusterNode *node)
+{
+  struct addrinfo  hints = {.ai_socktype = SOCK_STREAM, .ai_flags = AI_NUMERICSERV};
+  struct addrinfo *res   = NULL;
+  char             port[8];
+
+  snprintf(port, sizeof port, "%u", node->peer_port);
+
+  int rc = getaddrinfo(node->host, port, &hints, &res);
+
+  if (rc != 0 || !res || res->ai_addrlen > sizeof l->addr)
+  {
+    fprintf(stderr, "server: can't resolve cluster node %s: %s\n", node->host, rc ? gai_strerror(rc) : "no address");
+
+    if (res)
+    {
+      freeaddrinfo(res);
+    }
+
+    return false;
+  }
+
+  memcpy(&l->addr, res->ai_addr, res->ai_addrlen);
+  l->addr_len = res->ai_addrlen;
+
+  freeaddrinfo(res);
+
+  return true;
+}
+
+/**
+ * @brief Start dialing a peer; the event loop says when it's through
+ */
+static void peer_link_dial(PeerLink *l, int64_t now_ms)
+{
+  l->retry_ms = now_ms + CLUSTER_RETRY_MS;
+
+  int fd = socket(l->addr.ss_family, SOCK_STREAM, 0);
+
+  if (fd < 0 || set_nonblocking(fd) < 0 ||
+      (connect(fd, (const struct sockaddr *)&l->addr, l->addr_len) < 0 && errno != EINPROGRESS) ||
+      evloop_add(g_peer_loop, fd, EVT_WRITE, l) < 0)
+  {
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+
+    return;
+  }
+
+  // Changes only go out once per tick anyway; no point having Nagle sit on them on top of that
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+  l->fd         = fd;
+  l->connecting = true;
+  l->want_write = true;
+}
+
+/**
+ * @brief Send what the socket takes of a link's queue, watching for writability while some is left
+ * @returns false if the link broke
+ */
+static bool peer_link_flush(PeerLink *l)
+{
+  while (l->out.off < l->out.len)
+  {
+    ssize_t n = send(l->fd, l->out.data + l->out.off, l->out.len - l->out.off, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR)
+    {
+      metrics_inc(METRIC_EINTR_RETRIES);
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      break;
+    }
+
+    if (n <= 0)
+    {
+      return false;
+    }
+
+    l->out.off += (size_t)n;
+  }
+
+  bool pending = l->out.off < l->out.len;
+
+  if (pending != l->want_write)
+  {
+    // Nothing ever comes back on our own links; read readiness only ever means they went away
+    if (evloop_mod(g_peer_loop, l->fd, pending ? EVT_READ | EVT_WRITE : EVT_READ, l) < 0)
+    {
+      return false;
+    }
+
+    l->want_write = pending;
+  }
+
+  return true;
+}
+
+/**
+ * @brief Queue bytes on a link that's up
+ * @returns false if the peer is too far behind (or memory ran out) and the link got reset
+ */
+static bool peer_link_queue(PeerLink *l, const uint8_t *data, size_t len, size_t records, int64_t now_ms)
+{
+  if (l->out.len - l->out.off + len > CLUSTER_LINK_MAX_QUEUED || !peer_buffer_put(&l->out, data, len))
+  {
+    fprintf(stderr, "server: peer link %zu fell behind; resetting it\n", (size_t)(l - g_links));
+    peer_link_reset(l, now_ms);
+
+    return false;
+  }
+
+  metrics_add(METRIC_REPL_OUT, records);
+
+  return true;
+}
+
+// One pass over the table, building a batch of records
+typedef struct
+{
+  PeerBuffer batch;
+  size_t     records;
+  bool       snapshot; // Everybody whole, shadow untouched; for links that just came up
+} PeerScan;
+
+static void peer_scan_put(PeerScan *scan, const ClusterRecord *rec)
+{
+  uint8_t buf[CLUSTER_MAX_RECORD];
+  size_t  len = cluster_encode_record(rec, buf);
+
+  // Out of memory just loses this tick's changes for this player; the shadow still says they're owed
+  if (peer_buffer_put(&scan->batch, buf, len))
+  {
+    scan->records++;
+  }
+}
+
+/**
+ * @brief Look at one player; does its own stripe-held part of peer_scan()
+ * @note Runs under the player's stripe, see for_each_player()
+ */
+static void peer_scan_player(Player *p, void *arg)
+{
+  PeerScan *scan = (PeerScan *)arg;
+
+  // Replicas are their owner's to send; players without an avatar are still registering
+  if (!cluster_is_mine(g_cluster, p->ip) || !p->avatar)
+  {
+    return;
+  }
+
+  ClusterRecord  rec = {.kind = CLUSTER_REC_PLAYER};
+  PlayerReplica *r   = &rec.player;
+
+  r->ip          = p->ip;
+  r->player_id   = p->player_id;
+  r->pos_x       = p->pos_x;
+  r->pos_y       = p->pos_y;
+  r->connected   = p->connected;
+  r->avatar_hash = p->avatar_hash;
+  r->w           = p->w;
+  r->h           = p->h;
+  r->avatar      = p->avatar;
+  memcpy(r->nametag, p->nametag, sizeof r->nametag);
+
+  if (scan->snapshot)
+  {
+    r->fields = REPLICA_ALL;
+    peer_scan_put(scan, &rec);
+
+    return;
+  }
+
+  if (p->slot >= g_shadow_cap)
+  {
+    size_t      cap  = g_shadow_cap ? g_shadow_cap : MAX_PLAYERS;
+    PeerShadow *grow = NULL;
+
+    while (cap <= p->slot)
+    {
+      cap *= 2;
+    }
+
+    if (!(grow = (PeerShadow *)realloc(g_shadow, cap * sizeof *g_shadow)))
+    {
+      return;
+    }
+
+    memset(grow + g_shadow_cap, 0, (cap - g_shadow_cap) * sizeof *grow);
+    g_shadow     = grow;
+    g_shadow_cap = cap;
+  }
+
+  PeerShadow *sh    = &g_shadow[p->slot];
+  bool        fresh = sh->gen != p->slot_gen + 1 || sh->ip != p->ip || sh->player_id != p->player_id;
+
+  // Somebody else sat here before; peers can forget them
+  if (fresh && sh->gen)
+  {
+    ClusterRecord gone = {.kind = CLUSTER_REC_GONE, .player.ip = sh->ip};
+
+    peer_scan_put(scan, &gone);
+  }
+
+  if (fresh || (p->connected && !sh->connected))
+  {
+    r->fields = REPLICA_ALL;
+  }
+  else
+  {
+    r->fields = (p->pos_x != sh->pos_x || p->pos_y != sh->pos_y ? REPLICA_POS : 0) |
+                (p->connected != sh->connected ? REPLICA_STATE : 0) |
+                (strcmp(p->nametag, sh->nametag) != 0 ? REPLICA_TAG : 0) |
+                (p->avatar_hash != sh->avatar_hash ? REPLICA_AVATAR : 0);
+  }
+
+  if (r->fields)
+  {
+    peer_scan_put(scan, &rec);
+  }
+
+  sh->gen         = p->slot_gen + 1;
+  sh->ip          = p->ip;
+  sh->player_id   = p->player_id;
+  sh->pos_x       = p->pos_x;
+  sh->pos_y       = p->pos_y;
+  sh->connected   = p->connected;
+  sh->avatar_hash = p->avatar_hash;
+  sh->seen        = g_scan_epoch;
+  memcpy(sh->nametag, p->nametag, sizeof sh->nametag);
+}
+
+/**
+ * @brief Walk the table and build either this tick's changes or a full snapshot
+ */
+static void peer_scan(PeerScan *scan, bool snapshot)
+{
+  *scan          = (PeerScan){0};
+  scan->snapshot = snapshot;
+
+  if (!snapshot)
+  {
+    g_scan_epoch++;
+  }
+
+  for_each_player(peer_scan_player, scan);
+
+  if (snapshot)
+  {
+    return;
+  }
+
+  // Whoever the walk didn't come across got evicted (or stopped being ours)
+  for (size_t i = 0; i < g_shadow_cap; ++i)
+  {
+    PeerShadow *sh = &g_shadow[i];
+
+    if (sh->gen && sh->seen != g_scan_epoch)
+    {
+      ClusterRecord gone = {.kind = CLUSTER_REC_GONE, .player.ip = sh->ip};
+
+      peer_scan_put(scan, &gone);
+      sh->gen = 0;
+    }
+  }
+}
+
+/**
+ * @brief One replication tick: changes to every link that's caught up, snapshots to the new ones
+ */
+static void peer_tick(int64_t now_ms)
+{
+  PeerScan changes;
+  PeerScan snapshot;
+  bool     snapped = false;
+
+  peer_scan(&changes, false);
+
+  for (size_t n = 0; n < g_cluster->count; ++n)
+  {
+    PeerLink *l = &g_links[n];
+
+    if (n == g_cluster->self)
+    {
+      continue;
+    }
+
+    if (l->fd < 0)
+    {
+      if (now_ms >= l->retry_ms)
+      {
+        peer_link_dial(l, now_ms);
+      }
+
+      continue;
+    }
+
+    if (l->connecting)
+    {
+      continue;
+    }
+
+    PeerScan *send = &changes;
+
+    if (l->needs_snapshot)
+    {
+      // Taken after the changes, so it's at least as new as anything they'd have said
+      if (!snapped)
+      {
+        peer_scan(&snapshot, true);
+        snapped = true;
+      }
+
+      send              = &snapshot;
+      l->needs_snapshot = false;
+    }
+
+    // A link that can't take the batch has been reset already
+    if (!send->batch.len || !peer_link_queue(l, send->batch.data, send->batch.len, send->records, now_ms))
+    {
+      continue;
+    }
+
+    if (!peer_link_flush(l))
+    {
+      peer_link_reset(l, now_ms);
+    }
+  }
+
+  peer_buffer_free(&changes.batch);
+
+  if (snapped)
+  {
+    peer_buffer_free(&snapshot.batch);
+  }
+}
+
+/**
+ * @brief Mark a player disconnected if a given node owns them; see peer_inbound_close()
+ * @note Runs under the player's stripe, see for_each_player()
+ */
+static void peer_disconnect_player(Player *p, void *arg)
+{
+  size_t node = *(const size_t *)arg;
+
+  if (p->connected && cluster_owner(g_cluster, p->ip) == node)
+  {
+    p->connected = false;
+    p->last_seen = time(NULL);
+    persist_player_locked(p);
+  }
+}
+
+/**
+ * @brief A peer's link to us is gone; unless it's been replaced already, its players are too
+ */
+static void peer_inbound_close(PeerInbound *in)
+{
+  bool replaced = false;
+
+  for (size_t i = 0; i < CLUSTER_MAX_INBOUND; ++i)
+  {
+    PeerInbound *other = &g_inbound[i];
+
+    replaced |= other != in && other->fd >= 0 && other->hello && other->node == in->node;
+  }
+
+  if (in->hello && !replaced)
+  {
+    fprintf(stderr, "server: lost peer %zu\n", in->node);
+    for_each_player(peer_disconnect_player, &in->node);
+    peer_changed();
+  }
+
+  evloop_del(g_peer_loop, in->fd);
+  close(in->fd);
+  peer_buffer_free(&in->in);
+
+  in->fd    = -1;
+  in->hello = false;
+}
+
+/**
+ * @brief Apply whatever whole records a peer's link has brought in
+ * @returns false if the peer sent garbage
+ */
+static bool peer_inbound_parse(PeerInbound *in)
+{
+  PeerBuffer *b       = &in->in;
+  size_t      applied = 0;
+
+  if (!in->hello)
+  {
+    if (b->len - b->off < CLUSTER_HELLO_BYTES)
+    {
+      return true;
+    }
+
+    if (!cluster_decode_hello(g_cluster, b->data + b->off, &in->node))
+    {
+      fprintf(stderr, "server: peer with another node list (or version) turned away\n");
+
+      return false;
+    }
+
+    in->hello = true;
+    b->off += CLUSTER_HELLO_BYTES;
+
+    printf("server: peer %zu is up\n", in->node);
+  }
+
+  for (;;)
+  {
+    ClusterRecord rec;
+    long          used = cluster_decode_record(b->data + b->off, b->len - b->off, &rec);
+
+    if (used < 0)
+    {
+      return false;
+    }
+
+    if (used == 0)
+    {
+      break;
+    }
+
+    b->off += (size_t)used;
+
+    // A peer only speaks for its own players; anything else is a stale ring, not ours to believe
+    if (cluster_owner(g_cluster, rec.player.ip) != in->node)
+    {
+      continue;
+    }
+
+    if (rec.kind == CLUSTER_REC_GONE ? drop_replica(rec.player.ip) : apply_replica(&rec.player))
+    {
+      applied++;
+    }
+  }
+
+  if (applied)
+  {
+    metrics_add(METRIC_REPL_IN, applied);
+    peer_changed();
+  }
+
+  return true;
+}
+
+/**
+ * @brief Read everything a peer's link has
+ */
+static void peer_inbound_read(PeerInbound *in)
+{
+  uint8_t chunk[CLUSTER_RECV_CHUNK];
+
+  for (;;)
+  {
+    ssize_t n = recv(in->fd, chunk, sizeof chunk, 0);
+
+    if (n < 0 && errno == EINTR)
+    {
+      metrics_inc(METRIC_EINTR_RETRIES);
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      return;
+    }
+
+    if (n <= 0 || !peer_buffer_put(&in->in, chunk, (size_t)n) || !peer_inbound_parse(in))
+    {
+      peer_inbound_close(in);
+
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Take in peers' links; there's only ever room for CLUSTER_MAX_INBOUND of them
+ */
+static void peer_accept(void)
+{
+  int fd;
+
+  while ((fd = accept_nonblocking(g_peer_fd, NULL, NULL)) >= 0)
+  {
+    PeerInbound *in = NULL;
+
+    for (size_t i = 0; i < CLUSTER_MAX_INBOUND && !in; ++i)
+    {
+      in = g_inbound[i].fd < 0 ? &g_inbound[i] : NULL;
+    }
+
+    if (!in || evloop_add(g_peer_loop, fd, EVT_READ, in) < 0)
+    {
+      close(fd);
+      continue;
+    }
+
+    in->fd    = fd;
+    in->hello = false;
+  }
+}
+
+/**
+ * @brief An outbound link is through connecting (or not); say HELLO and line up a snapshot
+ */
+static void peer_link_connected(PeerLink *l, uint32_t events, int64_t now_ms)
+{
+  int       err = 0;
+  socklen_t len = sizeof err;
+  uint8_t   hello[CLUSTER_HELLO_BYTES];
+
+  if ((events & EVT_ERR) || getsockopt(l->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+  {
+    peer_link_reset(l, now_ms);
+
+    return;
+  }
+
+  cluster_encode_hello(g_cluster, hello);
+
+  l->connecting     = false;
+  l->needs_snapshot = true;
+
+  if (!peer_buffer_put(&l->out, hello, sizeof hello) || !peer_link_flush(l))
+  {
+    peer_link_reset(l, now_ms);
+  }
+}
+
+static void *peer_main(void *arg)
+{
+  (void)arg;
+
+  TRACE_THREAD_NAME("cluster");
+
+  int64_t next_tick = peer_now_ms();
+
+  for (;;)
+  {
+    LoopEvent events[CLUSTER_MAX_EVENTS];
+    int64_t   now     = peer_now_ms();
+    int       timeout = next_tick > now ? (int)(next_tick - now) : 0;
+    int       ready   = evloop_wait(g_peer_loop, events, CLUSTER_MAX_EVENTS, timeout);
+    bool      stop    = false;
+
+    if (ready < 0 && errno == EINTR)
+    {
+      metrics_inc(METRIC_EINTR_RETRIES);
+      continue;
+    }
+
+    if (ready < 0)
+    {
+      perror("server: cluster evloop_wait");
+
+      break;
+    }
+
+    now = peer_now_ms();
+
+    for (int e = 0; e < ready; ++e)
+    {
+      void    *udata = events[e].udata;
+      uint32_t ev    = events[e].events;
+
+      if (udata == g_cluster_stop)
+      {
+        stop = true;
+      }
+      else if (udata == &g_peer_fd)
+      {
+        peer_accept();
+      }
+      else if ((PeerLink *)udata >= g_links && (PeerLink *)udata < g_links + CLUSTER_MAX_NODES)
+      {
+        PeerLink *l = (PeerLink *)udata;
+
+        if (l->fd < 0)
+        {
+          continue;
+        }
+
+        if (l->connecting)
+        {
+          peer_link_connected(l, ev, now);
+        }
+        else if ((ev & (EVT_READ | EVT_HUP | EVT_ERR)) || !peer_link_flush(l))
+        {
+          peer_link_reset(l, now);
+        }
+      }
+      else if (((PeerInbound *)udata)->fd >= 0)
+      {
+        peer_inbound_read((PeerInbound *)udata);
+      }
+    }
+
+    if (stop)
+    {
+      break;
+    }
+
+    if (now >= next_tick)
+    {
+      peer_tick(now);
+      next_tick = now + g_tick_ms;
+    }
+  }
+
+  return NULL;
+}
+
+bool peer_start(const Cluster *cl, const char *bind_ip, uint32_t tick_ms, void (*changed)(void))
+{
+  g_cluster = cl;
+  g_tick_ms = tick_ms;
+  g_changed = changed;
+
+  ListenOptions opts = listen_defaults();
+
+  for (size_t i = 0; i < CLUSTER_MAX_NODES; ++i)
+  {
+    g_links[i].fd = -1;
+
+    if (i < g_cluster->count && i != g_cluster->self && !peer_link_resolve(&g_links[i], &g_cluster->nodes[i]))
+    {
+      return false;
+    }
+  }
+
+  for (size_t i = 0; i < CLUSTER_MAX_INBOUND; ++i)
+  {
+    g_inbound[i].fd = -1;
+  }
+
+  g_peer_fd = listen_open(bind_ip, g_cluster->nodes[g_cluster->self].peer_port, &opts);
+
+  if (g_peer_fd < 0)
+  {
+    return false;
+  }
+
+  if (pipe(g_cluster_stop) < 0 || !(g_peer_loop = evloop_create()) ||
+      evloop_add(g_peer_loop, g_peer_fd, EVT_READ, &g_peer_fd) < 0 ||
+      evloop_add(g_peer_loop, g_cluster_stop[0], EVT_READ, g_cluster_stop) < 0 ||
+      pthread_create(&g_cluster_thread, NULL, peer_main, NULL) != 0)
+  {
+    perror("server: cluster");
+
+    if (g_cluster_stop[0] >= 0)
+    {
+      close(g_cluster_stop[0]);
+      close(g_cluster_stop[1]);
+    }
+
+    g_cluster_stop[0] = g_cluster_stop[1] = -1;
+    evloop_destroy(g_peer_loop);
+    g_peer_loop = NULL;
+    close(g_peer_fd);
+
+    return false;
+  }
+
+  printf("server: node %zu of %zu, peers on port %u\n", g_cluster->self, g_cluster->count,
+         g_cluster->nodes[g_cluster->self].peer_port);
+
+  return true;
+}
+
+void peer_stop(void)
+{
+  if (!g_peer_loop)
+  {
+    return;
+  }
+
+  char    poke = 0;
+  ssize_t ignored;
+
+  do
+  {
+    ignored = write(g_cluster_stop[1], &poke, 1);
+  } while (ignored < 0 && errno == EINTR);
+
+  pthread_join(g_cluster_thread, NULL);
+
+  for (size_t i = 0; i < CLUSTER_MAX_NODES; ++i)
+  {
+    if (g_links[i].fd >= 0)
+    {
+      close(g_links[i].fd);
+    }
+
+    peer_buffer_free(&g_links[i].out);
+  }
+
+  for (size_t i = 0; i < CLUSTER_MAX_INBOUND; ++i)
+  {
+    if (g_inbound[i].fd >= 0)
+    {
+      close(g_inbound[i].fd);
+    }
+
+    peer_buffer_free(&g_inbound[i].in);
+  }
+
+  evloop_destroy(g_peer_loop);
+  close(g_cluster_stop[0]);
+  close(g_cluster_stop[1]);
+  close(g_peer_fd);
+  free(g_shadow);
+
+  g_peer_loop       = NULL;
+  g_cluster_stop[0] = g_cluster_stop[1] = -1;
+  g_shadow          = NULL;
+  g_shadow_cap      = 0;
+}
@@ -0,0 +1,272 @@
+#include "w-pixel.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define PIXEL_NEON 1
+#include <arm_neon.h>
+#endif
+
+// ==============================================================================
+// SCALAR
+// ==============================================================================
+
+// Grayscale to RGBA; just grab the single pixel value's brightness (0-255); assign it to all channels, and assume alpha is max
+static void gray_to_rgba_scalar(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  for (size_t i = 0; i < npixels; ++i)
+  {
+    uint8_t v = src[i];
+
+    dst[i * 4 + 0] = v;
+    dst[i * 4 + 1] = v;
+    dst[i * 4 + 2] = v;
+    dst[i * 4 + 3] = 255;
+  }
+}
+
+// RGB to RGBA; grab all RGB values and then just assume alpha is always max
+static void rgb_to_rgba_scalar(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  for (size_t i = 0; i < npixels; ++i)
+  {
+    // Load the whole pixel before storing; matters when converting in place
+    uint8_t r = src[i * 3 + 0];
+    uint8_t g = src[i * 3 + 1];
+    uint8_t b = src[i * 3 + 2];
+
+    dst[i * 4 + 0] = r;
+    dst[i * 4 + 1] = g;
+    dst[i * 4 + 2] = b;
+    dst[i * 4 + 3] = 255;
+  }
+}
+
+// RGBA to RGBA; basically no conversion we just pull all values as-is
+static void rgba_to_rgba(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  if (dst != src)
+  {
+    memmove(dst, src, npixels * 4);
+  }
+}
+
+// ==============================================================================
+// X86 (SSSE3 / AVX2)
+// ==============================================================================
+
+#if defined(PIXEL_X86)
+
+// pshufb masks; 0x80 lanes come out as zero and get filled with alpha by the OR
+#define ZERO_LANE ((char)0x80) // The intrinsics take char; a bare 0x80 overflows it
+#define GRAY_MASK(p)                                                                                                   \
+  p, p, p, ZERO_LANE, p + 1, p + 1, p + 1, ZERO_LANE, p + 2, p + 2, p + 2, ZERO_LANE, p + 3, p + 3, p + 3, ZERO_LANE
+#define RGB_MASK 0, 1, 2, ZERO_LANE, 3, 4, 5, ZERO_LANE, 6, 7, 8, ZERO_LANE, 9, 10, 11, ZERO_LANE
+
+__attribute__((target("ssse3"))) static void
+gray_to_rgba_ssse3(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+  const __m128i m0    = _mm_setr_epi8(GRAY_MASK(0));
+  const __m128i m1    = _mm_setr_epi8(GRAY_MASK(4));
+  const __m128i m2    = _mm_setr_epi8(GRAY_MASK(8));
+  const __m128i m3    = _mm_setr_epi8(GRAY_MASK(12));
+
+  size_t i = 0;
+
+  // 16 pixels in, 64 bytes out
+  for (; i + 16 <= npixels; i += 16)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+    _mm_storeu_si128((__m128i *)(dst + i * 4 + 0), _mm_or_si128(_mm_shuffle_epi8(v, m0), alpha));
+    _mm_storeu_si128((__m128i *)(dst + i * 4 + 16), _mm_or_si128(_mm_shuffle_epi8(v, m1), alpha));
+    _mm_storeu_si128((__m128i *)(dst + i * 4 + 32), _mm_or_si128(_mm_shuffle_epi8(v, m2), alpha));
+    _mm_storeu_si128((__m128i *)(dst + i * 4 + 48), _mm_or_si128(_mm_shuffle_epi8(v, m3), alpha));
+  }
+
+  gray_to_rgba_scalar(dst + i * 4, src + i, npixels - i);
+}
+
+__attribute__((target("ssse3"))) static void
+rgb_to_rgba_ssse3(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+  const __m128i mask  = _mm_setr_epi8(RGB_MASK);
+
+  size_t i = 0;
+
+  // 4 pixels per step, but each 16-byte load runs 4 bytes past them; stop while that's still in bounds
+  for (; i + 6 <= npixels; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+
+    _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(v, mask), alpha));
+  }
+
+  rgb_to_rgba_scalar(dst + i * 4, src + i * 3, npixels - i);
+}
+
+__attribute__((target("avx2"))) static void
+gray_to_rgba_avx2(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+
+  // vpshufb works per 128-bit lane; both lanes see the same 16 source bytes
+  const __m256i m01 = _mm256_setr_epi8(GRAY_MASK(0), GRAY_MASK(4));
+  const __m256i m23 = _mm256_setr_epi8(GRAY_MASK(8), GRAY_MASK(12));
+
+  size_t i = 0;
+
+  for (; i + 16 <= npixels; i += 16)
+  {
+    __m256i v = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(src + i)));
+
+    _mm256_storeu_si256((__m256i *)(dst + i * 4 + 0),
+                        _mm256_or_si256(_mm256_shuffle_epi8(v, m01), alpha));
+    _mm256_storeu_si256((__m256i *)(dst + i * 4 + 32),
+                        _mm256_or_si256(_mm256_shuffle_epi8(v, m23), alpha));
+  }
+
+  gray_to_rgba_scalar(dst + i * 4, src + i, npixels - i);
+}
+
+__attribute__((target("avx2"))) static void
+rgb_to_rgba_avx2(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  const __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+  const __m256i mask  = _mm256_setr_epi8(RGB_MASK, RGB_MASK);
+
+  size_t i = 0;
+
+  // 8 pixels per step: pixels 0-3 go in the low lane, 4-7 in the high one
+  // The high load runs 4 bytes past pixel 7, hence the +10
+  for (; i + 10 <= npixels; i += 8)
+  {
+    __m128i lo = _mm_loadu_si128((const __m128i *)(src + i * 3));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(src + i * 3 + 12));
+    __m256i v  = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+    _mm256_storeu_si256((__m256i *)(dst + i * 4),
+                        _mm256_or_si256(_mm256_shuffle_epi8(v, mask), alpha));
+  }
+
+  rgb_to_rgba_ssse3(dst + i * 4, src + i * 3, npixels - i);
+}
+
+#undef ZERO_LANE
+#undef GRAY_MASK
+#undef RGB_MASK
+
+#endif
+
+// ==============================================================================
+// NEON
+// ==============================================================================
+
+#if defined(PIXEL_NEON)
+
+static void gray_to_rgba_neon(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  size_t i = 0;
+
+  for (; i + 16 <= npixels; i += 16)
+  {
+    uint8x16x4_t px;
+
+    px.val[0] = px.val[1] = px.val[2] = vld1q_u8(src + i);
+    px.val[3]                         = vdupq_n_u8(255);
+
+    vst4q_u8(dst + i * 4, px);
+  }
+
+  gray_to_rgba_scalar(dst + i * 4, src + i, npixels - i);
+}
+
+static void rgb_to_rgba_neon(uint8_t *dst, const uint8_t *src, size_t npixels)
+{
+  size_t i = 0;
+
+  // vld3 de-interleaves R, G and B into their own registers; vst4 interleaves them back with alpha
+  for (; i + 16 <= npixels; i += 16)
+  {
+    uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+    uint8x16x4_t px;
+
+    px.val[0] = rgb.val[0];
+    px.val[1] = rgb.val[1];
+    px.val[2] = rgb.val[2];
+    px.val[3] = vdupq_n_u8(255);
+
+    vst4q_u8(dst + i * 4, px);
+  }
+
+  rgb_to_rgba_scalar(dst + i * 4, src + i * 3, npixels - i);
+}
+
+#endif
+
+// ==============================================================================
+// DISPATCH
+// ==============================================================================
+
+static PixelKernel    g_gray_kernel = gray_to_rgba_scalar;
+static PixelKernel    g_rgb_kernel  = rgb_to_rgba_scalar;
+static const char    *g_kernel_isa  = "scalar";
+static pthread_once_t g_kernel_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Ask the CPU what it can do, once, and remember the best kernels for it
+ */
+static void pick_kernels(void)
+{
+#if defined(PIXEL_X86)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+  {
+    g_gray_kernel = gray_to_rgba_avx2;
+    g_rgb_kernel  = rgb_to_rgba_avx2;
+    g_kernel_isa  = "avx2";
+  }
+  else if (__builtin_cpu_supports("ssse3"))
+  {
+    g_gray_kernel = gray_to_rgba_ssse3;
+    g_rgb_kernel  = rgb_to_rgba_ssse3;
+    g_kernel_isa  = "ssse3";
+  }
+#elif defined(PIXEL_NEON)
+  // NEON is baseline wherever this gets compiled in
+  g_gray_kernel = gray_to_rgba_neon;
+  g_rgb_kernel  = rgb_to_rgba_neon;
+  g_kernel_isa  = "neon";
+#endif
+}
+
+PixelKernel pixel_kernel_for(uint32_t channels)
+{
+  pthread_once(&g_kernel_once, pick_kernels);
+
+  switch (channels)
+  {
+  case 1:
+    return g_gray_kernel;
+  case 3:
+    return g_rgb_kernel;
+  case 4:
+    return rgba_to_rgba;
+  default:
+    return NULL;
+  }
+}
+
+const char *pixel_kernel_isa(void)
+{
+  pthread_once(&g_kernel_once, pick_kernels);
+
+  return g_kernel_isa;
+}
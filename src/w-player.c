@@ -0,0 +1,1237 @@
+#include "w-player.h"
+
+#include "w-dedup.h"
+#include "w-helper.h"
+#include "w-index.h"
+#include "w-metrics.h"
+#include "w-mpsc.h"
+#include "w-pixel.h"
+#include "w-pool.h"
+#include "w-store.h"
+#include "w-trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Slab             g_players;
+pthread_rwlock_t g_players_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static SlotIndex g_player_index; // Player key -> slot in g_players; see player_key()
+static SlotIndex g_player_ids;   // player_id -> slot in g_players
+static uint32_t  g_next_player_id =
+    1; // Counter used to keep track of player IDs; we assign these incrementally as new players come in
+static uint32_t  g_player_id_first  = 1; // Every ID we hand out is this, plus some multiple of...
+static uint32_t  g_player_id_stride = 1; // ...this; see set_player_id_space()
+
+// Every avatar lives in a MAX_AVATAR_BYTES block from here; registering never calls malloc()
+// Players with identical avatars share one block, through the dedup cache
+static BlockPool  g_avatar_pool;
+static DedupCache g_avatar_dedup;
+
+#ifndef SERVER_HEADLESS
+// SlabHandles of players with an avatar the renderer hasn't uploaded yet; see queue_avatar_upload()
+static MpscQueue   g_upload_queue;
+static atomic_bool g_upload_overflow; // Some push didn't fit; the next drain has to scan
+static atomic_bool g_uploads_enabled;
+#endif
+
+// Every live player is in here, connected or not; positions change under a stripe, cells under g_grid_lock
+static SpatialGrid     g_player_grid;
+static pthread_mutex_t g_grid_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define PLAYER_STORE_MAGIC 0x3152594C50574B48ull // "HKWPLYR1"; bump on any PlayerRecord change
+
+// One player as the store keeps them; record i mirrors slot i of g_players
+typedef struct
+{
+  uint32_t live; // 0 = nobody in this slot
+  uint32_t ip;
+  uint32_t player_id;
+  int32_t  pos_x, pos_y;
+  uint32_t w, h; // Avatar is always RGBA; 0 x 0 = none
+  int64_t  last_seen;
+  char     nametag[MAX_NAMETAG_LEN + 1];
+  uint8_t  avatar[MAX_AVATAR_BYTES];
+} PlayerRecord;
+
+// What the store keeps in its header for us
+typedef struct
+{
+  uint32_t next_player_id;
+} PlayerStoreHeader;
+
+_Static_assert(sizeof(PlayerStoreHeader) <= RECORD_STORE_USER_BYTES, "store header doesn't fit");
+
+// Not open = base is NULL, for every helper below; set up before any thread starts and torn down after they're gone
+static RecordStore g_player_store;
+
+static pthread_mutex_t g_player_stripes[PLAYER_LOCK_STRIPES];
+static pthread_once_t  g_players_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief One-time setup of everything that can't be statically initialized
+ */
+static void init_players(void)
+{
+  for (size_t i = 0; i < PLAYER_LOCK_STRIPES; ++i)
+  {
+    pthread_mutex_init(&g_player_stripes[i], NULL);
+  }
+
+  slab_init(&g_players, sizeof(Player), MAX_PLAYERS);
+
+  // Pre-carve a block per default player slot; the pool grows past that on its own
+  block_pool_init(&g_avatar_pool, MAX_AVATAR_BYTES, MAX_PLAYERS);
+  dedup_init(&g_avatar_dedup, &g_avatar_pool, MAX_PLAYERS);
+
+#ifndef SERVER_HEADLESS
+  mpsc_init(&g_upload_queue, AVATAR_UPLOAD_QUEUE_CAP);
+  atomic_init(&g_upload_overflow, false);
+#endif
+}
+
+pthread_mutex_t *player_lock(uint32_t ip)
+{
+  pthread_once(&g_players_once, init_players);
+
+  // Fibonacci hashing; spreads neighbouring addresses across stripes
+  uint32_t h = ip * 2654435761u;
+
+  return &g_player_stripes[h >> (32 - PLAYER_LOCK_STRIPE_BITS)];
+}
+
+void set_player_capacity(size_t max_players)
+{
+  pthread_once(&g_players_once, init_players);
+
+  pthread_rwlock_wrlock(&g_players_lock);
+
+  slab_set_limit(&g_players, max_players);
+
+  pthread_rwlock_unlock(&g_players_lock);
+}
+
+/**
+ * @brief Round g_next_player_id up into the residue set_player_id_space() picked
+ * @note Caller must hold g_players_lock exclusively, or be the only thread around
+ */
+static void align_next_player_id(void)
+{
+  uint32_t residue = g_player_id_first % g_player_id_stride;
+  uint32_t off     = (residue + g_player_id_stride - g_next_player_id % g_player_id_stride) % g_player_id_stride;
+
+  g_next_player_id += off;
+}
+
+void set_player_id_space(uint32_t first, uint32_t stride)
+{
+  pthread_once(&g_players_once, init_players);
+
+  pthread_rwlock_wrlock(&g_players_lock);
+
+  g_player_id_first  = first;
+  g_player_id_stride = stride ? stride : 1;
+
+  if (g_next_player_id < first)
+  {
+    g_next_player_id = first;
+  }
+
+  align_next_player_id();
+
+  pthread_rwlock_unlock(&g_players_lock);
+}
+
+/**
+ * @brief Write-lock the players table, timing how long that took
+ * @note Only the hot writers (ensure_player(), replicas) go through here; startup-only writers don't need watching
+ * @returns When the lock was taken; hand it to players_wrunlock()
+ */
+static int64_t players_wrlock(void)
+{
+  int64_t asked = metrics_now_ns();
+
+  TRACE_BEGIN(wait_span, "players.wrlock_wait");
+  pthread_rwlock_wrlock(&g_players_lock);
+  TRACE_END(wait_span);
+
+  int64_t taken = metrics_now_ns();
+
+  metrics_record(METRIC_HIST_PLAYERS_WAIT, (uint64_t)(taken - asked));
+
+  return taken;
+}
+
+/**
+ * @brief Undo players_wrlock(), timing how long the lock was held
+ * @param taken What players_wrlock() returned
+ */
+static void players_wrunlock(int64_t taken)
+{
+  int64_t held = metrics_now_ns() - taken;
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  metrics_record(METRIC_HIST_PLAYERS_HOLD, (uint64_t)held);
+}
+
+/**
+ * @brief Turn a player's address into the key they're indexed under
+ * @note Just the IPv4 address for now; the index takes 64-bit keys so IP:port or a hashed IPv6 address fit later
+ * @param ip The player's IP, network order
+ * @returns The index key
+ */
+static uint64_t player_key(uint32_t ip) { return (uint64_t)ip; }
+
+/**
+ * @brief A slot's record in the store
+ * @returns NULL without a store, or if the slot is past what it holds
+ */
+static PlayerRecord *player_record(uint32_t slot) { return (PlayerRecord *)record_store_at(&g_player_store, slot); }
+
+/**
+ * @brief Write a field of a record and mark it for the next flush
+ */
+static void record_put(void *field, const void *value, size_t len)
+{
+  memcpy(field, value, len);
+  record_store_touch(&g_player_store, field, len);
+}
+
+Player *find_player_by_ip(uint32_t target_ip)
+{
+  uint32_t slot = slot_index_find(&g_player_index, player_key(target_ip));
+
+  return slot == SLOT_INDEX_NONE ? NULL : (Player *)slab_at(&g_players, slot);
+}
+
+Player *find_player_by_id(uint32_t player_id)
+{
+  uint32_t slot = slot_index_find(&g_player_ids, player_id);
+
+  return slot == SLOT_INDEX_NONE ? NULL : (Player *)slab_at(&g_players, slot);
+}
+
+/**
+ * @brief Take a player out of the table for good: indexes, avatar, record, grid and slot
+ * @note Caller must hold g_players_lock exclusively
+ */
+static void remove_player_locked(Player *victim)
+{
+  // Keep both indexes in sync before the slot goes back on the free list
+  slot_index_remove(&g_player_index, player_key(victim->ip));
+  slot_index_remove(&g_player_ids, victim->player_id);
+  dedup_release(&g_avatar_dedup, victim->avatar, victim->avatar_hash);
+
+  PlayerRecord *rec = player_record(victim->slot);
+  if (rec)
+  {
+    uint32_t dead = 0;
+
+    record_put(&rec->live, &dead, sizeof dead);
+  }
+
+  pthread_mutex_lock(&g_grid_lock);
+  grid_remove(&g_player_grid, &victim->grid);
+  pthread_mutex_unlock(&g_grid_lock);
+
+  slab_free(&g_players, victim->slot);
+}
+
+/**
+ * @brief Make room by evicting whoever has been disconnected the longest
+ * @note Caller must hold g_players_lock exclusively; that also means nobody is mid-way through a stripe, so we can read connected directly
+ * @note Only runs when the table is full, so the scan doesn't matter in the common case
+ * @returns true if somebody got evicted, false if everyone is connected
+ */
+static bool evict_idle_player_locked(void)
+{
+  Player *victim = NULL;
+
+  for (uint32_t i = 0; i < g_players.high_water; ++i)
+  {
+    if (!slab_live(&g_players, i))
+    {
+      continue;
+    }
+
+    Player *p = (Player *)slab_at(&g_players, i);
+    if (!p->connected && (!victim || p->last_seen < victim->last_seen))
+    {
+      victim = p;
+    }
+  }
+
+  if (!victim)
+  {
+    return false;
+  }
+
+  remove_player_locked(victim);
+
+  return true;
+}
+
+/**
+ * @brief Mark a player as owned by a connection, so eviction leaves them alone
+ * @note Caller must hold g_players_lock (shared is enough)
+ */
+static void claim_player_locked(Player *p)
+{
+  pthread_mutex_t *lock = player_lock(p->ip);
+
+  pthread_mutex_lock(lock);
+  p->connected = true;
+  pthread_mutex_unlock(lock);
+}
+
+static Player *insert_player_locked(uint32_t target_ip, uint32_t new_player_id);
+
+Player *ensure_player(uint32_t target_ip)
+{
+  pthread_once(&g_players_once, init_players);
+
+  // Common case (returning player) only needs the shared lock
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  Player *p = find_player_by_ip(target_ip);
+
+  // If the player is in the table, they exist; we #stillguhd
+  // Claim them before letting go of the lock, or they could get evicted under our feet
+  if (p)
+  {
+    claim_player_locked(p);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  if (p)
+  {
+    return p;
+  }
+
+  // If the player does NOT exist, we wanna make sure they do
+  // Somebody may have added them between our unlock and this lock, so look again
+  int64_t taken = players_wrlock();
+
+  p = find_player_by_ip(target_ip);
+  if (p)
+  {
+    claim_player_locked(p);
+    players_wrunlock(taken);
+
+    return p;
+  }
+
+  Player *new_player = insert_player_locked(target_ip, g_next_player_id);
+
+  if (new_player)
+  {
+    g_next_player_id += g_player_id_stride;
+
+    if (g_player_store.base)
+    {
+      PlayerStoreHeader *hdr = (PlayerStoreHeader *)record_store_user(&g_player_store);
+
+      record_put(&hdr->next_player_id, &g_next_player_id, sizeof g_next_player_id);
+    }
+  }
+
+  players_wrunlock(taken);
+
+  return new_player;
+}
+
+/**
+ * @brief Put a brand new player in the table, evicting somebody if it's full
+ * @note Caller must hold g_players_lock exclusively; neither the IP nor the ID may be taken already
+ * @param target_ip The player's IP
+ * @param new_player_id Their ID
+ * @returns The player, connected and at a random position, or NULL if there's no room
+ */
+static Player *insert_player_locked(uint32_t target_ip, uint32_t new_player_id)
+{
+  // Check that there is room for a new player; if not, try and make some
+  SlabHandle handle;
+  Player    *new_player = (Player *)slab_alloc(&g_players, &handle);
+
+  if (!new_player && evict_idle_player_locked())
+  {
+    new_player = (Player *)slab_alloc(&g_players, &handle);
+  }
+
+  if (!new_player)
+  {
+    return NULL;
+  }
+
+  // Index next: if either can't take the key, hand the slot back and pretend nothing happened
+  if (!slot_index_insert(&g_player_index, player_key(target_ip), handle.index))
+  {
+    slab_free(&g_players, handle.index);
+
+    return NULL;
+  }
+
+  if (!slot_index_insert(&g_player_ids, new_player_id, handle.index))
+  {
+    slot_index_remove(&g_player_index, player_key(target_ip));
+    slab_free(&g_players, handle.index);
+
+    return NULL;
+  }
+
+  // Slab hands us a zeroed slot, so everything not set here starts out clean
+
+  // Set their attributes
+  new_player->ip        = target_ip;
+  new_player->player_id = new_player_id;
+  new_player->slot      = handle.index;
+  new_player->slot_gen  = handle.gen;
+
+  // Assign random pos
+  new_player->pos_x = irand(MIN_PLAYER_X_POS, MAX_PLAYER_X_POS);
+  new_player->pos_y = irand(MIN_PLAYER_Y_POS, MAX_PLAYER_Y_POS);
+
+  pthread_mutex_lock(&g_grid_lock);
+  grid_insert(&g_player_grid, &new_player->grid, new_player->pos_x, new_player->pos_y);
+  pthread_mutex_unlock(&g_grid_lock);
+
+  new_player->connected = true; // Claimed by the connection registering them
+
+  // Nobody else can see the slot yet, so the record is ours to fill in whole
+  PlayerRecord *rec = player_record(handle.index);
+  if (rec)
+  {
+    memset(rec, 0, sizeof *rec);
+    rec->live      = 1;
+    rec->ip        = target_ip;
+    rec->player_id = new_player_id;
+    rec->pos_x     = new_player->pos_x;
+    rec->pos_y     = new_player->pos_y;
+    record_store_touch(&g_player_store, rec, sizeof *rec);
+  }
+
+  return new_player;
+}
+
+static int32_t clamp_pos(int32_t v, int32_t limit) { return v < 0 ? 0 : v >= limit ? limit - 1 : v; }
+
+/**
+ * @brief Set a player's position and keep the grid in step
+ * @note Caller must hold g_players_lock (shared is enough) and the player's stripe
+ */
+static void place_player_locked(Player *p, int32_t pos_x, int32_t pos_y)
+{
+  p->pos_x = clamp_pos(pos_x, WORLD_W);
+  p->pos_y = clamp_pos(pos_y, WORLD_H);
+
+  // Only crossing a cell border touches the grid
+  pthread_mutex_lock(&g_grid_lock);
+  grid_move(&g_player_grid, &p->grid, p->pos_x, p->pos_y);
+  pthread_mutex_unlock(&g_grid_lock);
+
+  PlayerRecord *rec = player_record(p->slot);
+  if (rec)
+  {
+    int32_t pos[2] = {p->pos_x, p->pos_y};
+
+    record_put(&rec->pos_x, pos, sizeof pos);
+  }
+}
+
+bool move_player(uint32_t target_ip, int32_t pos_x, int32_t pos_y)
+{
+  pthread_once(&g_players_once, init_players);
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  Player *p = find_player_by_ip(target_ip);
+  if (p)
+  {
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+    place_player_locked(p, pos_x, pos_y);
+    pthread_mutex_unlock(lock);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  return p != NULL;
+}
+
+bool apply_udp_update(const UdpUpdate *u)
+{
+  pthread_once(&g_players_once, init_players);
+
+  bool applied = false;
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  Player *p = find_player_by_id(u->player_id);
+  if (p)
+  {
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+
+    // Serial number arithmetic; a newer seq is anything up to 2^31 ahead, wrapping included
+    applied = p->connected && p->session_token != 0 && p->session_token == u->token &&
+              (int32_t)(u->seq - p->udp_seq) > 0;
+
+    if (applied)
+    {
+      place_player_locked(p, u->pos_x, u->pos_y);
+
+      // The newest datagram is where they are now; NAT rebinding just moves this along
+      p->udp_seq  = u->seq;
+      p->udp_ack  = u->ack_tick;
+      p->udp_ip   = u->src_ip;
+      p->udp_port = u->src_port;
+    }
+
+    pthread_mutex_unlock(lock);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  return applied;
+}
+
+bool get_player_udp_peer(uint32_t slot, uint32_t player_id, uint32_t *ip, uint16_t *port, uint32_t *ack_tick)
+{
+  bool found = false;
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  if (slab_live(&g_players, slot))
+  {
+    Player          *p    = (Player *)slab_at(&g_players, slot);
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+
+    found = p->player_id == player_id && p->connected && p->session_token != 0 && p->udp_port != 0;
+
+    if (found)
+    {
+      *ip       = p->udp_ip;
+      *port     = p->udp_port;
+      *ack_tick = p->udp_ack;
+    }
+
+    pthread_mutex_unlock(lock);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  return found;
+}
+
+size_t collect_players_by_cell(uint32_t *slots, size_t cap, uint32_t *cell_start)
+{
+  size_t count = 0;
+
+  pthread_mutex_lock(&g_grid_lock);
+
+  for (uint32_t cell = 0; cell < GRID_CELLS; ++cell)
+  {
+    cell_start[cell] = (uint32_t)count;
+
+    for (GridNode *n = grid_cell_head(&g_player_grid, cell); n && count < cap; n = n->next)
+    {
+      slots[count++] = ((Player *)((char *)n - offsetof(Player, grid)))->slot;
+    }
+  }
+
+  cell_start[GRID_CELLS] = (uint32_t)count;
+
+  pthread_mutex_unlock(&g_grid_lock);
+
+  return count;
+}
+
+void for_each_player(void (*fn)(Player *p, void *arg), void *arg)
+{
+  pthread_once(&g_players_once, init_players);
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  for (uint32_t i = 0; i < g_players.high_water; ++i)
+  {
+    if (!slab_live(&g_players, i))
+    {
+      continue;
+    }
+
+    Player          *p    = (Player *)slab_at(&g_players, i);
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+    fn(p, arg);
+    pthread_mutex_unlock(lock);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+}
+
+void persist_player_locked(Player *p)
+{
+  PlayerRecord *rec = player_record(p->slot);
+  if (!rec)
+  {
+    return;
+  }
+
+  int32_t pos[2]    = {p->pos_x, p->pos_y};
+  int64_t last_seen = (int64_t)p->last_seen;
+
+  record_put(rec->nametag, p->nametag, sizeof rec->nametag);
+  record_put(&rec->pos_x, pos, sizeof pos);
+  record_put(&rec->last_seen, &last_seen, sizeof last_seen);
+}
+
+/**
+ * @brief Key the dedup cache hashes an avatar's pixels with; the same pixels at other dimensions never match
+ */
+static uint64_t avatar_seed(uint32_t av_w, uint32_t av_h)
+{
+  return (uint64_t)av_w << 32 | av_h;
+}
+
+/**
+ * @brief Swap a freshly converted RGBA buffer in as the player's avatar and release the old one
+ * @note Takes the player's stripe itself; only the pointer swap happens under it
+ * @note The buffer goes through the dedup cache first; if it's what the player has already,
+ *       nothing changes at all: no store write, no re-upload
+ */
+static void swap_player_avatar(Player *target_player, uint8_t *image_buf, uint32_t av_w, uint32_t av_h)
+{
+  uint64_t hash;
+  uint8_t *shared = dedup_intern(&g_avatar_dedup, image_buf, (size_t)av_w * av_h * RGBA_CHANNEL_COUNT,
+                                 avatar_seed(av_w, av_h), &hash);
+
+  pthread_mutex_t *lock = player_lock(target_player->ip);
+
+  pthread_mutex_lock(lock);
+
+  // Same block means same bytes and dimensions; typically somebody reconnecting
+  if (shared == target_player->avatar)
+  {
+    pthread_mutex_unlock(lock);
+
+    dedup_release(&g_avatar_dedup, shared, hash);
+    metrics_inc(METRIC_AVATAR_UNCHANGED);
+
+    return;
+  }
+
+  if (shared != image_buf)
+  {
+    metrics_inc(METRIC_AVATAR_SHARED);
+  }
+
+  uint8_t *old_avatar = target_player->avatar;
+  uint64_t old_hash   = target_player->avatar_hash;
+
+  target_player->avatar      = shared;
+  target_player->avatar_hash = hash;
+  target_player->w      = av_w;
+  target_player->h      = av_h;
+  target_player->ch     = RGBA_CHANNEL_COUNT; // Avatar is always RGBA!
+
+  PlayerRecord *rec = player_record(target_player->slot);
+  if (rec)
+  {
+    uint32_t dims[2] = {av_w, av_h};
+
+    record_put(rec->avatar, shared, (size_t)av_w * av_h * RGBA_CHANNEL_COUNT);
+    record_put(&rec->w, dims, sizeof dims);
+  }
+#ifndef SERVER_HEADLESS
+  // tex_inited is left alone: it says what's in their atlas cell, and that's still the old avatar until the
+  // renderer takes the upload queued below; only upload_texture_if_needed() (or an atlas regrow) changes it
+  target_player->tex_dirty = true;
+#endif
+
+  pthread_mutex_unlock(lock);
+
+  // We can't reach the old buffer anymore; let go of it outside the lock
+  dedup_release(&g_avatar_dedup, old_avatar, old_hash);
+
+#ifndef SERVER_HEADLESS
+  queue_avatar_upload(target_player);
+#endif
+}
+
+bool set_player_avatar(Player        *target_player,
+                       const uint8_t *av_pixels,
+                       uint32_t       av_w,
+                       uint32_t       av_h,
+                       uint8_t        av_ch)
+{
+  TRACE_SCOPE("set_player_avatar");
+
+  // Pick the conversion kernel once for the whole image; we always want RGBA out
+  PixelKernel convert = pixel_kernel_for(av_ch);
+
+  if (!convert)
+  {
+    return false;
+  }
+
+  // Check the received avatar dimensions; if they exceed our maximums, we truncate
+  // This is sensible and avoids crashing and dying and failing horribly
+  // Source rows keep their original length though, so remember it
+
+  size_t src_stride = (size_t)av_w * av_ch;
+
+  if (av_w > MAX_AVATAR_W)
+  {
+    av_w = MAX_AVATAR_W;
+  }
+
+  if (av_h > MAX_AVATAR_H)
+  {
+    av_h = MAX_AVATAR_H;
+  }
+
+  // Grab space for an RGBA image of the width and height we want
+  // Every block fits the biggest avatar we accept, so no need to size anything
+
+  uint8_t *image_buf = (uint8_t *)block_pool_alloc(&g_avatar_pool);
+
+  if (!image_buf)
+  {
+    return false;
+  }
+
+  // Write avatar pixel values to allocated image buffer; one call if rows are contiguous,
+  // otherwise one per row so the cut-off columns get skipped
+
+  if (src_stride == (size_t)av_w * av_ch)
+  {
+    convert(image_buf, av_pixels, (size_t)av_w * av_h);
+  }
+  else
+  {
+    for (uint32_t y = 0; y < av_h; ++y)
+    {
+      convert(image_buf + (size_t)y * av_w * RGBA_CHANNEL_COUNT, av_pixels + y * src_stride, av_w);
+    }
+  }
+
+  swap_player_avatar(target_player, image_buf, av_w, av_h);
+
+  return true;
+}
+
+uint8_t *alloc_avatar_block(void)
+{
+  pthread_once(&g_players_once, init_players);
+
+  return (uint8_t *)block_pool_alloc(&g_avatar_pool);
+}
+
+void free_avatar_block(uint8_t *block)
+{
+  block_pool_free(&g_avatar_pool, block);
+}
+
+bool adopt_player_avatar(Player  *target_player,
+                         uint8_t *block,
+                         uint32_t av_w,
+                         uint32_t av_h,
+                         uint8_t  av_ch)
+{
+  TRACE_SCOPE("adopt_player_avatar");
+
+  PixelKernel convert = pixel_kernel_for(av_ch);
+
+  // No truncation here; the pixels have to fill the block exactly the way we expect
+  if (!convert || av_w > MAX_AVATAR_W || av_h > MAX_AVATAR_H)
+  {
+    free_avatar_block(block);
+
+    return false;
+  }
+
+  // Expand front to back; the source sits at the tail, so every load beats the stores that would clobber it
+  size_t npixels = (size_t)av_w * av_h;
+
+  convert(block, block + avatar_tail_offset(av_w, av_h, av_ch), npixels);
+
+  swap_player_avatar(target_player, block, av_w, av_h);
+
+  return true;
+}
+
+/**
+ * @brief Make sure a replica is in the table under the ID its owner gave them
+ * @note Caller must hold g_players_lock exclusively
+ * @returns The player, or NULL if there's no room or the ID belongs to somebody else here
+ */
+static Player *ensure_replica_locked(const PlayerReplica *u)
+{
+  Player *p     = find_player_by_ip(u->ip);
+  Player *by_id = find_player_by_id(u->player_id);
+
+  if (p && p->player_id == u->player_id)
+  {
+    return p;
+  }
+
+  if (by_id)
+  {
+    return NULL;
+  }
+
+  if (!p)
+  {
+    return insert_player_locked(u->ip, u->player_id);
+  }
+
+  // Their owner forgot them and gave them a new ID since; follow along
+  if (!slot_index_insert(&g_player_ids, u->player_id, p->slot))
+  {
+    return NULL;
+  }
+
+  slot_index_remove(&g_player_ids, p->player_id);
+  p->player_id = u->player_id;
+
+  PlayerRecord *rec = player_record(p->slot);
+  if (rec)
+  {
+    record_put(&rec->player_id, &p->player_id, sizeof p->player_id);
+  }
+
+  return p;
+}
+
+bool apply_replica(const PlayerReplica *u)
+{
+  pthread_once(&g_players_once, init_players);
+
+  if (u->player_id == 0 ||
+      ((u->fields & REPLICA_AVATAR) && (u->w == 0 || u->h == 0 || u->w > MAX_AVATAR_W || u->h > MAX_AVATAR_H)))
+  {
+    return false;
+  }
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  Player *p = find_player_by_ip(u->ip);
+
+  if (!p || p->player_id != u->player_id)
+  {
+    pthread_rwlock_unlock(&g_players_lock);
+
+    // Whatever an update leaves out, a new player would be missing
+    if (!p && u->fields != REPLICA_ALL)
+    {
+      return false;
+    }
+
+    int64_t taken = players_wrlock();
+
+    p = ensure_replica_locked(u);
+
+    players_wrunlock(taken);
+
+    if (!p)
+    {
+      return false;
+    }
+
+    // Somebody may evict them while we're between locks; look them up again
+    pthread_rwlock_rdlock(&g_players_lock);
+
+    p = find_player_by_ip(u->ip);
+
+    if (!p || p->player_id != u->player_id)
+    {
+      pthread_rwlock_unlock(&g_players_lock);
+
+      return false;
+    }
+  }
+
+  pthread_mutex_t *lock = player_lock(p->ip);
+
+  // The table lock keeps them from being evicted; the avatar swap takes the stripe itself
+  if (u->fields & REPLICA_AVATAR)
+  {
+    pthread_mutex_lock(lock);
+
+    bool same = p->avatar && p->avatar_hash == u->avatar_hash && p->w == u->w && p->h == u->h;
+
+    pthread_mutex_unlock(lock);
+
+    uint8_t *block = same ? NULL : alloc_avatar_block();
+
+    if (block)
+    {
+      memcpy(block, u->avatar, (size_t)u->w * u->h * RGBA_CHANNEL_COUNT);
+      swap_player_avatar(p, block, u->w, u->h);
+    }
+  }
+
+  pthread_mutex_lock(lock);
+
+  if (u->fields & REPLICA_POS)
+  {
+    place_player_locked(p, u->pos_x, u->pos_y);
+  }
+
+  if (u->fields & REPLICA_TAG)
+  {
+    memcpy(p->nametag, u->nametag, sizeof p->nametag);
+    p->nametag[MAX_NAMETAG_LEN] = '\0';
+  }
+
+  if (u->fields & REPLICA_STATE)
+  {
+    p->connected = u->connected;
+    p->last_seen = time(NULL);
+  }
+
+  persist_player_locked(p);
+
+  pthread_mutex_unlock(lock);
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  return true;
+}
+
+bool drop_replica(uint32_t ip)
+{
+  pthread_once(&g_players_once, init_players);
+
+  int64_t taken = players_wrlock();
+
+  // Nobody is mid-way through a stripe with the table held exclusively
+  Player *p       = find_player_by_ip(ip);
+  bool    removed = p && !p->connected;
+
+  if (removed)
+  {
+    remove_player_locked(p);
+  }
+
+  players_wrunlock(taken);
+
+  return removed;
+}
+
+/**
+ * @brief Bring one stored player back into the table, disconnected, and line their record up with their new slot
+ * @note Caller must hold g_players_lock exclusively
+ * @param rec Their record; records before it are all settled already
+ * @param index Which record that is
+ * @returns false if the record is junk (torn, duplicate, out of bounds) and got dropped instead
+ */
+static bool load_player_locked(PlayerRecord *rec, uint32_t index)
+{
+  // Anything a torn write could have mangled gets checked before it's believed
+  if (rec->player_id == 0 || rec->w > MAX_AVATAR_W || rec->h > MAX_AVATAR_H || (rec->w == 0) != (rec->h == 0) ||
+      memchr(rec->nametag, '\0', sizeof rec->nametag) == NULL || find_player_by_ip(rec->ip) ||
+      find_player_by_id(rec->player_id))
+  {
+    return false;
+  }
+
+  uint8_t *avatar = NULL;
+
+  if (rec->w && !(avatar = (uint8_t *)block_pool_alloc(&g_avatar_pool)))
+  {
+    return false;
+  }
+
+  SlabHandle handle;
+  Player    *p = (Player *)slab_alloc(&g_players, &handle);
+
+  if (!p || !slot_index_insert(&g_player_index, player_key(rec->ip), handle.index))
+  {
+    if (p)
+    {
+      slab_free(&g_players, handle.index);
+    }
+
+    block_pool_free(&g_avatar_pool, avatar);
+
+    return false;
+  }
+
+  if (!slot_index_insert(&g_player_ids, rec->player_id, handle.index))
+  {
+    slot_index_remove(&g_player_index, player_key(rec->ip));
+    slab_free(&g_players, handle.index);
+    block_pool_free(&g_avatar_pool, avatar);
+
+    return false;
+  }
+
+  // IDs only ever go up, even if the header lost the race with a torn write
+  if (rec->player_id >= g_next_player_id)
+  {
+    g_next_player_id = rec->player_id + 1;
+  }
+
+  p->ip        = rec->ip;
+  p->player_id = rec->player_id;
+  p->slot      = handle.index;
+  p->slot_gen  = handle.gen;
+  p->pos_x     = clamp_pos(rec->pos_x, WORLD_W);
+  p->pos_y     = clamp_pos(rec->pos_y, WORLD_H);
+  p->last_seen = (time_t)rec->last_seen;
+  memcpy(p->nametag, rec->nametag, sizeof p->nametag);
+
+  if (avatar)
+  {
+    size_t len = (size_t)rec->w * rec->h * RGBA_CHANNEL_COUNT;
+
+    memcpy(avatar, rec->avatar, len);
+
+    p->avatar = dedup_intern(&g_avatar_dedup, avatar, len, avatar_seed(rec->w, rec->h), &p->avatar_hash);
+    p->w      = rec->w;
+    p->h      = rec->h;
+    p->ch     = RGBA_CHANNEL_COUNT;
+#ifndef SERVER_HEADLESS
+    p->tex_dirty = true; // Uploaded whenever the renderer first gets to them
+#endif
+  }
+
+  pthread_mutex_lock(&g_grid_lock);
+  grid_insert(&g_player_grid, &p->grid, p->pos_x, p->pos_y);
+  pthread_mutex_unlock(&g_grid_lock);
+
+  // Slots fill up from 0, so there's never anything live below us to clobber
+  if (handle.index != index)
+  {
+    PlayerRecord *dst  = player_record(handle.index);
+    uint32_t      dead = 0;
+
+    record_put(dst, rec, sizeof *rec);
+    record_put(&rec->live, &dead, sizeof dead);
+  }
+
+  return true;
+}
+
+bool open_player_store(const char *path, uint32_t capacity)
+{
+  pthread_once(&g_players_once, init_players);
+
+  bool created;
+
+  if (!record_store_open(&g_player_store, path, PLAYER_STORE_MAGIC, sizeof(PlayerRecord), capacity, &created))
+  {
+    return false;
+  }
+
+  if (created)
+  {
+    return true;
+  }
+
+  pthread_rwlock_wrlock(&g_players_lock);
+
+  PlayerStoreHeader *hdr = (PlayerStoreHeader *)record_store_user(&g_player_store);
+
+  if (hdr->next_player_id > g_next_player_id)
+  {
+    g_next_player_id = hdr->next_player_id;
+  }
+
+  // The file may hold more players than the table is allowed to; keep them all, the cap only stops new ones
+  size_t limit  = g_players.limit;
+  size_t loaded = 0;
+
+  slab_set_limit(&g_players, 0);
+
+  for (uint32_t i = 0; i < g_player_store.capacity; ++i)
+  {
+    PlayerRecord *rec = player_record(i);
+
+    if (!rec->live)
+    {
+      continue;
+    }
+
+    if (load_player_locked(rec, i))
+    {
+      loaded++;
+    }
+    else
+    {
+      uint32_t dead = 0;
+
+      record_put(&rec->live, &dead, sizeof dead);
+    }
+  }
+
+  slab_set_limit(&g_players, limit);
+
+  // Restored replicas carry other nodes' IDs; ours carry on in our own residue
+  align_next_player_id();
+
+  record_put(&hdr->next_player_id, &g_next_player_id, sizeof g_next_player_id);
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  printf("server: %zu player(s) restored from %s\n", loaded, path);
+
+  return true;
+}
+
+bool player_store_enabled(void) { return g_player_store.base != NULL; }
+
+void flush_player_store(void)
+{
+  if (g_player_store.base)
+  {
+    record_store_flush(&g_player_store);
+  }
+}
+
+void close_player_store(void)
+{
+  record_store_close(&g_player_store);
+}
+
+#ifndef SERVER_HEADLESS
+
+void set_avatar_uploads(bool enabled)
+{
+  atomic_store(&g_uploads_enabled, enabled);
+}
+
+void queue_avatar_upload(Player *p)
+{
+  pthread_once(&g_players_once, init_players);
+
+  if (!atomic_load_explicit(&g_uploads_enabled, memory_order_relaxed))
+  {
+    return;
+  }
+
+  // Already in there; the renderer will see the latest avatar when it gets to them
+  if (atomic_exchange(&p->upload_queued, true))
+  {
+    return;
+  }
+
+  uint64_t handle = ((uint64_t)p->slot_gen << 32) | p->slot;
+
+  if (!mpsc_push(&g_upload_queue, handle))
+  {
+    atomic_store(&p->upload_queued, false);
+    atomic_store(&g_upload_overflow, true);
+  }
+}
+
+size_t drain_avatar_uploads(size_t budget, bool (*upload)(Player *p))
+{
+  pthread_once(&g_players_once, init_players);
+
+  size_t   done   = 0;
+  bool     locked = false;
+  uint64_t value;
+
+  while (done < budget && mpsc_pop(&g_upload_queue, &value))
+  {
+    // The common frame has nothing queued; don't touch the table lock for those
+    if (!locked)
+    {
+      pthread_rwlock_rdlock(&g_players_lock);
+      locked = true;
+    }
+
+    SlabHandle handle = {.index = (uint32_t)value, .gen = (uint32_t)(value >> 32)};
+    Player    *p      = (Player *)slab_get(&g_players, handle);
+
+    // Evicted (and maybe replaced) since they were queued
+    if (!p)
+    {
+      continue;
+    }
+
+    // Clear before reading the avatar; a newer one set from here on queues them again
+    atomic_store(&p->upload_queued, false);
+
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+
+    bool retry = false;
+
+    if (p->tex_dirty)
+    {
+      retry = !upload(p);
+      done += !retry;
+    }
+
+    pthread_mutex_unlock(lock);
+
+    // Not uploadable yet; back of the line, and stop so we don't spin on them this call
+    if (retry)
+    {
+      queue_avatar_upload(p);
+
+      break;
+    }
+  }
+
+  // Some pushes got dropped; nothing for it but to look at everyone
+  if (done < budget && atomic_exchange(&g_upload_overflow, false))
+  {
+    if (!locked)
+    {
+      pthread_rwlock_rdlock(&g_players_lock);
+      locked = true;
+    }
+
+    for (uint32_t i = 0; i < g_players.high_water; ++i)
+    {
+      if (!slab_live(&g_players, i))
+      {
+        continue;
+      }
+
+      Player          *p    = (Player *)slab_at(&g_players, i);
+      pthread_mutex_t *lock = player_lock(p->ip);
+
+      pthread_mutex_lock(lock);
+
+      bool dirty = p->tex_dirty;
+
+      if (dirty && done < budget && upload(p))
+      {
+        done++;
+        dirty = false;
+      }
+
+      pthread_mutex_unlock(lock);
+
+      // Out of budget with dirty players left over; scan again next time
+      if (dirty)
+      {
+        atomic_store(&g_upload_overflow, true);
+
+        break;
+      }
+    }
+  }
+
+  if (locked)
+  {
+    pthread_rwlock_unlock(&g_players_lock);
+  }
+
+  return done;
+}
+
+#endif
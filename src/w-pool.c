@@ -0,0 +1,177 @@
+#include "w-pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_POOL_ALIGN 16
+
+// Sits right in front of every block's payload
+typedef struct
+{
+  _Atomic uint32_t next;  // Free stack link: next index + 1, or 0
+  uint32_t         index; // Which block this is; lets free() skip any lookup
+} BlockHeader;
+
+#define BLOCK_HEADER_SIZE                                                                \
+  ((sizeof(BlockHeader) + BLOCK_POOL_ALIGN - 1) & ~(size_t)(BLOCK_POOL_ALIGN - 1))
+
+static BlockHeader *header_at(BlockPool *pool, uint32_t index)
+{
+  uint8_t *chunk = pool->chunks[index / BLOCK_POOL_CHUNK_BLOCKS];
+
+  return (BlockHeader *)(chunk + (size_t)(index % BLOCK_POOL_CHUNK_BLOCKS) * pool->stride);
+}
+
+/**
+ * @brief Push a pre-linked run of blocks [first .. last] onto the free stack in one go
+ */
+static void push_chain(BlockPool *pool, uint32_t first, uint32_t last)
+{
+  BlockHeader *tail = header_at(pool, last);
+  uint64_t     head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+  uint64_t     next;
+
+  do
+  {
+    atomic_store_explicit(&tail->next, (uint32_t)head, memory_order_relaxed);
+    next = (head & 0xffffffff00000000ull) | (uint64_t)(first + 1);
+  } while (!atomic_compare_exchange_weak_explicit(
+      &pool->free_head, &head, next, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief Carve one more chunk into blocks and put them all on the free stack
+ * @note Caller holds grow_lock; the chunk is fully set up before any of it is published
+ */
+static bool add_chunk_locked(BlockPool *pool)
+{
+  size_t count = atomic_load_explicit(&pool->chunk_count, memory_order_relaxed);
+
+  if (count >= BLOCK_POOL_MAX_CHUNKS)
+  {
+    return false;
+  }
+
+  uint8_t *chunk = (uint8_t *)aligned_alloc(BLOCK_POOL_ALIGN,
+                                            BLOCK_POOL_CHUNK_BLOCKS * pool->stride);
+  if (!chunk)
+  {
+    return false;
+  }
+
+  pool->chunks[count] = chunk;
+
+  uint32_t first = (uint32_t)(count * BLOCK_POOL_CHUNK_BLOCKS);
+  uint32_t last  = first + BLOCK_POOL_CHUNK_BLOCKS - 1;
+
+  // Link the new blocks to each other; push_chain() links the last one to the old head
+  for (uint32_t i = first; i <= last; ++i)
+  {
+    BlockHeader *h = header_at(pool, i);
+
+    h->index = i;
+    atomic_store_explicit(&h->next, i + 2, memory_order_relaxed);
+  }
+
+  atomic_store_explicit(&pool->chunk_count, count + 1, memory_order_release);
+  push_chain(pool, first, last);
+
+  return true;
+}
+
+/**
+ * @brief Add a chunk, unless somebody else refilled the stack while we waited for the lock
+ */
+static bool grow(BlockPool *pool)
+{
+  pthread_mutex_lock(&pool->grow_lock);
+
+  bool ok = (uint32_t)atomic_load_explicit(&pool->free_head, memory_order_acquire) != 0 ||
+            add_chunk_locked(pool);
+
+  pthread_mutex_unlock(&pool->grow_lock);
+
+  return ok;
+}
+
+bool block_pool_init(BlockPool *pool, size_t block_size, size_t prealloc)
+{
+  memset(pool, 0, sizeof *pool);
+
+  pool->stride = BLOCK_HEADER_SIZE +
+                 ((block_size + BLOCK_POOL_ALIGN - 1) & ~(size_t)(BLOCK_POOL_ALIGN - 1));
+  atomic_init(&pool->free_head, 0);
+  atomic_init(&pool->chunk_count, 0);
+  pthread_mutex_init(&pool->grow_lock, NULL);
+
+  bool ok = true;
+
+  pthread_mutex_lock(&pool->grow_lock);
+
+  for (size_t have = 0; ok && have < prealloc; have += BLOCK_POOL_CHUNK_BLOCKS)
+  {
+    ok = add_chunk_locked(pool);
+  }
+
+  pthread_mutex_unlock(&pool->grow_lock);
+
+  return ok;
+}
+
+void block_pool_destroy(BlockPool *pool)
+{
+  size_t count = atomic_load(&pool->chunk_count);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    free(pool->chunks[i]);
+  }
+
+  pthread_mutex_destroy(&pool->grow_lock);
+  memset(pool, 0, sizeof *pool);
+}
+
+void *block_pool_alloc(BlockPool *pool)
+{
+  for (;;)
+  {
+    uint64_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+
+    if ((uint32_t)head == 0)
+    {
+      if (!grow(pool))
+      {
+        return NULL;
+      }
+
+      continue;
+    }
+
+    // Chunks are never freed while the pool is alive, so peeking at next is safe even if
+    // somebody else pops this block first; the tag makes our CAS fail in that case
+    BlockHeader *h    = header_at(pool, (uint32_t)head - 1);
+    uint32_t     next = atomic_load_explicit(&h->next, memory_order_relaxed);
+    uint64_t     tag  = (head >> 32) + 1;
+
+    if (atomic_compare_exchange_weak_explicit(&pool->free_head,
+                                              &head,
+                                              (tag << 32) | next,
+                                              memory_order_acquire,
+                                              memory_order_relaxed))
+    {
+      return (uint8_t *)h + BLOCK_HEADER_SIZE;
+    }
+  }
+}
+
+void block_pool_free(BlockPool *pool, void *block)
+{
+  if (!block)
+  {
+    return;
+  }
+
+  BlockHeader *h = (BlockHeader *)((uint8_t *)block - BLOCK_HEADER_SIZE);
+
+  push_chain(pool, h->index, h->index);
+}
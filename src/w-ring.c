@@ -0,0 +1,64 @@
+#include "w-ring.h"
+
+#include <string.h>
+
+#define RING_MASK (BYTE_RING_CAP - 1)
+
+_Static_assert((BYTE_RING_CAP & RING_MASK) == 0, "BYTE_RING_CAP must be a power of two");
+
+bool ring_push(ByteRing *ring, const void *msg, size_t len)
+{
+  if (len > BYTE_RING_CAP - ring->len)
+  {
+    return false;
+  }
+
+  size_t tail  = (ring->head + ring->len) & RING_MASK;
+  size_t first = BYTE_RING_CAP - tail; // Room before we wrap
+
+  if (first > len)
+  {
+    first = len;
+  }
+
+  memcpy(ring->data + tail, msg, first);
+  memcpy(ring->data, (const uint8_t *)msg + first, len - first);
+
+  ring->len += len;
+
+  return true;
+}
+
+int ring_iov(const ByteRing *ring, struct iovec iov[2])
+{
+  if (ring->len == 0)
+  {
+    return 0;
+  }
+
+  size_t first = BYTE_RING_CAP - ring->head;
+
+  if (first >= ring->len)
+  {
+    iov[0] = (struct iovec){.iov_base = (void *)(ring->data + ring->head), .iov_len = ring->len};
+
+    return 1;
+  }
+
+  iov[0] = (struct iovec){.iov_base = (void *)(ring->data + ring->head), .iov_len = first};
+  iov[1] = (struct iovec){.iov_base = (void *)ring->data, .iov_len = ring->len - first};
+
+  return 2;
+}
+
+void ring_consume(ByteRing *ring, size_t len)
+{
+  ring->head = (ring->head + len) & RING_MASK;
+  ring->len -= len;
+
+  // Rewind when empty; keeps the next burst in one piece
+  if (ring->len == 0)
+  {
+    ring->head = 0;
+  }
+}
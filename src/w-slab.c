@@ -0,0 +1,167 @@
+#include "w-slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define SLAB_CHUNK_LEN ((size_t)1 << SLAB_CHUNK_SHIFT)
+#define SLAB_CHUNK_MASK (SLAB_CHUNK_LEN - 1)
+
+void slab_init(Slab *slab, size_t elem_size, size_t limit)
+{
+  memset(slab, 0, sizeof *slab);
+
+  slab->elem_size = elem_size;
+  slab->limit     = limit;
+  slab->free_head = SLAB_NONE;
+}
+
+void slab_destroy(Slab *slab)
+{
+  for (size_t i = 0; i < slab->chunk_count; ++i)
+  {
+    free(slab->chunks[i]);
+  }
+
+  free(slab->chunks);
+  free(slab->slots);
+
+  slab_init(slab, slab->elem_size, slab->limit);
+}
+
+void slab_set_limit(Slab *slab, size_t limit) { slab->limit = limit; }
+
+void *slab_at(const Slab *slab, uint32_t index)
+{
+  return slab->chunks[index >> SLAB_CHUNK_SHIFT] +
+         (size_t)(index & SLAB_CHUNK_MASK) * slab->elem_size;
+}
+
+/**
+ * @brief Make room for one more never-used slot: a new chunk if the last one is full,
+ * plus room in the metadata array
+ */
+static bool grow(Slab *slab)
+{
+  size_t index = slab->high_water;
+
+  if (index >= SLAB_NONE)
+  {
+    return false;
+  }
+
+  // Metadata is only ever looked at under the caller's lock, so it's fine for it to move
+  if ((index & SLAB_CHUNK_MASK) == 0)
+  {
+    uint8_t **chunks =
+        (uint8_t **)realloc(slab->chunks, (slab->chunk_count + 1) * sizeof *chunks);
+    if (!chunks)
+    {
+      return false;
+    }
+
+    slab->chunks = chunks;
+
+    SlabSlot *slots =
+        (SlabSlot *)realloc(slab->slots, (index + SLAB_CHUNK_LEN) * sizeof *slots);
+    if (!slots)
+    {
+      return false;
+    }
+
+    slab->slots = slots;
+
+    // Element storage, on the other hand, never moves once handed out
+    slab->chunks[slab->chunk_count] = (uint8_t *)malloc(SLAB_CHUNK_LEN * slab->elem_size);
+    if (!slab->chunks[slab->chunk_count])
+    {
+      return false;
+    }
+
+    slab->chunk_count++;
+  }
+
+  slab->slots[index].gen       = 0;
+  slab->slots[index].next_free = SLAB_NONE;
+  slab->slots[index].live      = false;
+  slab->high_water++;
+
+  return true;
+}
+
+void *slab_alloc(Slab *slab, SlabHandle *out)
+{
+  if (slab->limit && slab->live >= slab->limit)
+  {
+    return NULL;
+  }
+
+  uint32_t index;
+
+  // Reuse before growing
+  if (slab->free_head != SLAB_NONE)
+  {
+    index           = slab->free_head;
+    slab->free_head = slab->slots[index].next_free;
+  }
+  else
+  {
+    if (!grow(slab))
+    {
+      return NULL;
+    }
+
+    index = (uint32_t)(slab->high_water - 1);
+  }
+
+  slab->slots[index].live      = true;
+  slab->slots[index].next_free = SLAB_NONE;
+  slab->live++;
+
+  void *elem = slab_at(slab, index);
+  memset(elem, 0, slab->elem_size);
+
+  if (out)
+  {
+    out->index = index;
+    out->gen   = slab->slots[index].gen;
+  }
+
+  return elem;
+}
+
+void slab_free(Slab *slab, uint32_t index)
+{
+  if (!slab_live(slab, index))
+  {
+    return;
+  }
+
+  // Bumping the generation is what turns old handles stale
+  slab->slots[index].gen++;
+  slab->slots[index].live      = false;
+  slab->slots[index].next_free = slab->free_head;
+  slab->free_head              = index;
+  slab->live--;
+}
+
+bool slab_live(const Slab *slab, uint32_t index)
+{
+  return index < slab->high_water && slab->slots[index].live;
+}
+
+void *slab_get(const Slab *slab, SlabHandle h)
+{
+  if (!slab_live(slab, h.index) || slab->slots[h.index].gen != h.gen)
+  {
+    return NULL;
+  }
+
+  return slab_at(slab, h.index);
+}
+
+SlabHandle slab_handle(const Slab *slab, uint32_t index)
+{
+  SlabHandle h = {.index = index, .gen = slab->slots[index].gen};
+
+  return h;
+}
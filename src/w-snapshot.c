@@ -0,0 +1,113 @@
+#include "w-snapshot.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_FRESH 4u // Set on the shared index when it holds something the renderer hasn't seen
+
+static RenderSnapshot g_snapshots[3];
+
+static unsigned         g_back  = 2; // Being built; owned by whoever holds g_build_lock
+static _Atomic unsigned g_ready = 1; // Latest complete snapshot, | SNAPSHOT_FRESH if unseen
+static unsigned         g_front = 0; // Being drawn; render thread only
+
+static pthread_mutex_t g_build_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool     g_stale;
+
+/**
+ * @brief Copy every drawable player into a snapshot
+ * @param snap The back buffer
+ */
+static void build_snapshot(RenderSnapshot *snap)
+{
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  snap->count      = 0;
+  snap->slot_limit = g_players.high_water;
+
+  // Room for everyone up front; the buffer only ever grows, so this settles quickly
+  if (snap->cap < g_players.live)
+  {
+    RenderItem *items = (RenderItem *)realloc(snap->items, g_players.live * sizeof *items);
+    if (!items)
+    {
+      pthread_rwlock_unlock(&g_players_lock);
+
+      return;
+    }
+
+    snap->items = items;
+    snap->cap   = g_players.live;
+  }
+
+  for (uint32_t i = 0; i < g_players.high_water; ++i)
+  {
+    if (!slab_live(&g_players, i))
+    {
+      continue;
+    }
+
+    Player          *p    = (Player *)slab_at(&g_players, i);
+    pthread_mutex_t *lock = player_lock(p->ip);
+
+    pthread_mutex_lock(lock);
+
+    if (p->connected && p->avatar)
+    {
+      RenderItem *item = &snap->items[snap->count++];
+
+      item->pos_x    = p->pos_x;
+      item->pos_y    = p->pos_y;
+      item->slot     = p->slot;
+      item->slot_gen = p->slot_gen;
+      item->w        = p->w;
+      item->h        = p->h;
+      memcpy(item->nametag, p->nametag, sizeof item->nametag);
+    }
+
+    pthread_mutex_unlock(lock);
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+}
+
+void render_snapshot_publish(void)
+{
+  atomic_store(&g_stale, true);
+
+  // Whoever holds the build lock keeps going until nobody has flagged anything newer
+  // Re-checking after unlocking covers a flag raised between the builder's last look and its unlock
+  while (atomic_load(&g_stale) && pthread_mutex_trylock(&g_build_lock) == 0)
+  {
+    while (atomic_exchange(&g_stale, false))
+    {
+      build_snapshot(&g_snapshots[g_back]);
+
+      g_back = atomic_exchange(&g_ready, g_back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+    }
+
+    pthread_mutex_unlock(&g_build_lock);
+  }
+}
+
+const RenderSnapshot *render_snapshot_acquire(void)
+{
+  // Only trade buffers if there's something new; otherwise keep drawing what we have
+  if (atomic_load(&g_ready) & SNAPSHOT_FRESH)
+  {
+    g_front = atomic_exchange(&g_ready, g_front) & ~SNAPSHOT_FRESH;
+  }
+
+  return &g_snapshots[g_front];
+}
+
+void render_snapshot_free(void)
+{
+  for (size_t i = 0; i < 3; ++i)
+  {
+    free(g_snapshots[i].items);
+    memset(&g_snapshots[i], 0, sizeof g_snapshots[i]);
+  }
+}
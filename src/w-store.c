@@ -0,0 +1,271 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // sync_file_range()
+#endif
+
+#include "w-store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECORD_STORE_VERSION 1
+
+// First thing in the file; the caller's own bytes follow right after
+typedef struct
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t capacity;
+  uint32_t reserved;
+  uint8_t  user[RECORD_STORE_USER_BYTES];
+} StoreHeader;
+
+static size_t records_offset(const RecordStore *s) { return s->page_size; }
+
+bool record_store_open(RecordStore *s, const char *path, uint64_t magic, size_t record_size, uint32_t capacity,
+                       bool *created)
+{
+  memset(s, 0, sizeof *s);
+  s->fd = -1;
+
+  s->page_size   = (size_t)sysconf(_SC_PAGESIZE);
+  s->record_size = record_size;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "server: store %s: %s\n", path, strerror(errno));
+
+    return false;
+  }
+
+  if (flock(fd, LOCK_EX | LOCK_NB) < 0)
+  {
+    fprintf(stderr, "server: store %s is in use by another server\n", path);
+    close(fd);
+
+    return false;
+  }
+
+  struct stat st;
+  StoreHeader hdr;
+
+  if (fstat(fd, &st) < 0)
+  {
+    perror("server: store fstat");
+    close(fd);
+
+    return false;
+  }
+
+  *created = st.st_size == 0;
+
+  if (!*created)
+  {
+    // Refuse anything we didn't write ourselves, rather than clobber it
+    if ((size_t)st.st_size < sizeof hdr || pread(fd, &hdr, sizeof hdr, 0) != (ssize_t)sizeof hdr ||
+        hdr.magic != magic || hdr.version != RECORD_STORE_VERSION || hdr.record_size != record_size)
+    {
+      fprintf(stderr, "server: store %s has a different layout; move it out of the way to start over\n", path);
+      close(fd);
+
+      return false;
+    }
+
+    // Never shrink; records past what was asked for just sit there
+    if (hdr.capacity > capacity)
+    {
+      capacity = hdr.capacity;
+    }
+  }
+
+  s->capacity = capacity;
+  s->size     = records_offset(s) + (size_t)capacity * record_size;
+
+  if ((size_t)st.st_size < s->size && ftruncate(fd, (off_t)s->size) < 0)
+  {
+    perror("server: store ftruncate");
+    close(fd);
+
+    return false;
+  }
+
+  void *base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    perror("server: store mmap");
+    close(fd);
+
+    return false;
+  }
+
+  size_t pages   = (s->size + s->page_size - 1) / s->page_size;
+  s->dirty_words = (pages + 63) / 64;
+  s->dirty       = (atomic_uint_fast64_t *)calloc(s->dirty_words, sizeof *s->dirty);
+
+  if (!s->dirty)
+  {
+    munmap(base, s->size);
+    close(fd);
+
+    return false;
+  }
+
+  s->fd   = fd;
+  s->base = (uint8_t *)base;
+
+  // New or grown; either way the header has to say so
+  StoreHeader *h = (StoreHeader *)s->base;
+
+  if (*created || h->capacity != capacity)
+  {
+    h->magic       = magic;
+    h->version     = RECORD_STORE_VERSION;
+    h->record_size = (uint32_t)record_size;
+    h->capacity    = capacity;
+
+    record_store_touch(s, h, sizeof *h);
+  }
+
+  return true;
+}
+
+void *record_store_at(const RecordStore *s, uint32_t index)
+{
+  if (!s->base || index >= s->capacity)
+  {
+    return NULL;
+  }
+
+  return s->base + records_offset(s) + (size_t)index * s->record_size;
+}
+
+void *record_store_user(const RecordStore *s)
+{
+  return ((StoreHeader *)s->base)->user;
+}
+
+void record_store_touch(RecordStore *s, const void *addr, size_t len)
+{
+  if (len == 0)
+  {
+    return;
+  }
+
+  size_t first = (size_t)((const uint8_t *)addr - s->base) / s->page_size;
+  size_t last  = ((size_t)((const uint8_t *)addr - s->base) + len - 1) / s->page_size;
+
+  for (size_t page = first; page <= last; ++page)
+  {
+    atomic_fetch_or_explicit(&s->dirty[page / 64], (uint_fast64_t)1 << (page % 64), memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Start writing one run of neighbouring pages back
+ * @note Not msync(MS_ASYNC): on Linux that's a no-op, and the pages would sit there until the kernel's own
+ * writeback got round to them. sync_file_range() queues them for real without waiting for the disk;
+ * elsewhere there's nothing like it, so it's MS_SYNC, and the caller waits
+ * @returns false if the kernel wouldn't take them; they're marked dirty again for the next flush
+ */
+static bool store_write_run(RecordStore *s, size_t from, size_t count)
+{
+  size_t off = from * s->page_size;
+  size_t len = count * s->page_size;
+
+  // The last page may stick out past the end of the file
+  if (off + len > s->size)
+  {
+    len = s->size - off;
+  }
+
+#ifdef __linux__
+  int rc;
+
+  do
+  {
+    rc = sync_file_range(s->fd, (off_t)off, (off_t)len, SYNC_FILE_RANGE_WRITE);
+  } while (rc < 0 && errno == EINTR);
+#else
+  int rc = msync(s->base + off, len, MS_SYNC);
+#endif
+
+  if (rc < 0)
+  {
+    for (size_t page = from; page < from + count; ++page)
+    {
+      atomic_fetch_or_explicit(&s->dirty[page / 64], (uint_fast64_t)1 << (page % 64), memory_order_relaxed);
+    }
+
+    return false;
+  }
+
+  return true;
+}
+
+size_t record_store_flush(RecordStore *s)
+{
+  size_t pages    = (s->size + s->page_size - 1) / s->page_size;
+  size_t flushed  = 0;
+  size_t run_from = 0;
+  size_t run_len  = 0;
+
+  for (size_t w = 0; w < s->dirty_words; ++w)
+  {
+    // Grab and clear in one go; anything touched from here on waits for the next flush
+    uint_fast64_t bits = atomic_exchange_explicit(&s->dirty[w], 0, memory_order_relaxed);
+
+    for (size_t b = 0; b < 64 && w * 64 + b < pages; ++b)
+    {
+      size_t page = w * 64 + b;
+
+      if (bits & ((uint_fast64_t)1 << b))
+      {
+        if (run_len == 0)
+        {
+          run_from = page;
+        }
+
+        run_len++;
+        continue;
+      }
+
+      // One write-back per run of neighbouring dirty pages
+      if (run_len > 0)
+      {
+        flushed += store_write_run(s, run_from, run_len) ? run_len : 0;
+        run_len = 0;
+      }
+    }
+  }
+
+  if (run_len > 0)
+  {
+    flushed += store_write_run(s, run_from, run_len) ? run_len : 0;
+  }
+
+  return flushed;
+}
+
+void record_store_close(RecordStore *s)
+{
+  if (!s->base)
+  {
+    return;
+  }
+
+  msync(s->base, s->size, MS_SYNC);
+  munmap(s->base, s->size);
+  close(s->fd);
+  free(s->dirty);
+
+  memset(s, 0, sizeof *s);
+  s->fd = -1;
+}
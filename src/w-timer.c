@@ -0,0 +1,226 @@
+#include "w-timer.h"
+
+#include <string.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+static uint64_t ticks_at(const TimerWheel *w, int64_t ms)
+{
+  return ms <= w->origin_ms ? 0 : (uint64_t)(ms - w->origin_ms) / w->tick_ms;
+}
+
+static void link_node(TimerWheel *w, unsigned level, unsigned slot, TimerNode *node)
+{
+  TimerNode **head = &w->slots[level][slot];
+
+  node->next = *head;
+  if (*head)
+  {
+    (*head)->pprev = &node->next;
+  }
+
+  *head       = node;
+  node->pprev = head;
+  node->level = (uint8_t)level;
+  node->slot  = (uint8_t)slot;
+
+  w->occupied[level] |= 1ull << slot;
+}
+
+static void unlink_node(TimerWheel *w, TimerNode *node)
+{
+  *node->pprev = node->next;
+  if (node->next)
+  {
+    node->next->pprev = node->pprev;
+  }
+
+  if (!w->slots[node->level][node->slot])
+  {
+    w->occupied[node->level] &= ~(1ull << node->slot);
+  }
+
+  node->next  = NULL;
+  node->pprev = NULL;
+}
+
+/**
+ * @brief Put a node in the slot matching its expiry, relative to the current tick
+ * @note Expects node->expires >= now_tick; during a cascade, == now_tick lands in the slot about to fire
+ */
+static void place(TimerWheel *w, TimerNode *node)
+{
+  uint64_t delta = node->expires - w->now_tick;
+
+  for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+  {
+    unsigned shift = level * TIMER_WHEEL_BITS;
+
+    if (delta < (1ull << (shift + TIMER_WHEEL_BITS)))
+    {
+      link_node(w, level, (unsigned)(node->expires >> shift) & SLOT_MASK, node);
+
+      return;
+    }
+  }
+
+  // Further out than the wheel spans; park it in the top slot that comes up last, it'll be re-placed from there
+  unsigned level = TIMER_WHEEL_LEVELS - 1;
+  unsigned shift = level * TIMER_WHEEL_BITS;
+
+  link_node(w, level, (unsigned)(w->now_tick >> shift) & SLOT_MASK, node);
+}
+
+/**
+ * @brief Move every timer in one slot down to wherever it belongs now
+ */
+static void cascade(TimerWheel *w, unsigned level, unsigned slot)
+{
+  // Detach the whole list first; re-placing may link into this very slot again
+  TimerNode *node = w->slots[level][slot];
+
+  w->slots[level][slot] = NULL;
+  w->occupied[level] &= ~(1ull << slot);
+
+  while (node)
+  {
+    TimerNode *next = node->next;
+
+    place(w, node);
+    node = next;
+  }
+}
+
+void timer_wheel_init(TimerWheel *w, uint32_t tick_ms, int64_t now_ms)
+{
+  memset(w, 0, sizeof *w);
+
+  w->tick_ms   = tick_ms ? tick_ms : 1;
+  w->origin_ms = now_ms;
+}
+
+void timer_schedule(TimerWheel *w, TimerNode *node, int64_t at_ms)
+{
+  if (timer_pending(node))
+  {
+    unlink_node(w, node);
+  }
+  else
+  {
+    w->count++;
+  }
+
+  // Round up, so a timer never fires early; what's due already goes on the next tick,
+  // since the current one has been processed
+  uint64_t expires = ticks_at(w, at_ms + (int64_t)w->tick_ms - 1);
+
+  node->expires = expires > w->now_tick ? expires : w->now_tick + 1;
+
+  place(w, node);
+}
+
+void timer_cancel(TimerWheel *w, TimerNode *node)
+{
+  if (!timer_pending(node))
+  {
+    return;
+  }
+
+  unlink_node(w, node);
+  w->count--;
+}
+
+void timer_advance(TimerWheel *w, int64_t now_ms, TimerFn fn, void *arg)
+{
+  uint64_t target = ticks_at(w, now_ms);
+
+  // Nothing to fire along the way; just catch up
+  if (w->count == 0)
+  {
+    w->now_tick = target > w->now_tick ? target : w->now_tick;
+
+    return;
+  }
+
+  while (w->now_tick < target)
+  {
+    uint64_t tick = ++w->now_tick;
+
+    // Each time a level wraps, the next slot up comes due and trickles down
+    for (unsigned level = 1; level < TIMER_WHEEL_LEVELS; ++level)
+    {
+      unsigned shift = level * TIMER_WHEEL_BITS;
+
+      if (tick & ((1ull << shift) - 1))
+      {
+        break;
+      }
+
+      cascade(w, level, (unsigned)(tick >> shift) & SLOT_MASK);
+    }
+
+    // Fire one at a time; the callback is free to touch the wheel, this slot included
+    TimerNode **head = &w->slots[0][tick & SLOT_MASK];
+
+    while (*head)
+    {
+      TimerNode *node = *head;
+
+      unlink_node(w, node);
+      w->count--;
+
+      fn(node, arg);
+    }
+
+    if (w->count == 0)
+    {
+      w->now_tick = target;
+    }
+  }
+}
+
+int timer_next_timeout(const TimerWheel *w, int64_t now_ms)
+{
+  if (w->count == 0)
+  {
+    return -1;
+  }
+
+  uint64_t best = UINT64_MAX;
+
+  // Per level: the next occupied slot after the current one, and the tick it comes up on
+  for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+  {
+    uint64_t bits = w->occupied[level];
+
+    if (!bits)
+    {
+      continue;
+    }
+
+    unsigned shift = level * TIMER_WHEEL_BITS;
+    unsigned cur   = (unsigned)(w->now_tick >> shift) & SLOT_MASK;
+
+    // Rotate so bit 0 is the slot right after the current one; the current slot itself comes up a lap later
+    unsigned rot   = (cur + 1) & SLOT_MASK;
+    uint64_t ahead = rot ? (bits >> rot) | (bits << (TIMER_WHEEL_SLOTS - rot)) : bits;
+    uint64_t steps = (uint64_t)__builtin_ctzll(ahead) + 1;
+
+    uint64_t tick = ((w->now_tick >> shift) + steps) << shift;
+
+    if (tick < best)
+    {
+      best = tick;
+    }
+  }
+
+  int64_t at   = w->origin_ms + (int64_t)(best * w->tick_ms);
+  int64_t wait = at - now_ms;
+
+  if (wait <= 0)
+  {
+    return 0;
+  }
+
+  return wait > INT32_MAX ? INT32_MAX : (int)wait;
+}
@@ -0,0 +1,316 @@
+#include "w-trace.h"
+
+#ifdef WALL_TRACE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TRACE_MAX_THREADS 128 // Threads past this many just don't get traced
+#define TRACE_NAME_LEN 32
+#define TRACE_DUMP 'd'
+#define TRACE_QUIT 'q'
+
+_Static_assert((TRACE_RING_EVENTS & (TRACE_RING_EVENTS - 1)) == 0, "TRACE_RING_EVENTS must be a power of two");
+
+// Fields are atomic only so a dump reading one mid-write isn't a data race; see ring_push()
+typedef struct
+{
+  _Atomic(const char *) name;
+  atomic_int_fast64_t   start_ns;
+  atomic_int_fast64_t   dur_ns;
+} TraceEvent;
+
+typedef struct
+{
+  atomic_uint_fast64_t head; // Events ever pushed; the next one goes in slot head % TRACE_RING_EVENTS
+  char                 name[TRACE_NAME_LEN];
+  uint32_t             tid;
+  TraceEvent           events[TRACE_RING_EVENTS];
+} TraceRing;
+
+static _Atomic(TraceRing *) g_rings[TRACE_MAX_THREADS];
+static atomic_size_t        g_ring_count = 0;
+
+static _Thread_local TraceRing *t_ring    = NULL;
+static _Thread_local bool       t_no_ring = false; // Ran out of slots or memory once; don't keep trying
+
+// Dump requests; the write end is atomic since signal handlers read it while trace_stop() may be closing it
+static int        g_dump_rd = -1;
+static atomic_int g_dump_wr = -1;
+static pthread_t  g_dump_thread;
+static unsigned   g_dump_seq = 0; // Dump thread only
+
+/**
+ * @brief This thread's ring; made on first use
+ * @returns NULL if there's none to be had
+ */
+static TraceRing *ring(void)
+{
+  if (t_ring || t_no_ring)
+  {
+    return t_ring;
+  }
+
+  size_t     index = atomic_fetch_add(&g_ring_count, 1);
+  TraceRing *r     = index < TRACE_MAX_THREADS ? (TraceRing *)calloc(1, sizeof *r) : NULL;
+
+  if (!r)
+  {
+    t_no_ring = true;
+
+    return NULL;
+  }
+
+  r->tid = (uint32_t)index + 1;
+  snprintf(r->name, sizeof r->name, "thread %u", r->tid);
+
+  atomic_store_explicit(&g_rings[index], r, memory_order_release);
+
+  t_ring = r;
+
+  return r;
+}
+
+/**
+ * @brief Record one event, overwriting the oldest if the ring is full
+ * @note Seqlock-style: head says how far the writer has gotten, and a reader that finds head moved
+ *       past a slot's lap while it was reading throws that slot away; see dump_ring()
+ */
+static void ring_push(TraceRing *r, const char *name, int64_t start_ns, int64_t dur_ns)
+{
+  uint64_t    head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  TraceEvent *e    = &r->events[head & (TRACE_RING_EVENTS - 1)];
+
+  // Readers must never see the slot change without also seeing the head that allowed it
+  atomic_thread_fence(memory_order_release);
+
+  atomic_store_explicit(&e->name, name, memory_order_relaxed);
+  atomic_store_explicit(&e->start_ns, start_ns, memory_order_relaxed);
+  atomic_store_explicit(&e->dur_ns, dur_ns, memory_order_relaxed);
+
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+void trace_span_end(TraceSpan *span)
+{
+  TraceRing *r = ring();
+
+  if (r)
+  {
+    ring_push(r, span->name, span->start_ns, trace_now_ns() - span->start_ns);
+  }
+}
+
+void trace_thread_name(const char *fmt, ...)
+{
+  TraceRing *r = ring();
+
+  // Only ever written by the owner before anything's worth dumping; a dump racing it just shows the old name
+  if (r)
+  {
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(r->name, sizeof r->name, fmt, ap);
+    va_end(ap);
+  }
+}
+
+// ==============================================================================
+// DUMPING
+// ==============================================================================
+
+/**
+ * @brief Write one ring's events, oldest first
+ * @param first Is nothing written to the event array yet? Updated
+ * @returns Amt. of events written
+ */
+static size_t dump_ring(FILE *f, const TraceRing *r, int pid, bool *first)
+{
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  uint64_t from = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+  size_t   kept = 0;
+
+  fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+          *first ? "" : ",", pid, r->tid, r->name);
+
+  *first = false;
+
+  for (uint64_t i = from; i < head; ++i)
+  {
+    const TraceEvent *e = &r->events[i & (TRACE_RING_EVENTS - 1)];
+
+    const char *name     = atomic_load_explicit(&e->name, memory_order_relaxed);
+    int64_t     start_ns = atomic_load_explicit(&e->start_ns, memory_order_relaxed);
+    int64_t     dur_ns   = atomic_load_explicit(&e->dur_ns, memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_acquire);
+
+    // The writer got far enough to start on this slot's next lap; what we read may be half of each
+    if (atomic_load_explicit(&r->head, memory_order_relaxed) >= i + TRACE_RING_EVENTS)
+    {
+      continue;
+    }
+
+    // Chrome wants microseconds; keep the nanoseconds as decimals
+    fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld}",
+            name, pid, r->tid,
+            (long long)(start_ns / 1000), (long long)(start_ns % 1000),
+            (long long)(dur_ns / 1000), (long long)(dur_ns % 1000));
+
+    kept++;
+  }
+
+  return kept;
+}
+
+static void dump_all(void)
+{
+  char path[64];
+  int  pid = (int)getpid();
+
+  snprintf(path, sizeof path, "trace-%d-%u.json", pid, g_dump_seq++);
+
+  FILE *f = fopen(path, "w");
+
+  if (!f)
+  {
+    fprintf(stderr, "server: trace %s: %s\n", path, strerror(errno));
+
+    return;
+  }
+
+  size_t count  = atomic_load(&g_ring_count);
+  size_t events = 0;
+  bool   first  = true;
+
+  if (count > TRACE_MAX_THREADS)
+  {
+    count = TRACE_MAX_THREADS;
+  }
+
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    // Claimed but not published yet; nothing in it worth having
+    const TraceRing *r = atomic_load_explicit(&g_rings[i], memory_order_acquire);
+
+    if (r)
+    {
+      events += dump_ring(f, r, pid, &first);
+    }
+  }
+
+  fprintf(f, "\n]}\n");
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "server: trace %s: %s\n", path, strerror(errno));
+
+    return;
+  }
+
+  fprintf(stderr, "server: %zu trace event(s) written to %s\n", events, path);
+}
+
+static void *dump_main(void *arg)
+{
+  (void)arg;
+
+  for (;;)
+  {
+    char    cmd;
+    ssize_t n = read(g_dump_rd, &cmd, 1);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (n != 1 || cmd == TRACE_QUIT)
+    {
+      return NULL;
+    }
+
+    dump_all();
+  }
+}
+
+int trace_start(void)
+{
+  int fds[2];
+
+  if (pipe(fds) < 0)
+  {
+    perror("server: trace_start");
+
+    return -1;
+  }
+
+  g_dump_rd = fds[0];
+
+  if (pthread_create(&g_dump_thread, NULL, dump_main, NULL) != 0)
+  {
+    perror("server: pthread_create");
+    close(fds[0]);
+    close(fds[1]);
+    g_dump_rd = -1;
+
+    return -1;
+  }
+
+  atomic_store(&g_dump_wr, fds[1]);
+
+  return 0;
+}
+
+void trace_request_dump(void)
+{
+  int  fd  = atomic_load(&g_dump_wr);
+  char cmd = TRACE_DUMP;
+
+  if (fd >= 0)
+  {
+    ssize_t ignored = write(fd, &cmd, 1);
+    (void)ignored;
+  }
+}
+
+void trace_stop(void)
+{
+  int  wr  = atomic_exchange(&g_dump_wr, -1);
+  char cmd = TRACE_QUIT;
+
+  if (wr < 0)
+  {
+    return;
+  }
+
+  // Dumps asked for before this go out first; the pipe keeps them in order
+  ssize_t ignored;
+
+  do
+  {
+    ignored = write(wr, &cmd, 1);
+  } while (ignored < 0 && errno == EINTR);
+
+  pthread_join(g_dump_thread, NULL);
+
+  close(wr);
+  close(g_dump_rd);
+  g_dump_rd = -1;
+}
+
+#else
+
+typedef int trace_compiled_out; // Keeps this translation unit from being empty
+
+#endif
@@ -0,0 +1,186 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // recvmmsg()/sendmmsg()
+#endif
+
+#include "w-udp.h"
+
+#include "w-helper.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int udp_open(const char *bind_ip, uint16_t port)
+{
+  struct sockaddr_in addr;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+
+  if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1)
+  {
+    fprintf(stderr, "server: bad bind address: %s\n", bind_ip);
+
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+  {
+    perror("server: udp socket");
+
+    return -1;
+  }
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 || set_nonblocking(fd) < 0)
+  {
+    perror("server: udp bind");
+    close(fd);
+
+    return -1;
+  }
+
+  return fd;
+}
+
+#if defined(__linux__)
+
+size_t udp_recv_batch(int fd, Datagram *out, size_t max)
+{
+  struct mmsghdr hdrs[UDP_BATCH];
+  struct iovec   iovs[UDP_BATCH];
+
+  if (max > UDP_BATCH)
+  {
+    max = UDP_BATCH;
+  }
+
+  for (size_t i = 0; i < max; ++i)
+  {
+    iovs[i] = (struct iovec){.iov_base = out[i].data, .iov_len = sizeof out[i].data};
+
+    memset(&hdrs[i], 0, sizeof hdrs[i]);
+    hdrs[i].msg_hdr.msg_name    = &out[i].addr;
+    hdrs[i].msg_hdr.msg_namelen = sizeof out[i].addr;
+    hdrs[i].msg_hdr.msg_iov     = &iovs[i];
+    hdrs[i].msg_hdr.msg_iovlen  = 1;
+  }
+
+  int n;
+  do
+  {
+    n = recvmmsg(fd, hdrs, (unsigned)max, MSG_DONTWAIT, NULL);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0)
+  {
+    return 0;
+  }
+
+  for (int i = 0; i < n; ++i)
+  {
+    out[i].len = hdrs[i].msg_len;
+  }
+
+  return (size_t)n;
+}
+
+size_t udp_send_batch(int fd, const Datagram *msgs, size_t count)
+{
+  struct mmsghdr hdrs[UDP_BATCH];
+  struct iovec   iovs[UDP_BATCH];
+  size_t         sent = 0;
+
+  while (sent < count)
+  {
+    size_t n = count - sent < UDP_BATCH ? count - sent : UDP_BATCH;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      const Datagram *d = &msgs[sent + i];
+
+      iovs[i] = (struct iovec){.iov_base = (void *)d->data, .iov_len = d->len};
+
+      memset(&hdrs[i], 0, sizeof hdrs[i]);
+      hdrs[i].msg_hdr.msg_name    = (void *)&d->addr;
+      hdrs[i].msg_hdr.msg_namelen = sizeof d->addr;
+      hdrs[i].msg_hdr.msg_iov     = &iovs[i];
+      hdrs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    int done = sendmmsg(fd, hdrs, (unsigned)n, MSG_DONTWAIT);
+
+    if (done < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    // Send buffer full (or worse); whatever's left is dropped, the next tick resends it
+    if (done <= 0)
+    {
+      break;
+    }
+
+    sent += (size_t)done;
+  }
+
+  return sent;
+}
+
+#else
+
+size_t udp_recv_batch(int fd, Datagram *out, size_t max)
+{
+  size_t count = 0;
+
+  while (count < max)
+  {
+    socklen_t addrlen = sizeof out[count].addr;
+    ssize_t   n       = recvfrom(fd, out[count].data, sizeof out[count].data, MSG_DONTWAIT,
+                                 (struct sockaddr *)&out[count].addr, &addrlen);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (n < 0)
+    {
+      break;
+    }
+
+    out[count++].len = (size_t)n;
+  }
+
+  return count;
+}
+
+size_t udp_send_batch(int fd, const Datagram *msgs, size_t count)
+{
+  size_t sent = 0;
+
+  while (sent < count)
+  {
+    const Datagram *d = &msgs[sent];
+    ssize_t n = sendto(fd, d->data, d->len, MSG_DONTWAIT, (const struct sockaddr *)&d->addr, sizeof d->addr);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (n < 0)
+    {
+      break;
+    }
+
+    sent++;
+  }
+
+  return sent;
+}
+
+#endif
@@ -0,0 +1,369 @@
+#include "w-world.h"
+
+#include "w-grid.h"
+#include "w-player.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+  uint32_t player_id; // 0 = nobody connected in this slot
+  int32_t  x, y;
+  uint32_t cell;
+} WorldEntry;
+
+typedef struct
+{
+  uint32_t    tick;    // 0 = never captured, or overwritten since
+  size_t      count;   // Amt. of slots captured; g_players.high_water at the time
+  size_t      cap;
+  WorldEntry *entries; // Indexed by player slot
+
+  // The same slots again, grouped by cell; cell c's are order[cell_start[c], cell_start[c + 1])
+  uint32_t *order;
+  size_t    order_cap;
+  uint32_t  cell_start[GRID_CELLS + 1];
+} WorldFrame;
+
+static WorldFrame       g_frames[WORLD_HISTORY];
+static uint32_t         g_latest_tick = 0;
+static pthread_rwlock_t g_world_lock  = PTHREAD_RWLOCK_INITIALIZER;
+
+static const WorldEntry k_nobody = {0, 0, 0, 0};
+
+/**
+ * @brief Find the frame captured for a tick, if it's still around
+ * @note Caller must hold g_world_lock
+ */
+static const WorldFrame *frame_for(uint32_t tick)
+{
+  const WorldFrame *f = &g_frames[tick % WORLD_HISTORY];
+
+  return (tick != 0 && f->tick == tick) ? f : NULL;
+}
+
+/**
+ * @brief A slot's entry in a frame; nobody if there's no frame or it predates the slot
+ */
+static const WorldEntry *entry_at(const WorldFrame *f, uint32_t slot)
+{
+  return (f && slot < f->count) ? &f->entries[slot] : &k_nobody;
+}
+
+/**
+ * @brief Make sure a frame has room for the table as it is now
+ * @note Frames only ever grow; they settle at the biggest the table has been
+ */
+static bool reserve_frame(WorldFrame *f, size_t slots, size_t live)
+{
+  if (f->cap < slots)
+  {
+    WorldEntry *entries = (WorldEntry *)realloc(f->entries, slots * sizeof *entries);
+    if (!entries)
+    {
+      return false;
+    }
+
+    f->entries = entries;
+    f->cap     = slots;
+  }
+
+  if (f->order_cap < live)
+  {
+    uint32_t *order = (uint32_t *)realloc(f->order, live * sizeof *order);
+    if (!order)
+    {
+      return false;
+    }
+
+    f->order     = order;
+    f->order_cap = live;
+  }
+
+  return true;
+}
+
+bool world_capture(uint32_t tick)
+{
+  pthread_rwlock_wrlock(&g_world_lock);
+
+  if (tick <= g_latest_tick)
+  {
+    pthread_rwlock_unlock(&g_world_lock);
+
+    return false;
+  }
+
+  WorldFrame *f = &g_frames[tick % WORLD_HISTORY];
+
+  pthread_rwlock_rdlock(&g_players_lock);
+
+  size_t count = g_players.high_water;
+
+  if (!reserve_frame(f, count, g_players.live))
+  {
+    pthread_rwlock_unlock(&g_players_lock);
+    pthread_rwlock_unlock(&g_world_lock);
+
+    return false;
+  }
+
+  // Empty slots are all zeroes, so comparing two frames is a plain memcmp()
+  if (count > 0)
+  {
+    memset(f->entries, 0, count * sizeof *f->entries);
+  }
+
+  // The grid already knows who stands where; no sorting, just walk it
+  collect_players_by_cell(f->order, f->order_cap, f->cell_start);
+
+  for (uint32_t cell = 0; cell < GRID_CELLS; ++cell)
+  {
+    for (uint32_t i = f->cell_start[cell]; i < f->cell_start[cell + 1]; ++i)
+    {
+      Player          *p    = (Player *)slab_at(&g_players, f->order[i]);
+      WorldEntry      *e    = &f->entries[p->slot];
+      pthread_mutex_t *lock = player_lock(p->ip);
+
+      pthread_mutex_lock(lock);
+
+      // A move racing us may already have the position a cell past the list; the list wins,
+      // so a frame always agrees with itself
+      if (p->connected)
+      {
+        e->player_id = p->player_id;
+        e->x         = p->pos_x;
+        e->y         = p->pos_y;
+        e->cell      = cell;
+      }
+
+      pthread_mutex_unlock(lock);
+    }
+  }
+
+  pthread_rwlock_unlock(&g_players_lock);
+
+  // Let the caller know whether anybody needs to hear about this at all
+  const WorldFrame *prev = frame_for(g_latest_tick);
+  bool              changed =
+      !prev || prev->count != count ||
+      (count > 0 && memcmp(prev->entries, f->entries, count * sizeof *f->entries) != 0);
+
+  f->tick       = tick;
+  f->count      = count;
+  g_latest_tick = tick;
+
+  pthread_rwlock_unlock(&g_world_lock);
+
+  return changed;
+}
+
+bool world_view(uint32_t tick, uint32_t base_tick, uint32_t viewer_slot, uint32_t viewer_id, WorldView *view)
+{
+  pthread_rwlock_rdlock(&g_world_lock);
+
+  const WorldFrame *now  = frame_for(tick);
+  const WorldFrame *base = frame_for(base_tick);
+  const WorldEntry *me   = entry_at(now, viewer_slot);
+  const WorldEntry *was  = entry_at(base, viewer_slot);
+
+  bool ok = now && me->player_id == viewer_id;
+
+  if (ok)
+  {
+    view->cell = me->cell;
+
+    // Baseline fell out of the history (or never was, or they weren't around back then); diff against nothing
+    if (base && was->player_id == viewer_id)
+    {
+      view->base_tick = base_tick;
+      view->base_cell = was->cell;
+    }
+    else
+    {
+      view->base_tick = 0;
+      view->base_cell = 0;
+    }
+  }
+
+  pthread_rwlock_unlock(&g_world_lock);
+
+  return ok;
+}
+
+/**
+ * @brief Append a LEB128 varint
+ * @returns false if it doesn't fit
+ */
+static bool put_varint(uint8_t *out, size_t cap, size_t *len, uint32_t v)
+{
+  do
+  {
+    if (*len == cap)
+    {
+      return false;
+    }
+
+    uint8_t byte = v & 0x7f;
+
+    v >>= 7;
+    out[(*len)++] = byte | (v ? 0x80 : 0);
+  } while (v);
+
+  return true;
+}
+
+// Zigzag folds the sign into the low bit, so small negative deltas stay small varints too
+static uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+
+static bool put_entry(uint8_t *out, size_t cap, size_t *len, uint32_t id, unsigned kind, int32_t dx, int32_t dy)
+{
+  if (!put_varint(out, cap, len, id << 2 | kind))
+  {
+    return false;
+  }
+
+  if (kind == WORLD_GONE)
+  {
+    return true;
+  }
+
+  return put_varint(out, cap, len, zigzag(dx)) && put_varint(out, cap, len, zigzag(dy));
+}
+
+/**
+ * @brief Does a viewer standing in a given cell see this entry as the given player?
+ */
+static bool sees(const WorldEntry *e, uint32_t player_id, uint32_t viewer_cell)
+{
+  return e->player_id != 0 && e->player_id == player_id && grid_cells_near(e->cell, viewer_cell);
+}
+
+/**
+ * @brief First and one-past-last row or column of the 3x3 block around one
+ */
+static void near_range(uint32_t at, uint32_t count, uint32_t *lo, uint32_t *hi)
+{
+  *lo = at > 0 ? at - 1 : 0;
+  *hi = at + 1 < count ? at + 2 : count;
+}
+
+/**
+ * @brief Walk the slots a frame has in the 3x3 block of cells around one
+ * @param f The frame
+ * @param center The center cell
+ * @param fn Called per slot; returns false to stop the walk
+ * @param ctx Passed through to fn
+ * @returns false if fn stopped the walk
+ */
+static bool for_each_near(const WorldFrame *f, uint32_t center, bool (*fn)(uint32_t slot, void *ctx), void *ctx)
+{
+  uint32_t col_lo, col_hi, row_lo, row_hi;
+
+  near_range(center % GRID_COLS, GRID_COLS, &col_lo, &col_hi);
+  near_range(center / GRID_COLS, GRID_ROWS, &row_lo, &row_hi);
+
+  // A row of neighbouring cells is contiguous in the order array, so that's 3 runs, not 9
+  for (uint32_t row = row_lo; row < row_hi; ++row)
+  {
+    uint32_t from = f->cell_start[row * GRID_COLS + col_lo];
+    uint32_t to   = f->cell_start[row * GRID_COLS + col_hi];
+
+    for (uint32_t i = from; i < to; ++i)
+    {
+      if (!fn(f->order[i], ctx))
+      {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+typedef struct
+{
+  const WorldFrame *now, *base;
+  const WorldView  *view;
+  uint8_t          *out;
+  size_t            cap, *len;
+} DeltaCtx;
+
+// Someone in view now: a new face appears, a known one that moved gets a delta
+static bool encode_seen_now(uint32_t slot, void *ctx_)
+{
+  DeltaCtx         *ctx = (DeltaCtx *)ctx_;
+  const WorldEntry *b   = entry_at(ctx->now, slot);
+  const WorldEntry *a   = entry_at(ctx->base, slot);
+
+  if (b->player_id == 0)
+  {
+    return true;
+  }
+
+  if (!sees(a, b->player_id, ctx->view->base_cell))
+  {
+    return put_entry(ctx->out, ctx->cap, ctx->len, b->player_id, WORLD_APPEARED, b->x, b->y);
+  }
+
+  if (a->x != b->x || a->y != b->y)
+  {
+    return put_entry(ctx->out, ctx->cap, ctx->len, b->player_id, WORLD_MOVED, b->x - a->x, b->y - a->y);
+  }
+
+  return true;
+}
+
+// Someone in view back then: if they aren't anymore, they're gone as far as this viewer knows
+static bool encode_seen_then(uint32_t slot, void *ctx_)
+{
+  DeltaCtx         *ctx = (DeltaCtx *)ctx_;
+  const WorldEntry *a   = entry_at(ctx->base, slot);
+
+  if (a->player_id == 0 || sees(entry_at(ctx->now, slot), a->player_id, ctx->view->cell))
+  {
+    return true;
+  }
+
+  return put_entry(ctx->out, ctx->cap, ctx->len, a->player_id, WORLD_GONE, 0, 0);
+}
+
+bool world_encode_delta(uint32_t tick, const WorldView *view, uint8_t *out, size_t cap, size_t *len)
+{
+  pthread_rwlock_rdlock(&g_world_lock);
+
+  DeltaCtx ctx = {frame_for(tick), frame_for(view->base_tick), view, out, cap, len};
+
+  *len = 0;
+
+  // Either frame getting recycled since world_view() makes the view stale
+  bool ok = ctx.now && (view->base_tick == 0 || ctx.base);
+
+  // Only the cells around the viewer, then and now, can hold anything they care about
+  if (ok)
+  {
+    ok = for_each_near(ctx.now, view->cell, encode_seen_now, &ctx) &&
+         (!ctx.base || for_each_near(ctx.base, view->base_cell, encode_seen_then, &ctx));
+  }
+
+  pthread_rwlock_unlock(&g_world_lock);
+
+  return ok;
+}
+
+void world_free(void)
+{
+  pthread_rwlock_wrlock(&g_world_lock);
+
+  for (size_t i = 0; i < WORLD_HISTORY; ++i)
+  {
+    free(g_frames[i].entries);
+    free(g_frames[i].order);
+    memset(&g_frames[i], 0, sizeof g_frames[i]);
+  }
+
+  g_latest_tick = 0;
+
+  pthread_rwlock_unlock(&g_world_lock);
+}